@@ -12,11 +12,45 @@ SOURCES += main.cpp \
     okFrontPanelDLL.cpp \
     rhd2000evalboardusb3.cpp \
     rhd2000registersusb3.cpp \
-    rhd2000datablockusb3.cpp
+    rhd2000datablockusb3.cpp \
+    rhd2000datablockringusb3.cpp \
+    rhd2000datablockpoolusb3.cpp \
+    rhd2000decoderusb3.cpp \
+    rhd2000datafilewriterusb3.cpp \
+    rhd2000asyncfilewriterusb3.cpp \
+    rhd2000sharedmemoryringusb3.cpp \
+    rhd2000sharedmemorysegmentusb3.cpp \
+    rhd2000decimationpyramidusb3.cpp \
+    rhd2000fpgasinkusb3.cpp \
+    rhd2000loopbackverifierusb3.cpp \
+    rhd2000frameencoderusb3.cpp \
+    rhd2000timestampmonitorusb3.cpp \
+    rhd2000multiboardusb3.cpp \
+    rhd2000dspengineusb3.cpp \
+    rhd2000biquadfilterbankusb3.cpp \
+    rhd2000linenoisefilterusb3.cpp \
+    rhd2000rereferenceusb3.cpp
 
 HEADERS += \
     okFrontPanelDLL.h \
     rhd2000evalboardusb3.h \
     rhd2000registersusb3.h \
-    rhd2000datablockusb3.h
+    rhd2000datablockusb3.h \
+    rhd2000datablockringusb3.h \
+    rhd2000datablockpoolusb3.h \
+    rhd2000decoderusb3.h \
+    rhd2000datafilewriterusb3.h \
+    rhd2000asyncfilewriterusb3.h \
+    rhd2000sharedmemoryringusb3.h \
+    rhd2000sharedmemorysegmentusb3.h \
+    rhd2000decimationpyramidusb3.h \
+    rhd2000fpgasinkusb3.h \
+    rhd2000loopbackverifierusb3.h \
+    rhd2000frameencoderusb3.h \
+    rhd2000timestampmonitorusb3.h \
+    rhd2000multiboardusb3.h \
+    rhd2000dspengineusb3.h \
+    rhd2000biquadfilterbankusb3.h \
+    rhd2000linenoisefilterusb3.h \
+    rhd2000rereferenceusb3.h
 
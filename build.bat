@@ -1,4 +1,4 @@
 @echo off
 call "C:\Program Files (x86)\Microsoft Visual Studio\2022\BuildTools\VC\Auxiliary\Build\vcvars64.bat"
-cl /EHsc main.cpp okFrontPanelDLL.cpp rhd2000evalboardusb3.cpp rhd2000registersusb3.cpp rhd2000datablockusb3.cpp /Fe:RHD2000Usb3Control.exe
+cl /EHsc main.cpp okFrontPanelDLL.cpp rhd2000evalboardusb3.cpp rhd2000registersusb3.cpp rhd2000datablockusb3.cpp rhd2000datablockringusb3.cpp rhd2000datablockpoolusb3.cpp rhd2000decoderusb3.cpp rhd2000datafilewriterusb3.cpp rhd2000asyncfilewriterusb3.cpp rhd2000sharedmemoryringusb3.cpp rhd2000sharedmemorysegmentusb3.cpp rhd2000decimationpyramidusb3.cpp rhd2000fpgasinkusb3.cpp rhd2000loopbackverifierusb3.cpp rhd2000frameencoderusb3.cpp rhd2000timestampmonitorusb3.cpp rhd2000multiboardusb3.cpp rhd2000dspengineusb3.cpp rhd2000biquadfilterbankusb3.cpp rhd2000linenoisefilterusb3.cpp rhd2000rereferenceusb3.cpp /Fe:RHD2000Usb3Control.exe
 pause
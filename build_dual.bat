@@ -1,7 +1,7 @@
 @echo off
 echo Building Windows dual-output neural data acquisition system...
 call "C:\Program Files (x86)\Microsoft Visual Studio\2022\BuildTools\VC\Auxiliary\Build\vcvars64.bat"
-cl /EHsc main_windows_dual.cpp okFrontPanelDLL.cpp rhd2000evalboardusb3.cpp rhd2000registersusb3.cpp rhd2000datablockusb3.cpp /Fe:IntanDualOutput.exe
+cl /EHsc main_windows_dual.cpp okFrontPanelDLL.cpp rhd2000evalboardusb3.cpp rhd2000registersusb3.cpp rhd2000datablockusb3.cpp rhd2000datablockringusb3.cpp rhd2000datablockpoolusb3.cpp rhd2000decoderusb3.cpp rhd2000datafilewriterusb3.cpp rhd2000asyncfilewriterusb3.cpp rhd2000sharedmemoryringusb3.cpp rhd2000sharedmemorysegmentusb3.cpp rhd2000decimationpyramidusb3.cpp rhd2000fpgasinkusb3.cpp rhd2000loopbackverifierusb3.cpp rhd2000frameencoderusb3.cpp rhd2000timestampmonitorusb3.cpp rhd2000multiboardusb3.cpp rhd2000dspengineusb3.cpp rhd2000biquadfilterbankusb3.cpp rhd2000linenoisefilterusb3.cpp rhd2000rereferenceusb3.cpp /Fe:IntanDualOutput.exe
 if %ERRORLEVEL% == 0 (
     echo.
     echo Build successful! Executable: IntanDualOutput.exe
@@ -9,7 +9,7 @@ if %ERRORLEVEL% == 0 (
     echo This program will:
     echo  1. Acquire neural data from Intan device
     echo  2. Save data to timestamped .dat files
-    echo  3. Send data to FPGA via Python pipe
+    echo  3. Send data to the downstream FPGA board
     echo  4. Stream data to visualizer via Windows shared memory
     echo.
 ) else (
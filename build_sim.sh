@@ -0,0 +1,6 @@
+#!/bin/sh
+# Build the benchmark harness against the simulated FrontPanel backend (no hardware or
+# okFrontPanel library required).  Run from the repository directory so main.bit is found.
+echo "Building IntanBenchmark with simulated XEM6310 backend..."
+g++ -std=c++14 -O2 -pthread main_benchmark.cpp main_benchmark_heap.cpp okFrontPanelSim.cpp rhd2000evalboardusb3.cpp rhd2000registersusb3.cpp rhd2000datablockusb3.cpp rhd2000datablockringusb3.cpp rhd2000datablockpoolusb3.cpp rhd2000decoderusb3.cpp rhd2000datafilewriterusb3.cpp rhd2000asyncfilewriterusb3.cpp rhd2000sharedmemoryringusb3.cpp rhd2000sharedmemorysegmentusb3.cpp rhd2000decimationpyramidusb3.cpp rhd2000fpgasinkusb3.cpp rhd2000loopbackverifierusb3.cpp rhd2000frameencoderusb3.cpp rhd2000timestampmonitorusb3.cpp rhd2000multiboardusb3.cpp rhd2000dspengineusb3.cpp rhd2000biquadfilterbankusb3.cpp rhd2000linenoisefilterusb3.cpp rhd2000rereferenceusb3.cpp -o IntanBenchmark || exit 1
+echo "Build successful! Executable: IntanBenchmark"
@@ -31,10 +31,16 @@ using namespace std;
 #include "rhd2000evalboardusb3.h"
 #include "rhd2000registersusb3.h"
 #include "rhd2000datablockusb3.h"
+#include "rhd2000fpgasinkusb3.h"
+#include "rhd2000frameencoderusb3.h"
 #include "okFrontPanelDLL.h"
 
 #define NUM_TIMESTEPS 1000
 
+// Downstream processing FPGA that receives the amplifier data
+#define FPGA_SINK_SERIAL "2416001B97"
+#define FPGA_SINK_BITFILE "C:/Users/rkt23/okClk_pipe/okClk_pipe.runs/impl_1/First.bit"
+
 int main(int argc, char* argv[])
 {
     // QCoreApplication a(argc, argv); // used for Qt console applications
@@ -169,6 +175,9 @@ int main(int argc, char* argv[])
 
     queue<Rhd2000DataBlockUsb3> dataQueue;
 
+    // Keep samples as native 16-bit words; the pipe below ships them without padding.
+    evalBoard->setSampleFormat(Rhd2000DataBlockUsb3::UInt16Samples);
+
     // Run for specified number of timesteps.
     evalBoard->setMaxTimeStep(NUM_TIMESTEPS);
     cout << "Reading " << NUM_TIMESTEPS << " timesteps of RHD2000 data..." << endl;
@@ -182,36 +191,17 @@ int main(int argc, char* argv[])
     cout << "number of enabled data streams: " << evalBoard->getNumEnabledDataStreams() << endl;
 
 
-    // create pipe to pipe data from Intan to python program which sends said data to the FPGA board
-    SECURITY_ATTRIBUTES s_attr {sizeof(s_attr), nullptr, TRUE};
-    HANDLE childStdinRead = nullptr, parentStdinWrite = nullptr;
-
-    if (!CreatePipe(&childStdinRead, &parentStdinWrite, &s_attr, 0))
-    {
-        cerr << "ERROR: CreatePipe failed" << endl;
-        exit(1);
-    }
-
-    SetHandleInformation(parentStdinWrite, HANDLE_FLAG_INHERIT, 0);
-
-    STARTUPINFOA si {};
-    si.cb = sizeof(si);
-    si.dwFlags = STARTF_USESTDHANDLES;
-    si.hStdInput = childStdinRead;
-    si.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
-    si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
-
-    PROCESS_INFORMATION pi {};
-    char cmd[] = "python data_transfer.py";
-
-    if (!CreateProcessA(nullptr, cmd, nullptr, nullptr, TRUE, NORMAL_PRIORITY_CLASS, nullptr, nullptr, &si, &pi))
+    // Forward data to the downstream FPGA from a dedicated sink thread, one frame per block
+    // holding every channel of every enabled stream.
+    Rhd2000FrameEncoderUsb3 frameEncoder;
+    frameEncoder.selectAllChannels(evalBoard->getEnabledDataStreamMask());
+    Rhd2000FpgaSinkUsb3 fpgaSink;
+    if (!fpgaSink.open(FPGA_SINK_SERIAL, FPGA_SINK_BITFILE))
     {
-        cerr << "ERROR: CreateProcessA failed" << endl;
+        cerr << "ERROR: downstream FPGA could not be opened" << endl;
         exit(1);
     }
 
-    CloseHandle(childStdinRead);
-
 
     int total_num_samples = 0;
     int datain_index = 0;
@@ -221,7 +211,7 @@ int main(int argc, char* argv[])
 
         if (usbDataRead)
         {
-            Rhd2000DataBlockUsb3 curr_data_block = dataQueue.front();
+            Rhd2000DataBlockUsb3 curr_data_block(std::move(dataQueue.front()));
             dataQueue.pop();
             total_num_samples++;
             cout << "total_num_samples so far: " << total_num_samples << endl;
@@ -240,12 +230,11 @@ int main(int argc, char* argv[])
 
             cout << endl;
 
-            // pipe data of channel 0 to python program
-            DWORD bytes_written;
-            char* msg_to_send = (char*) curr_data_block.amplifierDataFast;
-            DWORD bytes_to_write = CHANNELS_PER_STREAM * SAMPLES_PER_DATA_BLOCK * sizeof(int);
-            WriteFile(parentStdinWrite, msg_to_send, bytes_to_write, &bytes_written, nullptr);
-            cout << "Wrote " << bytes_written << " bytes to python program" << endl;
+            // send the block to the downstream FPGA
+            unsigned int bytes_to_write = frameEncoder.encode(curr_data_block);
+            if (bytes_to_write > 0) {
+                fpgaSink.submit(frameEncoder.getFrame(), bytes_to_write);
+            }
         } // if (usbDataRead)
     } while (usbDataRead || evalBoard->isRunning());
 
@@ -254,6 +243,19 @@ int main(int argc, char* argv[])
 
     evalBoard->flush();
 
+    Rhd2000EvalBoardUsb3::UsbReadStats usbStats;
+    evalBoard->getUsbReadStats(usbStats);
+    if (usbStats.numResyncs > 0 || usbStats.numTimeStampGaps > 0) {
+        cout << "Warning: USB stream resynchronized " << usbStats.numResyncs << " times (" << usbStats.numFramesLost <<
+                " frames lost, " << usbStats.numBlocksFlagged << " blocks flagged)" << endl;
+    }
+
+    fpgaSink.close();
+    Rhd2000FpgaSinkUsb3::SinkStats sinkStats;
+    fpgaSink.getStats(sinkStats);
+    cout << "Sent " << sinkStats.numBytesWritten << " bytes to the downstream FPGA in " << sinkStats.numTransfers <<
+            " transfers (round trip p99 " << sinkStats.latency99Ms << " ms)" << endl;
+
     saveOut.close();
 
     cout << "Done!" << endl << endl;
@@ -0,0 +1,3509 @@
+//----------------------------------------------------------------------------------
+// main_benchmark.cpp
+//
+// Load tests and benchmarks for the host acquisition pipeline.  Built against the
+// simulated FrontPanel backend (okFrontPanelSim.cpp) so it runs on a plain Linux box
+// without an XEM6310 attached; see build_sim.sh.
+//
+// Usage: IntanBenchmark <test> [arguments]
+//
+//   loadtest [streams] [seconds] [freerun]
+//       Acquire from a simulated board with the given number of data streams (default
+//       32) at 30 kS/s, consuming blocks the same way main_windows_dual.cpp does, and
+//       report throughput and FIFO backlog.  With "freerun" the simulated FIFO is kept
+//       full, so the reported rate is the host-side ceiling rather than the line rate.
+//
+//   readerthread [streams] [seconds] [stallMs]
+//       Acquire through the board's reader thread and block ring while the consumer
+//       sleeps for stallMs (default 50) once per second, imitating a slow disk or pipe
+//       write.  Reports ring occupancy, reader stalls and FIFO backlog.
+//
+//   batchread [streams] [seconds] [maxBlocks] [freerun]
+//       Acquire with readAvailableDataBlocks(), which reads every whole block waiting in
+//       the FIFO (up to maxBlocks, default MAX_NUM_BLOCKS) per USB transaction, and report
+//       MB/s, transactions/s and the achieved batch size.  Run with maxBlocks = 1 for the
+//       one-block-per-transaction baseline.
+//
+//   blockpool [streams] [blocks]
+//       Read the given number of blocks (default 20000) from a free-running simulated
+//       board three ways -- queue with a copying consumer, queue with a moving consumer,
+//       and Rhd2000DataBlockPoolUsb3 handles -- and report heap allocations per block
+//       (counted by a replacement operator new) and time per block.
+//
+//   decode [seconds]
+//       Decode synthetic USB blocks for 1, 4, 8, 16 and 32 streams with the original
+//       byte-by-byte decoder and with each SIMD path this CPU supports, check that the
+//       results match, and report decode throughput in GB/s of USB data.
+//
+//   layout [streams] [seconds]
+//       Compare TimeMajor and ChannelMajor amplifier layouts: decode throughput and the
+//       rate of a per-channel first-order high-pass filter that walks each channel
+//       through amplifierChannel()/amplifierSampleStride().
+//
+//   compact [streams] [seconds]
+//       Compare Int32Samples and UInt16Samples storage in both layouts: bytes held per
+//       block, decode throughput, and a check that every accessor and the saved file
+//       format agree with the reference decoder, and that the pointer accessor of the
+//       other sample format returns nullptr.
+//
+//   filewrite [streams] [blocks]
+//       Save the same data blocks with the original word-by-word writer
+//       (writeReference(), which write() and queueToFile() used), the serializing
+//       write(), queueToFile() and Rhd2000DataFileWriterUsb3.  Reports MB/s for each in
+//       both sample formats and checks that all files are byte-identical, also for a
+//       block of more streams than the fast serializer handles.
+//
+//   asyncwrite [streams] [seconds] [direct]
+//       Save real-time simulated acquisition through Rhd2000AsyncFileWriterUsb3
+//       (direct = 1 requests O_DIRECT), reporting the longest writeBlock() call seen by
+//       the acquisition loop, queue depth, write latency percentiles and drops, then
+//       check the file's time stamps are contiguous.  A second pass floods two small
+//       buffers faster than the disk to show backlog surfacing as dropped blocks.
+//
+//   shmring [slots] [seconds] [readers]
+//       Stress Rhd2000SharedMemoryRingUsb3: a producer publishes 32-stream, 16-bit
+//       block-sized slots as fast as it can while each reader attaches through its own
+//       mapping and follows the write cursor.  Every slot a reader accepts is checked for
+//       tearing; reports producer throughput and per-reader accepted/overwritten counts.
+//
+//   shmpayload [streams] [seconds]
+//       Publish decoded blocks to a shared memory ring as the former 12-byte
+//       {streamId, channelId, float} records and as raw 16-bit amplifier words, and
+//       compare bytes per block and producer time per block.  Checks that a reader
+//       converting the raw words with the ring header's scale and offset gets the
+//       record values.
+//
+//   pyramid [streams] [blocks]
+//       Feed blocks into Rhd2000DecimationPyramidUsb3 (32 streams = 1024 channels) in each
+//       layout and sample format, report the cost per block against the real-time block
+//       rate, and check the newest entries at every level, as read back by a reader
+//       attached to the shared memory segment, against a brute-force recomputation.
+//
+//   fpgasink [streams] [seconds] [depth]
+//       Forward 8 KB of amplifier words (one stream's worth) per real-time block
+//       through Rhd2000FpgaSinkUsb3 to a simulated
+//       loopback FPGA with the given pipeline depth (default 2).  Reports transfer sizes,
+//       round-trip latency percentiles and the longest submit() call, and checks every
+//       byte comes back in order.  Then times the former one-write-one-read-per-block loop.
+//
+//   loopback [streams] [seconds]
+//       Send every amplifier word of each block from a free-running board (1024
+//       channels by default) through the sink to a simulated loopback FPGA and check the
+//       read-back with Rhd2000LoopbackVerifierUsb3, reporting verified MB/s and block
+//       latency.  A second pass uses a deliberately wrong reference model and checks that
+//       every word is flagged.  A third sends odd-sized blocks with the first pipe write
+//       made to fail, and checks that exactly the blocks it carried are counted as lost,
+//       the rest verify and the flush padding is not counted as extra bytes.
+//
+//   frames [streams] [seconds]
+//       Encode synthetic blocks from non-contiguous hardware streams with
+//       Rhd2000FrameEncoderUsb3, for both block layouts and sample formats, a full and a
+//       sparse channel selection and both payload layouts.  Parses every frame back,
+//       checks each word, the channel order, sequence numbers and timestamps, and
+//       reports encode time per frame.
+//
+//   resync [streams] [seconds]
+//       Time the frame header search (Rhd2000DecoderUsb3::findMagicNumber()) on each SIMD
+//       path this CPU supports, then acquire through the reader thread while the simulated
+//       board loses a few bytes from the middle of a transfer twice a second.  Checks that
+//       each glitch costs exactly one resync and a few frames, that blocks keep flowing, and
+//       that every block with a time stamp gap is flagged.  First loses bytes at two places in
+//       one transfer and checks that only the two damaged frames are dropped.
+//
+//   timestamps [streams] [seconds]
+//       Run Rhd2000TimeStampMonitorUsb3 over synthetic blocks with gaps, repeats and a
+//       wrap of the 32-bit counter and check its totals and block annotations, time the
+//       per-block check, and check that both file writers' gap fill gives one frame per
+//       time stamp, with the fill frames found through the fill index rather than by
+//       their 0xffff words (some recorded blocks are saturated to 0xffff too).  Then
+//       acquire while the simulated board loses bytes, save through
+//       Rhd2000AsyncFileWriterUsb3 with gap fill, and check the file is continuous and
+//       holds one fill frame per sample the board's monitor counted as dropped.
+//
+//   cmdupload [frequencies] [controlUs]
+//       Upload the command lists of an impedance sweep (a Zcheck DAC waveform per
+//       frequency, default 3, and a register configuration per capacitor scale and
+//       channel) with every USB control transfer on the simulated board taking controlUs
+//       (default 100).  Compares the original word-by-word upload with the cached upload
+//       through the wire-ins and through the command RAM pipe, reporting transactions and
+//       time per bank.  Checks the simulated command RAM after every upload of a run of
+//       random lists, and that reconfiguring or resetting the FPGA forces a full upload.
+//
+//   faststart [controlUs]
+//       Bring a simulated board up as main_windows_dual.cpp does, leave it acquiring as a
+//       crashed program would, then bring it up again with fastStartFpga().  Reports FPGA
+//       configurations, wire-in updates, trigger-ins and time for cold and fast starts
+//       with every control transfer taking controlUs (default 100), and checks that the
+//       fast-started FPGA holds the same wire-in values as a cold-started one and
+//       acquires cleanly, and that wire-in updates during acquisition leave the state file
+//       alone.  Then checks that a different bitfile or a missing state file forces a full
+//       upload, and that a board only writes the default state file once it fast starts.
+//
+//   wirebatch [controlUs]
+//       Count the wire-in updates (UpdateWireIns control transfers) of initialize() and of
+//       a typical reconfiguration -- cable delays, data streams, DACs, TTL outputs --
+//       applied one setter at a time and inside a WireInBatch, with every control
+//       transfer taking controlUs (default 100).  Checks that both leave the FPGA with the
+//       same wire-in values, that the board counts match the simulator's, and that the
+//       board acquires cleanly afterwards.
+//
+//   multiboard [numBoards] [seconds] [streamsPerBoard]
+//       Run numBoards simulated boards (default 4) with streamsPerBoard data streams each
+//       (default 8) through Rhd2000MultiBoardUsb3 for the given time (default 3 s), with a
+//       2 Hz sync pulse on TTL input 0 of every board.  Reports per-board throughput and
+//       alignment, and checks that every board was aligned on the same pulse (against the
+//       simulator's rig clock) and that the merged stream has no gaps.
+//
+//   dsp [streams] [seconds] [maxThreads] [stages]
+//       Filter synthetic blocks through Rhd2000DspEngineUsb3 with a chain of stages
+//       first-order high-pass stages (default 4).  Checks, for both layouts and sample
+//       formats, that blocks come back in submission order and match a single-threaded
+//       pass over whole blocks, then reports blocks/s, channel-samples/s and speedup for
+//       1, 2, 4, ... up to maxThreads workers (default: hardware threads) on 16-bit blocks.
+//
+//   biquad [streams] [seconds] [order]
+//       Check Rhd2000BiquadFilterBankUsb3's Butterworth designs of orders 1-8 against the
+//       analytic response at every AmplifierSampleRate, then run a 300-6000 Hz band-pass
+//       of the given order (default 4) over synthetic blocks on each SIMD path.  Checks
+//       that every path matches the scalar path bit for bit and stays within half an ADC
+//       step of a double-precision cascade on full-scale noise, so the 16-bit output is
+//       off by at most one step, and reports channel-samples/s per path.
+//
+//   linenoise [streams] [seconds] [lineHz]
+//       Feed Rhd2000LineNoiseFilterUsb3 the given length (default 10 s) of synthetic
+//       recordings, background noise plus mains at lineHz (default 60) and its 2nd and 3rd
+//       harmonics, with the mains frequency drifting from +0.2 to -0.1 Hz off nominal.
+//       Reports how far the interference is reduced over the last 2 s with and without
+//       frequency tracking, the tracked frequency against the true one, and the cost per
+//       block against the real-time budget of one core.
+//
+//   reref [streams] [seconds]
+//       Check Rhd2000ReReferenceUsb3's median networks for 1-64 inputs on random data, then
+//       common average and common median referencing, on 16-channel shanks with some bad
+//       channels, against a plain per-sample mean and nth_element median for both layouts
+//       and sample formats.  Reports us/block and channel-samples/s for one group per
+//       stream (default 32 streams) with the mean, the median on each SIMD path and the
+//       nth_element median.
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <queue>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <new>
+#include <functional>
+#include <memory>
+
+using namespace std;
+
+#include "rhd2000evalboardusb3.h"
+#include "rhd2000registersusb3.h"
+#include "rhd2000datablockusb3.h"
+#include "rhd2000datablockringusb3.h"
+#include "rhd2000datablockpoolusb3.h"
+#include "rhd2000decoderusb3.h"
+#include "rhd2000datafilewriterusb3.h"
+#include "rhd2000asyncfilewriterusb3.h"
+#include "rhd2000sharedmemoryringusb3.h"
+#include "rhd2000decimationpyramidusb3.h"
+#include "rhd2000fpgasinkusb3.h"
+#include "rhd2000loopbackverifierusb3.h"
+#include "rhd2000frameencoderusb3.h"
+#include "rhd2000timestampmonitorusb3.h"
+#include "rhd2000multiboardusb3.h"
+#include "rhd2000dspengineusb3.h"
+#include "rhd2000biquadfilterbankusb3.h"
+#include "rhd2000linenoisefilterusb3.h"
+#include "rhd2000rereferenceusb3.h"
+#include "okFrontPanelSim.h"
+
+typedef chrono::steady_clock BenchClock;
+
+// Every heap allocation in the process is counted here (see main_benchmark_heap.cpp).
+extern atomic<unsigned long long> heapAllocations;
+
+// Results are stored here so the compiler cannot discard the work being timed.
+static volatile long long benchmarkSink;
+
+static double secondsSince(BenchClock::time_point start)
+{
+    return chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+// Open and configure a simulated board with numStreams data streams enabled.
+static Rhd2000EvalBoardUsb3* openSimBoard(int numStreams, Rhd2000EvalBoardUsb3::AmplifierSampleRate sampleRate)
+{
+    Rhd2000EvalBoardUsb3* evalBoard = new Rhd2000EvalBoardUsb3;
+
+    if (evalBoard->open() != 1) {
+        cerr << "Failed to open simulated board" << endl;
+        delete evalBoard;
+        return nullptr;
+    }
+    if (!evalBoard->uploadFpgaBitfile("main.bit")) {
+        cerr << "Run the benchmark from the repository directory so main.bit can be found." << endl;
+        delete evalBoard;
+        return nullptr;
+    }
+
+    evalBoard->initialize();
+    evalBoard->setSampleRate(sampleRate);
+    for (int stream = 0; stream < MAX_NUM_DATA_STREAMS; ++stream) {
+        evalBoard->enableDataStream(stream, stream < numStreams);
+    }
+    return evalBoard;
+}
+
+static void printUsbReadStats(Rhd2000EvalBoardUsb3* evalBoard)
+{
+    Rhd2000EvalBoardUsb3::UsbReadStats usbStats;
+    evalBoard->getUsbReadStats(usbStats);
+
+    cout << "USB transactions:       " << usbStats.transactionsPerSecond() << "/s (" <<
+            usbStats.numFifoQueries / usbStats.elapsedSeconds << " FIFO queries/s)" << endl;
+    cout << "USB pipe throughput:    " << usbStats.megabytesPerSecond() << " MB/s" << endl;
+    cout << "Blocks per transaction: " << usbStats.blocksPerTransaction() << " avg, " <<
+            usbStats.maxBlocksPerTransaction << " max (" <<
+            (double) usbStats.numBytes / (usbStats.numTransactions ? usbStats.numTransactions : 1) /
+            USB3_BLOCK_SIZE << " x " << USB3_BLOCK_SIZE << "-byte USB blocks)" << endl;
+    cout << "Stream resyncs:         " << usbStats.numResyncs << " (" << usbStats.numBytesSkipped <<
+            " bytes skipped, " << usbStats.numFramesLost << " frames lost, " << usbStats.numBlocksFlagged <<
+            " blocks flagged)" << endl;
+}
+
+static int runLoadTest(int argc, char* argv[])
+{
+    int numStreams = (argc > 0) ? atoi(argv[0]) : MAX_NUM_DATA_STREAMS;
+    double duration = (argc > 1) ? atof(argv[1]) : 10.0;
+    bool freeRun = (argc > 2) && (strcmp(argv[2], "freerun") == 0);
+
+    if (numStreams < 1 || numStreams > MAX_NUM_DATA_STREAMS) {
+        cerr << "loadtest: streams must be 1-" << MAX_NUM_DATA_STREAMS << endl;
+        return 1;
+    }
+
+    okFrontPanelSim_SetRealTime(!freeRun);
+    Rhd2000EvalBoardUsb3* evalBoard = openSimBoard(numStreams, Rhd2000EvalBoardUsb3::SampleRate30000Hz);
+    if (!evalBoard) return 1;
+
+    unsigned int blockBytes = 2 * Rhd2000DataBlockUsb3::calculateDataBlockSizeInWords(numStreams);
+    cout << endl << "Load test: " << numStreams << " streams x " << evalBoard->getSampleRate() << " S/s, " <<
+            duration << " s" << (freeRun ? " (free running)" : "") << endl;
+
+    queue<Rhd2000DataBlockUsb3> dataQueue;
+    unsigned long long numBlocks = 0, intervalBlocks = 0;
+    unsigned int expectedTimeStamp = 0, timeStampErrors = 0, maxFifoWords = 0;
+
+    evalBoard->setContinuousRunMode(true);
+    evalBoard->run();
+
+    BenchClock::time_point start = BenchClock::now();
+    BenchClock::time_point interval = start;
+    while (secondsSince(start) < duration) {
+        if (!evalBoard->readDataBlocks(1, dataQueue)) continue;
+
+        Rhd2000DataBlockUsb3 curr_data_block = dataQueue.front();
+        dataQueue.pop();
+        if (curr_data_block.timeStamp[0] != expectedTimeStamp) {
+            ++timeStampErrors;
+        }
+        expectedTimeStamp = curr_data_block.timeStamp[SAMPLES_PER_DATA_BLOCK - 1] + 1;
+        ++numBlocks;
+        ++intervalBlocks;
+
+        unsigned int fifoWords = evalBoard->getLastNumWordsInFifo();
+        if (fifoWords > maxFifoWords) maxFifoWords = fifoWords;
+
+        double elapsed = secondsSince(interval);
+        if (elapsed >= 1.0) {
+            cout << "  " << intervalBlocks / elapsed << " blocks/s  " <<
+                    intervalBlocks * blockBytes / elapsed / 1.0e6 << " MB/s  FIFO " << fifoWords << " words" << endl;
+            intervalBlocks = 0;
+            interval = BenchClock::now();
+        }
+    }
+    double elapsed = secondsSince(start);
+
+    evalBoard->setContinuousRunMode(false);
+    evalBoard->setMaxTimeStep(0);
+    evalBoard->flush();
+
+    okTSimDeviceStats stats;
+    okFrontPanelSim_GetDeviceStats("SIMRHD0001", stats);
+
+    double samplesPerSecond = numBlocks * SAMPLES_PER_DATA_BLOCK / elapsed;
+    cout << endl << "Blocks read:            " << numBlocks << endl;
+    cout << "Sample rate sustained:  " << samplesPerSecond << " S/s (" <<
+            samplesPerSecond * numStreams * CHANNELS_PER_STREAM / 1.0e6 << " MS/s over all channels)" << endl;
+    cout << "USB throughput:         " << numBlocks * blockBytes / elapsed / 1.0e6 << " MB/s" << endl;
+    cout << "Max FIFO backlog:       " << maxFifoWords << " words (" <<
+            100.0 * maxFifoWords / Rhd2000EvalBoardUsb3::fifoCapacityInWords() << "% of capacity)" << endl;
+    cout << "Time stamp errors:      " << timeStampErrors << endl;
+    cout << "Frames lost to overflow: " << stats.framesDropped << endl;
+
+    delete evalBoard;
+    return 0;
+}
+
+static int runReaderThreadTest(int argc, char* argv[])
+{
+    int numStreams = (argc > 0) ? atoi(argv[0]) : MAX_NUM_DATA_STREAMS;
+    double duration = (argc > 1) ? atof(argv[1]) : 10.0;
+    int stallMs = (argc > 2) ? atoi(argv[2]) : 50;
+
+    if (numStreams < 1 || numStreams > MAX_NUM_DATA_STREAMS) {
+        cerr << "readerthread: streams must be 1-" << MAX_NUM_DATA_STREAMS << endl;
+        return 1;
+    }
+
+    okFrontPanelSim_SetRealTime(true);
+    Rhd2000EvalBoardUsb3* evalBoard = openSimBoard(numStreams, Rhd2000EvalBoardUsb3::SampleRate30000Hz);
+    if (!evalBoard) return 1;
+
+    cout << endl << "Reader thread test: " << numStreams << " streams x " << evalBoard->getSampleRate() <<
+            " S/s, " << duration << " s, consumer stalls " << stallMs << " ms/s" << endl;
+
+    unsigned long long numBlocks = 0;
+    unsigned int expectedTimeStamp = 0, timeStampErrors = 0, maxFifoWords = 0;
+
+    evalBoard->setContinuousRunMode(true);
+    evalBoard->run();
+    evalBoard->resetUsbReadStats();
+    evalBoard->startReaderThread();
+    Rhd2000DataBlockRingUsb3* dataBlockRing = evalBoard->getDataBlockRing();
+
+    BenchClock::time_point start = BenchClock::now();
+    BenchClock::time_point interval = start;
+    while (secondsSince(start) < duration) {
+        Rhd2000DataBlockUsb3* dataBlock = dataBlockRing->front();
+        if (!dataBlock) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
+        }
+
+        if (dataBlock->timeStamp[0] != expectedTimeStamp) {
+            ++timeStampErrors;
+        }
+        expectedTimeStamp = dataBlock->timeStamp[SAMPLES_PER_DATA_BLOCK - 1] + 1;
+        dataBlockRing->pop();
+        ++numBlocks;
+
+        unsigned int fifoWords = evalBoard->getLastNumWordsInFifo();
+        if (fifoWords > maxFifoWords) maxFifoWords = fifoWords;
+
+        if (secondsSince(interval) >= 1.0) {
+            cout << "  ring " << dataBlockRing->size() << "/" << dataBlockRing->getCapacity() <<
+                    "  FIFO " << fifoWords << " words" << endl;
+            this_thread::sleep_for(chrono::milliseconds(stallMs));
+            interval = BenchClock::now();
+        }
+    }
+    double elapsed = secondsSince(start);
+
+    evalBoard->stopReaderThread();
+    evalBoard->setContinuousRunMode(false);
+    evalBoard->setMaxTimeStep(0);
+    evalBoard->flush();
+
+    okTSimDeviceStats stats;
+    okFrontPanelSim_GetDeviceStats("SIMRHD0001", stats);
+
+    cout << endl << "Blocks consumed:        " << numBlocks << " (" << numBlocks / elapsed << " blocks/s)" << endl;
+    cout << "Ring max occupancy:     " << dataBlockRing->getMaxOccupancy() << " of " <<
+            dataBlockRing->getCapacity() << " blocks" << endl;
+    cout << "Reader stalls (full):   " << evalBoard->getReaderStallCount() << endl;
+    printUsbReadStats(evalBoard);
+    cout << "Max FIFO backlog:       " << maxFifoWords << " words (" <<
+            100.0 * maxFifoWords / Rhd2000EvalBoardUsb3::fifoCapacityInWords() << "% of capacity)" << endl;
+    cout << "Time stamp errors:      " << timeStampErrors << endl;
+    cout << "Frames lost to overflow: " << stats.framesDropped << endl;
+
+    delete evalBoard;
+    return 0;
+}
+
+static int runBatchReadTest(int argc, char* argv[])
+{
+    int numStreams = (argc > 0) ? atoi(argv[0]) : MAX_NUM_DATA_STREAMS;
+    double duration = (argc > 1) ? atof(argv[1]) : 10.0;
+    int maxBlocks = (argc > 2) ? atoi(argv[2]) : MAX_NUM_BLOCKS;
+    bool freeRun = (argc > 3) && (strcmp(argv[3], "freerun") == 0);
+
+    if (numStreams < 1 || numStreams > MAX_NUM_DATA_STREAMS) {
+        cerr << "batchread: streams must be 1-" << MAX_NUM_DATA_STREAMS << endl;
+        return 1;
+    }
+
+    okFrontPanelSim_SetRealTime(!freeRun);
+    Rhd2000EvalBoardUsb3* evalBoard = openSimBoard(numStreams, Rhd2000EvalBoardUsb3::SampleRate30000Hz);
+    if (!evalBoard) return 1;
+    evalBoard->setMaxBlocksPerRead(maxBlocks);
+
+    cout << endl << "Batch read test: " << numStreams << " streams x " << evalBoard->getSampleRate() << " S/s, " <<
+            duration << " s, up to " << evalBoard->getMaxBlocksPerRead() << " blocks per read" <<
+            (freeRun ? " (free running)" : "") << endl;
+
+    queue<Rhd2000DataBlockUsb3> dataQueue;
+    unsigned long long numBlocks = 0;
+    unsigned int expectedTimeStamp = 0, timeStampErrors = 0, maxFifoWords = 0;
+
+    evalBoard->setContinuousRunMode(true);
+    evalBoard->run();
+    evalBoard->resetUsbReadStats();
+
+    BenchClock::time_point start = BenchClock::now();
+    while (secondsSince(start) < duration) {
+        if (evalBoard->readAvailableDataBlocks(dataQueue) == 0) {
+            if (!freeRun) this_thread::sleep_for(chrono::microseconds(500));
+            continue;
+        }
+
+        unsigned int fifoWords = evalBoard->getLastNumWordsInFifo();
+        if (fifoWords > maxFifoWords) maxFifoWords = fifoWords;
+
+        while (!dataQueue.empty()) {
+            if (dataQueue.front().timeStamp[0] != expectedTimeStamp) {
+                ++timeStampErrors;
+            }
+            expectedTimeStamp = dataQueue.front().timeStamp[SAMPLES_PER_DATA_BLOCK - 1] + 1;
+            dataQueue.pop();
+            ++numBlocks;
+        }
+    }
+
+    printUsbReadStats(evalBoard);
+
+    evalBoard->setContinuousRunMode(false);
+    evalBoard->setMaxTimeStep(0);
+    evalBoard->flush();
+
+    cout << "Blocks read:            " << numBlocks << endl;
+    cout << "Max FIFO backlog:       " << maxFifoWords << " words (" <<
+            100.0 * maxFifoWords / Rhd2000EvalBoardUsb3::fifoCapacityInWords() << "% of capacity)" << endl;
+    cout << "Time stamp errors:      " << timeStampErrors << endl;
+
+    delete evalBoard;
+    return 0;
+}
+
+enum BlockPoolMode {
+    QueueCopy,
+    QueueMove,
+    Pool
+};
+
+// Consume numBlocks blocks using one of the three ownership models, touching one sample per block
+// so the consumer cannot be optimized away.
+static void runBlockPoolPass(Rhd2000EvalBoardUsb3* evalBoard, BlockPoolMode mode, unsigned long long numBlocks)
+{
+    static const char* modeNames[] = { "queue + copy", "queue + move", "pool handles" };
+    int numStreams = evalBoard->getNumEnabledDataStreams();
+
+    queue<Rhd2000DataBlockUsb3> dataQueue;
+    Rhd2000DataBlockPoolUsb3 pool(64, numStreams);
+    vector<Rhd2000DataBlockHandleUsb3> dataBlocks;
+    dataBlocks.reserve(64);
+    long long checksum = 0;
+
+    // Warm up so queue and vector storage reach their working size before counting.
+    for (int i = 0; i < 64; ++i) {
+        if (mode == Pool) {
+            evalBoard->readDataBlocks(1, pool, dataBlocks);
+            dataBlocks.clear();
+        } else if (evalBoard->readDataBlocks(1, dataQueue)) {
+            dataQueue.pop();
+        }
+    }
+
+    unsigned long long heapStart = heapAllocations;
+    unsigned long long blockStart = Rhd2000DataBlockUsb3::getNumAllocations();
+    BenchClock::time_point start = BenchClock::now();
+
+    unsigned long long count = 0;
+    while (count < numBlocks) {
+        if (mode == Pool) {
+            if (!evalBoard->readDataBlocks(1, pool, dataBlocks)) continue;
+            checksum += dataBlocks[0]->amplifierDataFast[0];
+            dataBlocks.clear();
+        } else {
+            if (!evalBoard->readDataBlocks(1, dataQueue)) continue;
+            if (mode == QueueCopy) {
+                Rhd2000DataBlockUsb3 curr_data_block = dataQueue.front();
+                checksum += curr_data_block.amplifierDataFast[0];
+            } else {
+                Rhd2000DataBlockUsb3 curr_data_block(std::move(dataQueue.front()));
+                checksum += curr_data_block.amplifierDataFast[0];
+            }
+            dataQueue.pop();
+        }
+        ++count;
+    }
+
+    double elapsed = secondsSince(start);
+    unsigned long long heapCount = heapAllocations - heapStart;
+    unsigned long long blockCount = Rhd2000DataBlockUsb3::getNumAllocations() - blockStart;
+
+    cout << "  " << modeNames[mode] << ":  " << (double) heapCount / count << " heap allocations/block, " <<
+            (double) blockCount / count << " block allocations/block, " <<
+            1.0e6 * elapsed / count << " us/block" << endl;
+    benchmarkSink = checksum;
+}
+
+static int runBlockPoolTest(int argc, char* argv[])
+{
+    int numStreams = (argc > 0) ? atoi(argv[0]) : MAX_NUM_DATA_STREAMS;
+    unsigned long long numBlocks = (argc > 1) ? atoll(argv[1]) : 20000;
+
+    if (numStreams < 1 || numStreams > MAX_NUM_DATA_STREAMS) {
+        cerr << "blockpool: streams must be 1-" << MAX_NUM_DATA_STREAMS << endl;
+        return 1;
+    }
+
+    okFrontPanelSim_SetRealTime(false);
+    Rhd2000EvalBoardUsb3* evalBoard = openSimBoard(numStreams, Rhd2000EvalBoardUsb3::SampleRate30000Hz);
+    if (!evalBoard) return 1;
+
+    cout << endl << "Block pool test: " << numStreams << " streams, " << numBlocks << " blocks per pass" << endl;
+
+    evalBoard->setContinuousRunMode(true);
+    evalBoard->run();
+
+    runBlockPoolPass(evalBoard, QueueCopy, numBlocks);
+    runBlockPoolPass(evalBoard, QueueMove, numBlocks);
+    runBlockPoolPass(evalBoard, Pool, numBlocks);
+
+    evalBoard->setContinuousRunMode(false);
+    evalBoard->setMaxTimeStep(0);
+    evalBoard->flush();
+
+    delete evalBoard;
+    return 0;
+}
+
+// Fill buffer with numBlocks USB data blocks of pseudo-random words and valid frame headers.
+static void makeSyntheticUsbBlocks(vector<unsigned char> &buffer, int numDataStreams, int numBlocks)
+{
+    unsigned int frameWords = Rhd2000DataBlockUsb3::calculateDataBlockSizeInWords(numDataStreams) / SAMPLES_PER_DATA_BLOCK;
+    unsigned int numFrames = numBlocks * SAMPLES_PER_DATA_BLOCK;
+    unsigned int seed = 12345;
+
+    buffer.resize(2 * frameWords * numFrames);
+    for (unsigned int frame = 0; frame < numFrames; ++frame) {
+        unsigned char* p = &buffer[2 * frameWords * frame];
+        unsigned long long magic = RHD2000_HEADER_MAGIC_NUMBER;
+        for (int i = 0; i < 8; ++i) p[i] = (unsigned char) (magic >> (8 * i));
+        for (int i = 0; i < 4; ++i) p[8 + i] = (unsigned char) (frame >> (8 * i));
+        for (unsigned int i = 12; i < 2 * frameWords; ++i) {
+            seed = seed * 1103515245 + 12345;
+            p[i] = (unsigned char) (seed >> 16);
+        }
+    }
+}
+
+static bool sameDecodedData(const Rhd2000DataBlockUsb3 &a, const Rhd2000DataBlockUsb3 &b, int numDataStreams)
+{
+    int numAmp = numDataStreams * CHANNELS_PER_STREAM * SAMPLES_PER_DATA_BLOCK;
+    return memcmp(a.amplifierDataFast, b.amplifierDataFast, numAmp * sizeof(int)) == 0 &&
+            a.timeStamp == b.timeStamp && a.auxiliaryData == b.auxiliaryData &&
+            a.boardAdcData == b.boardAdcData && a.ttlIn == b.ttlIn && a.ttlOut == b.ttlOut;
+}
+
+// Decode every block in buffer repeatedly for about duration seconds; returns GB/s of USB data.
+static double timeDecode(vector<unsigned char> &buffer, int numDataStreams, int numBlocks, bool reference, double duration)
+{
+    Rhd2000DataBlockUsb3 dataBlock(numDataStreams);
+    unsigned long long passes = 0;
+    long long checksum = 0;
+
+    BenchClock::time_point start = BenchClock::now();
+    do {
+        for (int j = 0; j < numBlocks; ++j) {
+            if (reference) {
+                dataBlock.fillFromUsbBufferReference(&buffer[0], j, numDataStreams);
+            } else {
+                dataBlock.fillFromUsbBuffer(&buffer[0], j, numDataStreams);
+            }
+            checksum += dataBlock.amplifierDataFast[j];
+        }
+        ++passes;
+    } while (secondsSince(start) < duration);
+    double elapsed = secondsSince(start);
+
+    benchmarkSink = checksum;
+    return passes * buffer.size() / elapsed / 1.0e9;
+}
+
+static int runDecodeTest(int argc, char* argv[])
+{
+    static const int streamCounts[] = { 1, 4, 8, 16, 32 };
+    const int numBlocks = 16;
+    double duration = (argc > 0) ? atof(argv[0]) : 0.5;
+
+    Rhd2000DecoderUsb3::DecodePath bestPath = Rhd2000DecoderUsb3::detectBestPath();
+    cout << endl << "Decode benchmark (GB/s of USB data); best path on this CPU: " <<
+            Rhd2000DecoderUsb3::pathName(bestPath) << endl;
+    cout << "  streams  reference";
+    for (int path = Rhd2000DecoderUsb3::DecodeScalar; path <= bestPath; ++path) {
+        cout << "  " << setw(9) << Rhd2000DecoderUsb3::pathName((Rhd2000DecoderUsb3::DecodePath) path);
+    }
+    cout << endl;
+
+    bool allMatch = true;
+    for (int numDataStreams : streamCounts) {
+        vector<unsigned char> buffer;
+        makeSyntheticUsbBlocks(buffer, numDataStreams, numBlocks);
+
+        Rhd2000DataBlockUsb3 expected(numDataStreams), actual(numDataStreams);
+        cout << "  " << setw(7) << numDataStreams << "  " << setw(9) << fixed << setprecision(2) <<
+                timeDecode(buffer, numDataStreams, numBlocks, true, duration);
+
+        for (int path = Rhd2000DecoderUsb3::DecodeScalar; path <= bestPath; ++path) {
+            Rhd2000DecoderUsb3::setPath((Rhd2000DecoderUsb3::DecodePath) path);
+            for (int j = 0; j < numBlocks; ++j) {
+                expected.fillFromUsbBufferReference(&buffer[0], j, numDataStreams);
+                actual.fillFromUsbBuffer(&buffer[0], j, numDataStreams);
+                if (!sameDecodedData(expected, actual, numDataStreams)) allMatch = false;
+            }
+            cout << "  " << setw(9) << timeDecode(buffer, numDataStreams, numBlocks, false, duration);
+        }
+        cout << endl;
+    }
+    cout.unsetf(ios::fixed);
+    Rhd2000DecoderUsb3::setPath(bestPath);
+
+    cout << (allMatch ? "All decode paths match the reference decoder." :
+                        "MISMATCH between a decode path and the reference decoder!") << endl;
+    return allMatch ? 0 : 1;
+}
+
+// Run a first-order high-pass filter over every amplifier channel in the block; state holds one
+// value per channel.  Walks each channel with amplifierChannel() and amplifierSampleStride(), so the
+// same code serves both layouts.
+static void highPassFilterBlock(const Rhd2000DataBlockUsb3 &dataBlock, vector<float> &state, vector<float> &output)
+{
+    const float a = 0.99f;
+    int numDataStreams = dataBlock.getNumDataStreams();
+    int stride = dataBlock.amplifierSampleStride();
+    float* out = &output[0];
+
+    for (int stream = 0; stream < numDataStreams; ++stream) {
+        for (int channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
+            const int* x = dataBlock.amplifierChannel(stream, channel);
+            float y = state[stream * CHANNELS_PER_STREAM + channel];
+            for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+                y = a * y + (float) x[t * stride];
+                *out++ = y;
+            }
+            state[stream * CHANNELS_PER_STREAM + channel] = y;
+        }
+    }
+}
+
+static int runLayoutTest(int argc, char* argv[])
+{
+    int numDataStreams = (argc > 0) ? atoi(argv[0]) : MAX_NUM_DATA_STREAMS;
+    double duration = (argc > 1) ? atof(argv[1]) : 0.5;
+    const int numBlocks = 16;
+
+    if (numDataStreams < 1 || numDataStreams > MAX_NUM_DATA_STREAMS) {
+        cerr << "layout: streams must be 1-" << MAX_NUM_DATA_STREAMS << endl;
+        return 1;
+    }
+
+    vector<unsigned char> buffer;
+    makeSyntheticUsbBlocks(buffer, numDataStreams, numBlocks);
+    unsigned long long samplesPerBlock = (unsigned long long) numDataStreams * CHANNELS_PER_STREAM * SAMPLES_PER_DATA_BLOCK;
+
+    cout << endl << "Amplifier layout test: " << numDataStreams << " streams" << endl;
+
+    Rhd2000DataBlockUsb3 timeMajor(numDataStreams, Rhd2000DataBlockUsb3::TimeMajor);
+    Rhd2000DataBlockUsb3 channelMajor(numDataStreams, Rhd2000DataBlockUsb3::ChannelMajor);
+    Rhd2000DecoderUsb3::DecodePath bestPath = Rhd2000DecoderUsb3::detectBestPath();
+    bool match = true;
+    for (int path = Rhd2000DecoderUsb3::DecodeScalar; path <= bestPath; ++path) {
+        Rhd2000DecoderUsb3::setPath((Rhd2000DecoderUsb3::DecodePath) path);
+        for (int j = 0; j < numBlocks; ++j) {
+            timeMajor.fillFromUsbBufferReference(&buffer[0], j, numDataStreams);
+            channelMajor.fillFromUsbBuffer(&buffer[0], j, numDataStreams);
+            for (int stream = 0; stream < numDataStreams; ++stream) {
+                for (int channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
+                    for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+                        if (timeMajor.amplifierSample(stream, channel, t) != channelMajor.amplifierSample(stream, channel, t)) {
+                            match = false;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    Rhd2000DecoderUsb3::setPath(bestPath);
+
+    Rhd2000DataBlockUsb3* blocks[2] = { &timeMajor, &channelMajor };
+    const char* names[2] = { "TimeMajor   ", "ChannelMajor" };
+    for (int k = 0; k < 2; ++k) {
+        Rhd2000DataBlockUsb3 &dataBlock = *blocks[k];
+
+        unsigned long long passes = 0;
+        BenchClock::time_point start = BenchClock::now();
+        do {
+            for (int j = 0; j < numBlocks; ++j) {
+                dataBlock.fillFromUsbBuffer(&buffer[0], j, numDataStreams);
+            }
+            ++passes;
+        } while (secondsSince(start) < duration);
+        double decodeGBps = passes * buffer.size() / secondsSince(start) / 1.0e9;
+
+        vector<float> state(numDataStreams * CHANNELS_PER_STREAM, 0.0f), output(samplesPerBlock);
+        unsigned long long filterBlocks = 0;
+        start = BenchClock::now();
+        do {
+            highPassFilterBlock(dataBlock, state, output);
+            ++filterBlocks;
+        } while (secondsSince(start) < duration);
+        double filterMsps = filterBlocks * samplesPerBlock / secondsSince(start) / 1.0e6;
+        benchmarkSink = (long long) output[samplesPerBlock - 1];
+
+        cout << "  " << names[k] << "  decode " << fixed << setprecision(2) << decodeGBps << " GB/s,  " <<
+                "per-channel filter " << filterMsps << " MS/s" << endl;
+        cout.unsetf(ios::fixed);
+    }
+
+    cout << (match ? "Both layouts hold identical samples." : "MISMATCH between layouts!") << endl;
+    return match ? 0 : 1;
+}
+
+static bool sameSamples(const Rhd2000DataBlockUsb3 &a, const Rhd2000DataBlockUsb3 &b)
+{
+    int numDataStreams = a.getNumDataStreams();
+    for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        if (a.timeStamp[t] != b.timeStamp[t] || a.ttlInSample(t) != b.ttlInSample(t) ||
+                a.ttlOutSample(t) != b.ttlOutSample(t)) return false;
+        for (int i = 0; i < 8; ++i) {
+            if (a.boardAdcSample(i, t) != b.boardAdcSample(i, t)) return false;
+        }
+        for (int stream = 0; stream < numDataStreams; ++stream) {
+            for (int channel = 0; channel < 3; ++channel) {
+                if (a.auxiliarySample(stream, channel, t) != b.auxiliarySample(stream, channel, t)) return false;
+            }
+            for (int channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
+                if (a.amplifierSample(stream, channel, t) != b.amplifierSample(stream, channel, t)) return false;
+            }
+        }
+    }
+    return true;
+}
+
+static string savedBlockBytes(const Rhd2000DataBlockUsb3 &dataBlock, const char* fileName)
+{
+    {
+        ofstream saveOut(fileName, ios::binary | ios::out);
+        dataBlock.write(saveOut, dataBlock.getNumDataStreams());
+    }
+    ifstream saved(fileName, ios::binary);
+    string bytes((istreambuf_iterator<char>(saved)), istreambuf_iterator<char>());
+    saved.close();
+    remove(fileName);
+    return bytes;
+}
+
+// Check the per-channel accessors of dataBlock against amplifierSample(): copyAmplifierChannel() must
+// match in every format, the pointer accessor of the block's own format must walk the same samples,
+// and that of the other format must return nullptr.
+static bool channelAccessorsMatch(const Rhd2000DataBlockUsb3 &dataBlock)
+{
+    int stride = dataBlock.amplifierSampleStride();
+    bool uint16 = dataBlock.getSampleFormat() == Rhd2000DataBlockUsb3::UInt16Samples;
+    int samples[SAMPLES_PER_DATA_BLOCK];
+    for (int stream = 0; stream < dataBlock.getNumDataStreams(); ++stream) {
+        for (int channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
+            const int* x = dataBlock.amplifierChannel(stream, channel);
+            const unsigned short* x16 = dataBlock.amplifierChannel16(stream, channel);
+            if (uint16 ? (x != nullptr || x16 == nullptr) : (x == nullptr || x16 != nullptr)) return false;
+            dataBlock.copyAmplifierChannel(stream, channel, samples);
+            for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+                int sample = dataBlock.amplifierSample(stream, channel, t);
+                int direct = uint16 ? x16[t * stride] : x[t * stride];
+                if (samples[t] != sample || direct != sample) return false;
+            }
+        }
+    }
+    return true;
+}
+
+static int runCompactTest(int argc, char* argv[])
+{
+    int numDataStreams = (argc > 0) ? atoi(argv[0]) : MAX_NUM_DATA_STREAMS;
+    double duration = (argc > 1) ? atof(argv[1]) : 0.5;
+    const int numBlocks = 16;
+
+    if (numDataStreams < 1 || numDataStreams > MAX_NUM_DATA_STREAMS) {
+        cerr << "compact: streams must be 1-" << MAX_NUM_DATA_STREAMS << endl;
+        return 1;
+    }
+
+    vector<unsigned char> buffer;
+    makeSyntheticUsbBlocks(buffer, numDataStreams, numBlocks);
+
+    cout << endl << "Compact sample storage test: " << numDataStreams << " streams" << endl;
+
+    Rhd2000DataBlockUsb3 reference(numDataStreams);
+    reference.fillFromUsbBufferReference(&buffer[0], numBlocks - 1, numDataStreams);
+    string referenceFile = savedBlockBytes(reference, "compact_test_reference.dat");
+
+    // Sample bytes held per block: amplifier + aux + ADC + TTL words
+    unsigned int wordsPerBlock = SAMPLES_PER_DATA_BLOCK * (numDataStreams * (CHANNELS_PER_STREAM + 3) + 8 + 2);
+
+    bool match = true;
+    for (int format = Rhd2000DataBlockUsb3::Int32Samples; format <= Rhd2000DataBlockUsb3::UInt16Samples; ++format) {
+        for (int layout = Rhd2000DataBlockUsb3::TimeMajor; layout <= Rhd2000DataBlockUsb3::ChannelMajor; ++layout) {
+            Rhd2000DataBlockUsb3 dataBlock(numDataStreams, (Rhd2000DataBlockUsb3::AmplifierLayout) layout,
+                                           (Rhd2000DataBlockUsb3::SampleFormat) format);
+
+            dataBlock.fillFromUsbBuffer(&buffer[0], numBlocks - 1, numDataStreams);
+            bool ok = sameSamples(reference, dataBlock) && channelAccessorsMatch(dataBlock) &&
+                    savedBlockBytes(dataBlock, "compact_test_block.dat") == referenceFile;
+            if (!ok) match = false;
+
+            unsigned long long passes = 0;
+            BenchClock::time_point start = BenchClock::now();
+            do {
+                for (int j = 0; j < numBlocks; ++j) {
+                    dataBlock.fillFromUsbBuffer(&buffer[0], j, numDataStreams);
+                }
+                ++passes;
+            } while (secondsSince(start) < duration);
+            double decodeGBps = passes * buffer.size() / secondsSince(start) / 1.0e9;
+
+            cout << "  " << ((format == Rhd2000DataBlockUsb3::UInt16Samples) ? "UInt16" : "Int32 ") << " " <<
+                    ((layout == Rhd2000DataBlockUsb3::ChannelMajor) ? "ChannelMajor" : "TimeMajor   ") <<
+                    "  " << setw(7) << wordsPerBlock * ((format == Rhd2000DataBlockUsb3::UInt16Samples) ? 2 : 4) <<
+                    " bytes/block  decode " << fixed << setprecision(2) << decodeGBps << " GB/s" <<
+                    (ok ? "" : "  MISMATCH") << endl;
+            cout.unsetf(ios::fixed);
+        }
+    }
+
+    cout << (match ? "All formats and layouts match the reference decoder and file format." :
+                     "MISMATCH against the reference decoder!") << endl;
+    return match ? 0 : 1;
+}
+
+enum FileWriteMode {
+    FileWriteReference,
+    FileWriteBlock,
+    FileWriteQueue,
+    FileWriteWriter
+};
+
+// Save numBlocks copies of dataBlock with the given method; returns MB/s and the file contents.
+static double runFileWritePass(Rhd2000EvalBoardUsb3* evalBoard, const Rhd2000DataBlockUsb3 &dataBlock,
+                               FileWriteMode mode, int numBlocks, string &fileBytes)
+{
+    const char* fileName = "filewrite_test.dat";
+    int numDataStreams = dataBlock.getNumDataStreams();
+
+    queue<Rhd2000DataBlockUsb3> dataQueue;
+    if (mode == FileWriteQueue) {
+        for (int i = 0; i < numBlocks; ++i) {
+            dataQueue.push(dataBlock);
+        }
+    }
+
+    ofstream saveOut(fileName, ios::binary | ios::out);
+    BenchClock::time_point start = BenchClock::now();
+    switch (mode) {
+    case FileWriteReference:
+        for (int i = 0; i < numBlocks; ++i) {
+            dataBlock.writeReference(saveOut, numDataStreams);
+        }
+        break;
+    case FileWriteBlock:
+        {
+            vector<unsigned char> writeBuffer;
+            for (int i = 0; i < numBlocks; ++i) {
+                dataBlock.write(saveOut, numDataStreams, writeBuffer);
+            }
+        }
+        break;
+    case FileWriteQueue:
+        evalBoard->queueToFile(dataQueue, saveOut);
+        break;
+    case FileWriteWriter:
+        {
+            Rhd2000DataFileWriterUsb3 fileWriter(saveOut);
+            for (int i = 0; i < numBlocks; ++i) {
+                fileWriter.writeBlock(dataBlock, numDataStreams);
+            }
+        }
+        break;
+    }
+    saveOut.close();
+    double elapsed = secondsSince(start);
+
+    ifstream saved(fileName, ios::binary);
+    fileBytes.assign(istreambuf_iterator<char>(saved), istreambuf_iterator<char>());
+    saved.close();
+    remove(fileName);
+
+    return (double) numBlocks * Rhd2000DataBlockUsb3::getSerializedSizeInBytes(numDataStreams) / elapsed / 1.0e6;
+}
+
+static int runFileWriteTest(int argc, char* argv[])
+{
+    int numDataStreams = (argc > 0) ? atoi(argv[0]) : MAX_NUM_DATA_STREAMS;
+    int numBlocks = (argc > 1) ? atoi(argv[1]) : 100;
+    static const char* modeNames[4] = { "writeReference()", "write()", "queueToFile()", "Rhd2000DataFileWriterUsb3" };
+
+    if (numDataStreams < 1 || numDataStreams > MAX_NUM_DATA_STREAMS || numBlocks < 1) {
+        cerr << "filewrite: streams must be 1-" << MAX_NUM_DATA_STREAMS << " and blocks at least 1" << endl;
+        return 1;
+    }
+
+    Rhd2000EvalBoardUsb3* evalBoard = openSimBoard(numDataStreams, Rhd2000EvalBoardUsb3::SampleRate30000Hz);
+    if (!evalBoard) return 1;
+
+    vector<unsigned char> buffer;
+    makeSyntheticUsbBlocks(buffer, numDataStreams, 1);
+
+    cout << endl << "File write test: " << numDataStreams << " streams, " << numBlocks << " blocks of " <<
+            Rhd2000DataBlockUsb3::getSerializedSizeInBytes(numDataStreams) << " bytes" << endl;
+
+    bool match = true;
+    string referenceBytes;
+    for (int format = Rhd2000DataBlockUsb3::Int32Samples; format <= Rhd2000DataBlockUsb3::UInt16Samples; ++format) {
+        Rhd2000DataBlockUsb3 dataBlock(numDataStreams, Rhd2000DataBlockUsb3::TimeMajor,
+                                       (Rhd2000DataBlockUsb3::SampleFormat) format);
+        dataBlock.fillFromUsbBuffer(&buffer[0], 0, numDataStreams);
+
+        cout << ((format == Rhd2000DataBlockUsb3::UInt16Samples) ? "UInt16Samples" : "Int32Samples") << endl;
+        for (int mode = FileWriteReference; mode <= FileWriteWriter; ++mode) {
+            string fileBytes;
+            double mbps = runFileWritePass(evalBoard, dataBlock, (FileWriteMode) mode, numBlocks, fileBytes);
+            if (referenceBytes.empty()) {
+                referenceBytes = fileBytes;
+            }
+            bool ok = (fileBytes == referenceBytes);
+            if (!ok) match = false;
+            cout << "  " << left << setw(28) << modeNames[mode] << right << fixed << setprecision(1) <<
+                    setw(9) << mbps << " MB/s" << (ok ? "" : "  MISMATCH") << endl;
+            cout.unsetf(ios::fixed);
+        }
+    }
+
+    // More streams than the serializer's row tables hold: serialize() falls back to the accessors.
+    // (The reference decoder fills only Int32Samples blocks.)
+    const int manyStreams = MAX_NUM_DATA_STREAMS + 8;
+    makeSyntheticUsbBlocks(buffer, manyStreams, 1);
+    Rhd2000DataBlockUsb3 manyStreamBlock(manyStreams);
+    manyStreamBlock.fillFromUsbBuffer(&buffer[0], 0, manyStreams);
+    string manyStreamFile, serializedBytes(Rhd2000DataBlockUsb3::getSerializedSizeInBytes(manyStreams), '\0');
+    runFileWritePass(evalBoard, manyStreamBlock, FileWriteReference, 1, manyStreamFile);
+    manyStreamBlock.serialize((unsigned char*) &serializedBytes[0], manyStreams);
+    bool manyStreamsOk = (serializedBytes == manyStreamFile);
+    if (!manyStreamsOk) match = false;
+    cout << manyStreams << " streams: serialize() " << (manyStreamsOk ? "matches writeReference()" : "MISMATCH") << endl;
+
+    cout << (match ? "All writers produce identical files." : "MISMATCH between writers!") << endl;
+    delete evalBoard;
+    return match ? 0 : 1;
+}
+
+static void printWriterStats(Rhd2000AsyncFileWriterUsb3 &fileWriter)
+{
+    Rhd2000AsyncFileWriterUsb3::WriterStats stats;
+    fileWriter.getStats(stats);
+    cout << "  queue " << stats.queueDepth << "/" << stats.numBuffers << " (max " << stats.maxQueueDepth << ")" <<
+            "  written " << fixed << setprecision(1) << stats.numBytesWritten / 1.0e6 << " MB in " <<
+            stats.numWrites << " writes  latency p50 " << setprecision(2) << stats.latencyMedianMs <<
+            " ms p99 " << stats.latency99Ms << " ms max " << stats.latencyMaxMs << " ms  blocks " <<
+            stats.numBlocksQueued << " queued " << stats.numBlocksDropped << " dropped" <<
+            (stats.numWriteErrors ? "  WRITE ERRORS" : "") << endl;
+    cout.unsetf(ios::fixed);
+}
+
+// Check that a saved file holds numBlocks whole blocks with consecutive (16-bit) time stamps.
+static bool checkSavedTimeStamps(const char* fileName, int numDataStreams, unsigned long long numBlocks)
+{
+    unsigned int frameBytes = Rhd2000DataBlockUsb3::getSerializedSizeInBytes(numDataStreams) / SAMPLES_PER_DATA_BLOCK;
+    ifstream saved(fileName, ios::binary);
+    vector<unsigned char> frame(frameBytes);
+    unsigned long long numFrames = 0;
+    unsigned int lastTimeStamp = 0;
+    bool contiguous = true;
+
+    while (saved.read((char*) frame.data(), frameBytes)) {
+        unsigned int timeStamp = frame[0] | (frame[1] << 8);
+        if (numFrames > 0 && timeStamp != ((lastTimeStamp + 1) & 0xffff)) contiguous = false;
+        lastTimeStamp = timeStamp;
+        ++numFrames;
+    }
+    bool wholeFile = (saved.gcount() == 0 && numFrames == numBlocks * SAMPLES_PER_DATA_BLOCK);
+    return contiguous && wholeFile;
+}
+
+static int runAsyncWriteTest(int argc, char* argv[])
+{
+    int numStreams = (argc > 0) ? atoi(argv[0]) : MAX_NUM_DATA_STREAMS;
+    double duration = (argc > 1) ? atof(argv[1]) : 5.0;
+    bool directIo = (argc > 2) && atoi(argv[2]) != 0;
+    const char* fileName = "asyncwrite_test.dat";
+
+    if (numStreams < 1 || numStreams > MAX_NUM_DATA_STREAMS) {
+        cerr << "asyncwrite: streams must be 1-" << MAX_NUM_DATA_STREAMS << endl;
+        return 1;
+    }
+
+    okFrontPanelSim_SetRealTime(true);
+    Rhd2000EvalBoardUsb3* evalBoard = openSimBoard(numStreams, Rhd2000EvalBoardUsb3::SampleRate30000Hz);
+    if (!evalBoard) return 1;
+    evalBoard->setSampleFormat(Rhd2000DataBlockUsb3::UInt16Samples);
+
+    Rhd2000AsyncFileWriterUsb3 fileWriter;
+    if (!fileWriter.open(fileName, directIo)) {
+        delete evalBoard;
+        return 1;
+    }
+
+    cout << endl << "Async file writer test: " << numStreams << " streams x " << evalBoard->getSampleRate() <<
+            " S/s, " << duration << " s, " << (fileWriter.isDirectIo() ? "direct" : "buffered") << " I/O" << endl;
+
+    evalBoard->setContinuousRunMode(true);
+    evalBoard->run();
+    evalBoard->startReaderThread();
+    Rhd2000DataBlockRingUsb3* dataBlockRing = evalBoard->getDataBlockRing();
+
+    double maxWriteBlockMs = 0.0;
+    BenchClock::time_point start = BenchClock::now();
+    BenchClock::time_point interval = start;
+    while (secondsSince(start) < duration) {
+        Rhd2000DataBlockUsb3* dataBlock = dataBlockRing->front();
+        if (!dataBlock) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
+        }
+
+        BenchClock::time_point writeStart = BenchClock::now();
+        fileWriter.writeBlock(*dataBlock, numStreams);
+        maxWriteBlockMs = max(maxWriteBlockMs, 1000.0 * secondsSince(writeStart));
+        dataBlockRing->pop();
+
+        if (secondsSince(interval) >= 1.0) {
+            printWriterStats(fileWriter);
+            interval = BenchClock::now();
+        }
+    }
+
+    evalBoard->stopReaderThread();
+    evalBoard->setContinuousRunMode(false);
+    evalBoard->setMaxTimeStep(0);
+    evalBoard->flush();
+    delete evalBoard;
+
+    fileWriter.close();
+    Rhd2000AsyncFileWriterUsb3::WriterStats stats;
+    fileWriter.getStats(stats);
+    printWriterStats(fileWriter);
+    bool ok = (stats.numBlocksDropped > 0) || checkSavedTimeStamps(fileName, numStreams, stats.numBlocksQueued);
+    cout << "Longest writeBlock() call: " << maxWriteBlockMs << " ms" << endl;
+    cout << (ok ? "Saved file is complete with contiguous time stamps." : "Saved file is INCOMPLETE or out of order!") << endl;
+    remove(fileName);
+
+    // Flood two 1 MB buffers with pre-decoded blocks as fast as the CPU can serialize them
+    vector<unsigned char> buffer;
+    makeSyntheticUsbBlocks(buffer, numStreams, 1);
+    Rhd2000DataBlockUsb3 dataBlock(numStreams, Rhd2000DataBlockUsb3::TimeMajor, Rhd2000DataBlockUsb3::UInt16Samples);
+    dataBlock.fillFromUsbBuffer(&buffer[0], 0, numStreams);
+
+    Rhd2000AsyncFileWriterUsb3 floodWriter(1048576, 2);
+    if (!floodWriter.open(fileName, directIo)) return 1;
+    cout << endl << "Flooding 2 x 1 MB buffers for 1 s:" << endl;
+    start = BenchClock::now();
+    while (secondsSince(start) < 1.0) {
+        floodWriter.writeBlock(dataBlock, numStreams);
+    }
+    floodWriter.close();
+    printWriterStats(floodWriter);
+    floodWriter.getStats(stats);
+    ifstream saved(fileName, ios::binary | ios::ate);
+    bool sizeOk = ((unsigned long long) saved.tellg() ==
+                   stats.numBlocksQueued * Rhd2000DataBlockUsb3::getSerializedSizeInBytes(numStreams));
+    saved.close();
+    remove(fileName);
+    cout << (sizeOk ? "File holds exactly the queued blocks." : "File size does NOT match the queued blocks!") << endl;
+
+    return (ok && sizeOk) ? 0 : 1;
+}
+
+static int runSharedMemoryRingTest(int argc, char* argv[])
+{
+    unsigned int numSlots = (argc > 0) ? atoi(argv[0]) : 32;
+    double duration = (argc > 1) ? atof(argv[1]) : 2.0;
+    int numReaders = (argc > 2) ? atoi(argv[2]) : 3;
+    const char* ringName = "IntanBenchmarkRing";
+    const unsigned int slotBytes = MAX_NUM_DATA_STREAMS * CHANNELS_PER_STREAM * SAMPLES_PER_DATA_BLOCK * 2;
+    const unsigned int slotWords = slotBytes / sizeof(unsigned long long);
+
+    if (numSlots < 2 || numReaders < 1) {
+        cerr << "shmring: at least 2 slots and 1 reader are required" << endl;
+        return 1;
+    }
+
+    Rhd2000SharedMemoryRingUsb3 producerRing;
+    if (!producerRing.create(ringName, numSlots, slotBytes, MAX_NUM_DATA_STREAMS, CHANNELS_PER_STREAM, 30000)) {
+        return 1;
+    }
+    cout << endl << "Shared memory ring test: " << numSlots << " slots of " << slotBytes << " bytes, " <<
+            numReaders << " readers, " << duration << " s" << endl;
+
+    atomic<bool> stop(false);
+    vector<unsigned long long> numRead(numReaders, 0), numOverwritten(numReaders, 0), numTorn(numReaders, 0);
+    vector<thread> readers;
+    for (int i = 0; i < numReaders; ++i) {
+        readers.push_back(thread([&, i]() {
+            Rhd2000SharedMemoryRingUsb3 readerRing;
+            if (!readerRing.openExisting(ringName)) return;
+            vector<unsigned long long> payload(slotWords);
+            unsigned long long cursor = readerRing.getWriteCursor();
+            while (!stop) {
+                unsigned long long writeCursor = readerRing.getWriteCursor();
+                if (writeCursor - cursor > numSlots) {
+                    numOverwritten[i] += writeCursor - numSlots - cursor;
+                    cursor = writeCursor - numSlots;
+                }
+                unsigned int payloadBytes;
+                unsigned long long timestamp;
+                Rhd2000SharedMemoryRingUsb3::ReadResult result =
+                        readerRing.read(cursor, payload.data(), slotBytes, payloadBytes, timestamp);
+                if (result == Rhd2000SharedMemoryRingUsb3::ReadNotYetWritten) {
+                    this_thread::yield();
+                    continue;
+                }
+                if (result == Rhd2000SharedMemoryRingUsb3::ReadOk) {
+                    bool torn = (timestamp != cursor * SAMPLES_PER_DATA_BLOCK || payloadBytes != slotBytes);
+                    for (unsigned int w = 0; w < slotWords; ++w) {
+                        if (payload[w] != cursor) torn = true;
+                    }
+                    if (torn) ++numTorn[i];
+                    ++numRead[i];
+                } else {
+                    ++numOverwritten[i];
+                }
+                ++cursor;
+            }
+        }));
+    }
+    this_thread::sleep_for(chrono::milliseconds(100));
+
+    BenchClock::time_point start = BenchClock::now();
+    unsigned long long numWritten = 0;
+    while (secondsSince(start) < duration) {
+        unsigned long long* payload = (unsigned long long*) producerRing.beginWrite();
+        for (unsigned int w = 0; w < slotWords; ++w) {
+            payload[w] = numWritten;
+        }
+        producerRing.commitWrite(slotBytes, numWritten * SAMPLES_PER_DATA_BLOCK);
+        ++numWritten;
+    }
+    double elapsed = secondsSince(start);
+    stop = true;
+    for (int i = 0; i < numReaders; ++i) {
+        readers[i].join();
+    }
+
+    cout << "Producer: " << numWritten << " slots (" << fixed << setprecision(0) << numWritten / elapsed <<
+            " slots/s, " << setprecision(2) << numWritten * (double) slotBytes / elapsed / 1.0e9 << " GB/s)" << endl;
+    cout.unsetf(ios::fixed);
+    bool ok = true;
+    for (int i = 0; i < numReaders; ++i) {
+        cout << "  reader " << i << ": " << numRead[i] << " slots accepted, " << numOverwritten[i] <<
+                " overwritten before read, " << numTorn[i] << " torn" << endl;
+        if (numTorn[i] > 0 || numRead[i] == 0) ok = false;
+    }
+    cout << (ok ? "No reader accepted a torn slot." : "TORN SLOTS accepted, or a reader read nothing!") << endl;
+    return ok ? 0 : 1;
+}
+
+// Former IntanRHXData per-sample record
+struct SharedMemorySampleRecord {
+    uint32_t streamId;
+    uint32_t channelId;
+    float value;
+};
+
+static int runSharedMemoryPayloadTest(int argc, char* argv[])
+{
+    int numDataStreams = (argc > 0) ? atoi(argv[0]) : MAX_NUM_DATA_STREAMS;
+    double duration = (argc > 1) ? atof(argv[1]) : 1.0;
+
+    if (numDataStreams < 1 || numDataStreams > MAX_NUM_DATA_STREAMS) {
+        cerr << "shmpayload: streams must be 1-" << MAX_NUM_DATA_STREAMS << endl;
+        return 1;
+    }
+
+    vector<unsigned char> buffer;
+    makeSyntheticUsbBlocks(buffer, numDataStreams, 1);
+    Rhd2000DataBlockUsb3 dataBlock(numDataStreams, Rhd2000DataBlockUsb3::TimeMajor, Rhd2000DataBlockUsb3::UInt16Samples);
+    dataBlock.fillFromUsbBuffer(&buffer[0], 0, numDataStreams);
+
+    const unsigned int numSamples = numDataStreams * CHANNELS_PER_STREAM * SAMPLES_PER_DATA_BLOCK;
+    const unsigned int recordBytes = numSamples * sizeof(SharedMemorySampleRecord);
+    const unsigned int wordBytes = numSamples * sizeof(unsigned short);
+
+    Rhd2000SharedMemoryRingUsb3 recordRing, wordRing, reader;
+    if (!recordRing.create("IntanBenchmarkRecords", 32, recordBytes, numDataStreams, CHANNELS_PER_STREAM, 30000) ||
+            !wordRing.create("IntanBenchmarkWords", 32, wordBytes, numDataStreams, CHANNELS_PER_STREAM, 30000,
+                             Rhd2000SharedMemoryRingUsb3::PayloadAmplifierWords, SAMPLES_PER_DATA_BLOCK, 0.195, 32768) ||
+            !reader.openExisting("IntanBenchmarkWords")) {
+        return 1;
+    }
+
+    cout << endl << "Shared memory payload test: " << numDataStreams << " streams" << endl;
+
+    unsigned long long numBlocks = 0;
+    BenchClock::time_point start = BenchClock::now();
+    do {
+        SharedMemorySampleRecord* records = (SharedMemorySampleRecord*) recordRing.beginWrite();
+        size_t w = 0;
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            for (int stream = 0; stream < numDataStreams; ++stream) {
+                for (int channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
+                    int code = dataBlock.amplifierSample(stream, channel, t);
+                    float uV = (float) ((code - 32768) * 0.195f);
+                    records[w++] = { (uint32_t) stream, (uint32_t) channel, uV };
+                }
+            }
+        }
+        recordRing.commitWrite(recordBytes, numBlocks * SAMPLES_PER_DATA_BLOCK);
+        ++numBlocks;
+    } while (secondsSince(start) < duration);
+    double recordMicroseconds = 1.0e6 * secondsSince(start) / numBlocks;
+
+    numBlocks = 0;
+    start = BenchClock::now();
+    do {
+        unsigned char* words = wordRing.beginWrite();
+        memcpy(words, dataBlock.amplifierData16.data(), wordBytes);
+        wordRing.commitWrite(wordBytes, numBlocks * SAMPLES_PER_DATA_BLOCK);
+        ++numBlocks;
+    } while (secondsSince(start) < duration);
+    double wordMicroseconds = 1.0e6 * secondsSince(start) / numBlocks;
+
+    // Reader side: convert the newest slot lazily and compare with the record values
+    vector<unsigned short> words(numSamples);
+    unsigned int payloadBytes;
+    unsigned long long timestamp;
+    bool match = (reader.read(reader.getWriteCursor() - 1, words.data(), wordBytes, payloadBytes, timestamp) ==
+                  Rhd2000SharedMemoryRingUsb3::ReadOk);
+    const Rhd2000SharedMemoryRingHeader* header = reader.getHeader();
+    for (int t = 0; match && t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        for (int stream = 0; stream < numDataStreams; ++stream) {
+            for (int channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
+                unsigned short word = words[(t * header->channelCount + channel) * header->streamCount + stream];
+                float uV = (float) ((dataBlock.amplifierSample(stream, channel, t) - 32768) * 0.195f);
+                if (fabs(reader.sampleToMicrovolts(word) - uV) > 1.0e-3f) match = false;
+            }
+        }
+    }
+
+    cout << fixed << setprecision(1);
+    cout << "  {id, id, float} records: " << setw(8) << recordBytes << " bytes/block  " << setw(7) <<
+            recordMicroseconds << " us/block" << endl;
+    cout << "  16-bit amplifier words:  " << setw(8) << wordBytes << " bytes/block  " << setw(7) <<
+            wordMicroseconds << " us/block" << endl;
+    cout << "  " << setprecision(1) << (double) recordBytes / wordBytes << "x fewer bytes, " <<
+            recordMicroseconds / wordMicroseconds << "x less producer time" << endl;
+    cout.unsetf(ios::fixed);
+    cout << (match ? "Reader conversion matches the record values." : "Reader conversion MISMATCH!") << endl;
+    return match ? 0 : 1;
+}
+
+// Brute-force min/max/mean of entry number entry of a pyramid level, built the same way the pyramid
+// builds it: level 0 from raw samples, higher levels from the entries one level down.
+static Rhd2000DecimationEntry bruteForceEntry(const vector<Rhd2000DataBlockUsb3*> &blocks, const vector<unsigned int> &factors,
+                                              int level, unsigned long long entry, int stream, int channel)
+{
+    unsigned int count = (level == 0) ? factors[0] : factors[level] / factors[level - 1];
+    unsigned int low = 0xffff, high = 0, total = 0;
+    for (unsigned int j = 0; j < count; ++j) {
+        unsigned int minimum, maximum, mean;
+        if (level == 0) {
+            unsigned long long n = entry * count + j;
+            const Rhd2000DataBlockUsb3 *dataBlock = blocks[(n / SAMPLES_PER_DATA_BLOCK) % blocks.size()];
+            minimum = maximum = mean = dataBlock->amplifierSample(stream, channel, n % SAMPLES_PER_DATA_BLOCK);
+        } else {
+            Rhd2000DecimationEntry below = bruteForceEntry(blocks, factors, level - 1, entry * count + j, stream, channel);
+            minimum = below.minimum;
+            maximum = below.maximum;
+            mean = below.mean;
+        }
+        low = min(low, minimum);
+        high = max(high, maximum);
+        total += mean;
+    }
+    Rhd2000DecimationEntry result = { (uint16_t) low, (uint16_t) high, (uint16_t) ((total + count / 2) / count), 0 };
+    return result;
+}
+
+static int runPyramidTest(int argc, char* argv[])
+{
+    int numDataStreams = (argc > 0) ? atoi(argv[0]) : MAX_NUM_DATA_STREAMS;
+    int numBlocks = (argc > 1) ? atoi(argv[1]) : 600;
+    const int numSyntheticBlocks = 16;
+    const char* pyramidName = "IntanBenchmarkPyramid";
+
+    if (numDataStreams < 1 || numDataStreams > MAX_NUM_DATA_STREAMS || numBlocks < 1) {
+        cerr << "pyramid: streams must be 1-" << MAX_NUM_DATA_STREAMS << " and blocks at least 1" << endl;
+        return 1;
+    }
+
+    vector<unsigned char> buffer;
+    makeSyntheticUsbBlocks(buffer, numDataStreams, numSyntheticBlocks);
+    vector<unsigned int> factors = Rhd2000DecimationPyramidUsb3::defaultLevelFactors();
+    double realTimeMicroseconds = 1.0e6 * SAMPLES_PER_DATA_BLOCK / 30000.0;
+
+    cout << endl << "Decimation pyramid test: " << numDataStreams * CHANNELS_PER_STREAM << " channels, " <<
+            numBlocks << " blocks, levels";
+    for (unsigned int level = 0; level < factors.size(); ++level) cout << " " << factors[level] << "x";
+    cout << endl;
+
+    bool match = true;
+    for (int format = Rhd2000DataBlockUsb3::Int32Samples; format <= Rhd2000DataBlockUsb3::UInt16Samples; ++format) {
+        for (int layout = Rhd2000DataBlockUsb3::TimeMajor; layout <= Rhd2000DataBlockUsb3::ChannelMajor; ++layout) {
+            vector<Rhd2000DataBlockUsb3*> blocks;
+            for (int j = 0; j < numSyntheticBlocks; ++j) {
+                blocks.push_back(new Rhd2000DataBlockUsb3(numDataStreams, (Rhd2000DataBlockUsb3::AmplifierLayout) layout,
+                                                          (Rhd2000DataBlockUsb3::SampleFormat) format));
+                blocks[j]->fillFromUsbBuffer(&buffer[0], j, numDataStreams);
+            }
+
+            Rhd2000DecimationPyramidUsb3 pyramid, reader;
+            if (!pyramid.create(pyramidName, numDataStreams, 30000, factors) || !reader.openExisting(pyramidName)) {
+                return 1;
+            }
+
+            BenchClock::time_point start = BenchClock::now();
+            for (int j = 0; j < numBlocks; ++j) {
+                pyramid.addBlock(*blocks[j % numSyntheticBlocks]);
+            }
+            double microseconds = 1.0e6 * secondsSince(start) / numBlocks;
+
+            // Newest entry at every level, for a spread of channels
+            bool ok = true;
+            for (int level = 0; level < reader.getNumLevels(); ++level) {
+                unsigned long long numEntries = reader.getNumEntries(level);
+                if (numEntries == 0) continue;
+                for (int stream = 0; stream < numDataStreams; stream += 3) {
+                    for (int channel = 0; channel < CHANNELS_PER_STREAM; channel += 7) {
+                        Rhd2000DecimationEntry entry;
+                        Rhd2000DecimationEntry expected =
+                                bruteForceEntry(blocks, factors, level, numEntries - 1, stream, channel);
+                        if (!reader.readEntries(level, channel * numDataStreams + stream, numEntries - 1, 1, &entry) ||
+                                entry.minimum != expected.minimum || entry.maximum != expected.maximum ||
+                                entry.mean != expected.mean) {
+                            ok = false;
+                        }
+                    }
+                }
+            }
+            if (!ok) match = false;
+
+            cout << "  " << ((format == Rhd2000DataBlockUsb3::UInt16Samples) ? "UInt16" : "Int32 ") << " " <<
+                    ((layout == Rhd2000DataBlockUsb3::ChannelMajor) ? "ChannelMajor" : "TimeMajor   ") << "  " <<
+                    fixed << setprecision(1) << setw(7) << microseconds << " us/block  (" <<
+                    setprecision(2) << 100.0 * microseconds / realTimeMicroseconds << "% of real time at 30 kS/s)  entries";
+            cout.unsetf(ios::fixed);
+            for (int level = 0; level < reader.getNumLevels(); ++level) cout << " " << reader.getNumEntries(level);
+            cout << (ok ? "" : "  MISMATCH") << endl;
+
+            for (int j = 0; j < numSyntheticBlocks; ++j) delete blocks[j];
+        }
+    }
+
+    cout << (match ? "Pyramid entries match the brute-force recomputation." : "Pyramid MISMATCH!") << endl;
+    return match ? 0 : 1;
+}
+
+static void printSinkStats(Rhd2000FpgaSinkUsb3 &sink)
+{
+    Rhd2000FpgaSinkUsb3::SinkStats stats;
+    sink.getStats(stats);
+    cout << "  transfers " << stats.numTransfers << " (" << fixed << setprecision(0) << stats.meanTransferBytes <<
+            " bytes avg, max " << stats.maxInFlight << "/" << stats.pipelineDepth << " in flight)  written " <<
+            setprecision(1) << stats.numBytesWritten / 1.0e6 << " MB  read back " << stats.numBytesRead / 1.0e6 <<
+            " MB  latency p50 " << setprecision(3) << stats.latencyMedianMs << " ms p99 " << stats.latency99Ms <<
+            " ms max " << stats.latencyMaxMs << " ms  dropped " << stats.numBytesDropped << " bytes" <<
+            (stats.numErrors ? "  TRANSFER ERRORS" : "") << endl;
+    cout.unsetf(ios::fixed);
+}
+
+static int runFpgaSinkTest(int argc, char* argv[])
+{
+    int numStreams = (argc > 0) ? atoi(argv[0]) : MAX_NUM_DATA_STREAMS;
+    double duration = (argc > 1) ? atof(argv[1]) : 5.0;
+    unsigned int pipelineDepth = (argc > 2) ? (unsigned int) atoi(argv[2]) : FPGA_SINK_PIPELINE_DEPTH;
+    const char* sinkSerial = "SIMFPGA001";
+    const unsigned int payloadBytes = CHANNELS_PER_STREAM * SAMPLES_PER_DATA_BLOCK * sizeof(unsigned short);
+
+    if (numStreams < 1 || numStreams > MAX_NUM_DATA_STREAMS) {
+        cerr << "fpgasink: streams must be 1-" << MAX_NUM_DATA_STREAMS << endl;
+        return 1;
+    }
+
+    // Attach a loopback FPGA next to the Rhythm board; the registry is built on first use.
+    setenv("OK_SIM_DEVICES", "SIMRHD0001,SIMFPGA001:loopback", 1);
+    okFrontPanelSim_SetRealTime(true);
+    Rhd2000EvalBoardUsb3* evalBoard = openSimBoard(numStreams, Rhd2000EvalBoardUsb3::SampleRate30000Hz);
+    if (!evalBoard) return 1;
+    evalBoard->setSampleFormat(Rhd2000DataBlockUsb3::UInt16Samples);
+
+    // Every byte read back must equal the bytes submitted, in order.
+    Rhd2000FpgaSinkUsb3 sink(FPGA_SINK_TRANSFER_BYTES, FPGA_SINK_NUM_BUFFERS, pipelineDepth);
+    Rhd2000LoopbackVerifierUsb3 verifier;
+    verifier.attach(sink);
+    if (!sink.open(sinkSerial, "main.bit")) {
+        delete evalBoard;
+        return 1;
+    }
+
+    cout << endl << "FPGA sink test: " << numStreams << " streams x " << evalBoard->getSampleRate() << " S/s, " <<
+            duration << " s, " << payloadBytes << " bytes per block to loopback device " << sinkSerial << endl;
+
+    evalBoard->setContinuousRunMode(true);
+    evalBoard->run();
+    evalBoard->startReaderThread();
+    Rhd2000DataBlockRingUsb3* dataBlockRing = evalBoard->getDataBlockRing();
+
+    double maxSubmitMs = 0.0;
+    unsigned long long numBlocks = 0;
+    BenchClock::time_point start = BenchClock::now();
+    BenchClock::time_point interval = start;
+    while (secondsSince(start) < duration) {
+        Rhd2000DataBlockUsb3* dataBlock = dataBlockRing->front();
+        if (!dataBlock) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
+        }
+
+        BenchClock::time_point submitStart = BenchClock::now();
+        verifier.submit(sink, (const unsigned char*) dataBlock->amplifierData16.data(), payloadBytes);
+        maxSubmitMs = max(maxSubmitMs, 1000.0 * secondsSince(submitStart));
+        dataBlockRing->pop();
+        numBlocks++;
+
+        if (secondsSince(interval) >= 1.0) {
+            printSinkStats(sink);
+            interval = BenchClock::now();
+        }
+    }
+
+    evalBoard->stopReaderThread();
+    evalBoard->setContinuousRunMode(false);
+    evalBoard->setMaxTimeStep(0);
+    evalBoard->flush();
+    delete evalBoard;
+
+    sink.close();
+    printSinkStats(sink);
+    Rhd2000FpgaSinkUsb3::SinkStats stats;
+    sink.getStats(stats);
+    Rhd2000LoopbackVerifierUsb3::VerifierStats verifierStats;
+    verifier.getStats(verifierStats);
+    bool ok = verifierStats.numBlocksMismatched == 0 && verifierStats.numBlocksPending == 0 &&
+            stats.numErrors == 0 && stats.numBytesRead == stats.numBytesSubmitted;
+    cout << "Longest submit() call: " << maxSubmitMs << " ms over " << numBlocks << " blocks" << endl;
+    cout << (ok ? "Every submitted byte came back in order." : "Loopback data does NOT match what was submitted!") << endl;
+
+    // The former path: one blocking write/read round trip per block on the acquisition thread
+    okCFrontPanel dev;
+    if (dev.OpenBySerial(sinkSerial) != okCFrontPanel::NoError) return 1;
+    vector<unsigned char> payload(payloadBytes, 0x5a), readBack(payloadBytes);
+    int numRoundTrips = 2000;
+    start = BenchClock::now();
+    for (int i = 0; i < numRoundTrips; ++i) {
+        dev.WriteToPipeIn(FPGA_SINK_PIPE_IN, payloadBytes, payload.data());
+        dev.ReadFromPipeOut(FPGA_SINK_PIPE_OUT, payloadBytes, readBack.data());
+    }
+    cout << "Blocking round trip per block: " << 1000.0 * secondsSince(start) / numRoundTrips <<
+            " ms of acquisition thread time per block" << endl;
+
+    return ok ? 0 : 1;
+}
+
+static void printVerifierStats(Rhd2000LoopbackVerifierUsb3 &verifier)
+{
+    Rhd2000LoopbackVerifierUsb3::VerifierStats stats;
+    verifier.getStats(stats);
+    cout << "  blocks " << stats.numBlocksVerified << "/" << stats.numBlocksSent << " verified (" <<
+            stats.numBlocksPending << " pending, " << stats.numBlocksMismatched << " mismatched, " <<
+            stats.numWordsMismatched << " words)  " << fixed << setprecision(1) << stats.megabytesPerSecond <<
+            " MB/s  latency p50 " << setprecision(3) << stats.latencyMedianMs << " ms p99 " << stats.latency99Ms <<
+            " ms max " << stats.latencyMaxMs << " ms" << endl;
+    cout.unsetf(ios::fixed);
+}
+
+// Stream whole blocks from a free-running board through the sink and a loopback device, checked by
+// a verifier using the given reference model.
+static bool runLoopbackPass(Rhd2000EvalBoardUsb3* evalBoard, double duration,
+                            Rhd2000LoopbackVerifierUsb3::ReferenceModel model,
+                            Rhd2000LoopbackVerifierUsb3::VerifierStats &stats)
+{
+    Rhd2000FpgaSinkUsb3 sink(1048576, 16, 4);
+    Rhd2000LoopbackVerifierUsb3 verifier(model);
+    verifier.attach(sink);
+    if (!sink.open("SIMFPGA001", "")) return false;
+
+    evalBoard->setContinuousRunMode(true);
+    evalBoard->run();
+    evalBoard->startReaderThread();
+    Rhd2000DataBlockRingUsb3* dataBlockRing = evalBoard->getDataBlockRing();
+
+    BenchClock::time_point start = BenchClock::now();
+    BenchClock::time_point interval = start;
+    while (secondsSince(start) < duration) {
+        Rhd2000DataBlockUsb3* dataBlock = dataBlockRing->front();
+        if (!dataBlock) {
+            this_thread::sleep_for(chrono::microseconds(100));
+            continue;
+        }
+        verifier.submit(sink, (const unsigned char*) dataBlock->amplifierData16.data(),
+                        (unsigned int) (dataBlock->amplifierData16.size() * sizeof(unsigned short)));
+        dataBlockRing->pop();
+
+        if (secondsSince(interval) >= 1.0) {
+            printVerifierStats(verifier);
+            interval = BenchClock::now();
+        }
+    }
+
+    evalBoard->stopReaderThread();
+    evalBoard->setContinuousRunMode(false);
+    evalBoard->setMaxTimeStep(0);
+    evalBoard->flush();
+
+    sink.close();
+    printVerifierStats(verifier);
+    verifier.getStats(stats);
+    return true;
+}
+
+// Reference model for a design that adds one to every 16-bit word, used to check that the
+// verifier catches a loopback that does not match.
+static void incrementWordsModel(const unsigned char *input, unsigned int numBytes, unsigned char *expected)
+{
+    for (unsigned int i = 0; i + 1 < numBytes; i += 2) {
+        unsigned int word = (input[i] | (input[i + 1] << 8)) + 1;
+        expected[i] = (unsigned char) (word & 0xff);
+        expected[i + 1] = (unsigned char) ((word >> 8) & 0xff);
+    }
+}
+
+// Send odd-sized blocks through a sink whose first pipe write fails.  The blocks that transfer
+// carried must be retired as lost, every later block must verify, and the padding flush() adds to
+// the last transfer must not show up as extra bytes.
+static bool runLoopbackLossPass()
+{
+    const unsigned int transferBytes = 4096;
+    const unsigned int blockBytes = 1001;
+    const unsigned int numBlocks = 40;
+
+    Rhd2000FpgaSinkUsb3 sink(transferBytes, 16, 2);
+    Rhd2000LoopbackVerifierUsb3 verifier;
+    verifier.attach(sink);
+    if (!sink.open("SIMFPGA001", "")) return false;
+    okFrontPanelSim_FailPipeInWrites("SIMFPGA001", 1);
+
+    vector<unsigned char> block(blockBytes);
+    for (unsigned int i = 0; i < numBlocks; ++i) {
+        for (unsigned int j = 0; j < blockBytes; ++j) {
+            block[j] = (unsigned char) (i * 7 + j);
+        }
+        while (!verifier.submit(sink, block.data(), blockBytes)) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+    sink.flush();
+    sink.close();
+
+    Rhd2000FpgaSinkUsb3::SinkStats sinkStats;
+    sink.getStats(sinkStats);
+    Rhd2000LoopbackVerifierUsb3::VerifierStats stats;
+    verifier.getStats(stats);
+    printVerifierStats(verifier);
+    cout << "  " << stats.numBlocksLost << " blocks (" << stats.numBytesLost << " bytes) lost, " <<
+            stats.numExtraBytes << " extra bytes, sink lost " << sinkStats.numBytesLost << " bytes" << endl;
+
+    // The failed transfer carries blocks 0-3 and the first 92 bytes of block 4.
+    unsigned int numLostBlocks = transferBytes / blockBytes + 1;
+    return stats.numBlocksLost == numLostBlocks && stats.numBytesLost == transferBytes &&
+            sinkStats.numBytesLost == transferBytes && stats.numBlocksVerified == numBlocks - numLostBlocks &&
+            stats.numBlocksMismatched == 0 && stats.numBlocksPending == 0 && stats.numExtraBytes == 0;
+}
+
+static int runLoopbackTest(int argc, char* argv[])
+{
+    int numStreams = (argc > 0) ? atoi(argv[0]) : MAX_NUM_DATA_STREAMS;
+    double duration = (argc > 1) ? atof(argv[1]) : 5.0;
+
+    if (numStreams < 1 || numStreams > MAX_NUM_DATA_STREAMS) {
+        cerr << "loopback: streams must be 1-" << MAX_NUM_DATA_STREAMS << endl;
+        return 1;
+    }
+
+    setenv("OK_SIM_DEVICES", "SIMRHD0001,SIMFPGA001:loopback", 1);
+    okFrontPanelSim_SetRealTime(false);
+
+    cout << endl << "Loopback verifier test: " << numStreams * CHANNELS_PER_STREAM << " channels, " <<
+            numStreams * CHANNELS_PER_STREAM * SAMPLES_PER_DATA_BLOCK * 2 << " bytes per block, free-running, " <<
+            duration << " s (30 kS/s needs " << numStreams * CHANNELS_PER_STREAM * 30000 * 2 / 1.0e6 << " MB/s)" << endl;
+
+    Rhd2000EvalBoardUsb3* evalBoard = openSimBoard(numStreams, Rhd2000EvalBoardUsb3::SampleRate30000Hz);
+    if (!evalBoard) return 1;
+    evalBoard->setSampleFormat(Rhd2000DataBlockUsb3::UInt16Samples);
+
+    Rhd2000LoopbackVerifierUsb3::VerifierStats identityStats, wrongStats;
+    cout << "Identity reference model:" << endl;
+    bool passesRan = runLoopbackPass(evalBoard, duration, Rhd2000LoopbackVerifierUsb3::identityModel, identityStats);
+    if (passesRan) {
+        cout << "Reference model adding 1 to every word (every word should mismatch):" << endl;
+        passesRan = runLoopbackPass(evalBoard, 1.0, incrementWordsModel, wrongStats);
+    }
+    delete evalBoard;
+    if (!passesRan) return 1;
+
+    cout << "Odd-sized blocks, first pipe write failed:" << endl;
+    bool lossOk = runLoopbackLossPass();
+
+    bool identityOk = identityStats.numBlocksVerified == identityStats.numBlocksSent &&
+            identityStats.numBlocksMismatched == 0 && identityStats.numBlocksVerified > 0;
+    bool wrongOk = wrongStats.numBlocksMismatched == wrongStats.numBlocksVerified &&
+            wrongStats.numWordsMismatched == wrongStats.numBytesVerified / 2 && wrongStats.firstMismatchedBlock == 0;
+    cout << (identityOk ? "Loopback output matches the identity model." : "Loopback output does NOT match!") << endl;
+    cout << (wrongOk ? "Every word of the wrong model was flagged." : "Verifier MISSED mismatched words!") << endl;
+    cout << (lossOk ? "The failed transfer's blocks were retired as lost; the rest verified." :
+                      "Verifier did NOT resync after the failed transfer!") << endl;
+    return (identityOk && wrongOk && lossOk) ? 0 : 1;
+}
+
+// Check a frame against the block it was encoded from, using only the header to work out which
+// words the payload should hold.
+static bool checkFrame(const unsigned char* frame, unsigned int frameBytes, const Rhd2000DataBlockUsb3 &dataBlock,
+                       unsigned long long expectedSequence)
+{
+    Rhd2000FrameHeader header;
+    if (!Rhd2000FrameEncoderUsb3::parseHeader(frame, frameBytes, header) || header.frameBytes != frameBytes ||
+            header.sequence != expectedSequence || header.firstTimestamp != dataBlock.timeStamp[0] ||
+            header.numSamples != SAMPLES_PER_DATA_BLOCK) {
+        return false;
+    }
+
+    // Defined channel order: ascending channel, then ascending hardware stream
+    vector<pair<int, int> > channels;
+    for (int channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
+        int blockStream = 0;
+        for (int stream = 0; stream < MAX_NUM_DATA_STREAMS; ++stream) {
+            if (!(header.streamMask & (1u << stream))) continue;
+            if (header.channelMasks[stream] & (1u << channel)) {
+                channels.push_back(make_pair(blockStream, channel));
+            }
+            blockStream++;
+        }
+    }
+    if (channels.size() != header.numChannels) return false;
+
+    const unsigned short* payload = (const unsigned short*) (frame + header.headerBytes);
+    for (unsigned int i = 0; i < channels.size(); ++i) {
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            unsigned int index = (header.payloadLayout == Rhd2000FrameEncoderUsb3::PayloadChannelMajor) ?
+                        i * SAMPLES_PER_DATA_BLOCK + t : t * header.numChannels + i;
+            if (payload[index] != (unsigned short) dataBlock.amplifierSample(channels[i].first, channels[i].second, t)) {
+                return false;
+            }
+        }
+    }
+    for (unsigned int i = header.headerBytes + header.payloadBytes; i < frameBytes; ++i) {
+        if (frame[i] != 0) return false;
+    }
+    return true;
+}
+
+static int runFrameEncoderTest(int argc, char* argv[])
+{
+    int numDataStreams = (argc > 0) ? atoi(argv[0]) : MAX_NUM_DATA_STREAMS;
+    double duration = (argc > 1) ? atof(argv[1]) : 0.25;
+    const int numBlocks = 16;
+
+    if (numDataStreams < 1 || numDataStreams > MAX_NUM_DATA_STREAMS) {
+        cerr << "frames: streams must be 1-" << MAX_NUM_DATA_STREAMS << endl;
+        return 1;
+    }
+
+    // Enable the even hardware streams first, then the odd ones, so the mask has gaps.
+    unsigned int streamMask = 0;
+    for (int k = 0; k < numDataStreams; ++k) {
+        streamMask |= 1u << ((k < 16) ? 2 * k : 2 * (k - 16) + 1);
+    }
+    unsigned int sparseMasks[MAX_NUM_DATA_STREAMS] = { 0 };
+    for (int stream = 0; stream < MAX_NUM_DATA_STREAMS; ++stream) {
+        if (streamMask & (1u << stream)) {
+            sparseMasks[stream] = (stream % 3 == 0) ? 0x80000001u : 0x0000ff0fu;
+        }
+    }
+
+    vector<unsigned char> buffer;
+    makeSyntheticUsbBlocks(buffer, numDataStreams, numBlocks);
+
+    cout << endl << "Frame encoder test: " << numDataStreams << " streams (mask 0x" << hex << streamMask << dec <<
+            ")" << endl;
+
+    bool allMatch = true;
+    for (int layout = Rhd2000DataBlockUsb3::TimeMajor; layout <= Rhd2000DataBlockUsb3::ChannelMajor; ++layout) {
+        for (int format = Rhd2000DataBlockUsb3::Int32Samples; format <= Rhd2000DataBlockUsb3::UInt16Samples; ++format) {
+            vector<Rhd2000DataBlockUsb3> blocks;
+            for (int j = 0; j < numBlocks; ++j) {
+                blocks.emplace_back(numDataStreams, (Rhd2000DataBlockUsb3::AmplifierLayout) layout,
+                                    (Rhd2000DataBlockUsb3::SampleFormat) format);
+                blocks.back().fillFromUsbBuffer(&buffer[0], j, numDataStreams);
+            }
+
+            for (int sparse = 0; sparse < 2; ++sparse) {
+                for (int payloadLayout = Rhd2000FrameEncoderUsb3::PayloadTimeMajor;
+                     payloadLayout <= Rhd2000FrameEncoderUsb3::PayloadChannelMajor; ++payloadLayout) {
+                    Rhd2000FrameEncoderUsb3 encoder;
+                    if (sparse) {
+                        encoder.selectChannels(streamMask, sparseMasks);
+                    } else {
+                        encoder.selectAllChannels(streamMask);
+                    }
+                    encoder.setPayloadLayout((Rhd2000FrameEncoderUsb3::PayloadLayout) payloadLayout);
+
+                    bool match = true;
+                    for (int j = 0; j < numBlocks; ++j) {
+                        unsigned int frameBytes = encoder.encode(blocks[j]);
+                        if (!checkFrame(encoder.getFrame(), frameBytes, blocks[j], j)) match = false;
+                    }
+                    allMatch = allMatch && match;
+
+                    unsigned long long numFrames = 0;
+                    BenchClock::time_point start = BenchClock::now();
+                    do {
+                        for (int j = 0; j < numBlocks; ++j) {
+                            encoder.encode(blocks[j]);
+                        }
+                        numFrames += numBlocks;
+                    } while (secondsSince(start) < duration);
+                    double usPerFrame = 1.0e6 * secondsSince(start) / numFrames;
+                    benchmarkSink = encoder.getFrame()[FRAME_HEADER_BYTES];
+
+                    cout << "  " << (layout == Rhd2000DataBlockUsb3::TimeMajor ? "TimeMajor   " : "ChannelMajor") <<
+                            (format == Rhd2000DataBlockUsb3::UInt16Samples ? " 16-bit" : " 32-bit") <<
+                            (sparse ? "  sparse " : "  all    ") << setw(4) << encoder.getNumChannels() << " ch -> " <<
+                            (payloadLayout == Rhd2000FrameEncoderUsb3::PayloadTimeMajor ? "[t][ch]" : "[ch][t]") <<
+                            "  " << setw(7) << encoder.getFrameBytes() << " bytes  " << fixed << setprecision(2) <<
+                            setw(7) << usPerFrame << " us/frame  " << (match ? "ok" : "MISMATCH") << endl;
+                    cout.unsetf(ios::fixed);
+                }
+            }
+        }
+    }
+
+    cout << (allMatch ? "Every frame decodes to the selected channels of its block." : "Frame contents do NOT match!") << endl;
+    return allMatch ? 0 : 1;
+}
+
+// Search buffer for a frame header with the current decode path for about duration seconds;
+// returns GB/s searched.
+static double timeMagicNumberSearch(const vector<unsigned char> &buffer, double duration)
+{
+    unsigned long long passes = 0;
+    long long checksum = 0;
+
+    BenchClock::time_point start = BenchClock::now();
+    do {
+        checksum += Rhd2000DecoderUsb3::findMagicNumber(&buffer[0], (int) buffer.size());
+        ++passes;
+    } while (secondsSince(start) < duration);
+    double elapsed = secondsSince(start);
+
+    benchmarkSink = checksum;
+    return passes * buffer.size() / elapsed / 1.0e9;
+}
+
+// Lose bytes inside frames 5 and 10 of the first transfer after run().  The first glitch leaves
+// less than a frame between the realigned and raw positions, so the header search after the
+// second starts in bytes the compaction would already have overwritten.  Only the two damaged
+// frames may be lost, with one resync each.
+static bool runTwoGlitchTransfer(Rhd2000EvalBoardUsb3* evalBoard, int numStreams)
+{
+    unsigned int frameBytes = 2 * Rhd2000DataBlockUsb3::calculateDataBlockSizeInWords(numStreams) /
+            SAMPLES_PER_DATA_BLOCK;
+    unsigned int firstBytes = frameBytes - ((frameBytes / 4) & ~1U);
+    unsigned int secondBytes = (3 * frameBytes / 8) & ~1U;
+    vector<pair<unsigned int, unsigned int> > glitches;
+    glitches.push_back(make_pair(5 * frameBytes + 12, firstBytes));
+    glitches.push_back(make_pair(10 * frameBytes + 12 - firstBytes, secondBytes));
+
+    evalBoard->setContinuousRunMode(true);
+    evalBoard->run();
+    evalBoard->resetUsbReadStats();
+    bool injected = okFrontPanelSim_InjectDataGlitches("SIMRHD0001", glitches);
+
+    vector<unsigned int> timeStamps;
+    queue<Rhd2000DataBlockUsb3> dataQueue;
+    for (int read = 0; read < 8 && timeStamps.size() < 2 * SAMPLES_PER_DATA_BLOCK; ++read) {
+        evalBoard->readDataBlocks(2, dataQueue);
+        while (!dataQueue.empty()) {
+            for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) timeStamps.push_back(dataQueue.front().timeStamp[t]);
+            dataQueue.pop();
+        }
+    }
+
+    evalBoard->setContinuousRunMode(false);
+    evalBoard->setMaxTimeStep(0);
+    evalBoard->flush();
+
+    Rhd2000EvalBoardUsb3::UsbReadStats usbStats;
+    evalBoard->getUsbReadStats(usbStats);
+
+    bool ok = injected && timeStamps.size() >= 2 * SAMPLES_PER_DATA_BLOCK && usbStats.numResyncs == 2;
+    unsigned int expected = 0;
+    for (size_t i = 0; i < timeStamps.size() && ok; ++i, ++expected) {
+        if (expected == 5 || expected == 10) ++expected;
+        ok = timeStamps[i] == expected;
+    }
+    cout << "Two glitches in one transfer: " << usbStats.numResyncs << " resyncs, " <<
+            (ok ? "only the two damaged frames lost -- ok" : "WRONG FRAMES KEPT!") << endl;
+    return ok;
+}
+
+static int runResyncTest(int argc, char* argv[])
+{
+    int numStreams = (argc > 0) ? atoi(argv[0]) : 8;
+    double duration = (argc > 1) ? atof(argv[1]) : 5.0;
+
+    if (numStreams < 1 || numStreams > MAX_NUM_DATA_STREAMS) {
+        cerr << "resync: streams must be 1-" << MAX_NUM_DATA_STREAMS << endl;
+        return 1;
+    }
+
+    // Header search over pseudo-random words, first with a header planted at a few even offsets
+    // (and one odd offset, which must be ignored), then timed over a buffer with none.
+    vector<unsigned char> buffer(1 << 20);
+    unsigned int seed = 12345;
+    for (size_t i = 0; i < buffer.size(); ++i) {
+        seed = seed * 1103515245 + 12345;
+        buffer[i] = (unsigned char) (seed >> 16);
+    }
+    const int plantOffsets[] = { 0, 2, 14, 30, 46, 62, 4094, (int) buffer.size() - 8 };
+    unsigned char magic[8];
+    for (int i = 0; i < 8; ++i) magic[i] = (unsigned char) (RHD2000_HEADER_MAGIC_NUMBER >> (8 * i));
+
+    Rhd2000DecoderUsb3::DecodePath bestPath = Rhd2000DecoderUsb3::detectBestPath();
+    bool searchOk = true;
+    cout << endl << "Frame header search (GB/s):";
+    for (int path = Rhd2000DecoderUsb3::DecodeScalar; path <= bestPath; ++path) {
+        Rhd2000DecoderUsb3::setPath((Rhd2000DecoderUsb3::DecodePath) path);
+        if (Rhd2000DecoderUsb3::findMagicNumber(&buffer[0], (int) buffer.size()) != -1) searchOk = false;
+
+        vector<unsigned char> planted(buffer);
+        memcpy(&planted[1001], magic, 8);
+        if (Rhd2000DecoderUsb3::findMagicNumber(&planted[0], (int) planted.size()) != -1) searchOk = false;
+        for (int offset : plantOffsets) {
+            planted = buffer;
+            memcpy(&planted[offset], magic, 8);
+            if (Rhd2000DecoderUsb3::findMagicNumber(&planted[0], (int) planted.size()) != offset) searchOk = false;
+        }
+
+        cout << "  " << Rhd2000DecoderUsb3::pathName((Rhd2000DecoderUsb3::DecodePath) path) << " " <<
+                fixed << setprecision(2) << timeMagicNumberSearch(buffer, 0.3);
+    }
+    cout.unsetf(ios::fixed);
+    cout << endl;
+    Rhd2000DecoderUsb3::setPath(bestPath);
+
+    okFrontPanelSim_SetRealTime(false);
+    Rhd2000EvalBoardUsb3* evalBoard = openSimBoard(numStreams, Rhd2000EvalBoardUsb3::SampleRate30000Hz);
+    if (!evalBoard) return 1;
+
+    bool twoGlitchOk = runTwoGlitchTransfer(evalBoard, numStreams);
+    okFrontPanelSim_SetRealTime(true);
+
+    // Glitch sizes are even, as on the real link, and never a whole number of frames.
+    unsigned int frameBytes = 2 * Rhd2000DataBlockUsb3::calculateDataBlockSizeInWords(numStreams) /
+            SAMPLES_PER_DATA_BLOCK;
+    const unsigned int glitchSizes[] = { 2, 6, 130, 2 * frameBytes + 4 };
+    const int numGlitchSizes = sizeof(glitchSizes) / sizeof(glitchSizes[0]);
+
+    cout << endl << "Resync test: " << numStreams << " streams x " << evalBoard->getSampleRate() << " S/s, " <<
+            duration << " s, one glitch every 0.5 s (" << frameBytes << "-byte frames)" << endl;
+
+    unsigned long long numBlocks = 0, numFlagged = 0, numUnflaggedGaps = 0, numGlitches = 0;
+    unsigned long long glitchBytes = 0;
+    unsigned int expectedTimeStamp = 0;
+
+    evalBoard->setContinuousRunMode(true);
+    evalBoard->run();
+    evalBoard->resetUsbReadStats();
+    evalBoard->startReaderThread();
+    Rhd2000DataBlockRingUsb3* dataBlockRing = evalBoard->getDataBlockRing();
+
+    // Stop glitching a second before the end so the last one is read before the counts are taken.
+    BenchClock::time_point start = BenchClock::now();
+    BenchClock::time_point lastGlitch = start;
+    while (secondsSince(start) < duration) {
+        if (secondsSince(lastGlitch) >= 0.5 && secondsSince(start) < duration - 1.0) {
+            unsigned int size = glitchSizes[numGlitches % numGlitchSizes];
+            if (okFrontPanelSim_InjectDataGlitch("SIMRHD0001", size)) {
+                numGlitches++;
+                glitchBytes += size;
+            }
+            lastGlitch = BenchClock::now();
+        }
+
+        Rhd2000DataBlockUsb3* dataBlock = dataBlockRing->front();
+        if (!dataBlock) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
+        }
+        bool flagged = dataBlock->getSyncFlags() != 0;
+        if (flagged) {
+            ++numFlagged;
+        } else if (numBlocks > 0 && dataBlock->timeStamp[0] != expectedTimeStamp) {
+            ++numUnflaggedGaps;
+        }
+        expectedTimeStamp = dataBlock->timeStamp[SAMPLES_PER_DATA_BLOCK - 1] + 1;
+        dataBlockRing->pop();
+        ++numBlocks;
+    }
+    double elapsed = secondsSince(start);
+
+    evalBoard->stopReaderThread();
+    evalBoard->setContinuousRunMode(false);
+    evalBoard->setMaxTimeStep(0);
+    evalBoard->flush();
+
+    Rhd2000EvalBoardUsb3::UsbReadStats usbStats;
+    evalBoard->getUsbReadStats(usbStats);
+    okTSimDeviceStats stats;
+    okFrontPanelSim_GetDeviceStats("SIMRHD0001", stats);
+
+    double expectedBlocks = elapsed * evalBoard->getSampleRate() / SAMPLES_PER_DATA_BLOCK;
+    cout << "Blocks consumed:        " << numBlocks << " (" << fixed << setprecision(1) <<
+            100.0 * numBlocks / expectedBlocks << "% of the real-time rate)" << endl;
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6);
+    cout << "Glitches injected:      " << numGlitches << " (" << glitchBytes << " bytes, " <<
+            stats.glitchBytesDropped << " dropped by the board)" << endl;
+    printUsbReadStats(evalBoard);
+    cout << "Per glitch:             " << (double) usbStats.numFramesLost / (numGlitches ? numGlitches : 1) <<
+            " frames lost, " << (double) usbStats.numBytesSkipped / (numGlitches ? numGlitches : 1) <<
+            " bytes skipped" << endl;
+    cout << "Time stamp gaps:        " << usbStats.numTimeStampGaps << " flagged, " << numUnflaggedGaps <<
+            " unflagged" << endl;
+    cout << "Frames lost to overflow: " << stats.framesDropped << endl;
+
+    bool ok = searchOk && twoGlitchOk && numGlitches > 0 && usbStats.numResyncs == numGlitches &&
+            usbStats.numFramesLost >= numGlitches &&
+            usbStats.numFramesLost <= glitchBytes / frameBytes + 2 * numGlitches && numUnflaggedGaps == 0 && numFlagged >= numGlitches &&
+            numBlocks > 0.9 * expectedBlocks && stats.framesDropped == 0;
+    if (!searchOk) cout << "MISMATCH between a header search path and the expected offsets!" << endl;
+    cout << (ok ? "Every glitch was recovered with one resync." : "RESYNC CHECK FAILED!") << endl;
+
+    delete evalBoard;
+    return ok ? 0 : 1;
+}
+
+// Give dataBlock the time stamps first, first + 1, ...
+static void setTimeStamps(Rhd2000DataBlockUsb3 &dataBlock, unsigned int first)
+{
+    for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        dataBlock.timeStamp[t] = first + t;
+    }
+}
+
+// Read a saved file frame by frame, counting frames and breaks in the 16-bit time stamps, and the fill
+// frames listed in its fill index.  A partial frame at the end, a missing index, or an indexed frame that
+// is not FILL_FRAME_WORD throughout but for the time stamp counts as a break.
+static unsigned int checkFilledFile(const char* fileName, int numDataStreams, unsigned long long &numFrames,
+                                    unsigned long long &numFillFrames)
+{
+    unsigned int frameBytes = Rhd2000DataBlockUsb3::getSerializedFrameSizeInBytes(numDataStreams);
+    ifstream saved(fileName, ios::binary);
+    vector<unsigned char> frame(frameBytes);
+    unsigned int lastTimeStamp = 0, numBreaks = 0;
+
+    vector<Rhd2000DataBlockUsb3::FillRun> fillRuns;
+    if (!Rhd2000DataBlockUsb3::readFillIndex(string(fileName) + FILL_INDEX_SUFFIX, fillRuns)) ++numBreaks;
+    unsigned int run = 0;
+
+    numFrames = 0;
+    numFillFrames = 0;
+    while (saved.read((char*) frame.data(), frameBytes)) {
+        unsigned int timeStamp = frame[0] | (frame[1] << 8);
+        if (numFrames > 0 && timeStamp != ((lastTimeStamp + 1) & 0xffff)) ++numBreaks;
+        lastTimeStamp = timeStamp;
+
+        while (run < fillRuns.size() && fillRuns[run].firstFrame + fillRuns[run].numFrames <= numFrames) ++run;
+        if (run < fillRuns.size() && fillRuns[run].firstFrame <= numFrames) {
+            unsigned int i = 2;
+            while (i < frameBytes && (frame[i] | (frame[i + 1] << 8)) == FILL_FRAME_WORD) i += 2;
+            if (i == frameBytes) {
+                ++numFillFrames;
+            } else {
+                ++numBreaks;
+            }
+        }
+        ++numFrames;
+    }
+    return numBreaks + (saved.gcount() != 0 ? 1 : 0);
+}
+
+static int runTimeStampTest(int argc, char* argv[])
+{
+    int numStreams = (argc > 0) ? atoi(argv[0]) : 8;
+    double duration = (argc > 1) ? atof(argv[1]) : 5.0;
+
+    if (numStreams < 1 || numStreams > MAX_NUM_DATA_STREAMS) {
+        cerr << "timestamps: streams must be 1-" << MAX_NUM_DATA_STREAMS << endl;
+        return 1;
+    }
+    if (duration < 2.0) {
+        cerr << "timestamps: the live run needs at least 2 seconds" << endl;
+        return 1;
+    }
+    bool ok = true;
+
+    // Monitor: a script of blocks with known faults.  Each entry gives whether to restart() first,
+    // the first time stamp, a sample from which on shift is added to the time stamps (or -1), and
+    // the flags and dropped count expected.
+    struct ScriptBlock {
+        bool restart;
+        unsigned int first;
+        int sample;
+        int shift;
+        unsigned int flags;
+        unsigned int dropped;
+    };
+    const unsigned int gap = Rhd2000DataBlockUsb3::SyncTimeStampGap;
+    const unsigned int repeat = Rhd2000DataBlockUsb3::SyncTimeStampRepeat;
+    const ScriptBlock script[] = {
+        { false, 1000, -1, 0, 0, 0 },
+        { false, 1128, -1, 0, 0, 0 },
+        { false, 1256, 40, 5, gap, 5 },             // 5 lost before sample 40
+        { false, 1389, 10, -1, repeat, 0 },         // sample 9 delivered twice
+        { false, 1816, -1, 0, gap, 300 },           // 300 lost between blocks
+        { true, 0xffffff00u, -1, 0, 0, 0 },         // restarted close to the end of the count
+        { false, 0xffffff80u, -1, 0, 0, 0 },        // ends on 0xffffffff
+        { false, 0, -1, 0, 0, 0 },                  // wraps at the block boundary
+        { false, 128, -1, 0, 0, 0 },
+        { false, 100, -1, 0, repeat, 0 },           // runs backwards by 156 samples
+        { true, 0xffffffc0u, -1, 0, 0, 0 },
+        { false, 0x40, -1, 0, 0, 0 }                // wraps within the block
+    };
+    const int numScript = sizeof(script) / sizeof(script[0]);
+
+    Rhd2000TimeStampMonitorUsb3 monitor;
+    Rhd2000DataBlockUsb3 dataBlock(numStreams);
+    bool annotationsOk = true;
+    for (int i = 0; i < numScript; ++i) {
+        if (script[i].restart) {
+            monitor.restart();
+        }
+        setTimeStamps(dataBlock, script[i].first);
+        for (int t = script[i].sample; t >= 0 && t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            dataBlock.timeStamp[t] += script[i].shift;
+        }
+        dataBlock.setSyncFlags(0);
+        unsigned int flags = monitor.checkBlock(dataBlock);
+        if (flags != script[i].flags || dataBlock.getSyncFlags() != script[i].flags ||
+                dataBlock.getNumSamplesDropped() != script[i].dropped) {
+            cout << "  block " << i << ": flags " << flags << " dropped " << dataBlock.getNumSamplesDropped() <<
+                    ", expected flags " << script[i].flags << " dropped " << script[i].dropped << endl;
+            annotationsOk = false;
+        }
+    }
+    Rhd2000TimeStampMonitorUsb3::MonitorStats stats;
+    monitor.getStats(stats);
+    bool totalsOk = stats.numBlocks == (unsigned long long) numScript && stats.numGaps == 2 &&
+            stats.numSamplesDropped == 5 + 300 && stats.numRepeats == 2 && stats.numSamplesRepeated == 1 + 156 &&
+            stats.numWraps == 2 && stats.numRestarts == 2 &&
+            stats.lastSampleIndex == (2ull << 32) + 0x40 + SAMPLES_PER_DATA_BLOCK - 1;
+    cout << endl << "Time stamp monitor: " << stats.numGaps << " gaps (" << stats.numSamplesDropped <<
+            " samples), " << stats.numRepeats << " repeats (" << stats.numSamplesRepeated << " samples), " <<
+            stats.numWraps << " wraps -- " << (annotationsOk && totalsOk ? "as expected" : "WRONG") << endl;
+    ok = ok && annotationsOk && totalsOk;
+
+    // Cost of the check on a block that follows on, against the real-time block period.
+    monitor.reset();
+    const int numTimed = 2000000;
+    BenchClock::time_point start = BenchClock::now();
+    for (int i = 0; i < numTimed; ++i) {
+        setTimeStamps(dataBlock, (unsigned int) i * SAMPLES_PER_DATA_BLOCK);
+        monitor.checkBlock(dataBlock);
+    }
+    double nsPerBlock = secondsSince(start) * 1.0e9 / numTimed;
+    cout << "Check per block:        " << fixed << setprecision(1) << nsPerBlock << " ns including setup (" <<
+            setprecision(5) << 100.0 * nsPerBlock / (1.0e9 * SAMPLES_PER_DATA_BLOCK / 30000.0) <<
+            "% of a block period at 30 kS/s)" << endl;
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6);
+
+    // Writers: blocks with gaps between and within them, plus one jump too long to fill.  Some blocks
+    // hold saturated samples, every word 0xffff like a fill frame, which must not count as fill.
+    const unsigned int maxFill = 1000;
+    const char* fileName = "timestamps_test.dat";
+    const string fillIndexName = string(fileName) + FILL_INDEX_SUFFIX;
+    vector<unsigned char> usbBuffer, saturatedUsbBuffer;
+    makeSyntheticUsbBlocks(usbBuffer, numStreams, 1);
+    saturatedUsbBuffer = usbBuffer;
+    unsigned int usbFrameBytes = 2 * Rhd2000DataBlockUsb3::calculateDataBlockSizeInWords(numStreams) / SAMPLES_PER_DATA_BLOCK;
+    for (unsigned int offset = 0; offset < saturatedUsbBuffer.size(); offset += usbFrameBytes) {
+        memset(&saturatedUsbBuffer[offset + 12], 0xff, usbFrameBytes - 12);
+    }
+    vector<Rhd2000DataBlockUsb3> blocks;
+    unsigned int first = 500, expectedFill = 0;
+    for (int i = 0; i < 40; ++i) {
+        blocks.emplace_back(numStreams, (i % 2) ? Rhd2000DataBlockUsb3::ChannelMajor : Rhd2000DataBlockUsb3::TimeMajor,
+                            (i % 3) ? Rhd2000DataBlockUsb3::Int32Samples : Rhd2000DataBlockUsb3::UInt16Samples);
+        Rhd2000DataBlockUsb3 &block = blocks.back();
+        block.fillFromUsbBuffer((i % 6 == 4) ? &saturatedUsbBuffer[0] : &usbBuffer[0], 0, numStreams);
+        if (i == 20) {
+            first += 100000;                // not filled: the file breaks here
+        } else if (i % 5 == 4) {
+            first += 7 * i;
+            expectedFill += 7 * i;
+        }
+        setTimeStamps(block, first);
+        if (i % 7 == 3) {
+            for (int t = 64; t < SAMPLES_PER_DATA_BLOCK; ++t) block.timeStamp[t] += 3;
+            expectedFill += 3;
+        }
+        first = block.timeStamp[SAMPLES_PER_DATA_BLOCK - 1] + 1;
+    }
+
+    ofstream saveOut(fileName, ios::binary | ios::out);
+    Rhd2000DataFileWriterUsb3 dataFileWriter(saveOut, 65536);
+    dataFileWriter.setGapFill(maxFill);
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass == 0) {
+            for (const Rhd2000DataBlockUsb3 &block : blocks) dataFileWriter.writeBlock(block, numStreams);
+            dataFileWriter.flush();
+            saveOut.close();
+            Rhd2000DataBlockUsb3::writeFillIndex(fillIndexName, dataFileWriter.getFillRuns());
+        } else {
+            Rhd2000AsyncFileWriterUsb3 fileWriter(1048576, 4);
+            fileWriter.open(fileName);
+            fileWriter.setGapFill(maxFill);
+            for (const Rhd2000DataBlockUsb3 &block : blocks) {
+                while (!fileWriter.writeBlock(block, numStreams)) this_thread::sleep_for(chrono::milliseconds(1));
+            }
+            fileWriter.close();
+        }
+
+        unsigned long long numFrames, numFillFrames;
+        unsigned int numBreaks = checkFilledFile(fileName, numStreams, numFrames, numFillFrames);
+        unsigned long long expectedFrames = blocks.size() * SAMPLES_PER_DATA_BLOCK + expectedFill;
+        bool passOk = numBreaks == 1 && numFrames == expectedFrames && numFillFrames == expectedFill;
+        cout << (pass == 0 ? "Rhd2000DataFileWriterUsb3" : "Rhd2000AsyncFileWriterUsb3") << " gap fill: " <<
+                numFrames << " frames, " << numFillFrames << " fill, " << numBreaks << " break (expected " <<
+                expectedFrames << ", " << expectedFill << ", 1) -- " << (passOk ? "ok" : "WRONG") << endl;
+        ok = ok && passOk;
+    }
+    remove(fileName);
+    remove(fillIndexName.c_str());
+
+    // Live: the simulated board loses bytes now and then; the saved file must still be continuous.
+    okFrontPanelSim_SetRealTime(true);
+    Rhd2000EvalBoardUsb3* evalBoard = openSimBoard(numStreams, Rhd2000EvalBoardUsb3::SampleRate30000Hz);
+    if (!evalBoard) return 1;
+    cout << endl << "Live: " << numStreams << " streams x " << evalBoard->getSampleRate() << " S/s, " << duration <<
+            " s, bytes lost every 0.5 s, saved with gap fill" << endl;
+
+    Rhd2000AsyncFileWriterUsb3 fileWriter;
+    fileWriter.open(fileName);
+    fileWriter.setGapFill(30000);
+    evalBoard->getTimeStampMonitor().reset();
+
+    unsigned long long numBlocks = 0, blockDropped = 0;
+    unsigned int numGlitches = 0;
+    evalBoard->setContinuousRunMode(true);
+    evalBoard->run();
+    evalBoard->startReaderThread();
+    Rhd2000DataBlockRingUsb3* dataBlockRing = evalBoard->getDataBlockRing();
+
+    start = BenchClock::now();
+    BenchClock::time_point lastGlitch = start;
+    while (secondsSince(start) < duration) {
+        if (secondsSince(lastGlitch) >= 0.5 && secondsSince(start) < duration - 1.0) {
+            if (okFrontPanelSim_InjectDataGlitch("SIMRHD0001", 2 + 2 * (numGlitches % 200))) numGlitches++;
+            lastGlitch = BenchClock::now();
+        }
+        Rhd2000DataBlockUsb3* block = dataBlockRing->front();
+        if (!block) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
+        }
+        blockDropped += block->getNumSamplesDropped();
+        fileWriter.writeBlock(*block, numStreams);
+        dataBlockRing->pop();
+        ++numBlocks;
+    }
+
+    evalBoard->stopReaderThread();
+    evalBoard->setContinuousRunMode(false);
+    evalBoard->setMaxTimeStep(0);
+    evalBoard->flush();
+    fileWriter.close();
+
+    evalBoard->getTimeStampMonitor().getStats(stats);
+    Rhd2000AsyncFileWriterUsb3::WriterStats writerStats;
+    fileWriter.getStats(writerStats);
+    unsigned long long numFrames, numFillFrames;
+    bool continuous = checkFilledFile(fileName, numStreams, numFrames, numFillFrames) == 0;
+    remove(fileName);
+    remove(fillIndexName.c_str());
+
+    cout << "Blocks:                 " << numBlocks << " (" << numGlitches << " glitches)" << endl;
+    cout << "Monitor:                " << stats.numGaps << " gaps, " << stats.numSamplesDropped << " samples dropped (" <<
+            blockDropped << " in block annotations), " << stats.numRepeats << " repeats" << endl;
+    cout << "Saved file:             " << numFrames << " frames, " << numFillFrames << " fill (" <<
+            writerStats.numFillFrames << " reported), " << (continuous ? "continuous" : "NOT CONTINUOUS") << endl;
+
+    bool liveOk = continuous && numGlitches > 0 && stats.numGaps > 0 && stats.numSamplesDropped == blockDropped &&
+            numFillFrames == stats.numSamplesDropped && writerStats.numFillFrames == numFillFrames &&
+            numFrames == numBlocks * SAMPLES_PER_DATA_BLOCK + numFillFrames && stats.numRepeats == 0;
+    ok = ok && liveOk;
+    cout << (ok ? "Time stamp accounting and gap fill check out." : "TIME STAMP CHECK FAILED!") << endl;
+
+    delete evalBoard;
+    return ok ? 0 : 1;
+}
+
+// True if the simulated board's command RAM bank starts with commandList.
+static bool commandRamHolds(int slot, int bank, const vector<int> &commandList)
+{
+    vector<int> words;
+    return okFrontPanelSim_GetCommandRam("SIMRHD0001", slot, bank, words) &&
+            equal(commandList.begin(), commandList.end(), words.begin());
+}
+
+// Upload the command lists of an impedance sweep, as the impedance check of the Intan GUI does.
+// With uncached set, the command RAM cache is forgotten before every upload, so every command is
+// sent as the original uploadCommandList() did.  Returns false if the command RAM does not end up
+// holding the last list uploaded to each bank.
+static bool uploadImpedanceSweep(Rhd2000EvalBoardUsb3* evalBoard, int numFrequencies, bool uncached)
+{
+    static const double frequencies[] = { 1000.0, 100.0, 300.0, 3000.0, 30.0, 7500.0, 50.0 };
+    Rhd2000RegistersUsb3 chipRegisters(evalBoard->getSampleRate());
+    vector<int> dacList, configList;
+
+    chipRegisters.enableZcheck(true);
+    for (int f = 0; f < numFrequencies; ++f) {
+        chipRegisters.createCommandListZcheckDac(dacList, frequencies[f], 128.0);
+        if (uncached) evalBoard->invalidateCommandRamCache();
+        evalBoard->uploadCommandList(dacList, Rhd2000EvalBoardUsb3::AuxCmd1, 1);
+
+        for (int scale = 0; scale < 3; ++scale) {
+            chipRegisters.setZcheckScale((Rhd2000RegistersUsb3::ZcheckCs) scale);
+            for (int channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
+                chipRegisters.setZcheckChannel(channel);
+                chipRegisters.createCommandListRegisterConfig(configList, false);
+                if (uncached) evalBoard->invalidateCommandRamCache();
+                evalBoard->uploadCommandList(configList, Rhd2000EvalBoardUsb3::AuxCmd3, 3);
+            }
+        }
+    }
+    return commandRamHolds(1, 1, dacList) && commandRamHolds(3, 3, configList);
+}
+
+static int runCommandUploadTest(int argc, char* argv[])
+{
+    int numFrequencies = (argc > 0) ? atoi(argv[0]) : 3;
+    int controlUs = (argc > 1) ? atoi(argv[1]) : 100;
+
+    if (numFrequencies < 1 || numFrequencies > 7 || controlUs < 0) {
+        cerr << "cmdupload: frequencies must be 1-7 and controlUs at least 0" << endl;
+        return 1;
+    }
+
+    Rhd2000EvalBoardUsb3* evalBoard = openSimBoard(1, Rhd2000EvalBoardUsb3::SampleRate30000Hz);
+    if (!evalBoard) return 1;
+    bool ok = true;
+
+    cout << endl << "Impedance sweep: " << numFrequencies << " frequencies x 3 scales x " << CHANNELS_PER_STREAM <<
+            " channels, " << controlUs << " us per control transfer" << endl;
+    cout << "  Upload                     Time (s)  Uploads  Skipped  Words sent  Transactions  Last AuxCmd1/3 (ms)" << endl;
+    okFrontPanelSim_SetControlTransferTime(controlUs);
+
+    const char* passNames[] = { "Word by word (original)", "Cached, wire-ins", "Cached, pipe" };
+    for (int pass = 0; pass < 3; ++pass) {
+        evalBoard->invalidateCommandRamCache();
+        evalBoard->setCommandRamPipe(pass == 2);
+        evalBoard->resetCommandUploadStats();
+
+        BenchClock::time_point start = BenchClock::now();
+        bool held = uploadImpedanceSweep(evalBoard, numFrequencies, pass == 0);
+        double seconds = secondsSince(start);
+
+        Rhd2000EvalBoardUsb3::CommandUploadStats stats;
+        evalBoard->getCommandUploadStats(stats);
+        cout << "  " << left << setw(25) << passNames[pass] << right << fixed << setprecision(3) << setw(10) <<
+                seconds << setw(9) << stats.numUploads << setw(9) << stats.numUploadsSkipped << setw(12) <<
+                stats.numWordsWritten << setw(14) << stats.numTransactions << setprecision(2) << setw(11) <<
+                stats.bankMs[0][1] << " / " << stats.bankMs[2][3] << (held ? "" : "  COMMAND RAM WRONG") << endl;
+        cout.unsetf(ios::fixed);
+        cout << setprecision(6);
+        ok = ok && held;
+    }
+    okFrontPanelSim_SetControlTransferTime(0);
+
+    // Random lists of random lengths, each a few commands away from the last one sent to its bank
+    unsigned int seed = 12345;
+    vector<int> lists[3][4];
+    int numMismatched = 0;
+    for (int i = 0; i < 2000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        int slot = (seed >> 16) % 3;
+        int bank = (seed >> 20) % 4;
+        vector<int> &commandList = lists[slot][bank];
+        seed = seed * 1103515245 + 12345;
+        commandList.resize(1 + (seed >> 16) % COMMAND_RAM_WORDS);
+        for (int change = 0; change < 8; ++change) {
+            seed = seed * 1103515245 + 12345;
+            commandList[(seed >> 16) % commandList.size()] = (seed >> 4) & 0xffff;
+        }
+        evalBoard->setCommandRamPipe((i / 100) % 2 == 1);
+        evalBoard->uploadCommandList(commandList, (Rhd2000EvalBoardUsb3::AuxCmdSlot) slot, bank);
+        if (!commandRamHolds(slot + 1, bank, commandList)) numMismatched++;
+    }
+    cout << "Random lists:           2000 uploads, " << numMismatched << " left the command RAM wrong" << endl;
+    ok = ok && numMismatched == 0;
+
+    // Configuring the FPGA clears the command RAM, so an unchanged list must be sent in full again.
+    evalBoard->uploadFpgaBitfile("main.bit");
+    evalBoard->resetCommandUploadStats();
+    evalBoard->uploadCommandList(lists[0][0], Rhd2000EvalBoardUsb3::AuxCmd1, 0);
+    Rhd2000EvalBoardUsb3::CommandUploadStats stats;
+    evalBoard->getCommandUploadStats(stats);
+    bool reuploaded = stats.numWordsWritten == lists[0][0].size() && commandRamHolds(1, 0, lists[0][0]);
+    cout << "After reconfiguration:  " << stats.numWordsWritten << " of " << lists[0][0].size() <<
+            " commands sent -- " << (reuploaded ? "ok" : "WRONG") << endl;
+    ok = ok && reuploaded;
+
+    // So does resetting the board, which clears the command RAM too
+    evalBoard->uploadCommandList(lists[2][3], Rhd2000EvalBoardUsb3::AuxCmd3, 3);
+    evalBoard->resetBoard();
+    evalBoard->resetCommandUploadStats();
+    evalBoard->uploadCommandList(lists[2][3], Rhd2000EvalBoardUsb3::AuxCmd3, 3);
+    evalBoard->getCommandUploadStats(stats);
+    reuploaded = stats.numWordsWritten == lists[2][3].size() && commandRamHolds(3, 3, lists[2][3]);
+    cout << "After reset:            " << stats.numWordsWritten << " of " << lists[2][3].size() <<
+            " commands sent -- " << (reuploaded ? "ok" : "WRONG") << endl;
+    ok = ok && reuploaded;
+
+    cout << (ok ? "Command RAM uploads check out." : "COMMAND UPLOAD CHECK FAILED!") << endl;
+    delete evalBoard;
+    return ok ? 0 : 1;
+}
+
+struct StartCost {
+    unsigned long long numConfigurations;
+    unsigned long long numWireInUpdates;
+    unsigned long long numTriggerIns;
+    double seconds;
+    bool reused;
+};
+
+// Open the simulated board and bring it up as main_windows_dual.cpp does, with numStreams data
+// streams enabled, counting what startup costs on the USB link.  A null stateFile leaves the
+// board's default.
+static Rhd2000EvalBoardUsb3* startSimBoard(bool fastStart, const char* bitfile, const char* stateFile, int numStreams,
+                                           StartCost &cost)
+{
+    Rhd2000EvalBoardUsb3* evalBoard = new Rhd2000EvalBoardUsb3;
+    if (evalBoard->open() != 1) {
+        cerr << "Failed to open simulated board" << endl;
+        delete evalBoard;
+        return nullptr;
+    }
+    if (stateFile) {
+        evalBoard->setFpgaStateFile(stateFile);
+    }
+
+    okTSimDeviceStats before, after;
+    okFrontPanelSim_GetDeviceStats("SIMRHD0001", before);
+    BenchClock::time_point start = BenchClock::now();
+    bool configured = fastStart ? evalBoard->fastStartFpga(bitfile) : evalBoard->uploadFpgaBitfile(bitfile);
+    if (!configured) {
+        delete evalBoard;
+        return nullptr;
+    }
+    evalBoard->initialize();
+    for (int stream = 0; stream < MAX_NUM_DATA_STREAMS; ++stream) {
+        evalBoard->enableDataStream(stream, stream < numStreams);
+    }
+    evalBoard->setContinuousRunMode(true);
+    cost.seconds = secondsSince(start);
+    okFrontPanelSim_GetDeviceStats("SIMRHD0001", after);
+
+    cost.numConfigurations = after.fpgaConfigurations - before.fpgaConfigurations;
+    cost.numWireInUpdates = after.wireInUpdates - before.wireInUpdates;
+    cost.numTriggerIns = after.triggerIns - before.triggerIns;
+    cost.reused = evalBoard->isFpgaConfigurationReused();
+    return evalBoard;
+}
+
+static string fileBytes(const char* fileName)
+{
+    ifstream in(fileName, ios::binary);
+    return string((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+}
+
+static void printStartCost(const char* name, const StartCost &cost)
+{
+    cout << "  " << left << setw(31) << name << right << setw(14) << cost.numConfigurations << setw(10) <<
+            cost.numWireInUpdates << setw(10) << cost.numTriggerIns << fixed << setprecision(1) << setw(10) <<
+            1000.0 * cost.seconds << endl;
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6);
+}
+
+static int runFastStartTest(int argc, char* argv[])
+{
+    int controlUs = (argc > 0) ? atoi(argv[0]) : 100;
+    const int numStreams = 8;
+    const char* stateFile = "faststart_test.state";
+    const char* otherBitfile = "faststart_test.bit";
+
+    if (controlUs < 0) {
+        cerr << "faststart: controlUs must be at least 0" << endl;
+        return 1;
+    }
+    remove(stateFile);
+    okFrontPanelSim_SetControlTransferTime(controlUs);
+    StartCost cold, fast, other, back, noRecord;
+    vector<unsigned int> coldWireIns, fastWireIns;
+
+    // First start: no state file yet, so the bitfile is uploaded.  Acquire, then abandon the board.
+    // Wire-in updates during acquisition must not touch the state file.
+    Rhd2000EvalBoardUsb3* evalBoard = startSimBoard(true, "main.bit", stateFile, numStreams, cold);
+    if (!evalBoard) return 1;
+    okFrontPanelSim_GetFpgaWireIns("SIMRHD0001", coldWireIns);
+    Rhd2000DataBlockUsb3 dataBlock(evalBoard->getNumEnabledDataStreams());
+    evalBoard->run();
+    string stateWhileRunning = fileBytes(stateFile);
+    for (int i = 0; i < 10; ++i) {
+        while (!evalBoard->readDataBlock(&dataBlock)) this_thread::sleep_for(chrono::milliseconds(1));
+        int ttlOut[16] = { i & 1, 0, 1 };
+        evalBoard->setTtlOut(ttlOut);
+    }
+    bool stateUntouched = (fileBytes(stateFile) == stateWhileRunning);
+    delete evalBoard;       // still running
+
+    // Restart with fast start: same bitfile, so the configuration is kept.
+    evalBoard = startSimBoard(true, "main.bit", stateFile, numStreams, fast);
+    if (!evalBoard) return 1;
+    okFrontPanelSim_GetFpgaWireIns("SIMRHD0001", fastWireIns);
+    bool sameWireIns = (fastWireIns == coldWireIns);
+
+    evalBoard->resetUsbReadStats();
+    evalBoard->run();
+    bool blocksOk = true;
+    for (int i = 0; i < 10; ++i) {
+        while (!evalBoard->readDataBlock(&dataBlock)) this_thread::sleep_for(chrono::milliseconds(1));
+        blocksOk = blocksOk && dataBlock.timeStamp[0] == (unsigned int) (i * SAMPLES_PER_DATA_BLOCK) &&
+                dataBlock.getSyncFlags() == 0;
+    }
+    evalBoard->setContinuousRunMode(false);
+    evalBoard->setMaxTimeStep(0);
+    evalBoard->flush();
+    delete evalBoard;
+
+    // A different bitfile must be uploaded, and so must main.bit again afterwards.
+    {
+        ifstream in("main.bit", ios::binary);
+        ofstream out(otherBitfile, ios::binary);
+        out << in.rdbuf() << "x";
+    }
+    evalBoard = startSimBoard(true, otherBitfile, stateFile, numStreams, other);
+    if (!evalBoard) return 1;
+    delete evalBoard;
+    bool otherOk = !other.reused && other.numConfigurations == 1;
+
+    evalBoard = startSimBoard(true, "main.bit", stateFile, numStreams, back);
+    if (!evalBoard) return 1;
+    delete evalBoard;
+    otherOk = otherOk && !back.reused && back.numConfigurations == 1;
+
+    remove(stateFile);
+    evalBoard = startSimBoard(true, "main.bit", stateFile, numStreams, noRecord);
+    if (!evalBoard) return 1;
+    delete evalBoard;
+    otherOk = otherOk && !noRecord.reused && noRecord.numConfigurations == 1;
+
+    // With no state file chosen, only a fast start writes the default one.
+    StartCost plain, plainFast;
+    evalBoard = startSimBoard(false, "main.bit", nullptr, numStreams, plain);
+    if (!evalBoard) return 1;
+    string defaultStateFile = "rhd2000usb3_" + evalBoard->getSerialNumber() + ".state";
+    delete evalBoard;
+    bool defaultFileOk = !ifstream(defaultStateFile.c_str()).good();
+    evalBoard = startSimBoard(true, "main.bit", nullptr, numStreams, plainFast);
+    if (!evalBoard) return 1;
+    delete evalBoard;
+    defaultFileOk = defaultFileOk && ifstream(defaultStateFile.c_str()).good();
+    remove(defaultStateFile.c_str());
+
+    okFrontPanelSim_SetControlTransferTime(0);
+    remove(stateFile);
+    remove(otherBitfile);
+
+    cout << endl << "Startup (" << numStreams << " streams, " << controlUs << " us per control transfer)" << endl;
+    cout << "  Start                          Configurations  Wire-ins  Triggers  Time (ms)" << endl;
+    printStartCost("Cold (no state file)", cold);
+    printStartCost("Fast, after a crash", fast);
+    printStartCost("Fast, different bitfile", other);
+    printStartCost("Fast, original bitfile again", back);
+    printStartCost("Fast, state file deleted", noRecord);
+
+    bool fastOk = fast.reused && fast.numConfigurations == 0 && !cold.reused && cold.numConfigurations == 1;
+    cout << "Fast start:             " << (fastOk ? "configuration kept" : "WRONG") << ", FPGA wire-ins " <<
+            (sameWireIns ? "match a cold start" : "DIFFER FROM A COLD START") << ", acquisition " <<
+            (blocksOk ? "clean" : "BROKEN") << endl;
+    cout << "State file:             " << (stateUntouched ? "not written" : "WRITTEN") <<
+            " by wire-in updates during acquisition" << endl;
+    cout << "Full uploads:           " << (otherOk ? "forced when the bitfile or state file changes" : "WRONG") << endl;
+    cout << "Default state file:     " << (defaultFileOk ? "written by fast start only" : "WRONG") << endl;
+    bool ok = fastOk && sameWireIns && blocksOk && otherOk && stateUntouched && defaultFileOk;
+    cout << (ok ? "Fast start checks out." : "FAST START CHECK FAILED!") << endl;
+    return ok ? 0 : 1;
+}
+
+// The settings a user changes between recordings, each one a setter call.
+static void applyTypicalSettings(Rhd2000EvalBoardUsb3 &evalBoard)
+{
+    for (int port = 0; port < 8; ++port) {
+        evalBoard.setCableDelay((Rhd2000EvalBoardUsb3::BoardPort) port, 1 + port);
+        evalBoard.enableExternalDigOut((Rhd2000EvalBoardUsb3::BoardPort) port, false);
+    }
+    for (int stream = 0; stream < MAX_NUM_DATA_STREAMS; ++stream) {
+        evalBoard.enableDataStream(stream, stream < 16);
+    }
+    for (int dac = 0; dac < 8; ++dac) {
+        evalBoard.enableDac(dac, true);
+        evalBoard.selectDacDataStream(dac, dac);
+        evalBoard.selectDacDataChannel(dac, 4 * dac);
+    }
+    evalBoard.setDacGain(3);
+    evalBoard.setAudioNoiseSuppress(5);
+    evalBoard.enableDacHighpassFilter(true);
+    evalBoard.setDacHighpassFilter(250.0);
+    evalBoard.setDspSettle(false);
+    int ttlOut[16] = { 1, 1, 0, 1 };
+    evalBoard.setTtlOut(ttlOut);
+    int leds[8] = { 1, 0, 1, 0, 1, 0, 1, 0 };
+    evalBoard.setLedDisplay(leds);
+}
+
+struct WireInCost {
+    Rhd2000EvalBoardUsb3::WireInStats stats;
+    unsigned long long numSimUpdates;
+    double seconds;
+};
+
+static void printWireInCost(const char* name, const WireInCost &cost)
+{
+    cout << "  " << left << setw(33) << name << right << setw(10) << cost.stats.numUpdatesRequested << setw(8) <<
+            cost.stats.numUpdatesSent << setw(8) << cost.stats.numTransfersSaved << fixed << setprecision(1) <<
+            setw(11) << 1000.0 * cost.seconds << endl;
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6);
+}
+
+static int runWireInBatchTest(int argc, char* argv[])
+{
+    int controlUs = (argc > 0) ? atoi(argv[0]) : 100;
+    if (controlUs < 0) {
+        cerr << "wirebatch: controlUs must be at least 0" << endl;
+        return 1;
+    }
+
+    Rhd2000EvalBoardUsb3 evalBoard;
+    if (evalBoard.open() != 1) {
+        cerr << "Failed to open simulated board" << endl;
+        return 1;
+    }
+    if (!evalBoard.uploadFpgaBitfile("main.bit")) return 1;
+    okFrontPanelSim_SetControlTransferTime(controlUs);
+
+    // Run step on the board, recording wire-in counters from both ends.
+    auto measure = [&evalBoard](const function<void()> &step, WireInCost &cost) {
+        okTSimDeviceStats before, after;
+        evalBoard.resetWireInStats();
+        okFrontPanelSim_GetDeviceStats("SIMRHD0001", before);
+        BenchClock::time_point start = BenchClock::now();
+        step();
+        cost.seconds = secondsSince(start);
+        okFrontPanelSim_GetDeviceStats("SIMRHD0001", after);
+        evalBoard.getWireInStats(cost.stats);
+        cost.numSimUpdates = after.wireInUpdates - before.wireInUpdates;
+    };
+
+    WireInCost init, single, batched;
+    vector<unsigned int> singleWireIns, batchedWireIns;
+    measure([&evalBoard]() { evalBoard.initialize(); }, init);
+
+    measure([&evalBoard]() { applyTypicalSettings(evalBoard); }, single);
+    okFrontPanelSim_GetFpgaWireIns("SIMRHD0001", singleWireIns);
+
+    evalBoard.initialize();
+    measure([&evalBoard]() {
+        Rhd2000EvalBoardUsb3::WireInBatch batch(evalBoard);
+        applyTypicalSettings(evalBoard);
+    }, batched);
+    okFrontPanelSim_GetFpgaWireIns("SIMRHD0001", batchedWireIns);
+    okFrontPanelSim_SetControlTransferTime(0);
+
+    // Acquire a few blocks with the batched settings.
+    Rhd2000DataBlockUsb3 dataBlock(evalBoard.getNumEnabledDataStreams());
+    evalBoard.setContinuousRunMode(true);
+    evalBoard.run();
+    bool blocksOk = true;
+    for (int i = 0; i < 10; ++i) {
+        while (!evalBoard.readDataBlock(&dataBlock)) this_thread::sleep_for(chrono::milliseconds(1));
+        blocksOk = blocksOk && dataBlock.timeStamp[0] == (unsigned int) (i * SAMPLES_PER_DATA_BLOCK) &&
+                dataBlock.getSyncFlags() == 0;
+    }
+    evalBoard.setContinuousRunMode(false);
+    evalBoard.setMaxTimeStep(0);
+    evalBoard.flush();
+
+    cout << endl << "Wire-in updates (" << controlUs << " us per control transfer)" << endl;
+    cout << "  Step                              Requested    Sent   Saved  Time (ms)" << endl;
+    printWireInCost("initialize()", init);
+    printWireInCost("Reconfigure, setter by setter", single);
+    printWireInCost("Reconfigure, in a WireInBatch", batched);
+
+    bool countsOk = init.stats.numUpdatesSent == init.numSimUpdates &&
+            single.stats.numUpdatesSent == single.numSimUpdates && batched.stats.numUpdatesSent == batched.numSimUpdates;
+    bool sameWireIns = (singleWireIns == batchedWireIns);
+    cout << "Counters:               " << (countsOk ? "match the simulator" : "DO NOT MATCH THE SIMULATOR") << endl;
+    cout << "Batched settings:       FPGA wire-ins " << (sameWireIns ? "match" : "DIFFER FROM") <<
+            " setter-by-setter, acquisition " << (blocksOk ? "clean" : "BROKEN") << endl;
+    bool ok = countsOk && sameWireIns && blocksOk && batched.stats.numUpdatesSent < single.stats.numUpdatesSent;
+    cout << (ok ? "Wire-in batching checks out." : "WIRE-IN BATCHING CHECK FAILED!") << endl;
+    return ok ? 0 : 1;
+}
+
+static int runMultiBoardTest(int argc, char* argv[])
+{
+    int numBoards = (argc > 0) ? atoi(argv[0]) : 4;
+    double seconds = (argc > 1) ? atof(argv[1]) : 3.0;
+    int streamsPerBoard = (argc > 2) ? atoi(argv[2]) : 8;
+    const int syncBit = 0;
+    const double syncPeriod = 0.5;
+    const int startControlUs = 500;     // so the boards start a few samples apart
+
+    if (numBoards < 1 || numBoards > 16 || streamsPerBoard < 1 || streamsPerBoard > MAX_NUM_DATA_STREAMS ||
+            seconds < 1.0) {
+        cerr << "multiboard: numBoards must be 1-16, streamsPerBoard 1-" << MAX_NUM_DATA_STREAMS <<
+                " and seconds at least 1" << endl;
+        return 1;
+    }
+
+    // The simulated boards, listed before the simulator is first used
+    vector<string> serials;
+    string deviceList;
+    for (int i = 0; i < numBoards; ++i) {
+        char serial[16];
+        snprintf(serial, sizeof(serial), "SIMRHD%04d", i + 1);
+        serials.push_back(serial);
+        deviceList += (i > 0 ? "," : "") + serials.back();
+    }
+    setenv("OK_SIM_DEVICES", deviceList.c_str(), 1);
+    okFrontPanelSim_SetRealTime(true);
+    okFrontPanelSim_SetSyncPulse(syncBit, syncPeriod, 0.001);
+
+    Rhd2000MultiBoardUsb3 rig;
+    if (rig.open(serials) != 1) return 1;
+    for (int i = 0; i < numBoards; ++i) {
+        Rhd2000EvalBoardUsb3* evalBoard = rig.getBoard(i);
+        if (!evalBoard->uploadFpgaBitfile("main.bit")) return 1;
+        evalBoard->initialize();
+        for (int stream = 0; stream < MAX_NUM_DATA_STREAMS; ++stream) {
+            evalBoard->enableDataStream(stream, stream < streamsPerBoard);
+        }
+    }
+    rig.setSyncInput(syncBit, syncPeriod);
+
+    okFrontPanelSim_SetControlTransferTime(startControlUs);
+    if (!rig.start()) return 1;
+    okFrontPanelSim_SetControlTransferTime(0);
+
+    Rhd2000DataBlockUsb3 merged(rig.getNumDataStreams());
+    unsigned int nextTimeStamp = 0;
+    bool continuous = true;
+    bool startsOnPulse = false;
+    unsigned long long numBlocks = 0;
+    double mergeSeconds = 0.0;
+    BenchClock::time_point start = BenchClock::now();
+    while (secondsSince(start) < seconds) {
+        BenchClock::time_point mergeStart = BenchClock::now();
+        if (!rig.readMergedBlock(&merged)) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
+        }
+        mergeSeconds += secondsSince(mergeStart);
+        if (numBlocks == 0) {
+            startsOnPulse = (merged.ttlInSample(0) & (1 << syncBit)) != 0;
+        }
+        continuous = continuous && merged.timeStampsFollow(nextTimeStamp) && merged.getSyncFlags() == 0;
+        nextTimeStamp += SAMPLES_PER_DATA_BLOCK;
+        numBlocks++;
+    }
+
+    // Every board's sync time stamp must be the same instant on the simulated rig clock.
+    vector<Rhd2000MultiBoardUsb3::BoardStats> boardStats(numBoards);
+    vector<long long> rigSamples(numBoards, -1);
+    for (int i = 0; i < numBoards; ++i) {
+        rig.getBoardStats(i, boardStats[i]);
+        if (boardStats[i].syncTimeStamp >= 0) {
+            okFrontPanelSim_GetRigClockSample(serials[i], (unsigned int) boardStats[i].syncTimeStamp, rigSamples[i]);
+        }
+    }
+    Rhd2000MultiBoardUsb3::MergeStats mergeStats;
+    rig.getMergeStats(mergeStats);
+    rig.stop();
+
+    cout << endl << "Boards (" << streamsPerBoard << " streams each, sync pulse every " << syncPeriod << " s)" << endl;
+    cout << "  Serial      Streams  Sync time stamp  Merged  Discarded  Ring max    MB/s" << endl;
+    bool aligned = true;
+    for (int i = 0; i < numBoards; ++i) {
+        const Rhd2000MultiBoardUsb3::BoardStats &stats = boardStats[i];
+        cout << "  " << left << setw(10) << stats.serialNumber << right << setw(9) << stats.numDataStreams <<
+                setw(17) << stats.syncTimeStamp << setw(8) << stats.numBlocksMerged << setw(11) <<
+                stats.numBlocksDiscarded << setw(10) << stats.ringMaxOccupancy << fixed << setprecision(1) <<
+                setw(8) << stats.megabytesPerSecond << endl;
+        cout.unsetf(ios::fixed);
+        cout << setprecision(6);
+        aligned = aligned && rigSamples[i] >= 0 && rigSamples[i] == rigSamples[0] && stats.numTimeStampGaps == 0;
+    }
+
+    double expectedBlocks = (seconds - syncPeriod) * 30000.0 / SAMPLES_PER_DATA_BLOCK;
+    cout << "Merged stream:          " << numBlocks << " blocks of " << rig.getNumDataStreams() * CHANNELS_PER_STREAM <<
+            " channels, " << 1.0e6 * mergeSeconds / max(numBlocks, 1ULL) << " us per block to merge" << endl;
+    cout << "Alignment:              " << (aligned ? "all boards on the same rig clock sample" : "BOARDS MISALIGNED") <<
+            ", " << mergeStats.numSyncs << " sync" << (mergeStats.numSyncs == 1 ? "" : "s") << ", stream " <<
+            (continuous && startsOnPulse ? "starts on the pulse without gaps" : "BROKEN") << endl;
+    bool ok = aligned && continuous && startsOnPulse && mergeStats.numSyncs == 1 && numBlocks >= 0.9 * expectedBlocks;
+    cout << (ok ? "Multi-board acquisition checks out." : "MULTI-BOARD CHECK FAILED!") << endl;
+    return ok ? 0 : 1;
+}
+
+// A chain of first-order high-pass stages with cutoffs spread over 1 Hz to a few hundred Hz.
+static void makeHighPassChain(vector<unique_ptr<Rhd2000DspHighPassStageUsb3> > &chain, int numStages)
+{
+    chain.clear();
+    for (int i = 0; i < numStages; ++i) {
+        chain.push_back(unique_ptr<Rhd2000DspHighPassStageUsb3>(new Rhd2000DspHighPassStageUsb3(pow(3.0, i))));
+    }
+}
+
+// Single-threaded reference for the engine: the whole block as one tile through every stage.
+static void filterBlockReference(Rhd2000DataBlockUsb3 &dataBlock, vector<unique_ptr<Rhd2000DspHighPassStageUsb3> > &chain)
+{
+    const int numChannels = dataBlock.getNumDataStreams() * CHANNELS_PER_STREAM;
+    vector<float> tile(numChannels * SAMPLES_PER_DATA_BLOCK);
+    for (int c = 0; c < numChannels; ++c) {
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            tile[t * numChannels + c] = (float) (dataBlock.amplifierSample(c / CHANNELS_PER_STREAM, c % CHANNELS_PER_STREAM, t) - 32768);
+        }
+    }
+    for (unsigned int i = 0; i < chain.size(); ++i) {
+        chain[i]->processTile(tile.data(), 0, numChannels);
+    }
+    for (int c = 0; c < numChannels; ++c) {
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            float word = min(max(tile[t * numChannels + c] + 32768.5f, 0.0f), 65535.0f);
+            int index = dataBlock.fastIndex(c / CHANNELS_PER_STREAM, c % CHANNELS_PER_STREAM, t);
+            if (dataBlock.getSampleFormat() == Rhd2000DataBlockUsb3::UInt16Samples) {
+                dataBlock.amplifierData16[index] = (unsigned short) (int) word;
+            } else {
+                dataBlock.amplifierDataFast[index] = (int) word;
+            }
+        }
+    }
+}
+
+static int runDspEngineTest(int argc, char* argv[])
+{
+    int numDataStreams = (argc > 0) ? atoi(argv[0]) : MAX_NUM_DATA_STREAMS;
+    double duration = (argc > 1) ? atof(argv[1]) : 1.0;
+    int maxThreads = (argc > 2) ? atoi(argv[2]) : (int) thread::hardware_concurrency();
+    int numStages = (argc > 3) ? atoi(argv[3]) : 4;
+    const int numSyntheticBlocks = 16;
+    const int numCheckBlocks = 64;
+    const double sampleRate = 30000.0;
+
+    if (numDataStreams < 1 || numDataStreams > MAX_NUM_DATA_STREAMS || numStages < 1) {
+        cerr << "dsp: streams must be 1-" << MAX_NUM_DATA_STREAMS << " and stages at least 1" << endl;
+        return 1;
+    }
+    if (maxThreads < 1) maxThreads = 1;
+
+    vector<unsigned char> buffer;
+    makeSyntheticUsbBlocks(buffer, numDataStreams, numSyntheticBlocks);
+    const double samplesPerBlock = (double) numDataStreams * CHANNELS_PER_STREAM * SAMPLES_PER_DATA_BLOCK;
+    const double realTimeBlocksPerSecond = sampleRate / SAMPLES_PER_DATA_BLOCK;
+
+    cout << endl << "DSP engine test: " << numDataStreams * CHANNELS_PER_STREAM << " channels, " << numStages <<
+            " high-pass stages, " << thread::hardware_concurrency() << " hardware threads" << endl;
+
+    // Streaming correctness: more tiles than workers so that tiles get stolen, several blocks in
+    // flight, and filter state carried from block to block.
+    bool match = true;
+    bool ordered = true;
+    for (int format = Rhd2000DataBlockUsb3::Int32Samples; format <= Rhd2000DataBlockUsb3::UInt16Samples; ++format) {
+        for (int layout = Rhd2000DataBlockUsb3::TimeMajor; layout <= Rhd2000DataBlockUsb3::ChannelMajor; ++layout) {
+            vector<unique_ptr<Rhd2000DspHighPassStageUsb3> > engineChain, referenceChain;
+            makeHighPassChain(engineChain, numStages);
+            makeHighPassChain(referenceChain, numStages);
+            for (unsigned int i = 0; i < referenceChain.size(); ++i) {
+                referenceChain[i]->prepare(numDataStreams * CHANNELS_PER_STREAM, sampleRate);
+            }
+
+            Rhd2000DspEngineUsb3 engine;
+            for (unsigned int i = 0; i < engineChain.size(); ++i) engine.addStage(engineChain[i].get());
+            if (!engine.start(numDataStreams, sampleRate, max(maxThreads, 3), 8, 4)) return 1;
+
+            vector<Rhd2000DataBlockUsb3*> blocks, expected;
+            for (int j = 0; j < numCheckBlocks; ++j) {
+                blocks.push_back(new Rhd2000DataBlockUsb3(numDataStreams, (Rhd2000DataBlockUsb3::AmplifierLayout) layout,
+                                                          (Rhd2000DataBlockUsb3::SampleFormat) format));
+                blocks[j]->fillFromUsbBuffer(&buffer[0], j % numSyntheticBlocks, numDataStreams);
+                expected.push_back(new Rhd2000DataBlockUsb3(*blocks[j]));
+                filterBlockReference(*expected[j], referenceChain);
+            }
+
+            int submitted = 0, taken = 0;
+            while (taken < numCheckBlocks) {
+                while (submitted < numCheckBlocks && engine.submitBlock(blocks[submitted])) submitted++;
+                Rhd2000DataBlockUsb3* done = engine.takeProcessedBlock(true);
+                if (done != blocks[taken]) ordered = false;
+                taken++;
+            }
+            engine.stop();
+
+            bool ok = true;
+            for (int j = 0; j < numCheckBlocks; ++j) {
+                if (!sameSamples(*blocks[j], *expected[j])) ok = false;
+                delete blocks[j];
+                delete expected[j];
+            }
+            if (!ok) match = false;
+            cout << "  " << ((format == Rhd2000DataBlockUsb3::UInt16Samples) ? "UInt16" : "Int32 ") << " " <<
+                    ((layout == Rhd2000DataBlockUsb3::ChannelMajor) ? "ChannelMajor" : "TimeMajor   ") << "  " <<
+                    (ok ? "matches the single-threaded pass" : "MISMATCH") << endl;
+        }
+    }
+
+    // Scaling on the blocks main_windows_dual.cpp uses
+    vector<Rhd2000DataBlockUsb3*> blocks;
+    for (int j = 0; j < DSP_MAX_BLOCKS_IN_FLIGHT; ++j) {
+        blocks.push_back(new Rhd2000DataBlockUsb3(numDataStreams, Rhd2000DataBlockUsb3::TimeMajor,
+                                                  Rhd2000DataBlockUsb3::UInt16Samples));
+        blocks[j]->fillFromUsbBuffer(&buffer[0], j % numSyntheticBlocks, numDataStreams);
+    }
+    cout << endl << "  Threads  Tiles   Blocks/s  Mch-samples/s  x real time  Speedup  Stolen tiles" << endl;
+    double singleThreadRate = 0.0;
+    for (int numThreads = 1; ; numThreads = min(2 * numThreads, maxThreads)) {
+        vector<unique_ptr<Rhd2000DspHighPassStageUsb3> > chain;
+        makeHighPassChain(chain, numStages);
+        Rhd2000DspEngineUsb3 engine;
+        for (unsigned int i = 0; i < chain.size(); ++i) engine.addStage(chain[i].get());
+        if (!engine.start(numDataStreams, sampleRate, numThreads)) return 1;
+
+        unsigned long long submitted = 0, taken = 0;
+        BenchClock::time_point start = BenchClock::now();
+        while (secondsSince(start) < duration) {
+            while (engine.submitBlock(blocks[submitted % blocks.size()])) submitted++;
+            if (engine.takeProcessedBlock(true) == blocks[taken % blocks.size()]) {
+                taken++;
+            } else {
+                ordered = false;
+            }
+        }
+        while (engine.takeProcessedBlock(true) != nullptr) taken++;
+        double elapsed = secondsSince(start);
+        Rhd2000DspEngineUsb3::DspStats stats;
+        engine.getStats(stats);
+        engine.stop();
+
+        double blocksPerSecond = taken / elapsed;
+        if (numThreads == 1) singleThreadRate = blocksPerSecond;
+        cout << "  " << setw(7) << numThreads << setw(7) << stats.numTiles << fixed << setprecision(0) <<
+                setw(11) << blocksPerSecond << setw(15) << blocksPerSecond * samplesPerBlock / 1.0e6 <<
+                setprecision(1) << setw(13) << blocksPerSecond / realTimeBlocksPerSecond << setprecision(2) <<
+                setw(9) << blocksPerSecond / singleThreadRate << setw(14) << stats.numTilesStolen << endl;
+        cout.unsetf(ios::fixed);
+        if (numThreads == maxThreads) break;
+    }
+    for (unsigned int j = 0; j < blocks.size(); ++j) delete blocks[j];
+
+    if (!ordered) cout << "Blocks came back OUT OF ORDER!" << endl;
+    cout << (match && ordered ? "DSP engine output matches the single-threaded reference." : "DSP engine CHECK FAILED!") << endl;
+    return match && ordered ? 0 : 1;
+}
+
+// The rates of Rhd2000EvalBoardUsb3::AmplifierSampleRate, in Hz
+static const double amplifierSampleRates[] = { 1000.0, 1250.0, 1500.0, 2000.0, 2500.0, 3000.0, 10000.0 / 3.0, 4000.0,
+                                               5000.0, 6250.0, 8000.0, 10000.0, 12500.0, 15000.0, 20000.0, 25000.0,
+                                               30000.0 };
+
+// Largest relative difference between a design's gain and the Butterworth gain
+// 1 / sqrt(1 + W^2N) in the prewarped frequency W = tan(pi f / fs) / tan(pi fc / fs).
+static double butterworthDesignError(Rhd2000BiquadFilterBankUsb3::FilterType type, int order, double cutoffHz,
+                                     double sampleRate)
+{
+    const double pi = 3.14159265358979323846;
+    vector<Rhd2000BiquadFilterBankUsb3::Section> sections;
+    if (!Rhd2000BiquadFilterBankUsb3::designButterworth(type, order, cutoffHz, 0.0, sampleRate, sections)) {
+        return 1.0;
+    }
+    double worst = 0.0;
+    for (double f = cutoffHz / 8.0; f < 0.49 * sampleRate; f *= 1.25) {
+        double w = tan(pi * f / sampleRate) / tan(pi * cutoffHz / sampleRate);
+        if (type == Rhd2000BiquadFilterBankUsb3::HighPass) w = 1.0 / w;
+        double expected = 1.0 / sqrt(1.0 + pow(w, 2.0 * order));
+        double actual = Rhd2000BiquadFilterBankUsb3::magnitudeResponse(sections, f, sampleRate);
+        if (expected > 1.0e-6) worst = max(worst, fabs(actual - expected) / expected);
+    }
+    return worst;
+}
+
+// Difference between two floats in units in the last place.
+static long long floatUlps(float a, float b)
+{
+    int32_t ia, ib;
+    memcpy(&ia, &a, sizeof(ia));
+    memcpy(&ib, &b, sizeof(ib));
+    if (ia < 0) ia = INT32_MIN - ia;
+    if (ib < 0) ib = INT32_MIN - ib;
+    return llabs((long long) ia - (long long) ib);
+}
+
+// Run the sections in transposed direct form II in double precision; state holds two words per
+// section per channel.
+static void biquadCascadeDouble(const vector<Rhd2000BiquadFilterBankUsb3::Section> &sections, vector<double> &state,
+                                double *samples, int numChannels)
+{
+    for (unsigned int s = 0; s < sections.size(); ++s) {
+        const Rhd2000BiquadFilterBankUsb3::Section &c = sections[s];
+        for (int i = 0; i < numChannels; ++i) {
+            double &w1 = state[(2 * s) * numChannels + i];
+            double &w2 = state[(2 * s + 1) * numChannels + i];
+            for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+                double input = samples[t * numChannels + i];
+                double output = c.b0 * input + w1;
+                w1 = c.b1 * input - c.a1 * output + w2;
+                w2 = c.b2 * input - c.a2 * output;
+                samples[t * numChannels + i] = output;
+            }
+        }
+    }
+}
+
+static int runBiquadTest(int argc, char* argv[])
+{
+    int numDataStreams = (argc > 0) ? atoi(argv[0]) : MAX_NUM_DATA_STREAMS;
+    double duration = (argc > 1) ? atof(argv[1]) : 0.5;
+    int order = (argc > 2) ? atoi(argv[2]) : 4;
+    const int numSyntheticBlocks = 16;
+    const int numCheckBlocks = 200;
+    const double sampleRate = 30000.0;
+
+    if (numDataStreams < 1 || numDataStreams > MAX_NUM_DATA_STREAMS || order < 1 || order > 8) {
+        cerr << "biquad: streams must be 1-" << MAX_NUM_DATA_STREAMS << " and order 1-8" << endl;
+        return 1;
+    }
+    const int numChannels = numDataStreams * CHANNELS_PER_STREAM;
+
+    // Designs at every board sample rate: low-pass at 0.3 fs, high-pass at 300 Hz or 0.1 fs
+    cout << endl << "Butterworth designs, orders 1-8, largest relative gain error against the analytic response" << endl;
+    cout << "  Sample rate  Low-pass      High-pass" << endl;
+    bool designsOk = true;
+    for (double rate : amplifierSampleRates) {
+        double lowPassError = 0.0, highPassError = 0.0;
+        for (int n = 1; n <= 8; ++n) {
+            lowPassError = max(lowPassError, butterworthDesignError(Rhd2000BiquadFilterBankUsb3::LowPass, n, 0.3 * rate, rate));
+            highPassError = max(highPassError, butterworthDesignError(Rhd2000BiquadFilterBankUsb3::HighPass, n,
+                                                                      min(300.0, 0.1 * rate), rate));
+        }
+        designsOk = designsOk && lowPassError < 1.0e-9 && highPassError < 1.0e-9;
+        cout << "  " << setw(11) << fixed << setprecision(1) << rate << scientific << setprecision(1) << setw(10) <<
+                lowPassError << setw(15) << highPassError << endl;
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+    }
+
+    // Blocks of synthetic samples, as the DSP engine hands them to its stages
+    vector<unsigned char> buffer;
+    makeSyntheticUsbBlocks(buffer, numDataStreams, numSyntheticBlocks);
+    vector<vector<float> > tiles(numSyntheticBlocks, vector<float>(numChannels * SAMPLES_PER_DATA_BLOCK));
+    Rhd2000DataBlockUsb3 dataBlock(numDataStreams);
+    for (int j = 0; j < numSyntheticBlocks; ++j) {
+        dataBlock.fillFromUsbBuffer(&buffer[0], j, numDataStreams);
+        for (int c = 0; c < numChannels; ++c) {
+            for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+                tiles[j][t * numChannels + c] =
+                        (float) (dataBlock.amplifierSample(c / CHANNELS_PER_STREAM, c % CHANNELS_PER_STREAM, t) - 32768);
+            }
+        }
+    }
+
+    cout << endl << "300-6000 Hz band-pass, order " << order << " per edge, " << numChannels << " channels at " <<
+            sampleRate << " S/s" << endl;
+    cout << "  Path      Mch-samples/s  x real time  Speedup  Max ULPs vs scalar  Max error vs double" << endl;
+    Rhd2000DecoderUsb3::DecodePath bestPath = Rhd2000DecoderUsb3::detectBestPath();
+    vector<float> scalarOutput;
+    double scalarRate = 0.0;
+    bool pathsOk = true;
+    for (int path = Rhd2000DecoderUsb3::DecodeScalar; path <= bestPath; ++path) {
+        Rhd2000BiquadFilterBankUsb3 filter(Rhd2000BiquadFilterBankUsb3::BandPass, order, 300.0, 6000.0);
+        filter.setPath((Rhd2000DecoderUsb3::DecodePath) path);
+        if (!filter.prepare(numChannels, sampleRate)) return 1;
+
+        // Accuracy over a stream of blocks, so filter state carries across block boundaries
+        const vector<Rhd2000BiquadFilterBankUsb3::Section> &sections = filter.getSections();
+        vector<double> doubleState(2 * sections.size() * numChannels, 0.0);
+        vector<double> doubleTile(numChannels * SAMPLES_PER_DATA_BLOCK);
+        vector<float> output;
+        vector<float> tile;
+        double maxError = 0.0;
+        for (int j = 0; j < numCheckBlocks; ++j) {
+            tile = tiles[j % numSyntheticBlocks];
+            for (unsigned int k = 0; k < tile.size(); ++k) doubleTile[k] = tile[k];
+            filter.processTile(tile.data(), 0, numChannels);
+            biquadCascadeDouble(sections, doubleState, doubleTile.data(), numChannels);
+            for (unsigned int k = 0; k < tile.size(); ++k) maxError = max(maxError, fabs(tile[k] - doubleTile[k]));
+            output.insert(output.end(), tile.begin(), tile.end());
+        }
+        long long maxUlps = 0;
+        if (path == Rhd2000DecoderUsb3::DecodeScalar) {
+            scalarOutput = output;
+        } else {
+            for (unsigned int k = 0; k < output.size(); ++k) maxUlps = max(maxUlps, floatUlps(output[k], scalarOutput[k]));
+        }
+
+        // Throughput on a tile that stays in cache, as in the engine
+        filter.reset();
+        tile = tiles[0];
+        unsigned long long numBlocks = 0;
+        BenchClock::time_point start = BenchClock::now();
+        do {
+            for (int j = 0; j < 16; ++j) filter.processTile(tile.data(), 0, numChannels);
+            numBlocks += 16;
+        } while (secondsSince(start) < duration);
+        double channelSamplesPerSecond = (double) numBlocks * numChannels * SAMPLES_PER_DATA_BLOCK / secondsSince(start);
+        benchmarkSink = (long long) tile[0];
+        if (path == Rhd2000DecoderUsb3::DecodeScalar) scalarRate = channelSamplesPerSecond;
+
+        bool ok = maxUlps == 0 && maxError < 0.5;
+        pathsOk = pathsOk && ok;
+        cout << "  " << left << setw(8) << Rhd2000DecoderUsb3::pathName((Rhd2000DecoderUsb3::DecodePath) path) << right <<
+                fixed << setprecision(0) << setw(15) << channelSamplesPerSecond / 1.0e6 << setprecision(1) << setw(13) <<
+                channelSamplesPerSecond / (numChannels * sampleRate) << setprecision(2) << setw(9) <<
+                channelSamplesPerSecond / scalarRate << setw(20) << maxUlps << scientific << setprecision(2) <<
+                setw(21) << maxError << (ok ? "" : "  FAILED") << endl;
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+    }
+
+    bool ok = designsOk && pathsOk;
+    cout << (ok ? "Biquad designs and all SIMD paths check out." : "BIQUAD CHECK FAILED!") << endl;
+    return ok ? 0 : 1;
+}
+
+struct LineNoiseResult {
+    double reductionDb;         // interference power over residual power, last 2 s
+    double frequencyError;      // largest |tracked - true| line frequency at the end, Hz
+    double microsecondsPerBlock;
+};
+
+// Run one filter over numBlocks blocks of synthetic recording: background noise of about 20 ADC
+// steps RMS on every channel, plus mains of 50 to 360 steps per channel with 30% 2nd and 15% 3rd
+// harmonics, at a frequency drifting linearly from lineHz + 0.2 to lineHz - 0.1.
+static LineNoiseResult runLineNoisePass(Rhd2000LineNoiseFilterUsb3 &filter, int numChannels, int numBlocks, double lineHz)
+{
+    const double pi = 3.14159265358979323846;
+    const double sampleRate = 30000.0;
+    const int numNoise = 1 << 20;
+
+    vector<float> noise(numNoise);
+    unsigned int seed = 4321;
+    for (int i = 0; i < numNoise; ++i) {
+        float sum = 0.0f;
+        for (int j = 0; j < 4; ++j) {
+            seed = seed * 1103515245 + 12345;
+            sum += (float) ((seed >> 8) & 0xffff) / 65536.0f - 0.5f;
+        }
+        sum *= 34.6f;       // 4 uniform draws of variance 1/12 scaled to 20 steps RMS
+        noise[i] = sum;
+    }
+    vector<float> amplitude(numChannels), phaseCos(numChannels), phaseSin(numChannels);
+    for (int c = 0; c < numChannels; ++c) {
+        amplitude[c] = 50.0f + 10.0f * (c % CHANNELS_PER_STREAM);
+        double theta = 2.0 * pi * ((c * 37) % 100) / 100.0;
+        phaseCos[c] = (float) cos(theta);
+        phaseSin[c] = (float) sin(theta);
+    }
+
+    vector<float> tile(numChannels * SAMPLES_PER_DATA_BLOCK), clean(tile.size());
+    vector<float> mains(SAMPLES_PER_DATA_BLOCK * 6);
+    double phase = 0.0;
+    double frequency = lineHz;
+    double interferencePower = 0.0, residualPower = 0.0;
+    double seconds = 0.0;
+    const int measureFrom = numBlocks - (int) (2.0 * sampleRate / SAMPLES_PER_DATA_BLOCK);
+    unsigned int noiseIndex = 0;
+
+    for (int block = 0; block < numBlocks; ++block) {
+        // Shared mains waveform: cos and sin of each harmonic at every sample
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            double progress = (double) (block * SAMPLES_PER_DATA_BLOCK + t) / (numBlocks * SAMPLES_PER_DATA_BLOCK);
+            frequency = lineHz + 0.2 - 0.3 * progress;
+            for (int k = 0; k < 3; ++k) {
+                mains[t * 6 + 2 * k] = (float) cos((k + 1) * phase);
+                mains[t * 6 + 2 * k + 1] = (float) sin((k + 1) * phase);
+            }
+            phase = fmod(phase + 2.0 * pi * frequency / sampleRate, 2.0 * pi);
+        }
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            const float *m = &mains[t * 6];
+            for (int c = 0; c < numChannels; ++c) {
+                float interference = amplitude[c] * ((phaseCos[c] * m[0] - phaseSin[c] * m[1]) +
+                        0.30f * (phaseCos[c] * m[2] - phaseSin[c] * m[3]) + 0.15f * (phaseCos[c] * m[4] - phaseSin[c] * m[5]));
+                float background = noise[(noiseIndex + c * 7919) & (numNoise - 1)];
+                clean[t * numChannels + c] = background;
+                tile[t * numChannels + c] = background + interference;
+                if (block >= measureFrom) interferencePower += (double) interference * interference;
+            }
+            noiseIndex += 1;
+        }
+
+        BenchClock::time_point start = BenchClock::now();
+        filter.processTile(tile.data(), 0, numChannels);
+        seconds += secondsSince(start);
+
+        if (block >= measureFrom) {
+            for (unsigned int i = 0; i < tile.size(); ++i) {
+                double residual = tile[i] - clean[i];
+                residualPower += residual * residual;
+            }
+        }
+    }
+
+    LineNoiseResult result;
+    result.reductionDb = 10.0 * log10(interferencePower / residualPower);
+    result.frequencyError = 0.0;
+    for (int stream = 0; stream < numChannels / CHANNELS_PER_STREAM; ++stream) {
+        result.frequencyError = max(result.frequencyError, fabs(filter.getLineFrequency(stream) - frequency));
+    }
+    result.microsecondsPerBlock = 1.0e6 * seconds / numBlocks;
+    return result;
+}
+
+static int runLineNoiseTest(int argc, char* argv[])
+{
+    int numDataStreams = (argc > 0) ? atoi(argv[0]) : MAX_NUM_DATA_STREAMS;
+    double seconds = (argc > 1) ? atof(argv[1]) : 10.0;
+    double lineHz = (argc > 2) ? atof(argv[2]) : 60.0;
+    const double sampleRate = 30000.0;
+
+    if (numDataStreams < 1 || numDataStreams > MAX_NUM_DATA_STREAMS || seconds < 4.0 || lineHz < 40.0 || lineHz > 70.0) {
+        cerr << "linenoise: streams must be 1-" << MAX_NUM_DATA_STREAMS << ", seconds at least 4 and lineHz 40-70" << endl;
+        return 1;
+    }
+    const int numChannels = numDataStreams * CHANNELS_PER_STREAM;
+    const int numBlocks = (int) (seconds * sampleRate / SAMPLES_PER_DATA_BLOCK);
+    const double budgetMicroseconds = 1.0e6 * SAMPLES_PER_DATA_BLOCK / sampleRate;
+
+    cout << endl << "Line noise test: " << numChannels << " channels, " << seconds << " s, mains " << lineHz + 0.2 <<
+            " Hz drifting to " << lineHz - 0.1 << " Hz, 3 harmonics, 1 Hz notches" << endl;
+    cout << "  Tracking  Reduction  Frequency error  us/block  Share of one core" << endl;
+
+    bool ok = true;
+    for (int pass = 0; pass < 2; ++pass) {
+        bool tracking = (pass == 0);
+        Rhd2000LineNoiseFilterUsb3 filter(lineHz, 3, 1.0);
+        filter.setTracking(tracking);
+        if (!filter.prepare(numChannels, sampleRate)) return 1;
+        LineNoiseResult result = runLineNoisePass(filter, numChannels, numBlocks, lineHz);
+
+        cout << "  " << left << setw(8) << (tracking ? "on" : "off") << right << fixed << setprecision(1) <<
+                setw(9) << result.reductionDb << " dB" << setprecision(4) << setw(14) << result.frequencyError <<
+                " Hz" << setprecision(0) << setw(10) << result.microsecondsPerBlock << setprecision(1) << setw(18) <<
+                100.0 * result.microsecondsPerBlock / budgetMicroseconds << "%" << endl;
+        cout.unsetf(ios::fixed);
+        if (tracking) {
+            ok = result.reductionDb >= 30.0 && result.frequencyError < 0.01 &&
+                    result.microsecondsPerBlock < budgetMicroseconds;
+        }
+    }
+
+    cout << (ok ? "Line noise removed within the real-time budget." : "LINE NOISE CHECK FAILED!") << endl;
+    return ok ? 0 : 1;
+}
+
+// Straightforward re-referencing of whole blocks: at every sample, the mean or median of the
+// group's good channels, found with a running sum or nth_element, is subtracted from each channel.
+static void reReferenceBlockReference(Rhd2000DataBlockUsb3 &dataBlock, const vector<vector<int> > &groups,
+                                      const vector<bool> &bad, bool median)
+{
+    vector<int> values;
+    vector<int> reference(SAMPLES_PER_DATA_BLOCK);
+    for (unsigned int g = 0; g < groups.size(); ++g) {
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            values.clear();
+            for (int channel : groups[g]) {
+                if (!bad[channel]) {
+                    values.push_back(dataBlock.amplifierSample(channel / CHANNELS_PER_STREAM, channel % CHANNELS_PER_STREAM, t));
+                }
+            }
+            int m = (int) values.size();
+            if (m == 0) {
+                reference[t] = 0;
+            } else if (median) {
+                nth_element(values.begin(), values.begin() + m / 2, values.end());
+                int high = values[m / 2];
+                int low = *max_element(values.begin(), values.begin() + m / 2 + (m % 2));
+                reference[t] = (low + high + 1) >> 1;
+            } else {
+                long long sum = 0;
+                for (int v : values) sum += v;
+                reference[t] = (int) ((sum + m / 2) / m);
+            }
+        }
+        if (values.empty()) continue;
+        for (int channel : groups[g]) {
+            int index = dataBlock.fastIndex(channel / CHANNELS_PER_STREAM, channel % CHANNELS_PER_STREAM, 0);
+            for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+                int k = index + t * dataBlock.amplifierSampleStride();
+                int x = (dataBlock.getSampleFormat() == Rhd2000DataBlockUsb3::UInt16Samples) ?
+                        dataBlock.amplifierData16[k] : dataBlock.amplifierDataFast[k];
+                int word = min(max(x - reference[t] + 32768, 0), 65535);
+                if (dataBlock.getSampleFormat() == Rhd2000DataBlockUsb3::UInt16Samples) {
+                    dataBlock.amplifierData16[k] = (unsigned short) word;
+                } else {
+                    dataBlock.amplifierDataFast[k] = word;
+                }
+            }
+        }
+    }
+}
+
+static int runReReferenceTest(int argc, char* argv[])
+{
+    int numDataStreams = (argc > 0) ? atoi(argv[0]) : MAX_NUM_DATA_STREAMS;
+    double duration = (argc > 1) ? atof(argv[1]) : 0.5;
+    const int numSyntheticBlocks = 8;
+    const double sampleRate = 30000.0;
+    const double budgetMicroseconds = 1.0e6 * SAMPLES_PER_DATA_BLOCK / sampleRate;
+
+    if (numDataStreams < 1 || numDataStreams > MAX_NUM_DATA_STREAMS) {
+        cerr << "reref: streams must be 1-" << MAX_NUM_DATA_STREAMS << endl;
+        return 1;
+    }
+    const int numChannels = numDataStreams * CHANNELS_PER_STREAM;
+
+    // Selection networks: the middle element(s) must match a full sort
+    bool networksOk = true;
+    unsigned int seed = 2468;
+    vector<pair<int, int> > network;
+    for (int m = 1; m <= 64; ++m) {
+        Rhd2000ReReferenceUsb3::medianNetwork(m, network);
+        for (int trial = 0; trial < 200; ++trial) {
+            vector<int> values(m);
+            for (int i = 0; i < m; ++i) {
+                seed = seed * 1103515245 + 12345;
+                values[i] = (int) ((seed >> 16) % 64);
+            }
+            vector<int> sorted = values;
+            sort(sorted.begin(), sorted.end());
+            for (const pair<int, int> &comparator : network) {
+                if (values[comparator.first] > values[comparator.second]) {
+                    swap(values[comparator.first], values[comparator.second]);
+                }
+            }
+            if (values[(m - 1) / 2] != sorted[(m - 1) / 2] || values[m / 2] != sorted[m / 2]) networksOk = false;
+        }
+    }
+    Rhd2000ReReferenceUsb3::medianNetwork(16, network);
+    cout << endl << "Median networks for 1-64 inputs " << (networksOk ? "check out" : "FAILED") << "; 16 inputs: " <<
+            network.size() << " comparators";
+    Rhd2000ReReferenceUsb3::medianNetwork(32, network);
+    cout << ", 32 inputs: " << network.size() << " comparators" << endl;
+
+    // Correctness on 16-channel shanks with a few bad channels, in every layout and format
+    vector<unsigned char> buffer;
+    makeSyntheticUsbBlocks(buffer, numDataStreams, numSyntheticBlocks);
+    vector<vector<int> > shanks;
+    for (int first = 0; first < numChannels; first += 16) {
+        shanks.push_back(vector<int>());
+        for (int channel = first; channel < first + 16; ++channel) shanks.back().push_back(channel);
+    }
+    vector<int> badChannels;
+    vector<bool> bad(numChannels, false);
+    for (int channel = 3; channel < numChannels; channel += 13) {
+        badChannels.push_back(channel);
+        bad[channel] = true;
+    }
+    Rhd2000DecoderUsb3::DecodePath bestPath = Rhd2000DecoderUsb3::detectBestPath();
+    bool matchesOk = true;
+    cout << "Re-referencing " << numChannels << " channels in 16-channel shanks, " << badChannels.size() <<
+            " bad channels, against a plain mean and nth_element median" << endl;
+    for (int format = Rhd2000DataBlockUsb3::Int32Samples; format <= Rhd2000DataBlockUsb3::UInt16Samples; ++format) {
+        for (int layout = Rhd2000DataBlockUsb3::TimeMajor; layout <= Rhd2000DataBlockUsb3::ChannelMajor; ++layout) {
+            for (int path = Rhd2000DecoderUsb3::DecodeScalar; path <= bestPath; ++path) {
+                for (int mode = Rhd2000ReReferenceUsb3::CommonAverage; mode <= Rhd2000ReReferenceUsb3::CommonMedian; ++mode) {
+                    Rhd2000ReReferenceUsb3 reReference;
+                    reReference.configure(numDataStreams, (Rhd2000ReReferenceUsb3::ReferenceMode) mode);
+                    reReference.setPath((Rhd2000DecoderUsb3::DecodePath) path);
+                    if (!reReference.setGroups(shanks) || !reReference.setBadChannels(badChannels)) return 1;
+                    bool ok = true;
+                    for (int j = 0; j < numSyntheticBlocks; ++j) {
+                        Rhd2000DataBlockUsb3 dataBlock(numDataStreams, (Rhd2000DataBlockUsb3::AmplifierLayout) layout,
+                                                       (Rhd2000DataBlockUsb3::SampleFormat) format);
+                        dataBlock.fillFromUsbBuffer(&buffer[0], j, numDataStreams);
+                        Rhd2000DataBlockUsb3 expected(dataBlock);
+                        reReferenceBlockReference(expected, shanks, bad, mode == Rhd2000ReReferenceUsb3::CommonMedian);
+                        if (!reReference.apply(dataBlock) || !sameSamples(dataBlock, expected)) ok = false;
+                    }
+                    matchesOk = matchesOk && ok;
+                    if (!ok) {
+                        cout << "  MISMATCH: " << (format == Rhd2000DataBlockUsb3::UInt16Samples ? "UInt16" : "Int32") <<
+                                " " << (layout == Rhd2000DataBlockUsb3::TimeMajor ? "TimeMajor" : "ChannelMajor") << " " <<
+                                Rhd2000DecoderUsb3::pathName((Rhd2000DecoderUsb3::DecodePath) path) << " " <<
+                                (mode == Rhd2000ReReferenceUsb3::CommonMedian ? "median" : "mean") << endl;
+                    }
+                }
+            }
+        }
+    }
+    cout << "  " << (matchesOk ? "All layouts, formats, paths and modes match." : "Some combinations do not match.") << endl;
+
+    // Throughput: one 32-channel group per stream, in place on a 16-bit TimeMajor block
+    cout << endl << "One group per stream, " << numChannels << " channels, UInt16Samples TimeMajor blocks" << endl;
+    cout << "  Reference           us/block  Mch-samples/s  Share of one core at 30 kS/s" << endl;
+    Rhd2000DataBlockUsb3 dataBlock(numDataStreams, Rhd2000DataBlockUsb3::TimeMajor, Rhd2000DataBlockUsb3::UInt16Samples);
+    dataBlock.fillFromUsbBuffer(&buffer[0], 0, numDataStreams);
+    vector<vector<int> > streamGroups;
+    for (int first = 0; first < numChannels; first += CHANNELS_PER_STREAM) {
+        streamGroups.push_back(vector<int>());
+        for (int channel = first; channel < first + CHANNELS_PER_STREAM; ++channel) streamGroups.back().push_back(channel);
+    }
+    vector<bool> noneBad(numChannels, false);
+    for (int pass = -1; pass <= bestPath + 1; ++pass) {
+        // pass -1: mean; 0..bestPath: median on that path; bestPath + 1: nth_element median
+        Rhd2000ReReferenceUsb3 reReference;
+        reReference.configure(numDataStreams, (pass < 0) ? Rhd2000ReReferenceUsb3::CommonAverage :
+                                                           Rhd2000ReReferenceUsb3::CommonMedian);
+        if (pass >= 0 && pass <= bestPath) reReference.setPath((Rhd2000DecoderUsb3::DecodePath) pass);
+        unsigned long long numBlocks = 0;
+        BenchClock::time_point start = BenchClock::now();
+        do {
+            for (int j = 0; j < 8; ++j) {
+                if (pass > bestPath) {
+                    reReferenceBlockReference(dataBlock, streamGroups, noneBad, true);
+                } else {
+                    reReference.apply(dataBlock);
+                }
+            }
+            numBlocks += 8;
+        } while (secondsSince(start) < duration);
+        double seconds = secondsSince(start);
+        benchmarkSink = dataBlock.amplifierData16[0];
+        double microsecondsPerBlock = 1.0e6 * seconds / numBlocks;
+
+        string name;
+        if (pass < 0) {
+            name = "mean";
+        } else if (pass > bestPath) {
+            name = "median nth_element";
+        } else {
+            name = string("median ") + Rhd2000DecoderUsb3::pathName((Rhd2000DecoderUsb3::DecodePath) pass);
+        }
+        cout << "  " << left << setw(18) << name << right << fixed << setprecision(1) << setw(10) <<
+                microsecondsPerBlock << setprecision(0) << setw(15) <<
+                (double) numBlocks * numChannels * SAMPLES_PER_DATA_BLOCK / seconds / 1.0e6 << setprecision(1) <<
+                setw(29) << 100.0 * microsecondsPerBlock / budgetMicroseconds << "%" << endl;
+        cout.unsetf(ios::fixed);
+    }
+
+    bool ok = networksOk && matchesOk;
+    cout << (ok ? "Re-referencing checks out." : "RE-REFERENCING CHECK FAILED!") << endl;
+    return ok ? 0 : 1;
+}
+
+struct BenchmarkTest {
+    const char* name;
+    int (*run)(int argc, char* argv[]);
+};
+
+static const BenchmarkTest benchmarkTests[] = {
+    { "loadtest", runLoadTest },
+    { "readerthread", runReaderThreadTest },
+    { "batchread", runBatchReadTest },
+    { "blockpool", runBlockPoolTest },
+    { "decode", runDecodeTest },
+    { "layout", runLayoutTest },
+    { "compact", runCompactTest },
+    { "filewrite", runFileWriteTest },
+    { "asyncwrite", runAsyncWriteTest },
+    { "shmring", runSharedMemoryRingTest },
+    { "shmpayload", runSharedMemoryPayloadTest },
+    { "pyramid", runPyramidTest },
+    { "fpgasink", runFpgaSinkTest },
+    { "loopback", runLoopbackTest },
+    { "frames", runFrameEncoderTest },
+    { "resync", runResyncTest },
+    { "timestamps", runTimeStampTest },
+    { "cmdupload", runCommandUploadTest },
+    { "faststart", runFastStartTest },
+    { "wirebatch", runWireInBatchTest },
+    { "multiboard", runMultiBoardTest },
+    { "dsp", runDspEngineTest },
+    { "biquad", runBiquadTest },
+    { "linenoise", runLineNoiseTest },
+    { "reref", runReReferenceTest }
+};
+
+int main(int argc, char* argv[])
+{
+    int numTests = sizeof(benchmarkTests) / sizeof(benchmarkTests[0]);
+
+    if (argc >= 2) {
+        for (int i = 0; i < numTests; ++i) {
+            if (strcmp(argv[1], benchmarkTests[i].name) == 0) {
+                return benchmarkTests[i].run(argc - 2, argv + 2);
+            }
+        }
+    }
+
+    cerr << "Usage: " << argv[0] << " <test> [arguments]" << endl << "Tests:";
+    for (int i = 0; i < numTests; ++i) {
+        cerr << " " << benchmarkTests[i].name;
+    }
+    cerr << endl;
+    return 1;
+}
@@ -0,0 +1,76 @@
+//----------------------------------------------------------------------------------
+// main_benchmark_heap.cpp
+//
+// Global operator new/delete replacements for IntanBenchmark that count every heap
+// allocation in the process (see heapAllocations in main_benchmark.cpp).  Kept in their
+// own translation unit so the compiler cannot inline free() into callers and pair it
+// with the operator new that returned the pointer.
+//----------------------------------------------------------------------------------
+
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+using namespace std;
+
+atomic<unsigned long long> heapAllocations(0);
+
+static void* countedAlloc(size_t size)
+{
+    heapAllocations++;
+    return malloc(size ? size : 1);
+}
+
+void* operator new(size_t size)
+{
+    void* p = countedAlloc(size);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    void* p = countedAlloc(size);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, const nothrow_t &) noexcept
+{
+    return countedAlloc(size);
+}
+
+void* operator new[](size_t size, const nothrow_t &) noexcept
+{
+    return countedAlloc(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, const nothrow_t &) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, const nothrow_t &) noexcept
+{
+    free(p);
+}
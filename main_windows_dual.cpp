@@ -2,7 +2,7 @@
 // main_windows_dual.cpp
 //
 // Windows version of Intan neural data acquisition with dual output:
-// 1. FPGA processing via Python pipe (original functionality)  
+// 1. FPGA processing on a downstream Opal Kelly board (Rhd2000FpgaSinkUsb3)
 // 2. Shared memory for real-time visualization (new Windows implementation)
 //
 // Based on Linux decoupled version but adapted for Windows shared memory
@@ -16,81 +16,38 @@
 #include <stdio.h>
 #include <windows.h>
 #include <string>
+#include <cstring>
 
 using namespace std;
 
 #include "rhd2000evalboardusb3.h"
 #include "rhd2000registersusb3.h"
 #include "rhd2000datablockusb3.h"
+#include "rhd2000datablockringusb3.h"
+#include "rhd2000asyncfilewriterusb3.h"
+#include "rhd2000sharedmemoryringusb3.h"
+#include "rhd2000decimationpyramidusb3.h"
+#include "rhd2000fpgasinkusb3.h"
+#include "rhd2000loopbackverifierusb3.h"
+#include "rhd2000frameencoderusb3.h"
+#include "rhd2000timestampmonitorusb3.h"
+#include "rhd2000dspengineusb3.h"
+#include "rhd2000biquadfilterbankusb3.h"
+#include "rhd2000linenoisefilterusb3.h"
+#include "rhd2000rereferenceusb3.h"
 #include "okFrontPanelDLL.h"
 
 #define NUM_TIMESTEPS 1000
 
-// Shared memory data structures (matching Linux version)
-struct IntanDataHeader { 
-    uint32_t magic;
-    uint32_t timestamp;
-    uint32_t dataSize;
-    uint32_t streamCount;
-    uint32_t channelCount;
-    uint32_t sampleRate;
-};
-
-struct IntanDataBlock { 
-    uint32_t streamId;
-    uint32_t channelId; 
-    float value;
-};
-
-// Windows shared memory wrapper
-class WindowsSharedMemory {
-private:
-    HANDLE hMapFile;
-    void* pBuf;
-    size_t size;
-    
-public:
-    WindowsSharedMemory(const std::string& name, size_t shmSize) : hMapFile(NULL), pBuf(NULL), size(shmSize) {
-        // Create shared memory mapping
-        hMapFile = CreateFileMappingA(
-            INVALID_HANDLE_VALUE,    // use paging file
-            NULL,                    // default security
-            PAGE_READWRITE,          // read/write access
-            0,                       // maximum object size (high-order DWORD)
-            shmSize,                 // maximum object size (low-order DWORD)
-            name.c_str());           // name of mapping object
-
-        if (hMapFile == NULL) {
-            cerr << "Could not create file mapping object: " << GetLastError() << endl;
-            return;
-        }
+// Number of data blocks of history kept in the IntanRHXData shared memory ring
+#define SHM_RING_SLOTS 32
 
-        pBuf = MapViewOfFile(
-            hMapFile,               // handle to map object
-            FILE_MAP_ALL_ACCESS,    // read/write permission
-            0,
-            0,
-            shmSize);
-
-        if (pBuf == NULL) {
-            cerr << "Could not map view of file: " << GetLastError() << endl;
-            CloseHandle(hMapFile);
-            hMapFile = NULL;
-        }
-    }
-    
-    ~WindowsSharedMemory() {
-        if (pBuf) {
-            UnmapViewOfFile(pBuf);
-        }
-        if (hMapFile) {
-            CloseHandle(hMapFile);
-        }
-    }
-    
-    void* getBuffer() { return pBuf; }
-    bool isValid() { return pBuf != NULL; }
-};
+// Downstream processing FPGA fed through Rhd2000FpgaSinkUsb3 (override with the
+// FPGA_SINK_SERIAL and FPGA_SINK_BITFILE environment variables).  Set FPGA_SINK_VERIFY=1
+// when it runs a loopback design to check every byte it returns.
+#define DEFAULT_FPGA_SINK_SERIAL "2416001B97"
+#define DEFAULT_FPGA_SINK_BITFILE "C:/Users/rkt23/okClk_pipe/okClk_pipe.runs/impl_1/First.bit"
+#define FPGA_SINK_FRAMES_BUFFERED 8
 
 int main(int argc, char* argv[])
 {
@@ -109,20 +66,27 @@ int main(int argc, char* argv[])
         return f.good();
     };
     
+    // With RHD_FAST_START set, an FPGA still configured with the same bitfile (e.g., after a crash)
+    // is reused instead of reconfigured.
+    const bool fastStart = getenv("RHD_FAST_START") != nullptr;
+    auto loadBitfile = [evalBoard, fastStart](const string& path) -> bool {
+        return fastStart ? evalBoard->fastStartFpga(path) : evalBoard->uploadFpgaBitfile(path);
+    };
+
     // Prefer explicit env var path, otherwise require local main.bit (known-good)
     bool bitfileUploaded = false;
     const char* envPath = getenv("RHD_BITFILE");
     if (envPath && fileExists(envPath)) {
         cout << "Uploading FPGA bitfile: " << envPath << endl;
-        bitfileUploaded = evalBoard->uploadFpgaBitfile(string(envPath));
+        bitfileUploaded = loadBitfile(string(envPath));
     } else if (fileExists("main.bit")) {
         cout << "Uploading FPGA bitfile: main.bit" << endl;
-        bitfileUploaded = evalBoard->uploadFpgaBitfile(string("main.bit"));
+        bitfileUploaded = loadBitfile(string("main.bit"));
     } else if (fileExists("FPGA-bitfiles/ConfigRHDInterfaceBoard.bit")) {
         // Single fallback commonly used with XEM6310
         const char* fb = "FPGA-bitfiles/ConfigRHDInterfaceBoard.bit";
         cout << "Uploading FPGA bitfile: " << fb << endl;
-        bitfileUploaded = evalBoard->uploadFpgaBitfile(string(fb));
+        bitfileUploaded = loadBitfile(string(fb));
     }
     
     if (!bitfileUploaded) {
@@ -133,6 +97,9 @@ int main(int argc, char* argv[])
     // Initialize board.
     evalBoard->initialize();
 
+    // Send the settings below to the FPGA together rather than one control transfer per setter.
+    evalBoard->beginWireInBatch();
+
     // Select per-channel amplifier sampling rate.
     evalBoard->setSampleRate(Rhd2000EvalBoardUsb3::SampleRate30000Hz);
     evalBoard->setCableLengthFeet(Rhd2000EvalBoardUsb3::PortA, 3.0);
@@ -175,6 +142,8 @@ int main(int argc, char* argv[])
     evalBoard->selectAuxCommandLength(Rhd2000EvalBoardUsb3::AuxCmd3, 0, commandSequenceLength - 1);
     evalBoard->selectAuxCommandBank(Rhd2000EvalBoardUsb3::PortA, Rhd2000EvalBoardUsb3::AuxCmd3, 1);
 
+    evalBoard->endWireInBatch();
+
     // Run calibration
     evalBoard->setMaxTimeStep(128);
     evalBoard->setContinuousRunMode(false);
@@ -198,92 +167,184 @@ int main(int argc, char* argv[])
     fileName += ".dat";
     cout << "Save filename: " << fileName << endl;
 
-    // Open file for saving
-    ofstream saveOut(fileName, ios::binary | ios::out);
+    // Open file for saving; blocks are written to disk from the writer's own I/O thread
+    Rhd2000AsyncFileWriterUsb3 fileWriter;
+    fileWriter.open(fileName);
 
-    // Set up Windows shared memory for visualization
+    // RHD_GAP_FILL=n writes a fill frame (0xffff but for the time stamp) in place of each missing sample,
+    // for gaps of up to n samples, so that the file keeps one frame per time stamp.  0xffff is valid data
+    // too, so the fill frames are listed in <file>.fill, one "firstFrame numFrames" line per run
+    const char* gapFill = getenv("RHD_GAP_FILL");
+    if (gapFill) {
+        fileWriter.setGapFill((unsigned int) strtoul(gapFill, nullptr, 10));
+    }
+
+    // Set up a shared memory ring for visualization; readers follow its write cursor and
+    // can look back up to SHM_RING_SLOTS data blocks without blocking this process
     const int streams = evalBoard->getNumEnabledDataStreams();
     const int channelsPerStream = CHANNELS_PER_STREAM;
     const int samplesPerBlock = SAMPLES_PER_DATA_BLOCK;
     size_t blocks = (size_t)streams * channelsPerStream * samplesPerBlock;
-    size_t shmSize = sizeof(IntanDataHeader) + blocks * sizeof(IntanDataBlock);
+    unsigned int shmSlotBytes = (unsigned int) (blocks * sizeof(unsigned short));
     
     cout << "Setting up shared memory: streams=" << streams << " channels=" << channelsPerStream << " samples=" << samplesPerBlock << endl;
-    WindowsSharedMemory sharedMem("IntanRHXData", shmSize);
-    
-    IntanDataHeader* header = nullptr;
-    IntanDataBlock* shmOutput = nullptr;
+    Rhd2000SharedMemoryRingUsb3 sharedRing;
+    // Each slot holds one block of raw 16-bit amplifier words; readers convert to microvolts
+    // with the scale and offset published in the ring header.
+    bool shmOutput = sharedRing.create("IntanRHXData", SHM_RING_SLOTS, shmSlotBytes, streams, channelsPerStream,
+                                       (unsigned int) evalBoard->getSampleRate(),
+                                       Rhd2000SharedMemoryRingUsb3::PayloadAmplifierWords, samplesPerBlock, 0.195, 32768);
     
-    if (sharedMem.isValid()) {
-        header = reinterpret_cast<IntanDataHeader*>(sharedMem.getBuffer());
-        shmOutput = reinterpret_cast<IntanDataBlock*>((uint8_t*)sharedMem.getBuffer() + sizeof(IntanDataHeader));
-        
-        // Initialize header
-        header->magic = 0x494E5441;  // "INTA"
-        header->streamCount = streams;
-        header->channelCount = channelsPerStream;
-        header->sampleRate = (uint32_t)evalBoard->getSampleRate();
-        header->dataSize = (uint32_t)shmSize;
-        header->timestamp = 0;
-        
-        cout << "Shared memory initialized successfully (size=" << shmSize << " bytes)" << endl;
+    if (shmOutput) {
+        cout << "Shared memory ring initialized successfully (" << SHM_RING_SLOTS << " slots of " <<
+                shmSlotBytes << " bytes)" << endl;
     } else {
         cout << "Warning: Shared memory initialization failed, continuing without visualization" << endl;
     }
 
-    // Set up Python pipe for FPGA processing (restored original functionality)
-    SECURITY_ATTRIBUTES s_attr {sizeof(s_attr), nullptr, TRUE};
-    HANDLE childStdinRead = nullptr, parentStdinWrite = nullptr;
+    // Min/max/mean overview of every channel at several zoom levels, so viewers can draw long
+    // time spans without rescanning raw samples
+    Rhd2000DecimationPyramidUsb3 pyramid;
+    bool pyramidOutput = pyramid.create("IntanRHXPyramid", streams, (unsigned int) evalBoard->getSampleRate());
+    if (!pyramidOutput) {
+        cout << "Warning: Decimation pyramid initialization failed, continuing without overview data" << endl;
+    }
 
-    if (!CreatePipe(&childStdinRead, &parentStdinWrite, &s_attr, 0)) {
-        cerr << "ERROR: CreatePipe failed" << endl;
-        exit(1);
+    // RHD_REREF=mean or median[,channelsPerShank] subtracts the common average or median of each
+    // headstage (or of each group of channelsPerShank channels) at every sample, in place, before
+    // any filtering; RHD_REREF_BAD=c1,c2,... lists channels (stream * 32 + channel) to leave out of
+    // the reference.  Like the filters, it does not affect the saved file
+    const char* reReferenceMode = getenv("RHD_REREF");
+    const char* reReferenceBad = getenv("RHD_REREF_BAD");
+    Rhd2000ReReferenceUsb3 reReference;
+    bool reReferenceOutput = false;
+    if (reReferenceMode) {
+        int channelsPerShank = CHANNELS_PER_STREAM;
+        const char* comma = strchr(reReferenceMode, ',');
+        if (comma) {
+            channelsPerShank = atoi(comma + 1);
+        }
+        bool median = (strncmp(reReferenceMode, "median", 6) == 0);
+        vector<int> badChannels;
+        for (const char* p = reReferenceBad; p && *p; ) {
+            badChannels.push_back(atoi(p));
+            p = strchr(p, ',');
+            if (p) ++p;
+        }
+        reReferenceOutput = reReference.configure(streams, median ? Rhd2000ReReferenceUsb3::CommonMedian :
+                                                                    Rhd2000ReReferenceUsb3::CommonAverage) &&
+                reReference.groupByShank(channelsPerShank) && reReference.setBadChannels(badChannels);
+        if (reReferenceOutput) {
+            cout << "Host re-referencing: common " << (median ? "median" : "average") << " over " <<
+                    reReference.getNumGroups() << " groups of " << channelsPerShank << " channels, " <<
+                    badChannels.size() << " bad channels excluded" << endl;
+        } else {
+            cout << "Warning: re-referencing could not be configured, continuing without it" << endl;
+        }
     }
 
-    SetHandleInformation(parentStdinWrite, HANDLE_FLAG_INHERIT, 0);
-
-    STARTUPINFOA si {};
-    si.cb = sizeof(si);
-    si.dwFlags = STARTF_USESTDHANDLES;
-    si.hStdInput = childStdinRead;
-    si.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
-    si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
-
-    PROCESS_INFORMATION pi {};
-    char cmd[] = "py data_transfer.py";
-
-    cout << "Starting Python FPGA processing..." << endl;
-    if (!CreateProcessA(nullptr, cmd, nullptr, nullptr, TRUE, NORMAL_PRIORITY_CLASS, nullptr, nullptr, &si, &pi)) {
-        cout << "Warning: Python FPGA processing failed to start, continuing without FPGA processing" << endl;
-        CloseHandle(childStdinRead);
-        CloseHandle(parentStdinWrite);
-        childStdinRead = nullptr;
-        parentStdinWrite = nullptr;
-    } else {
-        CloseHandle(childStdinRead);
-        cout << "Python FPGA processing started successfully" << endl;
+    // RHD_DSP_LINE=50 or 60[,harmonics] removes mains interference (3 harmonics by default, with the
+    // line frequency tracked), RHD_DSP_HIGHPASS=f high-pass filters every channel at f Hz, and
+    // RHD_DSP_BANDPASS=low,high[,order] applies a Butterworth band-pass (e.g. 300,6000 for the spike
+    // band; order 4 by default).  They run in that order on a pool of worker threads (RHD_DSP_THREADS
+    // of them, default one per hardware thread) before the data is forwarded or published; the file
+    // keeps the raw samples
+    const char* dspLine = getenv("RHD_DSP_LINE");
+    const char* dspHighPass = getenv("RHD_DSP_HIGHPASS");
+    const char* dspBandPass = getenv("RHD_DSP_BANDPASS");
+    const char* dspThreads = getenv("RHD_DSP_THREADS");
+    double bandLow = 0.0, bandHigh = 0.0;
+    int bandOrder = 4;
+    if (dspBandPass) {
+        sscanf(dspBandPass, "%lf,%lf,%d", &bandLow, &bandHigh, &bandOrder);
+    }
+    double lineHz = 60.0;
+    int lineHarmonics = 3;
+    if (dspLine) {
+        sscanf(dspLine, "%lf,%d", &lineHz, &lineHarmonics);
+    }
+    Rhd2000DspEngineUsb3 dspEngine;
+    Rhd2000LineNoiseFilterUsb3 lineNoiseStage(lineHz, lineHarmonics);
+    Rhd2000DspHighPassStageUsb3 highPassStage(dspHighPass ? atof(dspHighPass) : 0.0);
+    Rhd2000BiquadFilterBankUsb3 bandPassStage(Rhd2000BiquadFilterBankUsb3::BandPass, bandOrder, bandLow, bandHigh);
+    bool dspOutput = false;
+    if (dspLine || dspHighPass || dspBandPass) {
+        if (dspLine) {
+            dspEngine.addStage(&lineNoiseStage);
+        }
+        if (dspHighPass) {
+            dspEngine.addStage(&highPassStage);
+        }
+        if (dspBandPass) {
+            dspEngine.addStage(&bandPassStage);
+        }
+        dspOutput = dspEngine.start(streams, evalBoard->getSampleRate(), dspThreads ? atoi(dspThreads) : 0);
+        if (dspOutput) {
+            cout << "Host DSP:";
+            if (dspLine) {
+                cout << " " << lineHz << " Hz line noise removal (" << lineHarmonics << " harmonics)";
+            }
+            if (dspHighPass) {
+                cout << " " << dspHighPass << " Hz high-pass";
+            }
+            if (dspBandPass) {
+                cout << " " << bandLow << "-" << bandHigh << " Hz band-pass (order " << bandOrder << ")";
+            }
+            cout << " on " << dspEngine.getNumThreads() << " threads" << endl;
+        } else {
+            cout << "Warning: host DSP could not be started, continuing without filtering" << endl;
+        }
+    }
+
+    // Forward data to the downstream FPGA from a dedicated sink thread, which batches blocks
+    // into pipe transfers and keeps a write in flight while the previous one is read back.
+    // Each block goes out as one frame holding every channel of every enabled stream, with
+    // room in the sink for FPGA_SINK_FRAMES_BUFFERED frames.
+    Rhd2000FrameEncoderUsb3 frameEncoder;
+    frameEncoder.selectAllChannels(evalBoard->getEnabledDataStreamMask());
+    unsigned int sinkBuffers = (FPGA_SINK_FRAMES_BUFFERED * frameEncoder.getFrameBytes()) / FPGA_SINK_TRANSFER_BYTES + 1;
+    if (sinkBuffers < FPGA_SINK_NUM_BUFFERS) {
+        sinkBuffers = FPGA_SINK_NUM_BUFFERS;
+    }
+    const char* sinkSerial = getenv("FPGA_SINK_SERIAL");
+    const char* sinkBitfile = getenv("FPGA_SINK_BITFILE");
+    const char* sinkVerify = getenv("FPGA_SINK_VERIFY");
+    bool fpgaVerify = sinkVerify && strcmp(sinkVerify, "0") != 0;
+    Rhd2000FpgaSinkUsb3 fpgaSink(FPGA_SINK_TRANSFER_BYTES, sinkBuffers);
+    Rhd2000LoopbackVerifierUsb3 fpgaVerifier;
+    if (fpgaVerify) {
+        fpgaVerifier.attach(fpgaSink);
+    }
+    cout << "Starting downstream FPGA sink..." << endl;
+    bool fpgaOutput = fpgaSink.open(sinkSerial ? sinkSerial : DEFAULT_FPGA_SINK_SERIAL,
+                                    sinkBitfile ? sinkBitfile : DEFAULT_FPGA_SINK_BITFILE);
+    if (!fpgaOutput) {
+        cout << "Warning: downstream FPGA could not be opened, continuing without FPGA processing" << endl;
     }
 
-    // Start continuous data acquisition
-    queue<Rhd2000DataBlockUsb3> dataQueue;
+    // Start continuous data acquisition.  A dedicated reader thread drains the USB FIFO into
+    // a ring of preallocated blocks, so a slow file, pipe or SHM write below cannot stall it.
+    // Blocks hold native 16-bit samples, halving the bytes moved to disk, pipe and SHM.
+    evalBoard->setSampleFormat(Rhd2000DataBlockUsb3::UInt16Samples);
     evalBoard->setContinuousRunMode(true);
     evalBoard->run();
+    evalBoard->startReaderThread();
+    Rhd2000DataBlockRingUsb3* dataBlockRing = evalBoard->getDataBlockRing();
 
     cout << "Starting data acquisition..." << endl;
     cout << "Enabled data streams: " << evalBoard->getNumEnabledDataStreams() << endl;
 
     int total_num_samples = 0;
     int datain_index = 0;
-    uint32_t timestamp = 0;
     unsigned long frameCount = 0;
     bool usbDataRead;
     
     do {
-        usbDataRead = evalBoard->readDataBlocks(1, dataQueue);
+        Rhd2000DataBlockUsb3* ringBlock = dataBlockRing->front();
+        usbDataRead = (ringBlock != nullptr);
 
         if (usbDataRead) {
-            Rhd2000DataBlockUsb3 curr_data_block = dataQueue.front();
-            dataQueue.pop();
+            Rhd2000DataBlockUsb3 &curr_data_block = *ringBlock;
             total_num_samples++;
             // cout << "total_num_samples so far: " << total_num_samples << endl;
             // cout << "new data queue size: " << dataQueue.size() << endl;
@@ -300,51 +361,141 @@ int main(int argc, char* argv[])
             // } // for (int channel = 0; channel < CHANNELS_PER_STREAM; channel++)
 
             // 1. Save to file (original functionality - restored from main.cpp)
-            curr_data_block.write(saveOut, evalBoard->getNumEnabledDataStreams());
-
-            // 2. Send to FPGA via Python pipe (original functionality - restored from main.cpp)
-            if (parentStdinWrite) {
-                DWORD bytes_written;
-                char* msg_to_send = (char*) curr_data_block.amplifierDataFast;
-                DWORD bytes_to_write = CHANNELS_PER_STREAM * SAMPLES_PER_DATA_BLOCK * sizeof(int);
-                WriteFile(parentStdinWrite, msg_to_send, bytes_to_write, &bytes_written, nullptr);
-                // cout << "Wrote " << bytes_written << " bytes to python program" << endl;
+            fileWriter.writeBlock(curr_data_block, evalBoard->getNumEnabledDataStreams());
+
+            if (reReferenceOutput) {
+                reReference.apply(curr_data_block);
+            }
+            if (dspOutput) {
+                dspEngine.processBlock(curr_data_block);
+            }
+
+            // 2. Send to the downstream FPGA as one frame; never waits on USB
+            if (fpgaOutput) {
+                unsigned int frameBytes = frameEncoder.encode(curr_data_block);
+                if (frameBytes > 0 && fpgaVerify) {
+                    fpgaVerifier.submit(fpgaSink, frameEncoder.getFrame(), frameBytes);
+                } else if (frameBytes > 0) {
+                    fpgaSink.submit(frameEncoder.getFrame(), frameBytes);
+                }
             }
 
             // 3. Copy to shared memory for visualization (NEW!)
             if (shmOutput) {
-                size_t w = 0;
-                auto computeIndex = [streams](int s, int ch, int t) { 
-                    return (t * streams * CHANNELS_PER_STREAM) + (ch * streams) + s; 
-                };
-                
-                for (int t = 0; t < samplesPerBlock; ++t) {
-                    for (int s = 0; s < streams; ++s) {
+                unsigned short* shmWords = reinterpret_cast<unsigned short*>(sharedRing.beginWrite());
+                if (curr_data_block.getSampleFormat() == Rhd2000DataBlockUsb3::UInt16Samples &&
+                        curr_data_block.getAmplifierLayout() == Rhd2000DataBlockUsb3::TimeMajor) {
+                    // Already in [t][channel][stream] order
+                    memcpy(shmWords, curr_data_block.amplifierData16.data(), shmSlotBytes);
+                } else {
+                    size_t w = 0;
+                    for (int t = 0; t < samplesPerBlock; ++t) {
                         for (int ch = 0; ch < channelsPerStream; ++ch) {
-                            int code = curr_data_block.amplifierDataFast[computeIndex(s, ch, t)];
-                            float uV = (float)((code - 32768) * 0.195f);  // Convert to microvolts
-                            shmOutput[w++] = { (uint32_t)s, (uint32_t)ch, uV };
+                            for (int s = 0; s < streams; ++s) {
+                                shmWords[w++] = (unsigned short) curr_data_block.amplifierSample(s, ch, t);
+                            }
                         }
                     }
                 }
-                timestamp += samplesPerBlock;
-                header->timestamp = timestamp;
+                // The block's own first time stamp, so slots stay aligned with the saved file across
+                // dropped blocks and gaps
+                sharedRing.commitWrite(shmSlotBytes, curr_data_block.timeStamp[0]);
                 
                 if (((++frameCount) % 50) == 0) {
-                    cout << "SHM Published frame " << frameCount << " ts=" << timestamp << " bytes=" << (blocks * sizeof(IntanDataBlock)) << endl;
+                    cout << "SHM Published frame " << frameCount << " ts=" << curr_data_block.timeStamp[0] << " bytes=" << shmSlotBytes << endl;
+                    Rhd2000AsyncFileWriterUsb3::WriterStats writerStats;
+                    fileWriter.getStats(writerStats);
+                    cout << "Disk writer: queue " << writerStats.queueDepth << "/" << writerStats.numBuffers <<
+                            " written " << writerStats.numBytesWritten << " bytes, p99 latency " <<
+                            writerStats.latency99Ms << " ms, dropped " << writerStats.numBlocksDropped << " blocks" << endl;
+                    if (fpgaOutput) {
+                        Rhd2000FpgaSinkUsb3::SinkStats sinkStats;
+                        fpgaSink.getStats(sinkStats);
+                        cout << "FPGA sink: " << sinkStats.numTransfers << " transfers, p99 round trip " <<
+                                sinkStats.latency99Ms << " ms, dropped " << sinkStats.numBytesDropped << " bytes" << endl;
+                    }
+                    if (fpgaOutput && fpgaVerify) {
+                        Rhd2000LoopbackVerifierUsb3::VerifierStats verifierStats;
+                        fpgaVerifier.getStats(verifierStats);
+                        cout << "FPGA loopback: " << verifierStats.numBlocksVerified << " blocks verified, " <<
+                                verifierStats.numBlocksMismatched << " mismatched, " << verifierStats.numBlocksLost <<
+                                " lost" << endl;
+                    }
                 }
             }
+
+            if (pyramidOutput) {
+                pyramid.addBlock(curr_data_block);
+            }
+
+            dataBlockRing->pop();
+        } else {
+            Sleep(1);
         }
-    } while (usbDataRead || evalBoard->isRunning());
+    } while (usbDataRead || evalBoard->isRunning() || evalBoard->getNumWordsInFifo() > 0);
 
     // cout << "Total samples collected: " << total_num_samples << endl;
 
     // Cleanup
+    evalBoard->stopReaderThread();
+    if (evalBoard->getReaderStallCount() > 0) {
+        cout << "Warning: reader thread stalled " << evalBoard->getReaderStallCount() <<
+                " times on a full ring (max occupancy " << dataBlockRing->getMaxOccupancy() << ")" << endl;
+    }
     evalBoard->flush();
-    saveOut.close();
+    Rhd2000EvalBoardUsb3::UsbReadStats usbStats;
+    evalBoard->getUsbReadStats(usbStats);
+    if (usbStats.numResyncs > 0 || usbStats.numTimeStampGaps > 0) {
+        cout << "Warning: USB stream resynchronized " << usbStats.numResyncs << " times (" << usbStats.numFramesLost <<
+                " frames lost, " << usbStats.numBlocksFlagged << " blocks flagged)" << endl;
+    }
+    Rhd2000TimeStampMonitorUsb3::MonitorStats monitorStats;
+    evalBoard->getTimeStampMonitor().getStats(monitorStats);
+    if (monitorStats.numGaps > 0 || monitorStats.numRepeats > 0) {
+        cout << "Warning: " << monitorStats.numSamplesDropped << " samples dropped in " << monitorStats.numGaps <<
+                " time stamp gaps (longest " << monitorStats.maxGapSamples << "), " << monitorStats.numSamplesRepeated <<
+                " repeated" << endl;
+    }
+    fileWriter.close();
+    if (dspOutput) {
+        Rhd2000DspEngineUsb3::DspStats dspStats;
+        dspEngine.getStats(dspStats);
+        dspEngine.stop();
+        cout << "Host DSP: " << dspStats.numBlocksProcessed << " blocks in " << dspStats.numTilesProcessed <<
+                " tiles (" << dspStats.numTilesStolen << " stolen), " << dspStats.busySeconds << " s busy" << endl;
+        if (dspLine) {
+            cout << "Line frequency tracked on stream 0: " << lineNoiseStage.getLineFrequency(0) << " Hz" << endl;
+        }
+    }
+    Rhd2000AsyncFileWriterUsb3::WriterStats writerStats;
+    fileWriter.getStats(writerStats);
+    if (writerStats.numBlocksDropped > 0 || writerStats.numWriteErrors > 0) {
+        cout << "Warning: disk writer dropped " << writerStats.numBlocksDropped << " of " <<
+                writerStats.numBlocksQueued + writerStats.numBlocksDropped << " blocks (" <<
+                writerStats.numWriteErrors << " write errors, max queue depth " << writerStats.maxQueueDepth << ")" << endl;
+    }
+    if (writerStats.numFillFrames > 0) {
+        cout << "Wrote " << writerStats.numFillFrames << " fill frames in place of missing samples" << endl;
+    }
     
-    if (parentStdinWrite) {
-        CloseHandle(parentStdinWrite);
+    if (fpgaOutput) {
+        fpgaSink.close();
+        Rhd2000FpgaSinkUsb3::SinkStats sinkStats;
+        fpgaSink.getStats(sinkStats);
+        cout << "FPGA sink: " << sinkStats.numBytesWritten << " bytes in " << sinkStats.numTransfers <<
+                " transfers, round trip p50 " << sinkStats.latencyMedianMs << " ms p99 " << sinkStats.latency99Ms <<
+                " ms max " << sinkStats.latencyMaxMs << " ms, " << sinkStats.numBytesDropped << " bytes dropped, " <<
+                sinkStats.numErrors << " errors" << endl;
+        if (fpgaVerify) {
+            Rhd2000LoopbackVerifierUsb3::VerifierStats verifierStats;
+            fpgaVerifier.getStats(verifierStats);
+            cout << "FPGA loopback: " << verifierStats.numBlocksVerified << " of " << verifierStats.numBlocksSent <<
+                    " blocks verified, " << verifierStats.numBlocksLost << " lost, " <<
+                    verifierStats.numBlocksMismatched << " mismatched (" <<
+                    verifierStats.numWordsMismatched << " words, first at block " << verifierStats.firstMismatchedBlock <<
+                    "), " << verifierStats.megabytesPerSecond << " MB/s, latency p99 " << verifierStats.latency99Ms <<
+                    " ms" << endl;
+        }
     }
 
     // Turn off LED
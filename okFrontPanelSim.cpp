@@ -0,0 +1,1064 @@
+//----------------------------------------------------------------------------------
+// okFrontPanelSim.cpp
+//
+// Simulated Opal Kelly FrontPanel backend.  Implements the okCFrontPanel wrapper class
+// declared in okFrontPanelDLL.h on top of a software model of an XEM6310 running the
+// Rhythm USB3 interface, so the host pipeline can be exercised and benchmarked without
+// hardware.  Build with this file instead of okFrontPanelDLL.cpp (see build_sim.sh).
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <utility>
+#include <cstdlib>
+#include <cstring>
+
+#include "okFrontPanelSim.h"
+
+using namespace std;
+
+// Simulated device model.  Endpoint addresses and constants mirror the Rhythm USB3
+// FPGA interface (see Rhd2000EvalBoardUsb3::OkEndPoint).
+namespace {
+
+const double ReferenceClockHz = 100.0e6;
+const int ClockCyclesPerSample = 2800;      // 80 clock cycles per SPI command x (32 + 3) commands
+
+const int RhythmBoardId = 700;
+const int RhythmBoardVersion = 1;
+const int RhythmBoardMode = 13;
+const unsigned long long FifoCapacityWords = 67108864;
+const unsigned long long RhythmMagicNumber = 0xd7a22aaa38132a53ULL;
+
+const int ChannelsPerStream = 32;
+const int NumBoardAdcs = 8;
+const int FreeRunDepthFrames = 57 * 128;    // FIFO depth kept in free-running mode (MAX_NUM_BLOCKS blocks)
+const int DefaultTimeoutMs = 10000;
+const unsigned long long LoopbackFifoBytes = 4194304;
+const int LoopbackLatencyUs = 250;              // time for the loopback design to pass data through
+const int LoopbackTransferOverheadUs = 50;      // per pipe transfer
+const double LoopbackBytesPerUs = 320.0;        // USB 3.0 pipe throughput
+
+const int NumAuxCmdSlots = 3;
+const int NumCommandBanks = 16;
+const int CommandRamWords = 1024;
+
+const int WaveTableBits = 12;
+const int WaveTableSize = 1 << WaveTableBits;
+const double SignalAmplitude = 1500.0;      // ~290 uV at 0.195 uV/bit
+const double MainsAmplitude = 400.0;
+const double MainsFrequency = 60.0;
+
+enum SimEndPoint {
+    WireInResetRun = 0x00,
+    WireInMaxTimeStep = 0x01,
+    WireInDataFreqPll = 0x03,
+    WireInCmdRamAddr = 0x05,
+    WireInCmdRamBank = 0x06,
+    WireInCmdRamData = 0x07,
+    WireInLoopbackReset = 0x10,
+    WireInDataStreamEn = 0x14,
+    WireInTtlOut = 0x15,
+
+    TrigInConfig = 0x40,
+    TrigInSpiStart = 0x41,
+
+    WireOutNumWords = 0x20,
+    WireOutSerialDigitalIn = 0x21,
+    WireOutSpiRunning = 0x22,
+    WireOutTtlIn = 0x23,
+    WireOutDataClkLocked = 0x24,
+    WireOutBoardMode = 0x25,
+    WireOutBoardId = 0x3e,
+    WireOutBoardVersion = 0x3f,
+
+    PipeInLoopback = 0x80,
+    PipeInCmdRam = 0x80,
+    PipeOutData = 0xa0
+};
+
+// A contiguous run of frames in the FIFO sharing one data stream configuration.  Frames
+// are synthesized on demand from their time stamps, so the FIFO only stores bookkeeping.
+struct SimSegment {
+    unsigned int firstTimeStamp;
+    unsigned long long numFrames;
+    unsigned long long bytesRead;
+    vector<int> streams;
+    unsigned int frameWords;
+    unsigned int ttlOut;
+    vector<unsigned int> phaseStep;     // per (channel, stream) signal phase increment
+    unsigned int mainsPhaseStep;
+    long long firstRigSample;           // rig clock sample of the first frame
+    unsigned int syncTtlIn;             // TTL in word while the sync pulse is high
+    long long syncPeriod;               // in samples; 0 for no sync pulse
+    long long syncWidth;
+};
+
+struct SimDevice {
+    string serial;
+    bool isOpen;
+    bool configured;
+    bool loopback;              // downstream FPGA echoing pipe-in 0x80 to pipe-out 0xA0
+
+    UINT32 wireIns[32];
+    UINT32 wireOuts[32];
+
+    double sampleRate;
+    bool running;
+    bool continuous;
+    unsigned int maxTimeStep;
+    unsigned int nextTimeStamp;
+    unsigned long long framesThisRun;
+    chrono::steady_clock::time_point runStart;
+    long long runStartRigSample;        // rig clock sample of time stamp 0 of this run
+    bool newSegment;
+
+    vector<unsigned short> commandRam;  // [slot][bank][address]; cleared by reset and configuration
+
+    deque<SimSegment> fifo;
+    unsigned long long fifoWords;
+    unsigned long long glitchBytes;     // to be lost from the middle of the next data pipe read,
+    vector<pair<unsigned int, unsigned int> > glitchPlaces;    // or at these (offset, bytes) instead
+    deque<unsigned char> loopbackFifo;
+    deque<pair<chrono::steady_clock::time_point, unsigned long long> > loopbackArrivals;   // when bytes become readable
+    unsigned int loopbackFailedWrites;  // pipe-in writes still to fail (see okFrontPanelSim_FailPipeInWrites())
+
+    okTSimDeviceStats stats;
+    mutex deviceMutex;
+};
+
+struct SimHandle {
+    SimDevice *device;
+    int timeoutMs;
+    UINT32 wireIns[32];         // host-side values, sent to the device by UpdateWireIns()
+};
+
+mutex registryMutex;
+vector<SimDevice*> registry;
+
+// Rig clock shared by all simulated devices, and the sync pulse every Rhythm board sees on its TTL
+// inputs (leaf lock: taken while a device is locked)
+mutex syncMutex;
+const chrono::steady_clock::time_point rigEpoch = chrono::steady_clock::now();
+int syncTtlBit = -1;
+double syncPeriodSeconds = 0.0;
+double syncWidthSeconds = 0.0;
+bool realTimeMode = true;
+int controlTransferUs = 0;
+vector<short> waveTable;
+
+void buildRegistry()
+{
+    if (!registry.empty()) return;
+
+    waveTable.resize(WaveTableSize);
+    for (int i = 0; i < WaveTableSize; ++i) {
+        waveTable[i] = (short) floor(sin(2.0 * 3.1415926535897 * i / WaveTableSize) * 32767.0 + 0.5);
+    }
+
+    string list = "SIMRHD0001";
+    const char *env = getenv("OK_SIM_DEVICES");
+    if (env && env[0] != '\0') list = env;
+
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == string::npos) end = list.size();
+        string serial = list.substr(start, end - start);
+        bool loopback = false;
+        size_t colon = serial.find(':');
+        if (colon != string::npos) {
+            loopback = (serial.substr(colon + 1) == "loopback");
+            serial = serial.substr(0, colon);
+        }
+        if (!serial.empty()) {
+            SimDevice *device = new SimDevice();
+            device->serial = serial.substr(0, MAX_SERIALNUMBER_LENGTH);
+            device->isOpen = false;
+            device->configured = false;
+            device->loopback = loopback;
+            device->commandRam.assign(NumAuxCmdSlots * NumCommandBanks * CommandRamWords, 0);
+            registry.push_back(device);
+        }
+        start = end + 1;
+    }
+}
+
+SimDevice* findDevice(const string &serial)
+{
+    for (unsigned int i = 0; i < registry.size(); ++i) {
+        if (registry[i]->serial == serial) return registry[i];
+    }
+    return nullptr;
+}
+
+// Return device to its power-on state (FIFO empty, command RAM cleared, SPI stopped, 30 kS/s).
+void resetDevice(SimDevice *d)
+{
+    fill(d->commandRam.begin(), d->commandRam.end(), 0);
+    d->sampleRate = 30000.0;
+    d->running = false;
+    d->continuous = false;
+    d->maxTimeStep = 0;
+    d->nextTimeStamp = 0;
+    d->framesThisRun = 0;
+    d->runStartRigSample = 0;
+    d->newSegment = true;
+    d->fifo.clear();
+    d->fifoWords = 0;
+    d->glitchBytes = 0;
+    d->glitchPlaces.clear();
+    d->loopbackFifo.clear();
+    d->loopbackArrivals.clear();
+    d->loopbackFailedWrites = 0;
+}
+
+void startSegment(SimDevice *d)
+{
+    SimSegment seg;
+    UINT32 mask = d->wireIns[WireInDataStreamEn];
+
+    seg.firstTimeStamp = d->nextTimeStamp;
+    seg.numFrames = 0;
+    seg.bytesRead = 0;
+    for (int i = 0; i < 32; ++i) {
+        if (mask & (1u << i)) seg.streams.push_back(i);
+    }
+    int n = (int) seg.streams.size();
+    seg.frameWords = 4 + 2 + n * (ChannelsPerStream + 3) + (n % 4) + NumBoardAdcs + 2;
+    seg.ttlOut = d->wireIns[WireInTtlOut] & 0xffff;
+
+    // Give every (stream, channel) its own test tone between 10 Hz and 3 kHz.
+    const double phaseScale = 4294967296.0 / d->sampleRate;
+    seg.phaseStep.resize(ChannelsPerStream * n);
+    for (int channel = 0; channel < ChannelsPerStream; ++channel) {
+        for (int k = 0; k < n; ++k) {
+            double freq = 10.0 * (1 + ((seg.streams[k] * ChannelsPerStream + channel) * 7) % 300);
+            seg.phaseStep[channel * n + k] = (unsigned int) (freq * phaseScale);
+        }
+    }
+    seg.mainsPhaseStep = (unsigned int) (MainsFrequency * phaseScale);
+
+    seg.firstRigSample = d->runStartRigSample + (long long) d->framesThisRun;
+    {
+        lock_guard<mutex> lockSync(syncMutex);
+        seg.syncTtlIn = (syncTtlBit >= 0) ? (1u << syncTtlBit) : 0;
+        seg.syncPeriod = (syncTtlBit >= 0) ? max(llround(syncPeriodSeconds * d->sampleRate), 1LL) : 0;
+        seg.syncWidth = llround(syncWidthSeconds * d->sampleRate);
+    }
+
+    d->fifo.push_back(seg);
+    d->newSegment = false;
+}
+
+// Move simulated time forward, pushing any newly acquired frames into the FIFO.
+void advance(SimDevice *d)
+{
+    if (!d->running) return;
+
+    unsigned long long target;
+    if (realTimeMode) {
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - d->runStart).count();
+        target = (unsigned long long) (elapsed * d->sampleRate);
+    } else {
+        unsigned int frameWords = d->fifo.empty() ? 1 : d->fifo.back().frameWords;
+        unsigned long long depth = d->fifoWords / frameWords;
+        target = d->framesThisRun + ((depth < FreeRunDepthFrames) ? (FreeRunDepthFrames - depth) : 0);
+    }
+    if (!d->continuous && target >= d->maxTimeStep) {
+        target = d->maxTimeStep;
+        d->running = false;
+    }
+    if (target <= d->framesThisRun) return;
+
+    unsigned long long newFrames = target - d->framesThisRun;
+    if (d->newSegment) startSegment(d);
+    SimSegment &seg = d->fifo.back();
+
+    unsigned long long room = (FifoCapacityWords - d->fifoWords) / seg.frameWords;
+    unsigned long long accepted = (newFrames < room) ? newFrames : room;
+    seg.numFrames += accepted;
+    d->fifoWords += accepted * seg.frameWords;
+    d->stats.framesGenerated += accepted;
+
+    if (accepted < newFrames) {
+        // FIFO overflow: frames are lost, but time stamps keep counting.
+        d->stats.framesDropped += newFrames - accepted;
+        d->newSegment = true;
+    }
+    d->nextTimeStamp += (unsigned int) newFrames;
+    d->framesThisRun = target;
+}
+
+inline void putWord(unsigned char *&p, unsigned int word)
+{
+    *p++ = (unsigned char) (word & 0xff);
+    *p++ = (unsigned char) ((word >> 8) & 0xff);
+}
+
+// Synthesize one complete USB frame in the Rhythm USB3 format.
+void buildFrame(const SimSegment &seg, unsigned long long frameIndex, unsigned char *out)
+{
+    unsigned char *p = out;
+    unsigned int timeStamp = seg.firstTimeStamp + (unsigned int) frameIndex;
+    int n = (int) seg.streams.size();
+    int i, channel, k;
+
+    for (i = 0; i < 8; ++i) {
+        *p++ = (unsigned char) ((RhythmMagicNumber >> (8 * i)) & 0xff);
+    }
+    putWord(p, timeStamp & 0xffff);
+    putWord(p, timeStamp >> 16);
+
+    // Auxiliary command results read back as zero.
+    for (i = 0; i < 3 * n; ++i) {
+        putWord(p, 0);
+    }
+
+    int mains = (int) (MainsAmplitude / 32767.0 *
+                       waveTable[(seg.mainsPhaseStep * timeStamp) >> (32 - WaveTableBits)]);
+    const unsigned int *step = &seg.phaseStep[0];
+    for (channel = 0; channel < ChannelsPerStream; ++channel) {
+        for (k = 0; k < n; ++k) {
+            int tone = (int) (waveTable[(*step++ * timeStamp) >> (32 - WaveTableBits)] * (SignalAmplitude / 32767.0));
+            putWord(p, (unsigned int) (32768 + tone + mains));
+        }
+    }
+
+    // Filler words keep each frame a multiple of 64 bits.
+    for (i = 0; i < n % 4; ++i) {
+        putWord(p, 0);
+    }
+
+    for (i = 0; i < NumBoardAdcs; ++i) {
+        putWord(p, 32768);
+    }
+    unsigned int ttlIn = 0;
+    if (seg.syncPeriod > 0) {
+        long long phase = (seg.firstRigSample + (long long) frameIndex) % seg.syncPeriod;
+        if (phase < 0) phase += seg.syncPeriod;
+        if (phase < seg.syncWidth) ttlIn = seg.syncTtlIn;
+    }
+    putWord(p, ttlIn);          // TTL in
+    putWord(p, seg.ttlOut);     // TTL out
+}
+
+// Copy numBytes of FIFO contents to data, consuming them.
+void drainFifo(SimDevice *d, unsigned char *data, unsigned long long numBytes)
+{
+    vector<unsigned char> scratch;
+
+    while (numBytes > 0 && !d->fifo.empty()) {
+        SimSegment &seg = d->fifo.front();
+        unsigned long long frameBytes = 2ULL * seg.frameWords;
+        unsigned long long segBytes = seg.numFrames * frameBytes;
+
+        while (numBytes > 0 && seg.bytesRead < segBytes) {
+            unsigned long long frameIndex = seg.bytesRead / frameBytes;
+            unsigned long long offset = seg.bytesRead % frameBytes;
+            unsigned long long chunk = frameBytes - offset;
+            if (chunk > numBytes) chunk = numBytes;
+
+            if (chunk == frameBytes) {
+                buildFrame(seg, frameIndex, data);
+            } else {
+                scratch.resize((size_t) frameBytes);
+                buildFrame(seg, frameIndex, &scratch[0]);
+                memcpy(data, &scratch[(size_t) offset], (size_t) chunk);
+            }
+            data += chunk;
+            numBytes -= chunk;
+            seg.bytesRead += chunk;
+            d->fifoWords -= chunk / 2;
+        }
+
+        // The tail segment keeps growing while the SPI interface runs; retire any other
+        // segment once it has been read out completely.
+        if (seg.bytesRead < segBytes || (d->fifo.size() == 1 && d->running && !d->newSegment)) {
+            break;
+        }
+        d->fifo.pop_front();
+    }
+    if (numBytes > 0) {
+        memset(data, 0, (size_t) numBytes);
+    }
+}
+
+SimDevice* deviceOf(okFrontPanel_HANDLE h)
+{
+    return ((SimHandle*) h)->device;
+}
+
+// Stand in for the round trip of a wire or trigger update over the USB control endpoint.
+void controlTransferDelay()
+{
+    if (controlTransferUs > 0) {
+        this_thread::sleep_for(chrono::microseconds(controlTransferUs));
+    }
+}
+
+// Store one word in the command RAM of an auxiliary command slot (0-2).
+void writeCommandRam(SimDevice *d, int slot, int bank, int address, unsigned int word)
+{
+    d->commandRam[(slot * NumCommandBanks + bank) * CommandRamWords + address] = (unsigned short) word;
+}
+
+// Command RAM pipe-in: each little-endian 32-bit word holds the slot (1-3) in bits 31-30, the bank
+// in bits 29-26, the address in bits 25-16 and the command in bits 15-0.  Slot 0 words are padding.
+void writeCommandRamPipe(SimDevice *d, const unsigned char *data, long length)
+{
+    for (long i = 0; i + 4 <= length; i += 4) {
+        unsigned int word = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16) | ((unsigned int) data[i + 3] << 24);
+        int slot = (int) (word >> 30);
+        if (slot != 0) {
+            writeCommandRam(d, slot - 1, (word >> 26) & 0x0f, (word >> 16) & 0x3ff, word & 0xffff);
+        }
+    }
+}
+
+// Time a pipe transfer of numBytes occupies the USB link.
+chrono::microseconds loopbackTransferTime(long numBytes)
+{
+    return chrono::microseconds(LoopbackTransferOverheadUs + (long long) (numBytes / LoopbackBytesPerUs));
+}
+
+// Number of loopback FIFO bytes that have made it through the design by now.
+unsigned long long loopbackReadableBytes(SimDevice *d)
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    unsigned long long numBytes = 0;
+    for (unsigned int i = 0; i < d->loopbackArrivals.size() && d->loopbackArrivals[i].first <= now; ++i) {
+        numBytes += d->loopbackArrivals[i].second;
+    }
+    return numBytes;
+}
+
+// Read back bytes a loopback device has echoed, stalling until length bytes are available or
+// the timeout expires.
+long readLoopbackPipeOut(SimDevice *d, int timeoutMs, long length, unsigned char *data)
+{
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+
+    unique_lock<mutex> lockDevice(d->deviceMutex);
+    while (loopbackReadableBytes(d) < (unsigned long long) length) {
+        if (chrono::steady_clock::now() >= deadline) {
+            return ok_Timeout;
+        }
+        lockDevice.unlock();
+        this_thread::sleep_for(chrono::microseconds(20));
+        lockDevice.lock();
+    }
+
+    copy(d->loopbackFifo.begin(), d->loopbackFifo.begin() + length, data);
+    d->loopbackFifo.erase(d->loopbackFifo.begin(), d->loopbackFifo.begin() + length);
+    unsigned long long remaining = (unsigned long long) length;
+    while (remaining > 0) {
+        unsigned long long chunk = min(remaining, d->loopbackArrivals.front().second);
+        d->loopbackArrivals.front().second -= chunk;
+        if (d->loopbackArrivals.front().second == 0) {
+            d->loopbackArrivals.pop_front();
+        }
+        remaining -= chunk;
+    }
+    d->stats.pipeReads++;
+    d->stats.bytesRead += length;
+    lockDevice.unlock();
+
+    this_thread::sleep_for(loopbackTransferTime(length));
+    return length;
+}
+
+} // namespace
+
+
+void okFrontPanelSim_SetRealTime(bool realTime)
+{
+    lock_guard<mutex> lockRegistry(registryMutex);
+    realTimeMode = realTime;
+}
+
+bool okFrontPanelSim_IsRealTime()
+{
+    lock_guard<mutex> lockRegistry(registryMutex);
+    return realTimeMode;
+}
+
+bool okFrontPanelSim_InjectDataGlitch(const string &serial, unsigned int numBytes)
+{
+    lock_guard<mutex> lockRegistry(registryMutex);
+    buildRegistry();
+    SimDevice *d = findDevice(serial);
+    if (!d || d->loopback || (numBytes % 2) != 0) return false;
+
+    lock_guard<mutex> lockDevice(d->deviceMutex);
+    if (!d->glitchPlaces.empty()) return false;
+    d->glitchBytes += numBytes;
+    return true;
+}
+
+bool okFrontPanelSim_InjectDataGlitches(const string &serial, const vector<pair<unsigned int, unsigned int> > &glitches)
+{
+    lock_guard<mutex> lockRegistry(registryMutex);
+    buildRegistry();
+    SimDevice *d = findDevice(serial);
+    if (!d || d->loopback || glitches.empty()) return false;
+    for (size_t i = 0; i < glitches.size(); ++i) {
+        if ((glitches[i].first % 2) != 0 || (glitches[i].second % 2) != 0) return false;
+        if (i > 0 && glitches[i].first < glitches[i - 1].first) return false;
+    }
+
+    lock_guard<mutex> lockDevice(d->deviceMutex);
+    if (d->glitchBytes > 0) return false;
+    d->glitchPlaces = glitches;
+    for (size_t i = 0; i < glitches.size(); ++i) {
+        d->glitchBytes += glitches[i].second;
+    }
+    return true;
+}
+
+bool okFrontPanelSim_FailPipeInWrites(const string &serial, unsigned int numWrites)
+{
+    lock_guard<mutex> lockRegistry(registryMutex);
+    buildRegistry();
+    SimDevice *d = findDevice(serial);
+    if (!d || !d->loopback) return false;
+
+    lock_guard<mutex> lockDevice(d->deviceMutex);
+    d->loopbackFailedWrites = numWrites;
+    return true;
+}
+
+void okFrontPanelSim_SetControlTransferTime(int microseconds)
+{
+    lock_guard<mutex> lockRegistry(registryMutex);
+    controlTransferUs = max(microseconds, 0);
+}
+
+bool okFrontPanelSim_GetCommandRam(const string &serial, int slot, int bank, vector<int> &words)
+{
+    lock_guard<mutex> lockRegistry(registryMutex);
+    buildRegistry();
+    SimDevice *d = findDevice(serial);
+    if (!d || d->loopback || slot < 1 || slot > NumAuxCmdSlots || bank < 0 || bank >= NumCommandBanks) return false;
+
+    lock_guard<mutex> lockDevice(d->deviceMutex);
+    const unsigned short *ram = &d->commandRam[((slot - 1) * NumCommandBanks + bank) * CommandRamWords];
+    words.assign(ram, ram + CommandRamWords);
+    return true;
+}
+
+bool okFrontPanelSim_GetFpgaWireIns(const string &serial, vector<unsigned int> &wireIns)
+{
+    lock_guard<mutex> lockRegistry(registryMutex);
+    buildRegistry();
+    SimDevice *d = findDevice(serial);
+    if (!d) return false;
+
+    lock_guard<mutex> lockDevice(d->deviceMutex);
+    wireIns.assign(d->wireIns, d->wireIns + 32);
+    return true;
+}
+
+void okFrontPanelSim_SetSyncPulse(int ttlBit, double periodSeconds, double widthSeconds)
+{
+    lock_guard<mutex> lockSync(syncMutex);
+    syncTtlBit = (ttlBit >= 0 && ttlBit < 16 && periodSeconds > 0.0) ? ttlBit : -1;
+    syncPeriodSeconds = periodSeconds;
+    syncWidthSeconds = widthSeconds;
+}
+
+bool okFrontPanelSim_GetRigClockSample(const string &serial, unsigned int timeStamp, long long &rigSample)
+{
+    lock_guard<mutex> lockRegistry(registryMutex);
+    buildRegistry();
+    SimDevice *d = findDevice(serial);
+    if (!d || d->loopback) return false;
+
+    lock_guard<mutex> lockDevice(d->deviceMutex);
+    rigSample = d->runStartRigSample + timeStamp;
+    return true;
+}
+
+bool okFrontPanelSim_GetDeviceStats(const string &serial, okTSimDeviceStats &stats)
+{
+    lock_guard<mutex> lockRegistry(registryMutex);
+    buildRegistry();
+    SimDevice *d = findDevice(serial);
+    if (!d) return false;
+
+    lock_guard<mutex> lockDevice(d->deviceMutex);
+    stats = d->stats;
+    return true;
+}
+
+
+//------------------------------------------------------------------------
+// FrontPanel library entry points
+//------------------------------------------------------------------------
+Bool okFrontPanelDLL_LoadLib(okFP_dll_pchar)
+{
+    lock_guard<mutex> lockRegistry(registryMutex);
+    buildRegistry();
+    return TRUE;
+}
+
+void okFrontPanelDLL_FreeLib(void)
+{
+}
+
+void DLL_ENTRY okFrontPanelDLL_GetVersion(char *date, char *time)
+{
+    strcpy(date, "Simulated");
+    strcpy(time, __DATE__);
+}
+
+
+//------------------------------------------------------------------------
+// okCFrontPanel C++ wrapper class (simulated)
+//------------------------------------------------------------------------
+bool okCFrontPanel::to_bool(Bool x)
+    { return( (x==TRUE)?(true):(false) ); }
+Bool okCFrontPanel::from_bool(bool x)
+    { return( (x==true)?(TRUE):(FALSE) ); }
+
+okCFrontPanel::okCFrontPanel()
+{
+    SimHandle *handle = new SimHandle;
+    handle->device = nullptr;
+    handle->timeoutMs = DefaultTimeoutMs;
+    memset(handle->wireIns, 0, sizeof(handle->wireIns));
+    h = handle;
+
+    lock_guard<mutex> lockRegistry(registryMutex);
+    buildRegistry();
+}
+
+okCFrontPanel::~okCFrontPanel()
+{
+    SimDevice *d = deviceOf(h);
+    if (d) {
+        lock_guard<mutex> lockDevice(d->deviceMutex);
+        d->isOpen = false;
+    }
+    delete (SimHandle*) h;
+}
+
+int okCFrontPanel::GetHostInterfaceWidth()
+    { return 32; }
+bool okCFrontPanel::IsHighSpeed()
+    { return true; }
+
+okCFrontPanel::BoardModel okCFrontPanel::GetBoardModel()
+    { return deviceOf(h) ? brdXEM6310LX45 : brdUnknown; }
+
+std::string okCFrontPanel::GetBoardModelString(okCFrontPanel::BoardModel m)
+    { return (m == brdXEM6310LX45) ? "XEM6310LX45 (simulated)" : "Unknown"; }
+
+int okCFrontPanel::GetDeviceCount()
+{
+    lock_guard<mutex> lockRegistry(registryMutex);
+    return (int) registry.size();
+}
+
+okCFrontPanel::BoardModel okCFrontPanel::GetDeviceListModel(int num)
+{
+    lock_guard<mutex> lockRegistry(registryMutex);
+    return (num >= 0 && num < (int) registry.size()) ? brdXEM6310LX45 : brdUnknown;
+}
+
+std::string okCFrontPanel::GetDeviceListSerial(int num)
+{
+    lock_guard<mutex> lockRegistry(registryMutex);
+    return (num >= 0 && num < (int) registry.size()) ? registry[num]->serial : string("");
+}
+
+okCFrontPanel::ErrorCode okCFrontPanel::GetFPGABootResetProfile(okTFPGAResetProfile *)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::GetFPGAJTAGResetProfile(okTFPGAResetProfile *)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::SetFPGABootResetProfile(okTFPGAResetProfile *)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::SetFPGAJTAGResetProfile(okTFPGAResetProfile *)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::FlashEraseSector(UINT32)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::FlashWrite(UINT32, UINT32, const UINT8 *)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::FlashRead(UINT32, UINT32, UINT8 *)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::ReadRegister(UINT32, UINT32 *)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::ReadRegisterSet(okTRegisterSet *)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::WriteRegister(UINT32, UINT32)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::WriteRegisterSet(okTRegisterSet *)
+    { return UnsupportedFeature; }
+
+void okCFrontPanel::EnableAsynchronousTransfers(bool)
+    { }
+
+okCFrontPanel::ErrorCode okCFrontPanel::OpenBySerial(std::string str)
+{
+    lock_guard<mutex> lockRegistry(registryMutex);
+    SimDevice *d = nullptr;
+
+    if (str.empty()) {
+        for (unsigned int i = 0; i < registry.size(); ++i) {
+            if (!registry[i]->isOpen) {
+                d = registry[i];
+                break;
+            }
+        }
+    } else {
+        d = findDevice(str);
+    }
+    if (!d || d->isOpen) return DeviceNotOpen;
+
+    // As with hardware, the FPGA keeps running whatever it was configured with.
+    lock_guard<mutex> lockDevice(d->deviceMutex);
+    d->isOpen = true;
+    memset(d->wireOuts, 0, sizeof(d->wireOuts));
+    memset(&d->stats, 0, sizeof(d->stats));
+    ((SimHandle*) h)->device = d;
+    memset(((SimHandle*) h)->wireIns, 0, sizeof(((SimHandle*) h)->wireIns));
+    return NoError;
+}
+
+bool okCFrontPanel::IsOpen()
+    { return deviceOf(h) != nullptr; }
+
+okCFrontPanel::ErrorCode okCFrontPanel::GetDeviceInfo(okTDeviceInfo *info)
+{
+    SimDevice *d = deviceOf(h);
+    if (!d) return DeviceNotOpen;
+
+    memset(info, 0, sizeof(okTDeviceInfo));
+    strncpy(info->deviceID, "Rhythm USB3 (simulated)", OK_MAX_DEVICEID_LENGTH - 1);
+    strncpy(info->serialNumber, d->serial.c_str(), OK_MAX_SERIALNUMBER_LENGTH - 1);
+    strncpy(info->productName, "XEM6310LX45", OK_MAX_BOARD_MODEL_STRING_LENGTH - 1);
+    info->productID = OK_PRODUCT_XEM6310LX45;
+    info->deviceInterface = OK_INTERFACE_USB3;
+    info->usbSpeed = OK_USBSPEED_SUPER;
+    info->deviceMajorVersion = 1;
+    info->isFrontPanelEnabled = d->configured;
+    info->wireWidth = 32;
+    info->triggerWidth = 32;
+    info->pipeWidth = 32;
+    return NoError;
+}
+
+int okCFrontPanel::GetDeviceMajorVersion()
+    { return 1; }
+int okCFrontPanel::GetDeviceMinorVersion()
+    { return 0; }
+
+std::string okCFrontPanel::GetSerialNumber()
+    { return deviceOf(h) ? deviceOf(h)->serial : string(""); }
+std::string okCFrontPanel::GetDeviceID()
+    { return "Rhythm USB3 (simulated)"; }
+void okCFrontPanel::SetDeviceID(const std::string)
+    { }
+
+okCFrontPanel::ErrorCode okCFrontPanel::SetBTPipePollingInterval(int)
+    { return NoError; }
+void okCFrontPanel::SetTimeout(int timeout)
+    { ((SimHandle*) h)->timeoutMs = timeout; }
+
+okCFrontPanel::ErrorCode okCFrontPanel::ResetFPGA()
+{
+    SimDevice *d = deviceOf(h);
+    if (!d) return DeviceNotOpen;
+
+    lock_guard<mutex> lockDevice(d->deviceMutex);
+    resetDevice(d);
+    return NoError;
+}
+
+okCFrontPanel::ErrorCode okCFrontPanel::ConfigureFPGAFromMemory(unsigned char *, const unsigned long length,
+                                                                 void(*)(int, int, void *), void *)
+{
+    SimDevice *d = deviceOf(h);
+    if (!d) return DeviceNotOpen;
+    if (length == 0) return InvalidBitstream;
+
+    lock_guard<mutex> lockDevice(d->deviceMutex);
+    d->configured = true;
+    d->stats.fpgaConfigurations++;
+    memset(d->wireIns, 0, sizeof(d->wireIns));
+    resetDevice(d);
+    return NoError;
+}
+
+okCFrontPanel::ErrorCode okCFrontPanel::ConfigureFPGA(const std::string strFilename,
+                                                      void (*)(int, int, void *), void *)
+{
+    SimDevice *d = deviceOf(h);
+    if (!d) return DeviceNotOpen;
+
+    ifstream bitfile(strFilename.c_str(), ios::binary);
+    if (!bitfile.good()) return FileError;
+
+    lock_guard<mutex> lockDevice(d->deviceMutex);
+    d->configured = true;
+    d->stats.fpgaConfigurations++;
+    memset(d->wireIns, 0, sizeof(d->wireIns));
+    resetDevice(d);
+    return NoError;
+}
+
+okCFrontPanel::ErrorCode okCFrontPanel::WriteI2C(const int, int, unsigned char *)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::ReadI2C(const int, int, unsigned char *)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::GetPLL22150Configuration(okCPLL22150&)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::SetPLL22150Configuration(okCPLL22150&)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::GetEepromPLL22150Configuration(okCPLL22150&)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::SetEepromPLL22150Configuration(okCPLL22150&)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::GetPLL22393Configuration(okCPLL22393&)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::SetPLL22393Configuration(okCPLL22393&)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::GetEepromPLL22393Configuration(okCPLL22393&)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::SetEepromPLL22393Configuration(okCPLL22393&)
+    { return UnsupportedFeature; }
+okCFrontPanel::ErrorCode okCFrontPanel::LoadDefaultPLLConfiguration()
+    { return UnsupportedFeature; }
+
+bool okCFrontPanel::IsFrontPanelEnabled()
+    { return deviceOf(h) ? deviceOf(h)->configured : false; }
+bool okCFrontPanel::IsFrontPanel3Supported()
+    { return true; }
+
+void okCFrontPanel::UpdateWireIns()
+{
+    SimDevice *d = deviceOf(h);
+    if (!d) return;
+    controlTransferDelay();
+
+    lock_guard<mutex> lockDevice(d->deviceMutex);
+    d->stats.wireInUpdates++;
+    advance(d);
+    memcpy(d->wireIns, ((SimHandle*) h)->wireIns, sizeof(d->wireIns));
+
+    if (d->loopback) {
+        if (d->wireIns[WireInLoopbackReset] & 0x01) {
+            d->loopbackFifo.clear();
+            d->loopbackArrivals.clear();
+        }
+        return;
+    }
+    if (d->wireIns[WireInResetRun] & 0x01) {
+        resetDevice(d);
+    }
+    d->continuous = (d->wireIns[WireInResetRun] & 0x02) != 0;
+    d->maxTimeStep = d->wireIns[WireInMaxTimeStep];
+}
+
+okCFrontPanel::ErrorCode okCFrontPanel::GetWireInValue(int epAddr, UINT32 *val)
+{
+    SimDevice *d = deviceOf(h);
+    if (!d) return DeviceNotOpen;
+    if (epAddr < 0x00 || epAddr > 0x1f) return InvalidEndpoint;
+
+    *val = ((SimHandle*) h)->wireIns[epAddr];
+    return NoError;
+}
+
+// As with the real DLL, wire-in values are held on the host and only reach the FPGA when
+// UpdateWireIns() is called.
+okCFrontPanel::ErrorCode okCFrontPanel::SetWireInValue(int ep, unsigned long val, unsigned long mask)
+{
+    SimDevice *d = deviceOf(h);
+    if (!d) return DeviceNotOpen;
+    if (ep < 0x00 || ep > 0x1f) return InvalidEndpoint;
+
+    UINT32 *wireIns = ((SimHandle*) h)->wireIns;
+    wireIns[ep] = (wireIns[ep] & ~((UINT32) mask)) | ((UINT32) val & (UINT32) mask);
+    return NoError;
+}
+
+void okCFrontPanel::UpdateWireOuts()
+{
+    SimDevice *d = deviceOf(h);
+    if (!d) return;
+    controlTransferDelay();
+
+    lock_guard<mutex> lockDevice(d->deviceMutex);
+    d->stats.wireOutUpdates++;
+    advance(d);
+
+    memset(d->wireOuts, 0, sizeof(d->wireOuts));
+    if (!d->configured || d->loopback) return;
+
+    d->wireOuts[WireOutNumWords - 0x20] = (UINT32) d->fifoWords;
+    d->wireOuts[WireOutSerialDigitalIn - 0x20] = 0;
+    d->wireOuts[WireOutSpiRunning - 0x20] = d->running ? 1 : 0;
+    d->wireOuts[WireOutTtlIn - 0x20] = 0;
+    d->wireOuts[WireOutDataClkLocked - 0x20] = 0x03;    // DCM programming done, data clock locked
+    d->wireOuts[WireOutBoardMode - 0x20] = RhythmBoardMode;
+    d->wireOuts[WireOutBoardId - 0x20] = RhythmBoardId;
+    d->wireOuts[WireOutBoardVersion - 0x20] = RhythmBoardVersion;
+}
+
+unsigned long okCFrontPanel::GetWireOutValue(int epAddr)
+{
+    SimDevice *d = deviceOf(h);
+    if (!d || epAddr < 0x20 || epAddr > 0x3f) return 0;
+
+    lock_guard<mutex> lockDevice(d->deviceMutex);
+    return d->wireOuts[epAddr - 0x20];
+}
+
+okCFrontPanel::ErrorCode okCFrontPanel::ActivateTriggerIn(int epAddr, int bit)
+{
+    SimDevice *d = deviceOf(h);
+    if (!d) return DeviceNotOpen;
+    if (epAddr < 0x40 || epAddr > 0x5f || bit < 0 || bit > 31) return InvalidEndpoint;
+    controlTransferDelay();
+
+    lock_guard<mutex> lockDevice(d->deviceMutex);
+    d->stats.triggerIns++;
+    advance(d);
+
+    if (epAddr == TrigInConfig && bit == 0) {
+        // Reprogram data clock: FPGA clock = 100 MHz * (M/D) / 2, sampling rate = clock / 2800.
+        UINT32 value = d->wireIns[WireInDataFreqPll];
+        double M = (double) ((value >> 8) & 0xff);
+        double D = (double) (value & 0xff);
+        if (M >= 2.0 && D >= 1.0) {
+            d->sampleRate = ReferenceClockHz * (M / D) / 2.0 / ClockCyclesPerSample;
+        }
+    } else if (epAddr == TrigInConfig && bit >= 1 && bit <= NumAuxCmdSlots && !d->loopback) {
+        // Write one command RAM word from the wire-ins
+        writeCommandRam(d, bit - 1, d->wireIns[WireInCmdRamBank] & 0x0f, d->wireIns[WireInCmdRamAddr] & 0x3ff,
+                        d->wireIns[WireInCmdRamData]);
+    } else if (epAddr == TrigInSpiStart && bit == 0 && d->configured) {
+        d->running = true;
+        d->continuous = (d->wireIns[WireInResetRun] & 0x02) != 0;
+        d->maxTimeStep = d->wireIns[WireInMaxTimeStep];
+        d->nextTimeStamp = 0;
+        d->framesThisRun = 0;
+        d->runStart = chrono::steady_clock::now();
+        d->runStartRigSample = llround(chrono::duration<double>(d->runStart - rigEpoch).count() * d->sampleRate);
+        d->newSegment = true;
+    }
+    return NoError;
+}
+
+void okCFrontPanel::UpdateTriggerOuts()
+    { }
+bool okCFrontPanel::IsTriggered(int, unsigned long)
+    { return false; }
+long okCFrontPanel::GetLastTransferLength()
+    { return 0; }
+
+long okCFrontPanel::WriteToPipeIn(int epAddr, long length, unsigned char *data)
+    { return WriteToBlockPipeIn(epAddr, 16, length, data); }
+long okCFrontPanel::ReadFromPipeOut(int epAddr, long length, unsigned char *data)
+    { return ReadFromBlockPipeOut(epAddr, 16, length, data); }
+
+// A Rhythm board's pipe-in loads its command RAM (see writeCommandRamPipe()).  A loopback device
+// queues what is written for pipe-out: bytes that do not fit in its FIFO are lost, and written
+// bytes can be read back LoopbackLatencyUs after the transfer completes.  A write made to fail
+// (okFrontPanelSim_FailPipeInWrites()) queues nothing.  As with USB 3.0 hardware, transfers must
+// be a multiple of 16 bytes.
+long okCFrontPanel::WriteToBlockPipeIn(int epAddr, int blockSize, long length, unsigned char *data)
+{
+    SimDevice *d = deviceOf(h);
+    if (!d) return ok_DeviceNotOpen;
+    if (d->loopback ? (epAddr != PipeInLoopback) : (epAddr != PipeInCmdRam || !d->configured)) return ok_InvalidEndpoint;
+    if (blockSize <= 0 || length < 0 || (length % 16) != 0 || (length % blockSize) != 0) return ok_InvalidBlockSize;
+
+    this_thread::sleep_for(loopbackTransferTime(length));
+
+    if (!d->loopback) {
+        lock_guard<mutex> lockDevice(d->deviceMutex);
+        writeCommandRamPipe(d, data, length);
+        d->stats.pipeWrites++;
+        d->stats.bytesWritten += length;
+        return length;
+    }
+
+    lock_guard<mutex> lockDevice(d->deviceMutex);
+    if (d->loopbackFailedWrites > 0) {
+        d->loopbackFailedWrites--;
+        return ok_TransferError;
+    }
+    unsigned long long room = LoopbackFifoBytes - d->loopbackFifo.size();
+    unsigned long long accepted = ((unsigned long long) length < room) ? (unsigned long long) length : room;
+    d->loopbackFifo.insert(d->loopbackFifo.end(), data, data + accepted);
+    d->loopbackArrivals.push_back(make_pair(chrono::steady_clock::now() + chrono::microseconds(LoopbackLatencyUs),
+                                            accepted));
+    d->stats.loopbackBytesDropped += (unsigned long long) length - accepted;
+    d->stats.pipeWrites++;
+    d->stats.bytesWritten += length;
+    return length;
+}
+
+// Read from the data FIFO.  As on the real board, a read larger than the FIFO contents
+// stalls until enough frames have been acquired or the timeout expires, unless the
+// pipeout block throttle has been overridden (WireInResetRun bit 16), in which case the
+// remainder is padded with zeros.
+long okCFrontPanel::ReadFromBlockPipeOut(int epAddr, int blockSize, long length, unsigned char *data)
+{
+    SimDevice *d = deviceOf(h);
+    if (!d) return ok_DeviceNotOpen;
+    if (epAddr != PipeOutData) return ok_InvalidEndpoint;
+    if (blockSize <= 0 || length < 0 || (length % blockSize) != 0) return ok_InvalidBlockSize;
+    if (d->loopback) return readLoopbackPipeOut(d, ((SimHandle*) h)->timeoutMs, length, data);
+
+    chrono::steady_clock::time_point deadline =
+            chrono::steady_clock::now() + chrono::milliseconds(((SimHandle*) h)->timeoutMs);
+
+    unique_lock<mutex> lockDevice(d->deviceMutex);
+    advance(d);
+    while (2 * d->fifoWords < (unsigned long long) length + d->glitchBytes && d->running &&
+           (d->wireIns[WireInResetRun] & (1 << 16)) == 0) {
+        if (chrono::steady_clock::now() >= deadline) {
+            return ok_Timeout;
+        }
+        lockDevice.unlock();
+        this_thread::sleep_for(chrono::microseconds(200));
+        lockDevice.lock();
+        advance(d);
+    }
+
+    if (d->glitchBytes > 0) {
+        // Lose bytes halfway through the transfer, as a fault on the USB link would, or at each
+        // place asked for (clipped to the transfer).
+        if (d->glitchPlaces.empty()) {
+            d->glitchPlaces.push_back(make_pair((unsigned int) (length / 2) & ~1U, (unsigned int) d->glitchBytes));
+        }
+        vector<unsigned char> lost((size_t) d->glitchBytes);
+        unsigned long long done = 0;
+        for (size_t i = 0; i < d->glitchPlaces.size(); ++i) {
+            unsigned long long place = min((unsigned long long) d->glitchPlaces[i].first, (unsigned long long) length);
+            drainFifo(d, data + done, place - done);
+            drainFifo(d, &lost[0], d->glitchPlaces[i].second);
+            done = place;
+        }
+        drainFifo(d, data + done, (unsigned long long) length - done);
+        d->stats.glitchBytesDropped += d->glitchBytes;
+        d->glitchBytes = 0;
+        d->glitchPlaces.clear();
+    } else {
+        drainFifo(d, data, (unsigned long long) length);
+    }
+    d->stats.pipeReads++;
+    d->stats.bytesRead += length;
+    return length;
+}
@@ -0,0 +1,102 @@
+//----------------------------------------------------------------------------------
+// okFrontPanelSim.h
+//
+// Software stand-in for the Opal Kelly FrontPanel DLL.  Link okFrontPanelSim.cpp in
+// place of okFrontPanelDLL.cpp and every okCFrontPanel opened by the host talks to a
+// simulated XEM6310 running the Rhythm USB3 interface instead of real hardware.
+//
+// The simulated device models the Rhythm wire-ins, trigger-ins, the WireOutNumWords
+// FIFO counter and the data block pipe, and synthesizes correctly framed USB data at
+// the sampling rate programmed through Rhd2000EvalBoardUsb3::setSampleRate().
+//
+// Simulated devices are listed by serial number in the OK_SIM_DEVICES environment
+// variable (comma-separated, e.g. "SIMRHD0001,SIMRHD0002").  If it is not set, a
+// single XEM6310-LX45 with serial number SIMRHD0001 is attached.
+//
+// As on hardware, a device's FPGA keeps its configuration, wire-in values and command RAM
+// when it is closed and opened again (e.g. by a host program restarted after a crash), and
+// wire-in values set through an okCFrontPanel only reach the FPGA on UpdateWireIns().
+//
+// Simulated Rhythm boards also keep the auxiliary command RAM, written one word at a time
+// through the wire-ins and TrigInConfig or in bulk through pipe-in 0x80 (see
+// Rhd2000EvalBoardUsb3::setCommandRamPipe()).
+//
+// Each Rhythm board acquires on a rig clock shared by all simulated devices, so boards started
+// at slightly different times see a common sync pulse (okFrontPanelSim_SetSyncPulse()) at
+// different time stamps, as boards on one rig do.
+//
+// A serial number followed by ":loopback" (e.g. "SIMRHD0001,SIMFPGA001:loopback") attaches
+// a downstream processing FPGA instead: bytes written to pipe-in 0x80 are returned unchanged
+// by pipe-out 0xA0, and setting bit 0 of wire-in 0x10 empties its FIFO.
+//----------------------------------------------------------------------------------
+
+#ifndef OKFRONTPANELSIM_H
+#define OKFRONTPANELSIM_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "okFrontPanelDLL.h"
+
+// Transaction counters kept by each simulated device.
+struct okTSimDeviceStats {
+    unsigned long long wireInUpdates;
+    unsigned long long wireOutUpdates;
+    unsigned long long triggerIns;
+    unsigned long long pipeReads;
+    unsigned long long pipeWrites;
+    unsigned long long bytesRead;
+    unsigned long long bytesWritten;
+    unsigned long long framesGenerated;
+    unsigned long long framesDropped;       // frames lost to FIFO overflow
+    unsigned long long fpgaConfigurations;
+    unsigned long long loopbackBytesDropped;    // pipe-in bytes lost to loopback FIFO overflow
+    unsigned long long glitchBytesDropped;      // data pipe bytes lost to okFrontPanelSim_InjectDataGlitch()
+};
+
+// In real-time mode (default) frames enter the FIFO at the programmed sampling rate.
+// With real-time mode off the FIFO is kept topped up, so the host runs flat out.
+void okFrontPanelSim_SetRealTime(bool realTime);
+bool okFrontPanelSim_IsRealTime();
+
+// Make the next data pipe read from this device lose numBytes (even) from the middle of the
+// transfer, as a USB link fault would, so the host sees frames out of alignment.  Returns false
+// if no simulated Rhythm board has this serial number.
+bool okFrontPanelSim_InjectDataGlitch(const std::string &serial, unsigned int numBytes);
+
+// As above, but lose glitches[i].second bytes after glitches[i].first bytes of the next transfer
+// have been delivered (offsets ascending, all even), so one transfer can hold several faults at
+// known places.  Returns false if a glitch is already pending.
+bool okFrontPanelSim_InjectDataGlitches(const std::string &serial,
+                                        const std::vector<std::pair<unsigned int, unsigned int> > &glitches);
+
+// Make the next numWrites pipe-in writes to this loopback device fail with ok_TransferError, queueing
+// nothing for pipe-out.  Returns false if no simulated loopback device has this serial number.
+bool okFrontPanelSim_FailPipeInWrites(const std::string &serial, unsigned int numWrites);
+
+// Make every wire-in update, wire-out update and trigger-in take this long, as a round trip over
+// the USB control endpoint does on hardware (0, the default, for none).
+void okFrontPanelSim_SetControlTransferTime(int microseconds);
+
+// Copy out all 1024 words of one command RAM bank of auxiliary command slot 1-3.  Returns false if
+// no simulated Rhythm board has this serial number or slot or bank is out of range.
+bool okFrontPanelSim_GetCommandRam(const std::string &serial, int slot, int bank, std::vector<int> &words);
+
+// Copy out the 32 wire-in values the FPGA last received.  Returns false if no simulated device
+// has this serial number.
+bool okFrontPanelSim_GetFpgaWireIns(const std::string &serial, std::vector<unsigned int> &wireIns);
+
+// Feed every simulated Rhythm board the same sync pulse on TTL input ttlBit (0-15): high for
+// widthSeconds once every periodSeconds of a rig clock all devices share, as a pulse generator
+// wired to several boards would.  A negative ttlBit removes it.  Takes effect from the next run().
+void okFrontPanelSim_SetSyncPulse(int ttlBit, double periodSeconds, double widthSeconds);
+
+// The rig clock sample (at the board's sampling rate) at which the frame with this time stamp of
+// the current run was acquired.  Returns false if no simulated Rhythm board has this serial number.
+bool okFrontPanelSim_GetRigClockSample(const std::string &serial, unsigned int timeStamp, long long &rigSample);
+
+// Returns false if no simulated device has this serial number.
+bool okFrontPanelSim_GetDeviceStats(const std::string &serial, okTSimDeviceStats &stats);
+
+#endif // OKFRONTPANELSIM_H
@@ -0,0 +1,526 @@
+//----------------------------------------------------------------------------------
+// rhd2000asyncfilewriterusb3.cpp
+//
+// Rhd2000AsyncFileWriterUsb3 Class
+//
+// Buffered data file writer with a dedicated I/O thread.
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#include "rhd2000asyncfilewriterusb3.h"
+#include "rhd2000datablockusb3.h"
+
+using namespace std;
+
+// Alignment of the I/O buffers, and of buffer sizes, required for unbuffered (direct) I/O
+#define ASYNC_FILE_ALIGNMENT 4096
+
+// Largest block written, at the Rhythm USB3 maximum of 32 data streams
+#define ASYNC_FILE_MAX_DATA_STREAMS 32
+
+// Constructor.  Allocates numBuffers I/O buffers (at least two) of bufferBytes each, rounded up
+// to a multiple of 4096, plus room for the part of a block that does not fit in a buffer.
+Rhd2000AsyncFileWriterUsb3::Rhd2000AsyncFileWriterUsb3(unsigned int bufferBytes_, unsigned int numBuffers) :
+    fillBuffer(nullptr),
+    numCarryBytes(0),
+    stopRequested(false),
+    maxFillSamples(0),
+    fillExpecting(false),
+    fillNextTimeStamp(0),
+    numFrames(0),
+    fileIsOpen(false),
+    directIo(false),
+    maxQueueDepth(0),
+    numBlocksQueued(0),
+    numBlocksDropped(0),
+    numFillFrames(0),
+    numBytesWritten(0),
+    numWrites(0),
+    numWriteErrors(0),
+    latencyHistoryNext(0),
+    latencyMaxMs(0.0)
+{
+#ifdef _WIN32
+    fileHandle = INVALID_HANDLE_VALUE;
+#else
+    fileDescriptor = -1;
+#endif
+
+    if (bufferBytes_ < ASYNC_FILE_ALIGNMENT) {
+        bufferBytes_ = ASYNC_FILE_ALIGNMENT;
+    }
+    bufferBytes = ((bufferBytes_ + ASYNC_FILE_ALIGNMENT - 1) / ASYNC_FILE_ALIGNMENT) * ASYNC_FILE_ALIGNMENT;
+    if (numBuffers < 2) {
+        numBuffers = 2;
+    }
+
+    unsigned int maxBlockBytes = Rhd2000DataBlockUsb3::getSerializedSizeInBytes(ASYNC_FILE_MAX_DATA_STREAMS);
+    buffers.resize(numBuffers);
+    for (unsigned int i = 0; i < numBuffers; ++i) {
+        WriteBuffer &buffer = buffers[i];
+        buffer.storage.resize(bufferBytes + maxBlockBytes + ASYNC_FILE_ALIGNMENT);
+        uintptr_t address = (uintptr_t) buffer.storage.data();
+        buffer.data = buffer.storage.data() + ((ASYNC_FILE_ALIGNMENT - (address % ASYNC_FILE_ALIGNMENT)) % ASYNC_FILE_ALIGNMENT);
+        buffer.numBytes = 0;
+        buffer.last = false;
+    }
+    carry.resize(maxBlockBytes);
+    latencyHistory.resize(ASYNC_FILE_LATENCY_HISTORY);
+}
+
+// Destructor.  Writes out any buffered data and closes the file.
+Rhd2000AsyncFileWriterUsb3::~Rhd2000AsyncFileWriterUsb3()
+{
+    close();
+}
+
+// Create (or truncate) fileName and start the I/O thread.  If directIo is true the file is opened
+// for unbuffered I/O (O_DIRECT on Linux, F_NOCACHE on Mac OS X, FILE_FLAG_NO_BUFFERING on Windows),
+// bypassing the OS page cache; if the file system does not support this, normal I/O is used
+// (see isDirectIo()).  Returns false if the file cannot be opened.
+bool Rhd2000AsyncFileWriterUsb3::open(const string &fileName, bool directIo_)
+{
+    if (fileIsOpen) {
+        cerr << "Error in Rhd2000AsyncFileWriterUsb3::open: a file is already open." << endl;
+        return false;
+    }
+
+    if (!openFile(fileName, directIo_)) {
+        cerr << "Error in Rhd2000AsyncFileWriterUsb3::open: cannot open " << fileName << endl;
+        return false;
+    }
+    fileIsOpen = true;
+
+    freeBuffers.clear();
+    fullBuffers.clear();
+    for (unsigned int i = 0; i < buffers.size(); ++i) {
+        buffers[i].numBytes = 0;
+        buffers[i].last = false;
+        freeBuffers.push_back(&buffers[i]);
+    }
+    fillBuffer = nullptr;
+    numCarryBytes = 0;
+    stopRequested = false;
+    fillExpecting = false;
+    numFrames = 0;
+    fillRuns.clear();
+    fillIndexFileName = fileName + FILL_INDEX_SUFFIX;
+
+    maxQueueDepth = 0;
+    numBlocksQueued = 0;
+    numBlocksDropped = 0;
+    numFillFrames = 0;
+    numBytesWritten = 0;
+    numWrites = 0;
+    numWriteErrors = 0;
+    latencyHistoryNext = 0;
+    latencyMaxMs = 0.0;
+
+    ioThread = thread(&Rhd2000AsyncFileWriterUsb3::ioThreadLoop, this);
+    return true;
+}
+
+bool Rhd2000AsyncFileWriterUsb3::isOpen() const
+{
+    return fileIsOpen;
+}
+
+// True if the open file bypasses the OS page cache.
+bool Rhd2000AsyncFileWriterUsb3::isDirectIo() const
+{
+    return directIo;
+}
+
+// Take a buffer the I/O thread has finished with, or nullptr if all are queued for I/O.
+Rhd2000AsyncFileWriterUsb3::WriteBuffer* Rhd2000AsyncFileWriterUsb3::takeFreeBuffer()
+{
+    lock_guard<mutex> lockBuffers(bufferMutex);
+
+    if (freeBuffers.empty()) {
+        return nullptr;
+    }
+    WriteBuffer* buffer = freeBuffers.front();
+    freeBuffers.pop_front();
+    return buffer;
+}
+
+// Queue a filled buffer for the I/O thread.
+void Rhd2000AsyncFileWriterUsb3::submitBuffer(WriteBuffer* buffer, bool last)
+{
+    {
+        lock_guard<mutex> lockBuffers(bufferMutex);
+        buffer->last = last;
+        fullBuffers.push_back(buffer);
+        if (fullBuffers.size() > maxQueueDepth) {
+            maxQueueDepth = (unsigned int) fullBuffers.size();
+        }
+    }
+    bufferReady.notify_one();
+}
+
+// Serialize one data block into the current buffer, handing the buffer to the I/O thread once it
+// holds a full write.  Never blocks on I/O: returns false, and counts the block as dropped, if every
+// buffer is still waiting to be written.  Must be called from one thread only.
+bool Rhd2000AsyncFileWriterUsb3::writeBlock(const Rhd2000DataBlockUsb3 &dataBlock, int numDataStreams)
+{
+    if (!fileIsOpen) {
+        cerr << "Error in Rhd2000AsyncFileWriterUsb3::writeBlock: no file is open." << endl;
+        return false;
+    }
+    if (numDataStreams < 1 || numDataStreams > ASYNC_FILE_MAX_DATA_STREAMS) {
+        cerr << "Error in Rhd2000AsyncFileWriterUsb3::writeBlock: numDataStreams out of range." << endl;
+        return false;
+    }
+
+    bool ok;
+    if (maxFillSamples > 0 && fillExpecting && !dataBlock.timeStampsFollow(fillNextTimeStamp)) {
+        ok = appendBlockWithFill(dataBlock, numDataStreams);
+    } else {
+        unsigned char* dest = appendSpace();
+        ok = (dest != nullptr);
+        if (ok) {
+            dataBlock.serialize(dest, numDataStreams);
+            commitAppend(Rhd2000DataBlockUsb3::getSerializedSizeInBytes(numDataStreams));
+        }
+    }
+
+    if (!ok) {
+        numBlocksDropped++;
+        return false;
+    }
+    numBlocksQueued++;
+    numFrames += SAMPLES_PER_DATA_BLOCK;
+    fillNextTimeStamp = dataBlock.timeStamp[SAMPLES_PER_DATA_BLOCK - 1] + 1;
+    fillExpecting = true;
+    return true;
+}
+
+// Write a fill frame (see Rhd2000DataBlockUsb3::serializeWithFill()) in place of each sample missing
+// between successive blocks passed to writeBlock(), or within a block, so that the file holds one
+// frame per time stamp.  Blocks this writer drops are filled in the same way when the next block is
+// written.  Jumps of more than maxFillSamples are left as they are; 0 (the default) turns filling off.
+// With filling on, close() lists the fill frames in the file name plus FILL_INDEX_SUFFIX (see
+// Rhd2000DataBlockUsb3::writeFillIndex()), so that readers can tell them from recorded frames.
+void Rhd2000AsyncFileWriterUsb3::setGapFill(unsigned int maxFillSamples_)
+{
+    maxFillSamples = maxFillSamples_;
+}
+
+// Where the fill frames are, by frame index from the start of the file.  Call from the thread
+// calling writeBlock(), or after close().
+const vector<Rhd2000DataBlockUsb3::FillRun>& Rhd2000AsyncFileWriterUsb3::getFillRuns() const
+{
+    return fillRuns;
+}
+
+// Room for one block at the end of the buffer being filled, or nullptr if every buffer is still
+// waiting to be written.
+unsigned char* Rhd2000AsyncFileWriterUsb3::appendSpace()
+{
+    if (!fillBuffer) {
+        fillBuffer = takeFreeBuffer();
+        if (!fillBuffer) {
+            return nullptr;
+        }
+        memcpy(fillBuffer->data, carry.data(), numCarryBytes);
+        fillBuffer->numBytes = numCarryBytes;
+        numCarryBytes = 0;
+    }
+    return fillBuffer->data + fillBuffer->numBytes;
+}
+
+// Take numBytes (at most one block) written at appendSpace() into the buffer, handing the buffer to
+// the I/O thread once it holds a full write.
+void Rhd2000AsyncFileWriterUsb3::commitAppend(unsigned int numBytes)
+{
+    fillBuffer->numBytes += numBytes;
+
+    if (fillBuffer->numBytes >= bufferBytes) {
+        // Write exactly bufferBytes; the overflow starts the next buffer (or waits in carry for one)
+        unsigned int overflow = fillBuffer->numBytes - bufferBytes;
+        WriteBuffer* nextBuffer = takeFreeBuffer();
+        if (nextBuffer) {
+            memcpy(nextBuffer->data, fillBuffer->data + bufferBytes, overflow);
+            nextBuffer->numBytes = overflow;
+        } else {
+            memcpy(carry.data(), fillBuffer->data + bufferBytes, overflow);
+            numCarryBytes = overflow;
+        }
+        fillBuffer->numBytes = bufferBytes;
+        submitBuffer(fillBuffer, false);
+        fillBuffer = nextBuffer;
+    }
+}
+
+// Serialize dataBlock with its fill frames, then append it a block (or buffer, if smaller) at a time,
+// so that no append overflows more than one buffer.  Returns false, appending nothing, unless enough
+// buffers are free to take all of it.
+bool Rhd2000AsyncFileWriterUsb3::appendBlockWithFill(const Rhd2000DataBlockUsb3 &dataBlock, int numDataStreams)
+{
+    const unsigned int blockBytes = Rhd2000DataBlockUsb3::getSerializedSizeInBytes(numDataStreams);
+    const unsigned int frameBytes = Rhd2000DataBlockUsb3::getSerializedFrameSizeInBytes(numDataStreams);
+    const unsigned int pendingBytes = fillBuffer ? fillBuffer->numBytes : numCarryBytes;
+    unsigned int maxFill = maxFillSamples;
+    unsigned int numFill = dataBlock.countFillFrames(fillNextTimeStamp, maxFill);
+
+    // Fill that could never fit in the buffers is left out, as for a jump longer than maxFillSamples.
+    if (pendingBytes + blockBytes + (unsigned long long) numFill * frameBytes > (buffers.size() - 1) * (unsigned long long) bufferBytes) {
+        maxFill = 0;
+        numFill = 0;
+    }
+    unsigned int totalBytes = blockBytes + numFill * frameBytes;
+
+    // Buffers only come free while we wait, so this many are sure to be there when needed.
+    unsigned long long buffersNeeded = (pendingBytes + (unsigned long long) totalBytes + bufferBytes - 1) / bufferBytes -
+            (fillBuffer ? 1 : 0);
+    {
+        lock_guard<mutex> lockBuffers(bufferMutex);
+        if (freeBuffers.size() < buffersNeeded) {
+            return false;
+        }
+    }
+
+    if (fillScratch.size() < totalBytes) {
+        fillScratch.resize(totalBytes);
+    }
+    dataBlock.serializeWithFill(fillScratch.data(), numDataStreams, fillNextTimeStamp, maxFill, &fillRuns, numFrames);
+
+    const unsigned int chunkBytes = min(blockBytes, bufferBytes);
+    for (unsigned int offset = 0; offset < totalBytes; offset += chunkBytes) {
+        unsigned char* dest = appendSpace();
+        unsigned int numBytes = min(chunkBytes, totalBytes - offset);
+        memcpy(dest, fillScratch.data() + offset, numBytes);
+        commitAppend(numBytes);
+    }
+    numFillFrames += numFill;
+    numFrames += numFill;
+    return true;
+}
+
+// Write out all buffered data, stop the I/O thread and close the file.  Waits for pending I/O.
+void Rhd2000AsyncFileWriterUsb3::close()
+{
+    if (!fileIsOpen) {
+        return;
+    }
+
+    if (!fillBuffer && numCarryBytes > 0) {
+        unique_lock<mutex> lockBuffers(bufferMutex);
+        bufferFree.wait(lockBuffers, [this] { return !freeBuffers.empty(); });
+        fillBuffer = freeBuffers.front();
+        freeBuffers.pop_front();
+        lockBuffers.unlock();
+
+        memcpy(fillBuffer->data, carry.data(), numCarryBytes);
+        fillBuffer->numBytes = numCarryBytes;
+        numCarryBytes = 0;
+    }
+    if (fillBuffer) {
+        if (fillBuffer->numBytes > 0) {
+            submitBuffer(fillBuffer, true);
+        }
+        fillBuffer = nullptr;
+    }
+
+    {
+        lock_guard<mutex> lockBuffers(bufferMutex);
+        stopRequested = true;
+    }
+    bufferReady.notify_one();
+    ioThread.join();
+
+    closeFile();
+    fileIsOpen = false;
+
+    if (maxFillSamples > 0) {
+        Rhd2000DataBlockUsb3::writeFillIndex(fillIndexFileName, fillRuns);
+    }
+}
+
+// I/O thread: write full buffers in order until stopped and drained.  A buffer stays at the front
+// of fullBuffers while it is being written, so it counts toward the queue depth.
+void Rhd2000AsyncFileWriterUsb3::ioThreadLoop()
+{
+    while (true) {
+        WriteBuffer* buffer;
+        {
+            unique_lock<mutex> lockBuffers(bufferMutex);
+            bufferReady.wait(lockBuffers, [this] { return stopRequested || !fullBuffers.empty(); });
+            if (fullBuffers.empty()) {
+                break;
+            }
+            buffer = fullBuffers.front();
+        }
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        bool ok = writeFile(buffer->data, buffer->numBytes, buffer->last);
+        double latencyMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        {
+            lock_guard<mutex> lockBuffers(bufferMutex);
+            fullBuffers.pop_front();
+            if (ok) {
+                numBytesWritten += buffer->numBytes;
+            } else {
+                numWriteErrors++;
+            }
+            numWrites++;
+            latencyHistory[latencyHistoryNext] = latencyMs;
+            latencyHistoryNext = (latencyHistoryNext + 1) % ASYNC_FILE_LATENCY_HISTORY;
+            latencyMaxMs = max(latencyMaxMs, latencyMs);
+
+            buffer->numBytes = 0;
+            buffer->last = false;
+            freeBuffers.push_back(buffer);
+        }
+        bufferFree.notify_all();
+    }
+}
+
+// Snapshot of the writer's backlog and throughput counters.  May be called from any thread.
+void Rhd2000AsyncFileWriterUsb3::getStats(WriterStats &stats)
+{
+    vector<double> latencies;
+    {
+        lock_guard<mutex> lockBuffers(bufferMutex);
+        stats.numBuffers = (unsigned int) buffers.size();
+        stats.queueDepth = (unsigned int) fullBuffers.size();
+        stats.maxQueueDepth = maxQueueDepth;
+        stats.numBytesWritten = numBytesWritten;
+        stats.numWrites = numWrites;
+        stats.numWriteErrors = numWriteErrors;
+        stats.latencyMaxMs = latencyMaxMs;
+        latencies.assign(latencyHistory.begin(),
+                         latencyHistory.begin() + min<unsigned long long>(numWrites, ASYNC_FILE_LATENCY_HISTORY));
+    }
+    stats.numBlocksQueued = numBlocksQueued;
+    stats.numBlocksDropped = numBlocksDropped;
+    stats.numFillFrames = numFillFrames;
+
+    stats.latencyMedianMs = 0.0;
+    stats.latency99Ms = 0.0;
+    if (!latencies.empty()) {
+        sort(latencies.begin(), latencies.end());
+        stats.latencyMedianMs = latencies[latencies.size() / 2];
+        stats.latency99Ms = latencies[(latencies.size() * 99) / 100];
+    }
+}
+
+#ifdef _WIN32
+
+bool Rhd2000AsyncFileWriterUsb3::openFile(const string &fileName, bool direct)
+{
+    DWORD flags = FILE_ATTRIBUTE_NORMAL | (direct ? FILE_FLAG_NO_BUFFERING : 0);
+    fileHandle = CreateFileA(fileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, flags, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE && direct) {
+        cerr << "Warning in Rhd2000AsyncFileWriterUsb3::open: unbuffered I/O not available; using buffered I/O." << endl;
+        direct = false;
+        fileHandle = CreateFileA(fileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL, nullptr);
+    }
+    directIo = direct;
+    openFileName = fileName;
+    return fileHandle != INVALID_HANDLE_VALUE;
+}
+
+bool Rhd2000AsyncFileWriterUsb3::writeFile(const unsigned char* data, unsigned int numBytes, bool last)
+{
+    if (last && directIo && (numBytes % ASYNC_FILE_ALIGNMENT) != 0) {
+        // Unbuffered handles only accept whole sectors; reopen with buffering for the final partial write
+        CloseHandle((HANDLE) fileHandle);
+        fileHandle = CreateFileA(openFileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                 FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        SetFilePointer((HANDLE) fileHandle, 0, nullptr, FILE_END);
+    }
+
+    DWORD bytesWritten = 0;
+    return WriteFile((HANDLE) fileHandle, data, numBytes, &bytesWritten, nullptr) && bytesWritten == numBytes;
+}
+
+void Rhd2000AsyncFileWriterUsb3::closeFile()
+{
+    if (fileHandle != INVALID_HANDLE_VALUE) {
+        CloseHandle((HANDLE) fileHandle);
+        fileHandle = INVALID_HANDLE_VALUE;
+    }
+}
+
+#else
+
+bool Rhd2000AsyncFileWriterUsb3::openFile(const string &fileName, bool direct)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    fileDescriptor = ::open(fileName.c_str(), flags | (direct ? O_DIRECT : 0), 0644);
+    if (fileDescriptor < 0 && direct && errno == EINVAL) {
+        cerr << "Warning in Rhd2000AsyncFileWriterUsb3::open: O_DIRECT not supported here; using buffered I/O." << endl;
+        direct = false;
+        fileDescriptor = ::open(fileName.c_str(), flags, 0644);
+    }
+#else
+    fileDescriptor = ::open(fileName.c_str(), flags, 0644);
+#ifdef F_NOCACHE
+    if (fileDescriptor >= 0 && direct) {
+        direct = (fcntl(fileDescriptor, F_NOCACHE, 1) != -1);
+    }
+#else
+    direct = false;
+#endif
+#endif
+    directIo = direct && fileDescriptor >= 0;
+    return fileDescriptor >= 0;
+}
+
+bool Rhd2000AsyncFileWriterUsb3::writeFile(const unsigned char* data, unsigned int numBytes, bool last)
+{
+#ifdef O_DIRECT
+    if (last && directIo && (numBytes % ASYNC_FILE_ALIGNMENT) != 0) {
+        // O_DIRECT only accepts whole blocks; switch to buffered I/O for the final partial write
+        fcntl(fileDescriptor, F_SETFL, fcntl(fileDescriptor, F_GETFL) & ~O_DIRECT);
+    }
+#endif
+
+    while (numBytes > 0) {
+        ssize_t result = ::write(fileDescriptor, data, numBytes);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += result;
+        numBytes -= (unsigned int) result;
+    }
+    return true;
+}
+
+void Rhd2000AsyncFileWriterUsb3::closeFile()
+{
+    if (fileDescriptor >= 0) {
+        ::close(fileDescriptor);
+        fileDescriptor = -1;
+    }
+}
+
+#endif
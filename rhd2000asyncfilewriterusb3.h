@@ -0,0 +1,140 @@
+//----------------------------------------------------------------------------------
+// rhd2000asyncfilewriterusb3.h
+//
+// Rhd2000AsyncFileWriterUsb3 Class Header File
+//
+// Saves data blocks in the Rhd2000DataBlockUsb3::write() file format from a dedicated
+// I/O thread.  The acquisition thread serializes blocks into one of a small set of large,
+// page-aligned buffers; full buffers are handed to the I/O thread and returned once written.
+// writeBlock() never waits on the disk: if every buffer is still queued for I/O the block is
+// dropped and counted, so a slow disk shows up as backlog and drop counters rather than as
+// a stalled USB reader.
+//----------------------------------------------------------------------------------
+
+#ifndef RHD2000ASYNCFILEWRITERUSB3_H
+#define RHD2000ASYNCFILEWRITERUSB3_H
+
+// Default size of each I/O buffer and of each write to the file (a multiple of 4096)
+#define ASYNC_FILE_BUFFER_BYTES 4194304
+
+// Default number of I/O buffers (two gives classic double buffering)
+#define ASYNC_FILE_NUM_BUFFERS 4
+
+// Number of most recent write latencies kept for the percentile statistics
+#define ASYNC_FILE_LATENCY_HISTORY 1024
+
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+using namespace std;
+
+#include "rhd2000datablockusb3.h"
+
+class Rhd2000AsyncFileWriterUsb3
+{
+public:
+    Rhd2000AsyncFileWriterUsb3(unsigned int bufferBytes = ASYNC_FILE_BUFFER_BYTES,
+                               unsigned int numBuffers = ASYNC_FILE_NUM_BUFFERS);
+    ~Rhd2000AsyncFileWriterUsb3();
+
+    bool open(const string &fileName, bool directIo = false);
+    bool isOpen() const;
+    bool isDirectIo() const;
+    bool writeBlock(const Rhd2000DataBlockUsb3 &dataBlock, int numDataStreams);
+    void setGapFill(unsigned int maxFillSamples);
+    const vector<Rhd2000DataBlockUsb3::FillRun>& getFillRuns() const;
+    void close();
+
+    struct WriterStats {
+        unsigned int numBuffers;
+        unsigned int queueDepth;                // full buffers waiting for (or in) I/O
+        unsigned int maxQueueDepth;
+        unsigned long long numBlocksQueued;     // blocks accepted by writeBlock()
+        unsigned long long numBlocksDropped;    // blocks rejected because no buffer was free
+        unsigned long long numFillFrames;       // fill frames written in place of missing samples
+        unsigned long long numBytesWritten;     // bytes written to the file
+        unsigned long long numWrites;           // write calls made on the file
+        unsigned long long numWriteErrors;
+        double latencyMedianMs;                 // over the last ASYNC_FILE_LATENCY_HISTORY writes
+        double latency99Ms;
+        double latencyMaxMs;                    // since open()
+    };
+    void getStats(WriterStats &stats);
+
+private:
+    Rhd2000AsyncFileWriterUsb3(const Rhd2000AsyncFileWriterUsb3 &);
+    Rhd2000AsyncFileWriterUsb3& operator=(const Rhd2000AsyncFileWriterUsb3 &);
+
+    struct WriteBuffer {
+        vector<unsigned char> storage;
+        unsigned char* data;        // first 4096-aligned byte in storage
+        unsigned int numBytes;
+        bool last;                  // final, possibly unaligned, write
+    };
+
+    unsigned int bufferBytes;
+    vector<WriteBuffer> buffers;
+
+    // Producer-side state, touched only by the thread calling writeBlock()
+    WriteBuffer* fillBuffer;
+    vector<unsigned char> carry;    // bytes past bufferBytes waiting for a free buffer
+    unsigned int numCarryBytes;
+
+    // Buffers shared with the I/O thread, guarded by bufferMutex
+    mutex bufferMutex;
+    condition_variable bufferReady;     // signalled when a buffer is submitted or stop is requested
+    condition_variable bufferFree;      // signalled when the I/O thread returns a buffer
+    deque<WriteBuffer*> freeBuffers;
+    deque<WriteBuffer*> fullBuffers;
+    bool stopRequested;
+
+    thread ioThread;
+    void ioThreadLoop();
+    WriteBuffer* takeFreeBuffer();
+    void submitBuffer(WriteBuffer* buffer, bool last);
+    unsigned char* appendSpace();
+    void commitAppend(unsigned int numBytes);
+    bool appendBlockWithFill(const Rhd2000DataBlockUsb3 &dataBlock, int numDataStreams);
+
+    // Gap filling (see setGapFill()), touched only by the thread calling writeBlock()
+    unsigned int maxFillSamples;
+    bool fillExpecting;                 // false until a block has been written since open()
+    unsigned int fillNextTimeStamp;     // time stamp that should follow the last frame written
+    vector<unsigned char> fillScratch;  // a block serialized with its fill frames
+    unsigned long long numFrames;       // frames accepted since open(), fill included
+    vector<Rhd2000DataBlockUsb3::FillRun> fillRuns;
+    string fillIndexFileName;
+
+    // Platform file I/O, used only by open(), close() and the I/O thread
+    bool openFile(const string &fileName, bool direct);
+    bool writeFile(const unsigned char* data, unsigned int numBytes, bool last);
+    void closeFile();
+#ifdef _WIN32
+    void* fileHandle;
+    string openFileName;
+#else
+    int fileDescriptor;
+#endif
+    bool fileIsOpen;
+    bool directIo;
+
+    // Statistics; the non-atomic counters are guarded by bufferMutex
+    unsigned int maxQueueDepth;
+    atomic<unsigned long long> numBlocksQueued;
+    atomic<unsigned long long> numBlocksDropped;
+    atomic<unsigned long long> numFillFrames;
+    unsigned long long numBytesWritten;
+    unsigned long long numWrites;
+    unsigned long long numWriteErrors;
+    vector<double> latencyHistory;
+    unsigned int latencyHistoryNext;
+    double latencyMaxMs;
+};
+
+#endif // RHD2000ASYNCFILEWRITERUSB3_H
@@ -0,0 +1,289 @@
+//----------------------------------------------------------------------------------
+// rhd2000biquadfilterbankusb3.cpp
+//
+// Rhd2000BiquadFilterBankUsb3 Class
+//
+// Butterworth design and run-time dispatched SIMD biquad cascades over channel tiles.
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <vector>
+#include <complex>
+#include <cmath>
+
+#include "rhd2000biquadfilterbankusb3.h"
+#include "rhd2000decoderusb3.h"
+#include "rhd2000datablockusb3.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define RHD2000_FILTER_X86
+#include <immintrin.h>
+#endif
+
+// GCC and Clang need per-function target attributes to emit AVX2/SSE4.1 code without compiling the
+// whole file for that instruction set; MSVC accepts the intrinsics as is.
+#if defined(RHD2000_FILTER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define RHD2000_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define RHD2000_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RHD2000_TARGET_SSE41
+#define RHD2000_TARGET_AVX2
+#endif
+
+// Highest filter order accepted (per edge of a band-pass filter)
+#define BIQUAD_MAX_ORDER 16
+
+using namespace std;
+
+// Constructor.  The sections are designed by prepare(), once the sample rate is known.
+Rhd2000BiquadFilterBankUsb3::Rhd2000BiquadFilterBankUsb3(FilterType type_, int order_, double cutoffHz_,
+                                                       double upperCutoffHz_) :
+    type(type_),
+    order(order_),
+    cutoffHz(cutoffHz_),
+    upperCutoffHz(upperCutoffHz_),
+    path(Rhd2000DecoderUsb3::detectBestPath()),
+    numChannels(0)
+{
+}
+
+// Append the sections of an order-N Butterworth low-pass or high-pass filter.  Each conjugate pole
+// pair of the analog prototype, s^2 + 2 sin(theta_k) s + 1, maps to one biquad through
+// s = (1 / K) (1 - z^-1) / (1 + z^-1) with K = tan(pi fc / fs); an odd order adds the real pole.
+void Rhd2000BiquadFilterBankUsb3::addButterworthSections(bool highPass, int order, double cutoffHz, double sampleRate,
+                                                         vector<Section> &sections)
+{
+    const double pi = 3.14159265358979323846;
+    const double k = tan(pi * cutoffHz / sampleRate);
+    const double k2 = k * k;
+
+    for (int pair = 0; pair < order / 2; ++pair) {
+        double damping = 2.0 * sin((2 * pair + 1) * pi / (2.0 * order));     // 1 / Q
+        double a0 = 1.0 + damping * k + k2;
+        Section section;
+        if (highPass) {
+            section.b0 = 1.0 / a0;
+            section.b1 = -2.0 / a0;
+            section.b2 = 1.0 / a0;
+        } else {
+            section.b0 = k2 / a0;
+            section.b1 = 2.0 * k2 / a0;
+            section.b2 = k2 / a0;
+        }
+        section.a1 = 2.0 * (k2 - 1.0) / a0;
+        section.a2 = (1.0 - damping * k + k2) / a0;
+        sections.push_back(section);
+    }
+    if (order % 2 == 1) {
+        Section section;
+        section.b0 = (highPass ? 1.0 : k) / (1.0 + k);
+        section.b1 = highPass ? -section.b0 : section.b0;
+        section.b2 = 0.0;
+        section.a1 = (k - 1.0) / (k + 1.0);
+        section.a2 = 0.0;
+        sections.push_back(section);
+    }
+}
+
+// Design a Butterworth filter of the given order at sampleRate.  upperCutoffHz is used only by
+// BandPass.  Returns false, leaving sections empty, if the order or cutoffs are out of range.
+bool Rhd2000BiquadFilterBankUsb3::designButterworth(FilterType type, int order, double cutoffHz, double upperCutoffHz,
+                                                    double sampleRate, vector<Section> &sections)
+{
+    sections.clear();
+    double nyquist = sampleRate / 2.0;
+    if (order < 1 || order > BIQUAD_MAX_ORDER) {
+        cerr << "Error in Rhd2000BiquadFilterBankUsb3::designButterworth: order " << order << " is outside 1-" <<
+                BIQUAD_MAX_ORDER << "." << endl;
+        return false;
+    }
+    if (cutoffHz <= 0.0 || cutoffHz >= nyquist ||
+            (type == BandPass && (upperCutoffHz <= cutoffHz || upperCutoffHz >= nyquist))) {
+        cerr << "Error in Rhd2000BiquadFilterBankUsb3::designButterworth: cutoffs must lie in (0, " << nyquist <<
+                ") Hz, the lower below the upper." << endl;
+        return false;
+    }
+
+    if (type == BandPass) {
+        addButterworthSections(true, order, cutoffHz, sampleRate, sections);
+        addButterworthSections(false, order, upperCutoffHz, sampleRate, sections);
+    } else {
+        addButterworthSections(type == HighPass, order, cutoffHz, sampleRate, sections);
+    }
+    return true;
+}
+
+// Gain of the cascade at frequencyHz.
+double Rhd2000BiquadFilterBankUsb3::magnitudeResponse(const vector<Section> &sections, double frequencyHz,
+                                                      double sampleRate)
+{
+    const double pi = 3.14159265358979323846;
+    complex<double> z1 = polar(1.0, -2.0 * pi * frequencyHz / sampleRate);     // z^-1
+    complex<double> z2 = z1 * z1;
+    complex<double> response(1.0, 0.0);
+    for (unsigned int i = 0; i < sections.size(); ++i) {
+        const Section &s = sections[i];
+        response *= (s.b0 + s.b1 * z1 + s.b2 * z2) / (1.0 + s.a1 * z1 + s.a2 * z2);
+    }
+    return abs(response);
+}
+
+bool Rhd2000BiquadFilterBankUsb3::prepare(int numChannels_, double sampleRate)
+{
+    if (!designButterworth(type, order, cutoffHz, upperCutoffHz, sampleRate, sections)) {
+        return false;
+    }
+    coefficients.resize(sections.size());
+    for (unsigned int i = 0; i < sections.size(); ++i) {
+        coefficients[i].b0 = (float) sections[i].b0;
+        coefficients[i].b1 = (float) sections[i].b1;
+        coefficients[i].b2 = (float) sections[i].b2;
+        coefficients[i].a1 = (float) sections[i].a1;
+        coefficients[i].a2 = (float) sections[i].a2;
+    }
+    numChannels = numChannels_;
+    reset();
+    return true;
+}
+
+// Clear the filter memory of every channel.
+void Rhd2000BiquadFilterBankUsb3::reset()
+{
+    state1.assign(sections.size() * numChannels, 0.0f);
+    state2.assign(sections.size() * numChannels, 0.0f);
+}
+
+const vector<Rhd2000BiquadFilterBankUsb3::Section>& Rhd2000BiquadFilterBankUsb3::getSections() const
+{
+    return sections;
+}
+
+Rhd2000DecoderUsb3::DecodePath Rhd2000BiquadFilterBankUsb3::getPath() const
+{
+    return path;
+}
+
+// Force a particular SIMD path (e.g., for benchmarking).  Returns false and leaves the current
+// path unchanged if the CPU does not support the requested one.
+bool Rhd2000BiquadFilterBankUsb3::setPath(Rhd2000DecoderUsb3::DecodePath path_)
+{
+    if (path_ > Rhd2000DecoderUsb3::detectBestPath()) return false;
+    path = path_;
+    return true;
+}
+
+void Rhd2000BiquadFilterBankUsb3::processTile(float *samples, int firstChannel, int numTileChannels)
+{
+    switch (path) {
+    case Rhd2000DecoderUsb3::DecodeAvx2:
+        processAvx2(samples, firstChannel, numTileChannels);
+        break;
+    case Rhd2000DecoderUsb3::DecodeSse41:
+        processSse41(samples, firstChannel, numTileChannels);
+        break;
+    default:
+        processScalar(samples, firstChannel, numTileChannels, 0);
+        break;
+    }
+}
+
+// Tile channels firstLane and up, one channel at a time.  Each section runs over the whole block
+// before the next, with its two state words held in registers.
+void Rhd2000BiquadFilterBankUsb3::processScalar(float *samples, int firstChannel, int numTileChannels, int firstLane)
+{
+    for (unsigned int s = 0; s < coefficients.size(); ++s) {
+        const Coefficients c = coefficients[s];
+        float *z1 = state1.data() + s * numChannels + firstChannel;
+        float *z2 = state2.data() + s * numChannels + firstChannel;
+        for (int i = firstLane; i < numTileChannels; ++i) {
+            float w1 = z1[i];
+            float w2 = z2[i];
+            float *x = samples + i;
+            for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+                float input = x[t * numTileChannels];
+                float output = c.b0 * input + w1;
+                w1 = (c.b1 * input - c.a1 * output) + w2;
+                w2 = c.b2 * input - c.a2 * output;
+                x[t * numTileChannels] = output;
+            }
+            z1[i] = w1;
+            z2[i] = w2;
+        }
+    }
+}
+
+#if defined(RHD2000_FILTER_X86)
+
+RHD2000_TARGET_SSE41
+void Rhd2000BiquadFilterBankUsb3::processSse41(float *samples, int firstChannel, int numTileChannels)
+{
+    int lanes = numTileChannels & ~3;
+    for (unsigned int s = 0; s < coefficients.size(); ++s) {
+        const __m128 b0 = _mm_set1_ps(coefficients[s].b0);
+        const __m128 b1 = _mm_set1_ps(coefficients[s].b1);
+        const __m128 b2 = _mm_set1_ps(coefficients[s].b2);
+        const __m128 a1 = _mm_set1_ps(coefficients[s].a1);
+        const __m128 a2 = _mm_set1_ps(coefficients[s].a2);
+        float *z1 = state1.data() + s * numChannels + firstChannel;
+        float *z2 = state2.data() + s * numChannels + firstChannel;
+        for (int i = 0; i < lanes; i += 4) {
+            __m128 w1 = _mm_loadu_ps(z1 + i);
+            __m128 w2 = _mm_loadu_ps(z2 + i);
+            float *x = samples + i;
+            for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+                __m128 input = _mm_loadu_ps(x + t * numTileChannels);
+                __m128 output = _mm_add_ps(_mm_mul_ps(b0, input), w1);
+                w1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, input), _mm_mul_ps(a1, output)), w2);
+                w2 = _mm_sub_ps(_mm_mul_ps(b2, input), _mm_mul_ps(a2, output));
+                _mm_storeu_ps(x + t * numTileChannels, output);
+            }
+            _mm_storeu_ps(z1 + i, w1);
+            _mm_storeu_ps(z2 + i, w2);
+        }
+    }
+    processScalar(samples, firstChannel, numTileChannels, lanes);
+}
+
+RHD2000_TARGET_AVX2
+void Rhd2000BiquadFilterBankUsb3::processAvx2(float *samples, int firstChannel, int numTileChannels)
+{
+    int lanes = numTileChannels & ~7;
+    for (unsigned int s = 0; s < coefficients.size(); ++s) {
+        const __m256 b0 = _mm256_set1_ps(coefficients[s].b0);
+        const __m256 b1 = _mm256_set1_ps(coefficients[s].b1);
+        const __m256 b2 = _mm256_set1_ps(coefficients[s].b2);
+        const __m256 a1 = _mm256_set1_ps(coefficients[s].a1);
+        const __m256 a2 = _mm256_set1_ps(coefficients[s].a2);
+        float *z1 = state1.data() + s * numChannels + firstChannel;
+        float *z2 = state2.data() + s * numChannels + firstChannel;
+        for (int i = 0; i < lanes; i += 8) {
+            __m256 w1 = _mm256_loadu_ps(z1 + i);
+            __m256 w2 = _mm256_loadu_ps(z2 + i);
+            float *x = samples + i;
+            for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+                __m256 input = _mm256_loadu_ps(x + t * numTileChannels);
+                __m256 output = _mm256_add_ps(_mm256_mul_ps(b0, input), w1);
+                w1 = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(b1, input), _mm256_mul_ps(a1, output)), w2);
+                w2 = _mm256_sub_ps(_mm256_mul_ps(b2, input), _mm256_mul_ps(a2, output));
+                _mm256_storeu_ps(x + t * numTileChannels, output);
+            }
+            _mm256_storeu_ps(z1 + i, w1);
+            _mm256_storeu_ps(z2 + i, w2);
+        }
+    }
+    processScalar(samples, firstChannel, numTileChannels, lanes);
+}
+
+#else
+
+void Rhd2000BiquadFilterBankUsb3::processSse41(float *samples, int firstChannel, int numTileChannels)
+{
+    processScalar(samples, firstChannel, numTileChannels, 0);
+}
+
+void Rhd2000BiquadFilterBankUsb3::processAvx2(float *samples, int firstChannel, int numTileChannels)
+{
+    processScalar(samples, firstChannel, numTileChannels, 0);
+}
+
+#endif
@@ -0,0 +1,85 @@
+//----------------------------------------------------------------------------------
+// rhd2000biquadfilterbankusb3.h
+//
+// Rhd2000BiquadFilterBankUsb3 Class Header File
+//
+// Butterworth low-pass, high-pass and band-pass filtering of every amplifier channel, as a
+// Rhd2000DspEngineUsb3 stage.  The filter is a cascade of second-order sections (plus one
+// first-order section for odd orders) designed by the bilinear transform with the cutoffs
+// prewarped, so the response is exactly Butterworth in the warped frequency at any
+// AmplifierSampleRate.  A band-pass filter of order N is a high-pass of order N at the lower
+// cutoff followed by a low-pass of order N at the upper one.
+//
+// Each section runs in transposed direct form II on float32 samples.  A tile holds the
+// channels of one time step next to each other, so channels map directly onto SIMD lanes:
+// AVX2 filters 8 channels at a time and SSE4.1 4, with the path chosen at run time as for
+// Rhd2000DecoderUsb3.  Every path performs the same float operations in the same order, so
+// all paths give bit-identical results.
+//----------------------------------------------------------------------------------
+
+#ifndef RHD2000BIQUADFILTERBANKUSB3_H
+#define RHD2000BIQUADFILTERBANKUSB3_H
+
+#include <vector>
+
+using namespace std;
+
+#include "rhd2000dspengineusb3.h"
+#include "rhd2000decoderusb3.h"
+
+class Rhd2000BiquadFilterBankUsb3 : public Rhd2000DspStageUsb3
+{
+public:
+    enum FilterType {
+        LowPass,
+        HighPass,
+        BandPass
+    };
+
+    // One section, y = (b0 + b1 z^-1 + b2 z^-2) / (1 + a1 z^-1 + a2 z^-2) x
+    struct Section {
+        double b0, b1, b2;
+        double a1, a2;
+    };
+
+    // cutoffHz is the -3 dB frequency, or the lower one of a band-pass filter.
+    Rhd2000BiquadFilterBankUsb3(FilterType type, int order, double cutoffHz, double upperCutoffHz = 0.0);
+
+    static bool designButterworth(FilterType type, int order, double cutoffHz, double upperCutoffHz,
+                                  double sampleRate, vector<Section> &sections);
+    static double magnitudeResponse(const vector<Section> &sections, double frequencyHz, double sampleRate);
+
+    bool prepare(int numChannels, double sampleRate) override;
+    void processTile(float *samples, int firstChannel, int numTileChannels) override;
+    void reset();
+
+    const vector<Section>& getSections() const;
+    Rhd2000DecoderUsb3::DecodePath getPath() const;
+    bool setPath(Rhd2000DecoderUsb3::DecodePath path);
+
+private:
+    struct Coefficients {
+        float b0, b1, b2;
+        float a1, a2;
+    };
+
+    FilterType type;
+    int order;
+    double cutoffHz;
+    double upperCutoffHz;
+    Rhd2000DecoderUsb3::DecodePath path;
+
+    vector<Section> sections;
+    vector<Coefficients> coefficients;
+    int numChannels;
+    vector<float> state1;               // [section][channel]
+    vector<float> state2;
+
+    static void addButterworthSections(bool highPass, int order, double cutoffHz, double sampleRate,
+                                       vector<Section> &sections);
+    void processScalar(float *samples, int firstChannel, int numTileChannels, int firstLane);
+    void processSse41(float *samples, int firstChannel, int numTileChannels);
+    void processAvx2(float *samples, int firstChannel, int numTileChannels);
+};
+
+#endif // RHD2000BIQUADFILTERBANKUSB3_H
@@ -0,0 +1,155 @@
+//----------------------------------------------------------------------------------
+// rhd2000datablockpoolusb3.cpp
+//
+// Rhd2000DataBlockPoolUsb3 / Rhd2000DataBlockHandleUsb3 Classes
+//
+// Fixed-capacity pool of preallocated data blocks with move-only handles.
+//----------------------------------------------------------------------------------
+
+#include <fstream>
+#include <vector>
+#include <mutex>
+
+#include "rhd2000datablockpoolusb3.h"
+#include "rhd2000datablockusb3.h"
+
+using namespace std;
+
+// Constructor.  Allocates every block up front; acquire() and release() never allocate.
+Rhd2000DataBlockPoolUsb3::Rhd2000DataBlockPoolUsb3(unsigned int capacity, int numDataStreams_,
+                                                   Rhd2000DataBlockUsb3::AmplifierLayout layout,
+                                                   Rhd2000DataBlockUsb3::SampleFormat format) :
+    numDataStreams(numDataStreams_),
+    numExhausted(0)
+{
+    blocks.resize(capacity);
+    freeBlocks.reserve(capacity);
+    for (unsigned int i = 0; i < capacity; ++i) {
+        blocks[i] = new Rhd2000DataBlockUsb3(numDataStreams, layout, format);
+        freeBlocks.push_back(blocks[i]);
+    }
+}
+
+// Destructor.  All handles must have been released before the pool is destroyed.
+Rhd2000DataBlockPoolUsb3::~Rhd2000DataBlockPoolUsb3()
+{
+    for (unsigned int i = 0; i < blocks.size(); ++i) {
+        delete blocks[i];
+    }
+}
+
+// Take a block from the pool.  Returns an empty handle if every block is in use.
+Rhd2000DataBlockHandleUsb3 Rhd2000DataBlockPoolUsb3::acquire()
+{
+    lock_guard<mutex> lockPool(poolMutex);
+
+    if (freeBlocks.empty()) {
+        numExhausted++;
+        return Rhd2000DataBlockHandleUsb3();
+    }
+    Rhd2000DataBlockUsb3 *block = freeBlocks.back();
+    freeBlocks.pop_back();
+    return Rhd2000DataBlockHandleUsb3(this, block);
+}
+
+// Return a block to the pool.  Called by Rhd2000DataBlockHandleUsb3.
+void Rhd2000DataBlockPoolUsb3::recycle(Rhd2000DataBlockUsb3 *block)
+{
+    lock_guard<mutex> lockPool(poolMutex);
+    freeBlocks.push_back(block);
+}
+
+unsigned int Rhd2000DataBlockPoolUsb3::getCapacity() const
+{
+    return (unsigned int) blocks.size();
+}
+
+int Rhd2000DataBlockPoolUsb3::getNumDataStreams() const
+{
+    return numDataStreams;
+}
+
+// Number of blocks currently free.
+unsigned int Rhd2000DataBlockPoolUsb3::getNumAvailable()
+{
+    lock_guard<mutex> lockPool(poolMutex);
+    return (unsigned int) freeBlocks.size();
+}
+
+// Number of acquire() calls that found the pool empty.
+unsigned long long Rhd2000DataBlockPoolUsb3::getNumExhausted()
+{
+    lock_guard<mutex> lockPool(poolMutex);
+    return numExhausted;
+}
+
+
+// Empty handle.
+Rhd2000DataBlockHandleUsb3::Rhd2000DataBlockHandleUsb3() :
+    pool(nullptr),
+    block(nullptr)
+{
+}
+
+Rhd2000DataBlockHandleUsb3::Rhd2000DataBlockHandleUsb3(Rhd2000DataBlockPoolUsb3 *pool_, Rhd2000DataBlockUsb3 *block_) :
+    pool(pool_),
+    block(block_)
+{
+}
+
+// Move constructor.  obj is left empty.
+Rhd2000DataBlockHandleUsb3::Rhd2000DataBlockHandleUsb3(Rhd2000DataBlockHandleUsb3 &&obj) :
+    pool(obj.pool),
+    block(obj.block)
+{
+    obj.pool = nullptr;
+    obj.block = nullptr;
+}
+
+// Move assignment.  Any block held by this handle is returned to its pool first.
+Rhd2000DataBlockHandleUsb3& Rhd2000DataBlockHandleUsb3::operator=(Rhd2000DataBlockHandleUsb3 &&obj)
+{
+    if (this != &obj) {
+        release();
+        pool = obj.pool;
+        block = obj.block;
+        obj.pool = nullptr;
+        obj.block = nullptr;
+    }
+    return *this;
+}
+
+Rhd2000DataBlockHandleUsb3::~Rhd2000DataBlockHandleUsb3()
+{
+    release();
+}
+
+Rhd2000DataBlockUsb3* Rhd2000DataBlockHandleUsb3::get() const
+{
+    return block;
+}
+
+Rhd2000DataBlockUsb3* Rhd2000DataBlockHandleUsb3::operator->() const
+{
+    return block;
+}
+
+Rhd2000DataBlockUsb3& Rhd2000DataBlockHandleUsb3::operator*() const
+{
+    return *block;
+}
+
+Rhd2000DataBlockHandleUsb3::operator bool() const
+{
+    return block != nullptr;
+}
+
+// Return the block to its pool and leave the handle empty.
+void Rhd2000DataBlockHandleUsb3::release()
+{
+    if (block) {
+        pool->recycle(block);
+        pool = nullptr;
+        block = nullptr;
+    }
+}
@@ -0,0 +1,81 @@
+//----------------------------------------------------------------------------------
+// rhd2000datablockpoolusb3.h
+//
+// Rhd2000DataBlockPoolUsb3 / Rhd2000DataBlockHandleUsb3 Class Header File
+//
+// Fixed-capacity pool of preallocated Rhd2000DataBlockUsb3 objects.  Blocks are handed
+// out as move-only handles and return to the pool when the handle is released or
+// destroyed, so steady-state acquisition performs no heap allocation per block.
+//----------------------------------------------------------------------------------
+
+#ifndef RHD2000DATABLOCKPOOLUSB3_H
+#define RHD2000DATABLOCKPOOLUSB3_H
+
+#include <vector>
+#include <fstream>
+#include <mutex>
+
+using namespace std;
+
+#include "rhd2000datablockusb3.h"
+
+class Rhd2000DataBlockPoolUsb3;
+
+// Owning reference to one pooled data block.  Moving a handle transfers ownership;
+// handles cannot be copied.
+class Rhd2000DataBlockHandleUsb3
+{
+public:
+    Rhd2000DataBlockHandleUsb3();
+    Rhd2000DataBlockHandleUsb3(Rhd2000DataBlockHandleUsb3 &&obj);
+    Rhd2000DataBlockHandleUsb3& operator=(Rhd2000DataBlockHandleUsb3 &&obj);
+    ~Rhd2000DataBlockHandleUsb3();
+
+    Rhd2000DataBlockUsb3* get() const;
+    Rhd2000DataBlockUsb3* operator->() const;
+    Rhd2000DataBlockUsb3& operator*() const;
+    explicit operator bool() const;
+    void release();
+
+private:
+    friend class Rhd2000DataBlockPoolUsb3;
+    Rhd2000DataBlockHandleUsb3(Rhd2000DataBlockPoolUsb3 *pool, Rhd2000DataBlockUsb3 *block);
+    Rhd2000DataBlockHandleUsb3(const Rhd2000DataBlockHandleUsb3 &);
+    Rhd2000DataBlockHandleUsb3& operator=(const Rhd2000DataBlockHandleUsb3 &);
+
+    Rhd2000DataBlockPoolUsb3 *pool;
+    Rhd2000DataBlockUsb3 *block;
+};
+
+class Rhd2000DataBlockPoolUsb3
+{
+public:
+    Rhd2000DataBlockPoolUsb3(unsigned int capacity, int numDataStreams,
+                             Rhd2000DataBlockUsb3::AmplifierLayout layout = Rhd2000DataBlockUsb3::TimeMajor,
+                             Rhd2000DataBlockUsb3::SampleFormat format = Rhd2000DataBlockUsb3::Int32Samples);
+    ~Rhd2000DataBlockPoolUsb3();
+
+    Rhd2000DataBlockHandleUsb3 acquire();
+
+    unsigned int getCapacity() const;
+    int getNumDataStreams() const;
+    unsigned int getNumAvailable();
+    unsigned long long getNumExhausted();
+
+private:
+    friend class Rhd2000DataBlockHandleUsb3;
+    Rhd2000DataBlockPoolUsb3(const Rhd2000DataBlockPoolUsb3 &);
+    Rhd2000DataBlockPoolUsb3& operator=(const Rhd2000DataBlockPoolUsb3 &);
+
+    void recycle(Rhd2000DataBlockUsb3 *block);
+
+    vector<Rhd2000DataBlockUsb3*> blocks;
+    vector<Rhd2000DataBlockUsb3*> freeBlocks;
+    int numDataStreams;
+    unsigned long long numExhausted;
+
+    // Handles may be released on a different thread than the one acquiring blocks.
+    mutex poolMutex;
+};
+
+#endif // RHD2000DATABLOCKPOOLUSB3_H
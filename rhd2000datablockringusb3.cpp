@@ -0,0 +1,141 @@
+//----------------------------------------------------------------------------------
+// rhd2000datablockringusb3.cpp
+//
+// Rhd2000DataBlockRingUsb3 Class
+//
+// Lock-free single-producer/single-consumer ring of preallocated data blocks.
+//----------------------------------------------------------------------------------
+
+#include <fstream>
+#include <vector>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "rhd2000datablockringusb3.h"
+#include "rhd2000datablockusb3.h"
+
+using namespace std;
+
+// Constructor.  Allocates every slot up front, so no memory is allocated while acquiring.
+Rhd2000DataBlockRingUsb3::Rhd2000DataBlockRingUsb3(unsigned int capacity_, int numDataStreams_,
+                                                   Rhd2000DataBlockUsb3::AmplifierLayout layout,
+                                                   Rhd2000DataBlockUsb3::SampleFormat format) :
+    capacity(capacity_ > 0 ? capacity_ : 1),
+    numDataStreams(numDataStreams_),
+    writeCount(0),
+    readCount(0),
+    maxOccupancy(0)
+{
+    slots.resize(capacity);
+    for (unsigned int i = 0; i < capacity; ++i) {
+        slots[i] = new Rhd2000DataBlockUsb3(numDataStreams, layout, format);
+    }
+}
+
+Rhd2000DataBlockRingUsb3::~Rhd2000DataBlockRingUsb3()
+{
+    for (unsigned int i = 0; i < capacity; ++i) {
+        delete slots[i];
+    }
+}
+
+// Allocate a ring aligned for its counters.
+void* Rhd2000DataBlockRingUsb3::operator new(size_t size)
+{
+    void* p = nullptr;
+#ifdef _WIN32
+    p = _aligned_malloc(size, alignof(Rhd2000DataBlockRingUsb3));
+#else
+    if (posix_memalign(&p, alignof(Rhd2000DataBlockRingUsb3), size) != 0) {
+        p = nullptr;
+    }
+#endif
+    if (!p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void Rhd2000DataBlockRingUsb3::operator delete(void* p)
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+// Number of slots the producer may fill before the ring is full.
+unsigned int Rhd2000DataBlockRingUsb3::getFreeSlots() const
+{
+    return capacity - (unsigned int) (writeCount.load(memory_order_relaxed) - readCount.load(memory_order_acquire));
+}
+
+// Return the index-th free slot past the write position for the producer to fill, or nullptr
+// if the ring does not have that many free slots.  Slots are not visible to the consumer until
+// commitWrite() is called.
+Rhd2000DataBlockUsb3* Rhd2000DataBlockRingUsb3::beginWrite(unsigned int index)
+{
+    unsigned long long w = writeCount.load(memory_order_relaxed);
+    if (w + index - readCount.load(memory_order_acquire) >= capacity) {
+        return nullptr;
+    }
+    return slots[(w + index) % capacity];
+}
+
+// Publish the next count slots obtained from beginWrite() to the consumer.
+void Rhd2000DataBlockRingUsb3::commitWrite(unsigned int count)
+{
+    unsigned long long w = writeCount.load(memory_order_relaxed) + count;
+    writeCount.store(w, memory_order_release);
+
+    unsigned int occupancy = (unsigned int) (w - readCount.load(memory_order_relaxed));
+    if (occupancy > maxOccupancy.load(memory_order_relaxed)) {
+        maxOccupancy.store(occupancy, memory_order_relaxed);
+    }
+}
+
+// Return the oldest filled slot, or nullptr if the ring is empty.  The block remains
+// owned by the ring and stays valid until pop() is called.
+Rhd2000DataBlockUsb3* Rhd2000DataBlockRingUsb3::front()
+{
+    unsigned long long r = readCount.load(memory_order_relaxed);
+    if (writeCount.load(memory_order_acquire) == r) {
+        return nullptr;
+    }
+    return slots[r % capacity];
+}
+
+// Release the slot returned by front() back to the producer.
+void Rhd2000DataBlockRingUsb3::pop()
+{
+    readCount.store(readCount.load(memory_order_relaxed) + 1, memory_order_release);
+}
+
+// Number of filled slots.  Exact only when called from the producer or consumer thread.
+unsigned int Rhd2000DataBlockRingUsb3::size() const
+{
+    return (unsigned int) (writeCount.load(memory_order_acquire) - readCount.load(memory_order_acquire));
+}
+
+unsigned int Rhd2000DataBlockRingUsb3::getCapacity() const
+{
+    return capacity;
+}
+
+int Rhd2000DataBlockRingUsb3::getNumDataStreams() const
+{
+    return numDataStreams;
+}
+
+// Highest number of filled slots seen so far; a value near capacity means the consumer
+// is close to stalling the reader thread.
+unsigned int Rhd2000DataBlockRingUsb3::getMaxOccupancy() const
+{
+    return maxOccupancy.load(memory_order_relaxed);
+}
@@ -0,0 +1,64 @@
+//----------------------------------------------------------------------------------
+// rhd2000datablockringusb3.h
+//
+// Rhd2000DataBlockRingUsb3 Class Header File
+//
+// Fixed-capacity, lock-free single-producer/single-consumer ring of preallocated
+// Rhd2000DataBlockUsb3 slots.  Filled by the Rhd2000EvalBoardUsb3 reader thread and
+// drained by the application without taking the board's USB mutex.
+//----------------------------------------------------------------------------------
+
+#ifndef RHD2000DATABLOCKRINGUSB3_H
+#define RHD2000DATABLOCKRINGUSB3_H
+
+#include <vector>
+#include <fstream>
+#include <atomic>
+#include <cstddef>
+
+using namespace std;
+
+#include "rhd2000datablockusb3.h"
+
+class Rhd2000DataBlockRingUsb3
+{
+public:
+    Rhd2000DataBlockRingUsb3(unsigned int capacity, int numDataStreams,
+                             Rhd2000DataBlockUsb3::AmplifierLayout layout = Rhd2000DataBlockUsb3::TimeMajor,
+                             Rhd2000DataBlockUsb3::SampleFormat format = Rhd2000DataBlockUsb3::Int32Samples);
+    ~Rhd2000DataBlockRingUsb3();
+
+    // Producer side (one thread only).
+    unsigned int getFreeSlots() const;
+    Rhd2000DataBlockUsb3* beginWrite(unsigned int index = 0);
+    void commitWrite(unsigned int count = 1);
+
+    // Consumer side (one thread only).
+    Rhd2000DataBlockUsb3* front();
+    void pop();
+
+    unsigned int size() const;
+    unsigned int getCapacity() const;
+    int getNumDataStreams() const;
+    unsigned int getMaxOccupancy() const;
+
+    // The counters below need 64-byte alignment, which plain new does not give before C++17.
+    static void* operator new(size_t size);
+    static void operator delete(void* p);
+
+private:
+    Rhd2000DataBlockRingUsb3(const Rhd2000DataBlockRingUsb3 &);
+    Rhd2000DataBlockRingUsb3& operator=(const Rhd2000DataBlockRingUsb3 &);
+
+    vector<Rhd2000DataBlockUsb3*> slots;
+    unsigned int capacity;
+    int numDataStreams;
+
+    // Monotonic write and read counters, kept on separate cache lines so the producer and
+    // consumer do not false-share.
+    alignas(64) atomic<unsigned long long> writeCount;
+    alignas(64) atomic<unsigned long long> readCount;
+    alignas(64) atomic<unsigned int> maxOccupancy;
+};
+
+#endif // RHD2000DATABLOCKRINGUSB3_H
@@ -22,19 +22,46 @@
 #include <fstream>
 #include <iomanip>
 #include <vector>
+#include <atomic>
+#include <utility>
+#include <cstring>
 
 #include "rhd2000datablockusb3.h"
+#include "rhd2000decoderusb3.h"
 
 using namespace std;
 
+// Largest stream count handled by the fast decoder's fixed-size row tables (the Rhythm USB3 maximum).
+#define MAX_DATA_STREAMS_DECODED 32
+
 // This class creates a data structure storing SAMPLES_PER_DATA_BLOCK data frames
 // from a Rhythm USB3 FPGA interface controlling up to 16 RHD2000 chips.
 
-// Constructor.  Allocates memory for data block.
-Rhd2000DataBlockUsb3::Rhd2000DataBlockUsb3(int numDataStreams)
+// Number of data blocks whose sample buffers have been heap-allocated (by construction or copy)
+// since program start.  Moves and pooled reuse do not allocate.
+static atomic<unsigned long long> numAllocations(0);
+
+// Constructor.  Allocates memory for data block, with amplifier samples stored in the given layout and
+// all samples in the given format.
+Rhd2000DataBlockUsb3::Rhd2000DataBlockUsb3(int numDataStreams, AmplifierLayout layout, SampleFormat format)
 {
+    numAllocations++;
     numDataStreamsStored = numDataStreams;
+    amplifierLayout = layout;
+    sampleFormat = format;
+    numBadHeaders = 0;
+    syncFlags = 0;
+    numSamplesDropped = 0;
     allocateUIntArray1D(timeStamp, SAMPLES_PER_DATA_BLOCK);
+    if (sampleFormat == UInt16Samples) {
+        amplifierDataFast = nullptr;
+        amplifierData16.resize(numDataStreams * CHANNELS_PER_STREAM * SAMPLES_PER_DATA_BLOCK);
+        auxiliaryData16.resize(numDataStreams * 3 * SAMPLES_PER_DATA_BLOCK);
+        boardAdcData16.resize(8 * SAMPLES_PER_DATA_BLOCK);
+        ttlIn16.resize(SAMPLES_PER_DATA_BLOCK);
+        ttlOut16.resize(SAMPLES_PER_DATA_BLOCK);
+        return;
+    }
     // allocateIntArray3D(amplifierData, numDataStreams, CHANNELS_PER_STREAM, SAMPLES_PER_DATA_BLOCK);
     amplifierDataFast = new int [numDataStreams * CHANNELS_PER_STREAM * SAMPLES_PER_DATA_BLOCK];
     allocateIntArray3D(auxiliaryData, numDataStreams, 3, SAMPLES_PER_DATA_BLOCK);
@@ -52,10 +79,14 @@ Rhd2000DataBlockUsb3::~Rhd2000DataBlockUsb3()
 // Copy constructor
 Rhd2000DataBlockUsb3::Rhd2000DataBlockUsb3(const Rhd2000DataBlockUsb3 &obj)
 {
-    int size = obj.numDataStreamsStored * CHANNELS_PER_STREAM * SAMPLES_PER_DATA_BLOCK;
-    amplifierDataFast = new int [size];
-    for (int i = 0; i < size; ++i) {
-        amplifierDataFast[i] = obj.amplifierDataFast[i];
+    numAllocations++;
+    amplifierDataFast = nullptr;
+    if (obj.amplifierDataFast) {
+        int size = obj.numDataStreamsStored * CHANNELS_PER_STREAM * SAMPLES_PER_DATA_BLOCK;
+        amplifierDataFast = new int [size];
+        for (int i = 0; i < size; ++i) {
+            amplifierDataFast[i] = obj.amplifierDataFast[i];
+        }
     }
 
     timeStamp = obj.timeStamp;
@@ -64,7 +95,173 @@ Rhd2000DataBlockUsb3::Rhd2000DataBlockUsb3(const Rhd2000DataBlockUsb3 &obj)
     boardAdcData = obj.boardAdcData;
     ttlIn = obj.ttlIn;
     ttlOut = obj.ttlOut;
+    amplifierData16 = obj.amplifierData16;
+    auxiliaryData16 = obj.auxiliaryData16;
+    boardAdcData16 = obj.boardAdcData16;
+    ttlIn16 = obj.ttlIn16;
+    ttlOut16 = obj.ttlOut16;
+    numDataStreamsStored = obj.numDataStreamsStored;
+    amplifierLayout = obj.amplifierLayout;
+    sampleFormat = obj.sampleFormat;
+    numBadHeaders = obj.numBadHeaders;
+    syncFlags = obj.syncFlags;
+    numSamplesDropped = obj.numSamplesDropped;
+}
+
+// Move constructor.  Takes over the sample buffers of obj without allocating; obj is left empty.
+Rhd2000DataBlockUsb3::Rhd2000DataBlockUsb3(Rhd2000DataBlockUsb3 &&obj) :
+    timeStamp(std::move(obj.timeStamp)),
+    amplifierDataFast(obj.amplifierDataFast),
+    auxiliaryData(std::move(obj.auxiliaryData)),
+    boardAdcData(std::move(obj.boardAdcData)),
+    ttlIn(std::move(obj.ttlIn)),
+    ttlOut(std::move(obj.ttlOut)),
+    amplifierData16(std::move(obj.amplifierData16)),
+    auxiliaryData16(std::move(obj.auxiliaryData16)),
+    boardAdcData16(std::move(obj.boardAdcData16)),
+    ttlIn16(std::move(obj.ttlIn16)),
+    ttlOut16(std::move(obj.ttlOut16)),
+    numDataStreamsStored(obj.numDataStreamsStored),
+    amplifierLayout(obj.amplifierLayout),
+    sampleFormat(obj.sampleFormat),
+    numBadHeaders(obj.numBadHeaders),
+    syncFlags(obj.syncFlags),
+    numSamplesDropped(obj.numSamplesDropped)
+{
+    obj.amplifierDataFast = nullptr;
+    obj.numDataStreamsStored = 0;
+}
+
+// Copy assignment.  Reuses the existing amplifier buffer when the stream counts match.
+Rhd2000DataBlockUsb3& Rhd2000DataBlockUsb3::operator=(const Rhd2000DataBlockUsb3 &obj)
+{
+    if (this == &obj) return *this;
+
+    int size = obj.numDataStreamsStored * CHANNELS_PER_STREAM * SAMPLES_PER_DATA_BLOCK;
+    if (!obj.amplifierDataFast) {
+        delete [] amplifierDataFast;
+        amplifierDataFast = nullptr;
+    } else {
+        if (numDataStreamsStored != obj.numDataStreamsStored || !amplifierDataFast) {
+            delete [] amplifierDataFast;
+            amplifierDataFast = new int [size];
+            numAllocations++;
+        }
+        for (int i = 0; i < size; ++i) {
+            amplifierDataFast[i] = obj.amplifierDataFast[i];
+        }
+    }
+
+    timeStamp = obj.timeStamp;
+    auxiliaryData = obj.auxiliaryData;
+    boardAdcData = obj.boardAdcData;
+    ttlIn = obj.ttlIn;
+    ttlOut = obj.ttlOut;
+    amplifierData16 = obj.amplifierData16;
+    auxiliaryData16 = obj.auxiliaryData16;
+    boardAdcData16 = obj.boardAdcData16;
+    ttlIn16 = obj.ttlIn16;
+    ttlOut16 = obj.ttlOut16;
+    numDataStreamsStored = obj.numDataStreamsStored;
+    amplifierLayout = obj.amplifierLayout;
+    sampleFormat = obj.sampleFormat;
+    numBadHeaders = obj.numBadHeaders;
+    syncFlags = obj.syncFlags;
+    numSamplesDropped = obj.numSamplesDropped;
+    return *this;
+}
+
+// Move assignment.
+Rhd2000DataBlockUsb3& Rhd2000DataBlockUsb3::operator=(Rhd2000DataBlockUsb3 &&obj)
+{
+    if (this == &obj) return *this;
+
+    delete [] amplifierDataFast;
+    amplifierDataFast = obj.amplifierDataFast;
+    obj.amplifierDataFast = nullptr;
+
+    timeStamp = std::move(obj.timeStamp);
+    auxiliaryData = std::move(obj.auxiliaryData);
+    boardAdcData = std::move(obj.boardAdcData);
+    ttlIn = std::move(obj.ttlIn);
+    ttlOut = std::move(obj.ttlOut);
+    amplifierData16 = std::move(obj.amplifierData16);
+    auxiliaryData16 = std::move(obj.auxiliaryData16);
+    boardAdcData16 = std::move(obj.boardAdcData16);
+    ttlIn16 = std::move(obj.ttlIn16);
+    ttlOut16 = std::move(obj.ttlOut16);
     numDataStreamsStored = obj.numDataStreamsStored;
+    amplifierLayout = obj.amplifierLayout;
+    sampleFormat = obj.sampleFormat;
+    numBadHeaders = obj.numBadHeaders;
+    syncFlags = obj.syncFlags;
+    numSamplesDropped = obj.numSamplesDropped;
+    obj.numDataStreamsStored = 0;
+    return *this;
+}
+
+// Returns the number of data blocks allocated so far.  Moves and pooled reuse do not count.
+unsigned long long Rhd2000DataBlockUsb3::getNumAllocations()
+{
+    return numAllocations;
+}
+
+// Returns the number of data streams this block was allocated for.
+int Rhd2000DataBlockUsb3::getNumDataStreams() const
+{
+    return numDataStreamsStored;
+}
+
+Rhd2000DataBlockUsb3::AmplifierLayout Rhd2000DataBlockUsb3::getAmplifierLayout() const
+{
+    return amplifierLayout;
+}
+
+Rhd2000DataBlockUsb3::SampleFormat Rhd2000DataBlockUsb3::getSampleFormat() const
+{
+    return sampleFormat;
+}
+
+// Returns the number of frames that lacked the Rhythm magic number when the block was last filled.
+int Rhd2000DataBlockUsb3::getNumBadHeaders() const
+{
+    return numBadHeaders;
+}
+
+// Returns the SyncFlag bits describing problems found when the block was last filled.
+unsigned int Rhd2000DataBlockUsb3::getSyncFlags() const
+{
+    return syncFlags;
+}
+
+// Replaces the SyncFlag bits; used by Rhd2000EvalBoardUsb3, which sees the USB stream the block came from.
+void Rhd2000DataBlockUsb3::setSyncFlags(unsigned int flags)
+{
+    syncFlags = flags;
+}
+
+// Returns the number of samples missing between the previous block and the end of this one, as
+// counted by Rhd2000TimeStampMonitorUsb3.
+unsigned int Rhd2000DataBlockUsb3::getNumSamplesDropped() const
+{
+    return numSamplesDropped;
+}
+
+void Rhd2000DataBlockUsb3::setNumSamplesDropped(unsigned int numSamples)
+{
+    numSamplesDropped = numSamples;
+}
+
+// Returns true if the time stamps run firstTimeStamp, firstTimeStamp + 1, ... without a break
+// (wrapping around after 0xffffffff).
+bool Rhd2000DataBlockUsb3::timeStampsFollow(unsigned int firstTimeStamp) const
+{
+    const unsigned int *stamps = timeStamp.data();
+    unsigned int mismatch = 0;
+    for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        mismatch |= stamps[t] ^ (firstTimeStamp + t);
+    }
+    return mismatch == 0;
 }
 
 
@@ -163,16 +360,132 @@ int Rhd2000DataBlockUsb3::convertUsbWord(unsigned char usbBuffer[], int index)
     return (int) result;
 }
 
-// Fill data block with raw data from USB input buffer.
+// Fill data block with raw data from USB input buffer.  In TimeMajor layout the amplifier words, which
+// make up nearly all of each frame and are already in amplifierDataFast order, are widened (or, for
+// UInt16Samples, copied) in bulk by the fastest SIMD path the CPU supports (see Rhd2000DecoderUsb3).
+// In ChannelMajor layout they are transposed to per-channel rows instead.  Auxiliary, ADC and TTL
+// words are scattered through row pointers computed once per block.  Frames without the magic number
+// are decoded anyway but counted (getNumBadHeaders()) and flagged (SyncBadHeader) rather than reported
+// one by one; Rhd2000EvalBoardUsb3 realigns the USB stream before blocks get this far.
 void Rhd2000DataBlockUsb3::fillFromUsbBuffer(unsigned char usbBuffer[], int blockIndex, int numDataStreams)
+{
+    int channel, stream, i;
+
+    if (numDataStreams > MAX_DATA_STREAMS_DECODED) {
+        fillFromUsbBufferReference(usbBuffer, blockIndex, numDataStreams);
+        return;
+    }
+
+    // Destination rows for the scattered words, in the order they appear in each USB frame
+    if (sampleFormat == UInt16Samples) {
+        unsigned short *auxRows[3 * MAX_DATA_STREAMS_DECODED];
+        unsigned short *adcRows[8];
+        for (channel = 0; channel < 3; ++channel) {
+            for (stream = 0; stream < numDataStreams; ++stream) {
+                auxRows[channel * numDataStreams + stream] =
+                        &auxiliaryData16[(stream * 3 + channel) * SAMPLES_PER_DATA_BLOCK];
+            }
+        }
+        for (i = 0; i < 8; ++i) {
+            adcRows[i] = &boardAdcData16[i * SAMPLES_PER_DATA_BLOCK];
+        }
+        decodeFrames(usbBuffer, blockIndex, numDataStreams, amplifierData16.data(), auxRows, adcRows,
+                     ttlIn16.data(), ttlOut16.data());
+    } else {
+        int *auxRows[3 * MAX_DATA_STREAMS_DECODED];
+        int *adcRows[8];
+        for (channel = 0; channel < 3; ++channel) {
+            for (stream = 0; stream < numDataStreams; ++stream) {
+                auxRows[channel * numDataStreams + stream] = auxiliaryData[stream][channel].data();
+            }
+        }
+        for (i = 0; i < 8; ++i) {
+            adcRows[i] = boardAdcData[i].data();
+        }
+        decodeFrames(usbBuffer, blockIndex, numDataStreams, amplifierDataFast, auxRows, adcRows,
+                     ttlIn.data(), ttlOut.data());
+    }
+    syncFlags = (numBadHeaders > 0) ? SyncBadHeader : 0;
+    numSamplesDropped = 0;
+}
+
+// Frame loop of fillFromUsbBuffer(), shared by both sample formats.
+template <typename Sample>
+void Rhd2000DataBlockUsb3::decodeFrames(unsigned char usbBuffer[], int blockIndex, int numDataStreams, Sample *amp,
+                                        Sample **auxRows, Sample **adcRows, Sample *ttlInRow, Sample *ttlOutRow)
+{
+    // Magic number bytes in USB (little-endian) order
+    static const unsigned char magicNumberBytes[8] = { 0x53, 0x2a, 0x13, 0x38, 0xaa, 0x2a, 0xa2, 0xd7 };
+
+    int t, channel, stream, i;
+
+    const int numAuxWords = 3 * numDataStreams;
+    const int numAmpWords = CHANNELS_PER_STREAM * numDataStreams;
+    const int frameSizeInBytes = 2 * calculateDataBlockSizeInWords(numDataStreams) / SAMPLES_PER_DATA_BLOCK;
+    const int ampOffset = 12 + 2 * numAuxWords;
+    const int adcOffset = ampOffset + 2 * (numAmpWords + (numDataStreams % 4));
+
+    // ChannelMajor layout: start of the amplifier row for each amplifier word in a frame
+    int ampRows[CHANNELS_PER_STREAM * MAX_DATA_STREAMS_DECODED];
+    bool channelMajor = (amplifierLayout == ChannelMajor);
+    if (channelMajor) {
+        for (channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
+            for (stream = 0; stream < numDataStreams; ++stream) {
+                ampRows[channel * numDataStreams + stream] = fastIndex(stream, channel, 0);
+            }
+        }
+    }
+
+    unsigned char *frame = usbBuffer + blockIndex * SAMPLES_PER_DATA_BLOCK * frameSizeInBytes;
+    Sample *ampFrame = amp;
+    numBadHeaders = 0;
+    for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        if (memcmp(frame, magicNumberBytes, 8) != 0) {
+            numBadHeaders++;
+        }
+        timeStamp[t] = convertUsbTimeStamp(frame, 8);
+
+        for (i = 0; i < numAuxWords; ++i) {
+            auxRows[i][t] = (Sample) convertUsbWord(frame, 12 + 2 * i);
+        }
+
+        if (channelMajor) {
+            // Transpose amplifier words eight frames at a time (SAMPLES_PER_DATA_BLOCK is a multiple of 8)
+            if (t % 8 == 7) {
+                Rhd2000DecoderUsb3::transposeWords8(frame - 7 * frameSizeInBytes + ampOffset, frameSizeInBytes,
+                                                    numAmpWords, amp + t - 7, ampRows);
+            }
+        } else {
+            Rhd2000DecoderUsb3::decodeWords(frame + ampOffset, ampFrame, numAmpWords);
+            ampFrame += numAmpWords;
+        }
+
+        for (i = 0; i < 8; ++i) {
+            adcRows[i][t] = (Sample) convertUsbWord(frame, adcOffset + 2 * i);
+        }
+        ttlInRow[t] = (Sample) convertUsbWord(frame, adcOffset + 16);
+        ttlOutRow[t] = (Sample) convertUsbWord(frame, adcOffset + 18);
+
+        frame += frameSizeInBytes;
+    }
+}
+
+// Original byte-by-byte decoder.  Kept as the reference that fillFromUsbBuffer() is checked and
+// benchmarked against.  Supports Int32Samples blocks only.
+void Rhd2000DataBlockUsb3::fillFromUsbBufferReference(unsigned char usbBuffer[], int blockIndex, int numDataStreams)
 {
     int index, t, channel, stream, i;
 
-    int ampIndex = 0;
+    if (sampleFormat != Int32Samples) {
+        cerr << "Error in Rhd2000DataBlockUsb3::fillFromUsbBufferReference: block does not store Int32Samples." << endl;
+        return;
+    }
+
     index = blockIndex * 2 * calculateDataBlockSizeInWords(numDataStreams);
+    numBadHeaders = 0;
     for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
         if (!checkUsbHeader(usbBuffer, index)) {
-            cout << "Error in Rhd2000DataBlockUsb3::fillFromUsbBuffer: Incorrect header." << endl;
+            numBadHeaders++;
         }
         index += 8;
         timeStamp[t] = convertUsbTimeStamp(usbBuffer, index);
@@ -190,7 +503,7 @@ void Rhd2000DataBlockUsb3::fillFromUsbBuffer(unsigned char usbBuffer[], int bloc
         for (channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
             for (stream = 0; stream < numDataStreams; ++stream) {
                 // amplifierData[stream][channel][t] = convertUsbWord(usbBuffer, index);
-                amplifierDataFast[ampIndex++] = convertUsbWord(usbBuffer, index);
+                amplifierDataFast[fastIndex(stream, channel, t)] = convertUsbWord(usbBuffer, index);
                 index += 2;
             }
         }
@@ -211,6 +524,8 @@ void Rhd2000DataBlockUsb3::fillFromUsbBuffer(unsigned char usbBuffer[], int bloc
         ttlOut[t] = convertUsbWord(usbBuffer, index);
         index += 2;
     }
+    syncFlags = (numBadHeaders > 0) ? SyncBadHeader : 0;
+    numSamplesDropped = 0;
 }
 
 // Print the contents of RHD2000 registers from a selected USB data stream (0-31)
@@ -223,24 +538,24 @@ void Rhd2000DataBlockUsb3::print(int stream) const
     cout << "RHD 2000 Data Block contents:" << endl;
     cout << "  ROM contents:" << endl;
     cout << "    Chip Name: " <<
-           (char) auxiliaryData[stream][2][24] <<
-           (char) auxiliaryData[stream][2][25] <<
-           (char) auxiliaryData[stream][2][26] <<
-           (char) auxiliaryData[stream][2][27] <<
-           (char) auxiliaryData[stream][2][28] <<
-           (char) auxiliaryData[stream][2][29] <<
-           (char) auxiliaryData[stream][2][30] <<
-           (char) auxiliaryData[stream][2][31] << endl;
+           (char) auxiliarySample(stream, 2, 24) <<
+           (char) auxiliarySample(stream, 2, 25) <<
+           (char) auxiliarySample(stream, 2, 26) <<
+           (char) auxiliarySample(stream, 2, 27) <<
+           (char) auxiliarySample(stream, 2, 28) <<
+           (char) auxiliarySample(stream, 2, 29) <<
+           (char) auxiliarySample(stream, 2, 30) <<
+           (char) auxiliarySample(stream, 2, 31) << endl;
     cout << "    Company Name:" <<
-           (char) auxiliaryData[stream][2][32] <<
-           (char) auxiliaryData[stream][2][33] <<
-           (char) auxiliaryData[stream][2][34] <<
-           (char) auxiliaryData[stream][2][35] <<
-           (char) auxiliaryData[stream][2][36] << endl;
-    cout << "    Intan Chip ID: " << auxiliaryData[stream][2][19] << endl;
-    cout << "    Number of Amps: " << auxiliaryData[stream][2][20] << endl;
+           (char) auxiliarySample(stream, 2, 32) <<
+           (char) auxiliarySample(stream, 2, 33) <<
+           (char) auxiliarySample(stream, 2, 34) <<
+           (char) auxiliarySample(stream, 2, 35) <<
+           (char) auxiliarySample(stream, 2, 36) << endl;
+    cout << "    Intan Chip ID: " << auxiliarySample(stream, 2, 19) << endl;
+    cout << "    Number of Amps: " << auxiliarySample(stream, 2, 20) << endl;
     cout << "    Unipolar/Bipolar Amps: ";
-    switch (auxiliaryData[stream][2][21]) {
+    switch (auxiliarySample(stream, 2, 21)) {
         case 0:
             cout << "bipolar";
             break;
@@ -251,51 +566,51 @@ void Rhd2000DataBlockUsb3::print(int stream) const
             cout << "UNKNOWN";
     }
     cout << endl;
-    cout << "    Die Revision: " << auxiliaryData[stream][2][22] << endl;
-    cout << "    Future Expansion Register: " << auxiliaryData[stream][2][23] << endl;
+    cout << "    Die Revision: " << auxiliarySample(stream, 2, 22) << endl;
+    cout << "    Future Expansion Register: " << auxiliarySample(stream, 2, 23) << endl;
 
     cout << "  RAM contents:" << endl;
-    cout << "    ADC reference BW:      " << ((auxiliaryData[stream][2][RamOffset + 0] & 0xc0) >> 6) << endl;
-    cout << "    amp fast settle:       " << ((auxiliaryData[stream][2][RamOffset + 0] & 0x20) >> 5) << endl;
-    cout << "    amp Vref enable:       " << ((auxiliaryData[stream][2][RamOffset + 0] & 0x10) >> 4) << endl;
-    cout << "    ADC comparator bias:   " << ((auxiliaryData[stream][2][RamOffset + 0] & 0x0c) >> 2) << endl;
-    cout << "    ADC comparator select: " << ((auxiliaryData[stream][2][RamOffset + 0] & 0x03) >> 0) << endl;
-    cout << "    VDD sense enable:      " << ((auxiliaryData[stream][2][RamOffset + 1] & 0x40) >> 6) << endl;
-    cout << "    ADC buffer bias:       " << ((auxiliaryData[stream][2][RamOffset + 1] & 0x3f) >> 0) << endl;
-    cout << "    MUX bias:              " << ((auxiliaryData[stream][2][RamOffset + 2] & 0x3f) >> 0) << endl;
-    cout << "    MUX load:              " << ((auxiliaryData[stream][2][RamOffset + 3] & 0xe0) >> 5) << endl;
-    cout << "    tempS2, tempS1:        " << ((auxiliaryData[stream][2][RamOffset + 3] & 0x10) >> 4) << "," <<
-           ((auxiliaryData[stream][2][RamOffset + 3] & 0x08) >> 3) << endl; 
-    cout << "    tempen:                " << ((auxiliaryData[stream][2][RamOffset + 3] & 0x04) >> 2) << endl;
-    cout << "    digout HiZ:            " << ((auxiliaryData[stream][2][RamOffset + 3] & 0x02) >> 1) << endl;
-    cout << "    digout:                " << ((auxiliaryData[stream][2][RamOffset + 3] & 0x01) >> 0) << endl;
-    cout << "    weak MISO:             " << ((auxiliaryData[stream][2][RamOffset + 4] & 0x80) >> 7) << endl;
-    cout << "    twoscomp:              " << ((auxiliaryData[stream][2][RamOffset + 4] & 0x40) >> 6) << endl;
-    cout << "    absmode:               " << ((auxiliaryData[stream][2][RamOffset + 4] & 0x20) >> 5) << endl;
-    cout << "    DSPen:                 " << ((auxiliaryData[stream][2][RamOffset + 4] & 0x10) >> 4) << endl;
-    cout << "    DSP cutoff freq:       " << ((auxiliaryData[stream][2][RamOffset + 4] & 0x0f) >> 0) << endl;
-    cout << "    Zcheck DAC power:      " << ((auxiliaryData[stream][2][RamOffset + 5] & 0x40) >> 6) << endl;
-    cout << "    Zcheck load:           " << ((auxiliaryData[stream][2][RamOffset + 5] & 0x20) >> 5) << endl;
-    cout << "    Zcheck scale:          " << ((auxiliaryData[stream][2][RamOffset + 5] & 0x18) >> 3) << endl;
-    cout << "    Zcheck conn all:       " << ((auxiliaryData[stream][2][RamOffset + 5] & 0x04) >> 2) << endl;
-    cout << "    Zcheck sel pol:        " << ((auxiliaryData[stream][2][RamOffset + 5] & 0x02) >> 1) << endl;
-    cout << "    Zcheck en:             " << ((auxiliaryData[stream][2][RamOffset + 5] & 0x01) >> 0) << endl;
-    cout << "    Zcheck DAC:            " << ((auxiliaryData[stream][2][RamOffset + 6] & 0xff) >> 0) << endl;
-    cout << "    Zcheck select:         " << ((auxiliaryData[stream][2][RamOffset + 7] & 0x3f) >> 0) << endl;
-    cout << "    ADC aux1 en:           " << ((auxiliaryData[stream][2][RamOffset + 9] & 0x80) >> 7) << endl;
-    cout << "    ADC aux2 en:           " << ((auxiliaryData[stream][2][RamOffset + 11] & 0x80) >> 7) << endl;
-    cout << "    ADC aux3 en:           " << ((auxiliaryData[stream][2][RamOffset + 13] & 0x80) >> 7) << endl;
-    cout << "    offchip RH1:           " << ((auxiliaryData[stream][2][RamOffset + 8] & 0x80) >> 7) << endl;
-    cout << "    offchip RH2:           " << ((auxiliaryData[stream][2][RamOffset + 10] & 0x80) >> 7) << endl;
-    cout << "    offchip RL:            " << ((auxiliaryData[stream][2][RamOffset + 12] & 0x80) >> 7) << endl;
-
-    int rH1Dac1 = auxiliaryData[stream][2][RamOffset + 8] & 0x3f;
-    int rH1Dac2 = auxiliaryData[stream][2][RamOffset + 9] & 0x1f;
-    int rH2Dac1 = auxiliaryData[stream][2][RamOffset + 10] & 0x3f;
-    int rH2Dac2 = auxiliaryData[stream][2][RamOffset + 11] & 0x1f;
-    int rLDac1 = auxiliaryData[stream][2][RamOffset + 12] & 0x7f;
-    int rLDac2 = auxiliaryData[stream][2][RamOffset + 13] & 0x3f;
-    int rLDac3 = auxiliaryData[stream][2][RamOffset + 13] & 0x40 >> 6;
+    cout << "    ADC reference BW:      " << ((auxiliarySample(stream, 2, RamOffset + 0) & 0xc0) >> 6) << endl;
+    cout << "    amp fast settle:       " << ((auxiliarySample(stream, 2, RamOffset + 0) & 0x20) >> 5) << endl;
+    cout << "    amp Vref enable:       " << ((auxiliarySample(stream, 2, RamOffset + 0) & 0x10) >> 4) << endl;
+    cout << "    ADC comparator bias:   " << ((auxiliarySample(stream, 2, RamOffset + 0) & 0x0c) >> 2) << endl;
+    cout << "    ADC comparator select: " << ((auxiliarySample(stream, 2, RamOffset + 0) & 0x03) >> 0) << endl;
+    cout << "    VDD sense enable:      " << ((auxiliarySample(stream, 2, RamOffset + 1) & 0x40) >> 6) << endl;
+    cout << "    ADC buffer bias:       " << ((auxiliarySample(stream, 2, RamOffset + 1) & 0x3f) >> 0) << endl;
+    cout << "    MUX bias:              " << ((auxiliarySample(stream, 2, RamOffset + 2) & 0x3f) >> 0) << endl;
+    cout << "    MUX load:              " << ((auxiliarySample(stream, 2, RamOffset + 3) & 0xe0) >> 5) << endl;
+    cout << "    tempS2, tempS1:        " << ((auxiliarySample(stream, 2, RamOffset + 3) & 0x10) >> 4) << "," <<
+           ((auxiliarySample(stream, 2, RamOffset + 3) & 0x08) >> 3) << endl; 
+    cout << "    tempen:                " << ((auxiliarySample(stream, 2, RamOffset + 3) & 0x04) >> 2) << endl;
+    cout << "    digout HiZ:            " << ((auxiliarySample(stream, 2, RamOffset + 3) & 0x02) >> 1) << endl;
+    cout << "    digout:                " << ((auxiliarySample(stream, 2, RamOffset + 3) & 0x01) >> 0) << endl;
+    cout << "    weak MISO:             " << ((auxiliarySample(stream, 2, RamOffset + 4) & 0x80) >> 7) << endl;
+    cout << "    twoscomp:              " << ((auxiliarySample(stream, 2, RamOffset + 4) & 0x40) >> 6) << endl;
+    cout << "    absmode:               " << ((auxiliarySample(stream, 2, RamOffset + 4) & 0x20) >> 5) << endl;
+    cout << "    DSPen:                 " << ((auxiliarySample(stream, 2, RamOffset + 4) & 0x10) >> 4) << endl;
+    cout << "    DSP cutoff freq:       " << ((auxiliarySample(stream, 2, RamOffset + 4) & 0x0f) >> 0) << endl;
+    cout << "    Zcheck DAC power:      " << ((auxiliarySample(stream, 2, RamOffset + 5) & 0x40) >> 6) << endl;
+    cout << "    Zcheck load:           " << ((auxiliarySample(stream, 2, RamOffset + 5) & 0x20) >> 5) << endl;
+    cout << "    Zcheck scale:          " << ((auxiliarySample(stream, 2, RamOffset + 5) & 0x18) >> 3) << endl;
+    cout << "    Zcheck conn all:       " << ((auxiliarySample(stream, 2, RamOffset + 5) & 0x04) >> 2) << endl;
+    cout << "    Zcheck sel pol:        " << ((auxiliarySample(stream, 2, RamOffset + 5) & 0x02) >> 1) << endl;
+    cout << "    Zcheck en:             " << ((auxiliarySample(stream, 2, RamOffset + 5) & 0x01) >> 0) << endl;
+    cout << "    Zcheck DAC:            " << ((auxiliarySample(stream, 2, RamOffset + 6) & 0xff) >> 0) << endl;
+    cout << "    Zcheck select:         " << ((auxiliarySample(stream, 2, RamOffset + 7) & 0x3f) >> 0) << endl;
+    cout << "    ADC aux1 en:           " << ((auxiliarySample(stream, 2, RamOffset + 9) & 0x80) >> 7) << endl;
+    cout << "    ADC aux2 en:           " << ((auxiliarySample(stream, 2, RamOffset + 11) & 0x80) >> 7) << endl;
+    cout << "    ADC aux3 en:           " << ((auxiliarySample(stream, 2, RamOffset + 13) & 0x80) >> 7) << endl;
+    cout << "    offchip RH1:           " << ((auxiliarySample(stream, 2, RamOffset + 8) & 0x80) >> 7) << endl;
+    cout << "    offchip RH2:           " << ((auxiliarySample(stream, 2, RamOffset + 10) & 0x80) >> 7) << endl;
+    cout << "    offchip RL:            " << ((auxiliarySample(stream, 2, RamOffset + 12) & 0x80) >> 7) << endl;
+
+    int rH1Dac1 = auxiliarySample(stream, 2, RamOffset + 8) & 0x3f;
+    int rH1Dac2 = auxiliarySample(stream, 2, RamOffset + 9) & 0x1f;
+    int rH2Dac1 = auxiliarySample(stream, 2, RamOffset + 10) & 0x3f;
+    int rH2Dac2 = auxiliarySample(stream, 2, RamOffset + 11) & 0x1f;
+    int rLDac1 = auxiliarySample(stream, 2, RamOffset + 12) & 0x7f;
+    int rLDac2 = auxiliarySample(stream, 2, RamOffset + 13) & 0x3f;
+    int rLDac3 = auxiliarySample(stream, 2, RamOffset + 13) & 0x40 >> 6;
 
     double rH1 = 2630.0 + rH1Dac2 * 30800.0 + rH1Dac1 * 590.0;
     double rH2 = 8200.0 + rH2Dac2 * 38400.0 + rH2Dac1 * 730.0;
@@ -311,44 +626,44 @@ void Rhd2000DataBlockUsb3::print(int stream) const
             (rL / 1000) << " kOhm" << endl;
 
     cout << "    amp power[31:0]:       " <<
-           ((auxiliaryData[stream][2][RamOffset + 17] & 0x80) >> 7) <<
-           ((auxiliaryData[stream][2][RamOffset + 17] & 0x40) >> 6) <<
-           ((auxiliaryData[stream][2][RamOffset + 17] & 0x20) >> 5) <<
-           ((auxiliaryData[stream][2][RamOffset + 17] & 0x10) >> 4) <<
-           ((auxiliaryData[stream][2][RamOffset + 17] & 0x08) >> 3) <<
-           ((auxiliaryData[stream][2][RamOffset + 17] & 0x04) >> 2) <<
-           ((auxiliaryData[stream][2][RamOffset + 17] & 0x02) >> 1) <<
-           ((auxiliaryData[stream][2][RamOffset + 17] & 0x01) >> 0) << " " <<
-           ((auxiliaryData[stream][2][RamOffset + 16] & 0x80) >> 7) <<
-           ((auxiliaryData[stream][2][RamOffset + 16] & 0x40) >> 6) <<
-           ((auxiliaryData[stream][2][RamOffset + 16] & 0x20) >> 5) <<
-           ((auxiliaryData[stream][2][RamOffset + 16] & 0x10) >> 4) <<
-           ((auxiliaryData[stream][2][RamOffset + 16] & 0x08) >> 3) <<
-           ((auxiliaryData[stream][2][RamOffset + 16] & 0x04) >> 2) <<
-           ((auxiliaryData[stream][2][RamOffset + 16] & 0x02) >> 1) <<
-           ((auxiliaryData[stream][2][RamOffset + 16] & 0x01) >> 0) << " " <<
-           ((auxiliaryData[stream][2][RamOffset + 15] & 0x80) >> 7) <<
-           ((auxiliaryData[stream][2][RamOffset + 15] & 0x40) >> 6) <<
-           ((auxiliaryData[stream][2][RamOffset + 15] & 0x20) >> 5) <<
-           ((auxiliaryData[stream][2][RamOffset + 15] & 0x10) >> 4) <<
-           ((auxiliaryData[stream][2][RamOffset + 15] & 0x08) >> 3) <<
-           ((auxiliaryData[stream][2][RamOffset + 15] & 0x04) >> 2) <<
-           ((auxiliaryData[stream][2][RamOffset + 15] & 0x02) >> 1) <<
-           ((auxiliaryData[stream][2][RamOffset + 15] & 0x01) >> 0) << " " <<
-           ((auxiliaryData[stream][2][RamOffset + 14] & 0x80) >> 7) <<
-           ((auxiliaryData[stream][2][RamOffset + 14] & 0x40) >> 6) <<
-           ((auxiliaryData[stream][2][RamOffset + 14] & 0x20) >> 5) <<
-           ((auxiliaryData[stream][2][RamOffset + 14] & 0x10) >> 4) <<
-           ((auxiliaryData[stream][2][RamOffset + 14] & 0x08) >> 3) <<
-           ((auxiliaryData[stream][2][RamOffset + 14] & 0x04) >> 2) <<
-           ((auxiliaryData[stream][2][RamOffset + 14] & 0x02) >> 1) <<
-           ((auxiliaryData[stream][2][RamOffset + 14] & 0x01) >> 0) << endl;
+           ((auxiliarySample(stream, 2, RamOffset + 17) & 0x80) >> 7) <<
+           ((auxiliarySample(stream, 2, RamOffset + 17) & 0x40) >> 6) <<
+           ((auxiliarySample(stream, 2, RamOffset + 17) & 0x20) >> 5) <<
+           ((auxiliarySample(stream, 2, RamOffset + 17) & 0x10) >> 4) <<
+           ((auxiliarySample(stream, 2, RamOffset + 17) & 0x08) >> 3) <<
+           ((auxiliarySample(stream, 2, RamOffset + 17) & 0x04) >> 2) <<
+           ((auxiliarySample(stream, 2, RamOffset + 17) & 0x02) >> 1) <<
+           ((auxiliarySample(stream, 2, RamOffset + 17) & 0x01) >> 0) << " " <<
+           ((auxiliarySample(stream, 2, RamOffset + 16) & 0x80) >> 7) <<
+           ((auxiliarySample(stream, 2, RamOffset + 16) & 0x40) >> 6) <<
+           ((auxiliarySample(stream, 2, RamOffset + 16) & 0x20) >> 5) <<
+           ((auxiliarySample(stream, 2, RamOffset + 16) & 0x10) >> 4) <<
+           ((auxiliarySample(stream, 2, RamOffset + 16) & 0x08) >> 3) <<
+           ((auxiliarySample(stream, 2, RamOffset + 16) & 0x04) >> 2) <<
+           ((auxiliarySample(stream, 2, RamOffset + 16) & 0x02) >> 1) <<
+           ((auxiliarySample(stream, 2, RamOffset + 16) & 0x01) >> 0) << " " <<
+           ((auxiliarySample(stream, 2, RamOffset + 15) & 0x80) >> 7) <<
+           ((auxiliarySample(stream, 2, RamOffset + 15) & 0x40) >> 6) <<
+           ((auxiliarySample(stream, 2, RamOffset + 15) & 0x20) >> 5) <<
+           ((auxiliarySample(stream, 2, RamOffset + 15) & 0x10) >> 4) <<
+           ((auxiliarySample(stream, 2, RamOffset + 15) & 0x08) >> 3) <<
+           ((auxiliarySample(stream, 2, RamOffset + 15) & 0x04) >> 2) <<
+           ((auxiliarySample(stream, 2, RamOffset + 15) & 0x02) >> 1) <<
+           ((auxiliarySample(stream, 2, RamOffset + 15) & 0x01) >> 0) << " " <<
+           ((auxiliarySample(stream, 2, RamOffset + 14) & 0x80) >> 7) <<
+           ((auxiliarySample(stream, 2, RamOffset + 14) & 0x40) >> 6) <<
+           ((auxiliarySample(stream, 2, RamOffset + 14) & 0x20) >> 5) <<
+           ((auxiliarySample(stream, 2, RamOffset + 14) & 0x10) >> 4) <<
+           ((auxiliarySample(stream, 2, RamOffset + 14) & 0x08) >> 3) <<
+           ((auxiliarySample(stream, 2, RamOffset + 14) & 0x04) >> 2) <<
+           ((auxiliarySample(stream, 2, RamOffset + 14) & 0x02) >> 1) <<
+           ((auxiliarySample(stream, 2, RamOffset + 14) & 0x01) >> 0) << endl;
 
     cout << endl;
 
-    int tempA = auxiliaryData[stream][1][12];
-    int tempB = auxiliaryData[stream][1][20];
-    int vddSample = auxiliaryData[stream][1][28];
+    int tempA = auxiliarySample(stream, 1, 12);
+    int tempB = auxiliarySample(stream, 1, 20);
+    int vddSample = auxiliarySample(stream, 1, 28);
 
     double tempUnitsC = ((double)(tempB - tempA)) / 98.9 - 273.15;
     double tempUnitsF = (9.0/5.0) * tempUnitsC + 32.0;
@@ -385,8 +700,54 @@ void Rhd2000DataBlockUsb3::writeWordLittleEndian(ofstream &outputStream, int dat
     outputStream << (unsigned char) msb;
 }
 
-// Write contents of data block to a binary output stream (saveOut) in little endian format.
+// Number of bytes written to a file per data block by write() or serialize().
+unsigned int Rhd2000DataBlockUsb3::getSerializedSizeInBytes(int numDataStreams)
+{
+    return SAMPLES_PER_DATA_BLOCK * getSerializedFrameSizeInBytes(numDataStreams);
+}
+
+// Number of bytes written to a file per sample.
+unsigned int Rhd2000DataBlockUsb3::getSerializedFrameSizeInBytes(int numDataStreams)
+{
+    // Time stamp (low 16 bits), amplifier, auxiliary, ADC and TTL words
+    return 2 * (1 + (CHANNELS_PER_STREAM + 3) * numDataStreams + 8 + 2);
+}
+
+// Store a 16-bit dataWord in little endian format and return the position of the next word.
+static inline unsigned char* putWordLittleEndian(unsigned char *dest, int dataWord)
+{
+    dest[0] = (unsigned char) (dataWord & 0x00ff);
+    dest[1] = (unsigned char) ((dataWord & 0xff00) >> 8);
+    return dest + 2;
+}
+
+static inline bool hostIsLittleEndian()
+{
+    const unsigned short one = 1;
+    return *((const unsigned char*) &one) == 1;
+}
+
+// Write contents of data block to a binary output stream (saveOut) in little endian format.  The block
+// is serialized into a byte buffer and handed to the stream with a single write; see
+// Rhd2000DataFileWriterUsb3 to also batch several blocks per write.  This version allocates the buffer
+// on every call; use the one below to write many blocks.
 void Rhd2000DataBlockUsb3::write(ofstream &saveOut, int numDataStreams) const
+{
+    vector<unsigned char> buffer;
+    write(saveOut, numDataStreams, buffer);
+}
+
+// As above, serializing into buffer, which is grown as needed and can be passed again with the next
+// block so that writing allocates nothing once it is large enough.
+void Rhd2000DataBlockUsb3::write(ofstream &saveOut, int numDataStreams, vector<unsigned char> &buffer) const
+{
+    buffer.resize(getSerializedSizeInBytes(numDataStreams));
+    serialize(buffer.data(), numDataStreams);
+    saveOut.write((const char*) buffer.data(), buffer.size());
+}
+
+// Original word-by-word writer.  Kept as the reference that write() is checked and benchmarked against.
+void Rhd2000DataBlockUsb3::writeReference(ofstream &saveOut, int numDataStreams) const
 {
     int t, channel, stream, i;
 
@@ -394,24 +755,237 @@ void Rhd2000DataBlockUsb3::write(ofstream &saveOut, int numDataStreams) const
         writeWordLittleEndian(saveOut, timeStamp[t]);
         for (channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
             for (stream = 0; stream < numDataStreams; ++stream) {
-                writeWordLittleEndian(saveOut, amplifierDataFast[fastIndex(stream, channel, t)]);
+                writeWordLittleEndian(saveOut, amplifierSample(stream, channel, t));
+            }
+        }
+        for (channel = 0; channel < 3; ++channel) {
+            for (stream = 0; stream < numDataStreams; ++stream) {
+                writeWordLittleEndian(saveOut, auxiliarySample(stream, channel, t));
+            }
+        }
+        for (i = 0; i < 8; ++i) {
+            writeWordLittleEndian(saveOut, boardAdcSample(i, t));
+        }
+        writeWordLittleEndian(saveOut, ttlInSample(t));
+        writeWordLittleEndian(saveOut, ttlOutSample(t));
+    }
+}
+
+// Serialize contents of data block into buffer in the write() file format.  buffer must hold
+// getSerializedSizeInBytes(numDataStreams) bytes.
+void Rhd2000DataBlockUsb3::serialize(unsigned char buffer[], int numDataStreams) const
+{
+    int channel, stream, i;
+
+    if (numDataStreams > MAX_DATA_STREAMS_DECODED) {
+        serializeReference(buffer, numDataStreams);
+        return;
+    }
+
+    // Source rows for the auxiliary and ADC words, in the order they appear in each file frame
+    if (sampleFormat == UInt16Samples) {
+        const unsigned short *auxRows[3 * MAX_DATA_STREAMS_DECODED];
+        const unsigned short *adcRows[8];
+        for (channel = 0; channel < 3; ++channel) {
+            for (stream = 0; stream < numDataStreams; ++stream) {
+                auxRows[channel * numDataStreams + stream] =
+                        &auxiliaryData16[(stream * 3 + channel) * SAMPLES_PER_DATA_BLOCK];
+            }
+        }
+        for (i = 0; i < 8; ++i) {
+            adcRows[i] = &boardAdcData16[i * SAMPLES_PER_DATA_BLOCK];
+        }
+        serializeFrames(buffer, numDataStreams, amplifierData16.data(), auxRows, adcRows,
+                        ttlIn16.data(), ttlOut16.data());
+    } else {
+        const int *auxRows[3 * MAX_DATA_STREAMS_DECODED];
+        const int *adcRows[8];
+        for (channel = 0; channel < 3; ++channel) {
+            for (stream = 0; stream < numDataStreams; ++stream) {
+                auxRows[channel * numDataStreams + stream] = auxiliaryData[stream][channel].data();
+            }
+        }
+        for (i = 0; i < 8; ++i) {
+            adcRows[i] = boardAdcData[i].data();
+        }
+        serializeFrames(buffer, numDataStreams, (const int*) amplifierDataFast, auxRows, adcRows,
+                        ttlIn.data(), ttlOut.data());
+    }
+}
+
+// Word-by-word serialize(), through the layout- and format-independent accessors, for more streams
+// than the row tables of serialize() hold.
+void Rhd2000DataBlockUsb3::serializeReference(unsigned char buffer[], int numDataStreams) const
+{
+    int t, channel, stream, i;
+
+    unsigned char *out = buffer;
+    for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        out = putWordLittleEndian(out, timeStamp[t]);
+        for (channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
+            for (stream = 0; stream < numDataStreams; ++stream) {
+                out = putWordLittleEndian(out, amplifierSample(stream, channel, t));
             }
         }
         for (channel = 0; channel < 3; ++channel) {
             for (stream = 0; stream < numDataStreams; ++stream) {
-                writeWordLittleEndian(saveOut, auxiliaryData[stream][channel][t]);
+                out = putWordLittleEndian(out, auxiliarySample(stream, channel, t));
             }
         }
         for (i = 0; i < 8; ++i) {
-            writeWordLittleEndian(saveOut, boardAdcData[i][t]);
+            out = putWordLittleEndian(out, boardAdcSample(i, t));
+        }
+        out = putWordLittleEndian(out, ttlInSample(t));
+        out = putWordLittleEndian(out, ttlOutSample(t));
+    }
+}
+
+// Number of fill frames serializeWithFill() writes for this block: one for each sample missing between
+// nextTimeStamp, the time stamp expected at the start of the block, and the last time stamp.  Jumps
+// of more than maxFillSamples (e.g., a restart) are not filled, nor are backward jumps.
+unsigned int Rhd2000DataBlockUsb3::countFillFrames(unsigned int nextTimeStamp, unsigned int maxFillSamples) const
+{
+    unsigned int numFill = 0;
+    unsigned int expected = nextTimeStamp;
+    for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        unsigned int step = timeStamp[t] - expected;
+        if ((int) step > 0 && step <= maxFillSamples) {
+            numFill += step;
+        }
+        expected = timeStamp[t] + 1;
+    }
+    return numFill;
+}
+
+// Serialize like serialize(), with a fill frame in place of each missing sample (see countFillFrames()),
+// so that the file holds one frame per time stamp.  A fill frame has the missing time stamp and
+// FILL_FRAME_WORD for every other word.  buffer must hold getSerializedSizeInBytes(numDataStreams) plus
+// countFillFrames() frames.  If fillRuns is given, each run of fill frames is appended to it, with
+// frame indices counted from firstFrame at the start of buffer.  Returns the number of fill frames written.
+unsigned int Rhd2000DataBlockUsb3::serializeWithFill(unsigned char buffer[], int numDataStreams,
+                                                     unsigned int nextTimeStamp, unsigned int maxFillSamples,
+                                                     vector<FillRun> *fillRuns, unsigned long long firstFrame) const
+{
+    const unsigned int frameBytes = getSerializedFrameSizeInBytes(numDataStreams);
+    const unsigned int numFill = countFillFrames(nextTimeStamp, maxFillSamples);
+
+    // Serialize the block past the room the fill frames need, then move each frame down into place.
+    unsigned char *in = buffer + numFill * frameBytes;
+    serialize(in, numDataStreams);
+    if (numFill == 0) {
+        return 0;
+    }
+
+    unsigned char *out = buffer;
+    unsigned int expected = nextTimeStamp;
+    for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        unsigned int step = timeStamp[t] - expected;
+        if ((int) step > 0 && step <= maxFillSamples) {
+            serializeFillFrames(out, numDataStreams, expected, step);
+            if (fillRuns) {
+                FillRun run;
+                run.firstFrame = firstFrame + (out - buffer) / frameBytes;
+                run.numFrames = step;
+                fillRuns->push_back(run);
+            }
+            out += step * frameBytes;
+        }
+        memmove(out, in, frameBytes);
+        out += frameBytes;
+        in += frameBytes;
+        expected = timeStamp[t] + 1;
+    }
+    return numFill;
+}
+
+// Save the fill runs of a data file to fileName (by convention the data file name plus
+// FILL_INDEX_SUFFIX), one "firstFrame numFrames" line per run.  Returns false if the file cannot
+// be written.
+bool Rhd2000DataBlockUsb3::writeFillIndex(const string &fileName, const vector<FillRun> &fillRuns)
+{
+    ofstream indexOut(fileName.c_str(), ios::out | ios::trunc);
+    for (unsigned int i = 0; i < fillRuns.size(); ++i) {
+        indexOut << fillRuns[i].firstFrame << " " << fillRuns[i].numFrames << "\n";
+    }
+    indexOut.close();
+    if (!indexOut) {
+        cerr << "Error in Rhd2000DataBlockUsb3::writeFillIndex: cannot write " << fileName << endl;
+        return false;
+    }
+    return true;
+}
+
+// Read a fill index written by writeFillIndex().  Returns false if the file cannot be read.
+bool Rhd2000DataBlockUsb3::readFillIndex(const string &fileName, vector<FillRun> &fillRuns)
+{
+    fillRuns.clear();
+    ifstream indexIn(fileName.c_str());
+    if (!indexIn) {
+        return false;
+    }
+    FillRun run;
+    while (indexIn >> run.firstFrame >> run.numFrames) {
+        fillRuns.push_back(run);
+    }
+    return indexIn.eof();
+}
+
+// Write numFrames fill frames, with time stamps from firstTimeStamp on, in the write() file format.
+void Rhd2000DataBlockUsb3::serializeFillFrames(unsigned char buffer[], int numDataStreams,
+                                               unsigned int firstTimeStamp, unsigned int numFrames)
+{
+    const int numWords = getSerializedFrameSizeInBytes(numDataStreams) / 2 - 1;
+    unsigned char *out = buffer;
+    for (unsigned int frame = 0; frame < numFrames; ++frame) {
+        out = putWordLittleEndian(out, firstTimeStamp + frame);
+        for (int i = 0; i < numWords; ++i) {
+            out = putWordLittleEndian(out, FILL_FRAME_WORD);
         }
-        writeWordLittleEndian(saveOut, ttlIn[t]);
-        writeWordLittleEndian(saveOut, ttlOut[t]);
     }
 }
 
-// Inline function to address data stored in amplifierDataFast[] array
-inline int Rhd2000DataBlockUsb3::fastIndex(int stream, int channel, int t) const
+// Frame loop of serialize(), shared by both sample formats.  When every stored stream is written in
+// TimeMajor layout, each frame's amplifier words are one contiguous row in file order; 16-bit rows
+// are then copied directly on little-endian hosts.
+template <typename Sample>
+void Rhd2000DataBlockUsb3::serializeFrames(unsigned char buffer[], int numDataStreams, const Sample *amp,
+                                           const Sample *const *auxRows, const Sample *const *adcRows,
+                                           const Sample *ttlInRow, const Sample *ttlOutRow) const
 {
-    return ((t * numDataStreamsStored * CHANNELS_PER_STREAM) + (channel * numDataStreamsStored) + stream);
+    int t, channel, stream, i;
+
+    const int numAuxWords = 3 * numDataStreams;
+    const int numAmpWords = CHANNELS_PER_STREAM * numDataStreams;
+    const bool rowOrder = (amplifierLayout == TimeMajor && numDataStreams == numDataStreamsStored);
+    const bool rowCopy = rowOrder && sizeof(Sample) == 2 && hostIsLittleEndian();
+
+    unsigned char *out = buffer;
+    for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        out = putWordLittleEndian(out, timeStamp[t]);
+
+        if (rowCopy) {
+            memcpy(out, amp + t * numAmpWords, 2 * numAmpWords);
+            out += 2 * numAmpWords;
+        } else if (rowOrder) {
+            const Sample *ampRow = amp + t * numAmpWords;
+            for (i = 0; i < numAmpWords; ++i) {
+                out = putWordLittleEndian(out, ampRow[i]);
+            }
+        } else {
+            for (channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
+                for (stream = 0; stream < numDataStreams; ++stream) {
+                    out = putWordLittleEndian(out, amp[fastIndex(stream, channel, t)]);
+                }
+            }
+        }
+
+        for (i = 0; i < numAuxWords; ++i) {
+            out = putWordLittleEndian(out, auxRows[i][t]);
+        }
+        for (i = 0; i < 8; ++i) {
+            out = putWordLittleEndian(out, adcRows[i][t]);
+        }
+        out = putWordLittleEndian(out, ttlInRow[t]);
+        out = putWordLittleEndian(out, ttlOutRow[t]);
+    }
 }
@@ -25,6 +25,14 @@
 #define CHANNELS_PER_STREAM 32
 #define RHD2000_HEADER_MAGIC_NUMBER 0xd7a22aaa38132a53
 
+// Every word but the time stamp of a fill frame, which serializeWithFill() writes to a file in
+// place of a missing sample.  0xffff is also a valid sample, so fill frames are told apart by the
+// fill index saved with the file (see Rhd2000DataBlockUsb3::writeFillIndex()), not by their contents.
+#define FILL_FRAME_WORD 0xffff
+
+// Suffix of the fill index written next to a data file saved with gap fill
+#define FILL_INDEX_SUFFIX ".fill"
+
 using namespace std;
 
 class Rhd2000EvalBoardUsb3;
@@ -32,9 +40,38 @@ class Rhd2000EvalBoardUsb3;
 class Rhd2000DataBlockUsb3
 {
 public:
-    Rhd2000DataBlockUsb3(int numDataStreams);
+    // Memory order of amplifierDataFast
+    enum AmplifierLayout {
+        TimeMajor,      // [t][channel][stream], the order of the USB frames (default)
+        ChannelMajor    // [stream][channel][t], SAMPLES_PER_DATA_BLOCK contiguous samples per channel
+    };
+
+    // Which set of sample arrays the block stores; the other set is left empty
+    enum SampleFormat {
+        Int32Samples,   // amplifierDataFast, auxiliaryData, boardAdcData, ttlIn, ttlOut (default)
+        UInt16Samples   // amplifierData16, auxiliaryData16, boardAdcData16, ttlIn16, ttlOut16
+    };
+
+    // Problems found while the block was read, OR'ed together in getSyncFlags()
+    enum SyncFlag {
+        SyncBadHeader = 0x1,        // some frames lacked the magic number; their samples are not valid
+        SyncResynchronized = 0x2,   // USB bytes were skipped to find the next frame within or before this block
+        SyncTimeStampGap = 0x4,     // samples are missing within or before this block (see getNumSamplesDropped())
+        SyncTimeStampRepeat = 0x8   // time stamps repeat or run backwards within or before this block
+    };
+
+    // A run of consecutive fill frames in a saved file, by frame index from the start of the file
+    struct FillRun {
+        unsigned long long firstFrame;
+        unsigned int numFrames;
+    };
+
+    Rhd2000DataBlockUsb3(int numDataStreams, AmplifierLayout layout = TimeMajor, SampleFormat format = Int32Samples);
     ~Rhd2000DataBlockUsb3();
     Rhd2000DataBlockUsb3(const Rhd2000DataBlockUsb3 &obj); // copy constructor
+    Rhd2000DataBlockUsb3(Rhd2000DataBlockUsb3 &&obj); // move constructor
+    Rhd2000DataBlockUsb3& operator=(const Rhd2000DataBlockUsb3 &obj);
+    Rhd2000DataBlockUsb3& operator=(Rhd2000DataBlockUsb3 &&obj);
 
     vector<unsigned int> timeStamp;
     int* amplifierDataFast;
@@ -44,13 +81,54 @@ public:
     vector<int> ttlIn;
     vector<int> ttlOut;
 
+    // UInt16Samples storage: the 16-bit words exactly as delivered by the FPGA, at half the size
+    vector<unsigned short> amplifierData16;     // indexed by fastIndex(), like amplifierDataFast
+    vector<unsigned short> auxiliaryData16;     // [stream][aux channel][t]
+    vector<unsigned short> boardAdcData16;      // [ADC channel][t]
+    vector<unsigned short> ttlIn16;
+    vector<unsigned short> ttlOut16;
+
     static unsigned int calculateDataBlockSizeInWords(int numDataStreams);
     static unsigned int getSamplesPerDataBlock();
+    static unsigned long long getNumAllocations();
+    static unsigned int getSerializedSizeInBytes(int numDataStreams);
+    static unsigned int getSerializedFrameSizeInBytes(int numDataStreams);
+    int getNumDataStreams() const;
+    AmplifierLayout getAmplifierLayout() const;
+    SampleFormat getSampleFormat() const;
     void fillFromUsbBuffer(unsigned char usbBuffer[], int blockIndex, int numDataStreams);
+    void fillFromUsbBufferReference(unsigned char usbBuffer[], int blockIndex, int numDataStreams);
     void print(int stream) const;
     void write(ofstream &saveOut, int numDataStreams) const;
+    void write(ofstream &saveOut, int numDataStreams, vector<unsigned char> &buffer) const;
+    void writeReference(ofstream &saveOut, int numDataStreams) const;
+    void serialize(unsigned char buffer[], int numDataStreams) const;
+    unsigned int countFillFrames(unsigned int nextTimeStamp, unsigned int maxFillSamples) const;
+    unsigned int serializeWithFill(unsigned char buffer[], int numDataStreams, unsigned int nextTimeStamp,
+                                   unsigned int maxFillSamples, vector<FillRun> *fillRuns = nullptr,
+                                   unsigned long long firstFrame = 0) const;
+    static bool writeFillIndex(const string &fileName, const vector<FillRun> &fillRuns);
+    static bool readFillIndex(const string &fileName, vector<FillRun> &fillRuns);
+    static void serializeFillFrames(unsigned char buffer[], int numDataStreams, unsigned int firstTimeStamp,
+                                    unsigned int numFrames);
+    bool timeStampsFollow(unsigned int firstTimeStamp) const;
     bool checkUsbHeader(unsigned char usbBuffer[], int index);
+    int getNumBadHeaders() const;
+    unsigned int getSyncFlags() const;
+    void setSyncFlags(unsigned int flags);
+    unsigned int getNumSamplesDropped() const;
+    void setNumSamplesDropped(unsigned int numSamples);
     inline int fastIndex(int stream, int channel, int t) const;
+    inline int amplifierSample(int stream, int channel, int t) const;
+    inline int* amplifierChannel(int stream, int channel);
+    inline const int* amplifierChannel(int stream, int channel) const;
+    inline int amplifierSampleStride() const;
+    inline const unsigned short* amplifierChannel16(int stream, int channel) const;
+    inline void copyAmplifierChannel(int stream, int channel, int samples[SAMPLES_PER_DATA_BLOCK]) const;
+    inline int auxiliarySample(int stream, int auxChannel, int t) const;
+    inline int boardAdcSample(int adcChannel, int t) const;
+    inline int ttlInSample(int t) const;
+    inline int ttlOutSample(int t) const;
 
 private:
     void allocateIntArray3D(vector<vector<vector<int> > > &array3D, int xSize, int ySize, int zSize);
@@ -59,10 +137,121 @@ private:
     void allocateUIntArray1D(vector<unsigned int> &array1D, int xSize);
 
     void writeWordLittleEndian(ofstream &outputStream, int dataWord) const;
+    void serializeReference(unsigned char buffer[], int numDataStreams) const;
+
+    template <typename Sample>
+    void decodeFrames(unsigned char usbBuffer[], int blockIndex, int numDataStreams, Sample *amp,
+                      Sample **auxRows, Sample **adcRows, Sample *ttlInRow, Sample *ttlOutRow);
+    template <typename Sample>
+    void serializeFrames(unsigned char buffer[], int numDataStreams, const Sample *amp, const Sample *const *auxRows,
+                         const Sample *const *adcRows, const Sample *ttlInRow, const Sample *ttlOutRow) const;
 
     int numDataStreamsStored;
+    AmplifierLayout amplifierLayout;
+    SampleFormat sampleFormat;
+    int numBadHeaders;
+    unsigned int syncFlags;
+    unsigned int numSamplesDropped;
     unsigned int convertUsbTimeStamp(unsigned char usbBuffer[], int index);
     int convertUsbWord(unsigned char usbBuffer[], int index);
 };
 
+// Index of a given amplifier sample in amplifierDataFast, for either layout.
+inline int Rhd2000DataBlockUsb3::fastIndex(int stream, int channel, int t) const
+{
+    if (amplifierLayout == ChannelMajor) {
+        return ((stream * CHANNELS_PER_STREAM + channel) * SAMPLES_PER_DATA_BLOCK) + t;
+    }
+    return ((t * numDataStreamsStored * CHANNELS_PER_STREAM) + (channel * numDataStreamsStored) + stream);
+}
+
+// The following accessors return samples regardless of layout and sample format.
+inline int Rhd2000DataBlockUsb3::amplifierSample(int stream, int channel, int t) const
+{
+    if (sampleFormat == UInt16Samples) {
+        return amplifierData16[fastIndex(stream, channel, t)];
+    }
+    return amplifierDataFast[fastIndex(stream, channel, t)];
+}
+
+inline int Rhd2000DataBlockUsb3::auxiliarySample(int stream, int auxChannel, int t) const
+{
+    if (sampleFormat == UInt16Samples) {
+        return auxiliaryData16[(stream * 3 + auxChannel) * SAMPLES_PER_DATA_BLOCK + t];
+    }
+    return auxiliaryData[stream][auxChannel][t];
+}
+
+inline int Rhd2000DataBlockUsb3::boardAdcSample(int adcChannel, int t) const
+{
+    if (sampleFormat == UInt16Samples) {
+        return boardAdcData16[adcChannel * SAMPLES_PER_DATA_BLOCK + t];
+    }
+    return boardAdcData[adcChannel][t];
+}
+
+inline int Rhd2000DataBlockUsb3::ttlInSample(int t) const
+{
+    return (sampleFormat == UInt16Samples) ? ttlIn16[t] : ttlIn[t];
+}
+
+inline int Rhd2000DataBlockUsb3::ttlOutSample(int t) const
+{
+    return (sampleFormat == UInt16Samples) ? ttlOut16[t] : ttlOut[t];
+}
+
+// First sample (t = 0) of one amplifier channel.  Successive samples are amplifierSampleStride()
+// elements apart: 1 in ChannelMajor layout, numDataStreams * CHANNELS_PER_STREAM in TimeMajor layout.
+// Returns nullptr for a UInt16Samples block, which has no amplifierDataFast; use amplifierChannel16()
+// or copyAmplifierChannel() there.
+inline int* Rhd2000DataBlockUsb3::amplifierChannel(int stream, int channel)
+{
+    if (sampleFormat != Int32Samples) {
+        return nullptr;
+    }
+    return amplifierDataFast + fastIndex(stream, channel, 0);
+}
+
+inline const int* Rhd2000DataBlockUsb3::amplifierChannel(int stream, int channel) const
+{
+    if (sampleFormat != Int32Samples) {
+        return nullptr;
+    }
+    return amplifierDataFast + fastIndex(stream, channel, 0);
+}
+
+inline int Rhd2000DataBlockUsb3::amplifierSampleStride() const
+{
+    return (amplifierLayout == ChannelMajor) ? 1 : numDataStreamsStored * CHANNELS_PER_STREAM;
+}
+
+// UInt16Samples counterpart of amplifierChannel(), with the same stride.  Returns nullptr for an
+// Int32Samples block.
+inline const unsigned short* Rhd2000DataBlockUsb3::amplifierChannel16(int stream, int channel) const
+{
+    if (sampleFormat != UInt16Samples) {
+        return nullptr;
+    }
+    return amplifierData16.data() + fastIndex(stream, channel, 0);
+}
+
+// Copy the SAMPLES_PER_DATA_BLOCK samples of one amplifier channel into samples, in time order,
+// regardless of layout and sample format.
+inline void Rhd2000DataBlockUsb3::copyAmplifierChannel(int stream, int channel, int samples[SAMPLES_PER_DATA_BLOCK]) const
+{
+    int stride = amplifierSampleStride();
+    int index = fastIndex(stream, channel, 0);
+    if (sampleFormat == UInt16Samples) {
+        const unsigned short* x = amplifierData16.data() + index;
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            samples[t] = x[t * stride];
+        }
+    } else {
+        const int* x = amplifierDataFast + index;
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            samples[t] = x[t * stride];
+        }
+    }
+}
+
 #endif // RHD2000DATABLOCKUSB3_H
@@ -0,0 +1,179 @@
+//----------------------------------------------------------------------------------
+// rhd2000datafilewriterusb3.cpp
+//
+// Rhd2000DataFileWriterUsb3 Class
+//
+// Buffered writer for the Rhd2000DataBlockUsb3::write() file format.
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+#include "rhd2000datafilewriterusb3.h"
+#include "rhd2000datablockusb3.h"
+
+using namespace std;
+
+// Constructor.  Data is passed to saveOut in multiples of chunkBytes, rounded up to a multiple
+// of DATA_FILE_CHUNK_ALIGNMENT; the remainder is held until the next chunk fills or flush() is called.
+Rhd2000DataFileWriterUsb3::Rhd2000DataFileWriterUsb3(ofstream &saveOut_, unsigned int chunkBytes_) :
+    saveOut(&saveOut_),
+    buffer(nullptr),
+    bufferCapacity(0),
+    numBufferedBytes(0),
+    numBytesWritten(0),
+    numWrites(0),
+    maxFillSamples(0),
+    fillExpecting(false),
+    fillNextTimeStamp(0),
+    numFillFrames(0),
+    numFrames(0)
+{
+    if (chunkBytes_ < DATA_FILE_CHUNK_ALIGNMENT) {
+        chunkBytes_ = DATA_FILE_CHUNK_ALIGNMENT;
+    }
+    chunkBytes = ((chunkBytes_ + DATA_FILE_CHUNK_ALIGNMENT - 1) / DATA_FILE_CHUNK_ALIGNMENT) * DATA_FILE_CHUNK_ALIGNMENT;
+}
+
+// Destructor.  Writes out any buffered data.
+Rhd2000DataFileWriterUsb3::~Rhd2000DataFileWriterUsb3()
+{
+    flush();
+}
+
+// Grow the buffer to hold at least numBytes, keeping any buffered data.
+void Rhd2000DataFileWriterUsb3::reserveBuffer(unsigned int numBytes)
+{
+    if (numBytes <= bufferCapacity) {
+        return;
+    }
+
+    vector<unsigned char> newStorage(numBytes + DATA_FILE_CHUNK_ALIGNMENT);
+    uintptr_t address = (uintptr_t) newStorage.data();
+    unsigned char* newBuffer = newStorage.data() +
+            ((DATA_FILE_CHUNK_ALIGNMENT - (address % DATA_FILE_CHUNK_ALIGNMENT)) % DATA_FILE_CHUNK_ALIGNMENT);
+    if (numBufferedBytes > 0) {
+        memcpy(newBuffer, buffer, numBufferedBytes);
+    }
+
+    storage.swap(newStorage);
+    buffer = newBuffer;
+    bufferCapacity = numBytes;
+}
+
+// Pass the first numBytes of the buffer to the output stream and move any remaining bytes
+// to the front of the buffer.
+bool Rhd2000DataFileWriterUsb3::writeBytes(unsigned int numBytes)
+{
+    saveOut->write((const char*) buffer, numBytes);
+    numBufferedBytes -= numBytes;
+    if (numBufferedBytes > 0) {
+        memmove(buffer, buffer + numBytes, numBufferedBytes);
+    }
+
+    if (!*saveOut) {
+        cerr << "Error in Rhd2000DataFileWriterUsb3::writeBytes: write to output stream failed." << endl;
+        return false;
+    }
+    numBytesWritten += numBytes;
+    ++numWrites;
+    return true;
+}
+
+// Append one data block in the Rhd2000DataBlockUsb3::write() file format.  Returns false if
+// a chunk could not be written to the output stream.
+bool Rhd2000DataFileWriterUsb3::writeBlock(const Rhd2000DataBlockUsb3 &dataBlock, int numDataStreams)
+{
+    unsigned int blockBytes = Rhd2000DataBlockUsb3::getSerializedSizeInBytes(numDataStreams);
+
+    if (maxFillSamples > 0 && fillExpecting && !dataBlock.timeStampsFollow(fillNextTimeStamp)) {
+        unsigned int numFill = dataBlock.countFillFrames(fillNextTimeStamp, maxFillSamples);
+        blockBytes += numFill * Rhd2000DataBlockUsb3::getSerializedFrameSizeInBytes(numDataStreams);
+        reserveBuffer(chunkBytes + blockBytes);
+        dataBlock.serializeWithFill(buffer + numBufferedBytes, numDataStreams, fillNextTimeStamp, maxFillSamples,
+                                    &fillRuns, numFrames);
+        numFillFrames += numFill;
+        numFrames += numFill;
+    } else {
+        reserveBuffer(chunkBytes + blockBytes);
+        dataBlock.serialize(buffer + numBufferedBytes, numDataStreams);
+    }
+    numBufferedBytes += blockBytes;
+    numFrames += SAMPLES_PER_DATA_BLOCK;
+    fillNextTimeStamp = dataBlock.timeStamp[SAMPLES_PER_DATA_BLOCK - 1] + 1;
+    fillExpecting = true;
+
+    // Whole chunks only; a block (with its fill) may span several.
+    if (numBufferedBytes >= chunkBytes) {
+        return writeBytes(numBufferedBytes - numBufferedBytes % chunkBytes);
+    }
+    return true;
+}
+
+// Write a fill frame (see Rhd2000DataBlockUsb3::serializeWithFill()) in place of each sample missing
+// between successive blocks passed to writeBlock(), or within a block, so that the file holds one
+// frame per time stamp.  Jumps of more than maxFillSamples are left as they are; 0 (the default) turns
+// filling off.  The fill frames are listed in getFillRuns(); save them with
+// Rhd2000DataBlockUsb3::writeFillIndex() so that readers can tell them from recorded frames.
+void Rhd2000DataFileWriterUsb3::setGapFill(unsigned int maxFillSamples_)
+{
+    maxFillSamples = maxFillSamples_;
+}
+
+// Write out all buffered data.  The final write is generally not a whole chunk.
+bool Rhd2000DataFileWriterUsb3::flush()
+{
+    bool ok = true;
+    if (numBufferedBytes > 0) {
+        ok = writeBytes(numBufferedBytes);
+    }
+    saveOut->flush();
+    return ok;
+}
+
+// Write out all buffered data, then pass later blocks to saveOut instead.  The buffer is kept, so one
+// writer can serve a series of output streams without allocating again.  Returns false if the
+// buffered data could not be written.
+bool Rhd2000DataFileWriterUsb3::setOutputStream(ofstream &saveOut_)
+{
+    bool ok = flush();
+    saveOut = &saveOut_;
+    return ok;
+}
+
+unsigned int Rhd2000DataFileWriterUsb3::getChunkBytes() const
+{
+    return chunkBytes;
+}
+
+// Bytes serialized but not yet passed to the output stream.
+unsigned int Rhd2000DataFileWriterUsb3::getNumBufferedBytes() const
+{
+    return numBufferedBytes;
+}
+
+unsigned long long Rhd2000DataFileWriterUsb3::getNumBytesWritten() const
+{
+    return numBytesWritten;
+}
+
+// Number of write calls made on the output stream.
+unsigned long long Rhd2000DataFileWriterUsb3::getNumWrites() const
+{
+    return numWrites;
+}
+
+// Number of fill frames written in place of missing samples.
+unsigned long long Rhd2000DataFileWriterUsb3::getNumFillFrames() const
+{
+    return numFillFrames;
+}
+
+// Where the fill frames are, by frame index from the first frame this writer wrote.
+const vector<Rhd2000DataBlockUsb3::FillRun>& Rhd2000DataFileWriterUsb3::getFillRuns() const
+{
+    return fillRuns;
+}
@@ -0,0 +1,73 @@
+//----------------------------------------------------------------------------------
+// rhd2000datafilewriterusb3.h
+//
+// Rhd2000DataFileWriterUsb3 Class Header File
+//
+// Buffered writer for the Rhd2000DataBlockUsb3::write() file format.  Whole data blocks
+// are serialized into one reusable, page-aligned byte buffer, which is handed to the
+// output stream in large chunks instead of one stream insertion per byte.
+//----------------------------------------------------------------------------------
+
+#ifndef RHD2000DATAFILEWRITERUSB3_H
+#define RHD2000DATAFILEWRITERUSB3_H
+
+// Default number of bytes passed to the output stream per write call
+#define DATA_FILE_CHUNK_BYTES 1048576
+
+// Alignment (and granularity) of the chunks passed to the output stream
+#define DATA_FILE_CHUNK_ALIGNMENT 4096
+
+#include <vector>
+#include <fstream>
+
+using namespace std;
+
+#include "rhd2000datablockusb3.h"
+
+class Rhd2000DataFileWriterUsb3
+{
+public:
+    Rhd2000DataFileWriterUsb3(ofstream &saveOut, unsigned int chunkBytes = DATA_FILE_CHUNK_BYTES);
+    ~Rhd2000DataFileWriterUsb3();
+
+    bool writeBlock(const Rhd2000DataBlockUsb3 &dataBlock, int numDataStreams);
+    void setGapFill(unsigned int maxFillSamples);
+    bool flush();
+    bool setOutputStream(ofstream &saveOut);
+
+    unsigned int getChunkBytes() const;
+    unsigned int getNumBufferedBytes() const;
+    unsigned long long getNumBytesWritten() const;
+    unsigned long long getNumWrites() const;
+    unsigned long long getNumFillFrames() const;
+    const vector<Rhd2000DataBlockUsb3::FillRun>& getFillRuns() const;
+
+private:
+    Rhd2000DataFileWriterUsb3(const Rhd2000DataFileWriterUsb3 &);
+    Rhd2000DataFileWriterUsb3& operator=(const Rhd2000DataFileWriterUsb3 &);
+
+    void reserveBuffer(unsigned int numBytes);
+    bool writeBytes(unsigned int numBytes);
+
+    ofstream *saveOut;
+    unsigned int chunkBytes;
+
+    // buffer points to the first DATA_FILE_CHUNK_ALIGNMENT-aligned byte in storage
+    vector<unsigned char> storage;
+    unsigned char* buffer;
+    unsigned int bufferCapacity;
+    unsigned int numBufferedBytes;
+
+    unsigned long long numBytesWritten;
+    unsigned long long numWrites;
+
+    // Gap filling (see setGapFill())
+    unsigned int maxFillSamples;
+    bool fillExpecting;
+    unsigned int fillNextTimeStamp;
+    unsigned long long numFillFrames;
+    unsigned long long numFrames;               // frames written or buffered, fill included
+    vector<Rhd2000DataBlockUsb3::FillRun> fillRuns;
+};
+
+#endif // RHD2000DATAFILEWRITERUSB3_H
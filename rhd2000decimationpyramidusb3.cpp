@@ -0,0 +1,334 @@
+//----------------------------------------------------------------------------------
+// rhd2000decimationpyramidusb3.cpp
+//
+// Rhd2000DecimationPyramidUsb3 Class
+//
+// Streaming min/max/mean decimation pyramid in shared memory.
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include "rhd2000decimationpyramidusb3.h"
+#include "rhd2000datablockusb3.h"
+#include "rhd2000decoderusb3.h"
+#include "rhd2000sharedmemorysegmentusb3.h"
+
+using namespace std;
+
+Rhd2000DecimationPyramidUsb3::Rhd2000DecimationPyramidUsb3() :
+    header(nullptr),
+    storage(nullptr),
+    isProducer(false)
+{
+}
+
+Rhd2000DecimationPyramidUsb3::~Rhd2000DecimationPyramidUsb3()
+{
+    close();
+}
+
+// 16x, 256x, 4096x and 65536x decimation.
+vector<unsigned int> Rhd2000DecimationPyramidUsb3::defaultLevelFactors()
+{
+    vector<unsigned int> levelFactors;
+    levelFactors.push_back(16);
+    levelFactors.push_back(256);
+    levelFactors.push_back(4096);
+    levelFactors.push_back(65536);
+    return levelFactors;
+}
+
+// Create a pyramid for all amplifier channels of numDataStreams streams, in the named shared memory
+// segment (or in private memory if name is empty).  levelFactors gives the raw samples per entry at
+// each level; each factor must be a multiple of the one before.  historyLength entries are kept per
+// channel at each level.  microvoltsPerBit and sampleOffset are published for readers.
+bool Rhd2000DecimationPyramidUsb3::create(const string &name, int numDataStreams, unsigned int sampleRate,
+                                          const vector<unsigned int> &levelFactors, unsigned int historyLength,
+                                          double microvoltsPerBit, int sampleOffset)
+{
+    close();
+
+    int numLevels = (int) levelFactors.size();
+    if (numLevels < 1 || numLevels > DECIMATION_PYRAMID_MAX_LEVELS || historyLength < 2 || numDataStreams < 1) {
+        cerr << "Error in Rhd2000DecimationPyramidUsb3::create: invalid number of levels, history or streams." << endl;
+        return false;
+    }
+    for (int level = 0; level < numLevels; ++level) {
+        unsigned int below = (level == 0) ? 1 : levelFactors[level - 1];
+        // Sums of up to 65536 16-bit values fit in 32 bits
+        if (levelFactors[level] <= below || levelFactors[level] % below != 0 || levelFactors[level] / below > 65536) {
+            cerr << "Error in Rhd2000DecimationPyramidUsb3::create: each level factor must be a multiple " <<
+                    "(at most 65536 times) of the one before." << endl;
+            return false;
+        }
+    }
+
+    unsigned int numChannels = numDataStreams * CHANNELS_PER_STREAM;
+    size_t size = PYRAMID_HEADER_BYTES + (size_t) numLevels * historyLength * numChannels * sizeof(Rhd2000DecimationEntry);
+    if (name.empty()) {
+        privateStorage.assign(size, 0);
+        storage = privateStorage.data();
+    } else {
+        if (!sharedSegment.create(name, size)) {
+            return false;
+        }
+        storage = sharedSegment.getData();
+    }
+    isProducer = true;
+
+    header = new (storage) Rhd2000DecimationPyramidHeader;
+    header->magic = 0;
+    header->version = DECIMATION_PYRAMID_VERSION;
+    header->numChannels = numChannels;
+    header->streamCount = numDataStreams;
+    header->channelCount = CHANNELS_PER_STREAM;
+    header->sampleRate = sampleRate;
+    header->numLevels = numLevels;
+    header->historyLength = historyLength;
+    header->microvoltsPerBit = microvoltsPerBit;
+    header->sampleOffset = sampleOffset;
+    for (int level = 0; level < DECIMATION_PYRAMID_MAX_LEVELS; ++level) {
+        header->levelFactor[level] = (level < numLevels) ? levelFactors[level] : 0;
+        header->levelCursor[level].store(0, memory_order_relaxed);
+    }
+
+    accMin.assign(numLevels, vector<uint16_t>(numChannels, 0));
+    accMax.assign(numLevels, vector<uint16_t>(numChannels, 0));
+    accSum.assign(numLevels, vector<uint32_t>(numChannels, 0));
+    accCount.assign(numLevels, 0);
+    numEntries.assign(numLevels, 0);
+
+    // Readers check the magic number last, so they never see a partly initialized header
+    atomic_thread_fence(memory_order_release);
+    header->magic = DECIMATION_PYRAMID_MAGIC;
+    return true;
+}
+
+// Attach to a pyramid created by another process.
+bool Rhd2000DecimationPyramidUsb3::openExisting(const string &name)
+{
+    close();
+    if (!sharedSegment.open(name, PYRAMID_HEADER_BYTES)) {
+        return false;
+    }
+    const Rhd2000DecimationPyramidHeader* probe = (const Rhd2000DecimationPyramidHeader*) sharedSegment.getData();
+    if (probe->magic != DECIMATION_PYRAMID_MAGIC || probe->version != DECIMATION_PYRAMID_VERSION) {
+        cerr << "Error in Rhd2000DecimationPyramidUsb3::openExisting: " << name <<
+                " is not a version " << DECIMATION_PYRAMID_VERSION << " decimation pyramid." << endl;
+        close();
+        return false;
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    // Remap with the full size now that the geometry is known
+    size_t size = PYRAMID_HEADER_BYTES +
+            (size_t) probe->numLevels * probe->historyLength * probe->numChannels * sizeof(Rhd2000DecimationEntry);
+    if (!sharedSegment.open(name, size)) {
+        return false;
+    }
+    storage = sharedSegment.getData();
+    header = (Rhd2000DecimationPyramidHeader*) storage;
+    isProducer = false;
+    return true;
+}
+
+// Unmap the segment (see Rhd2000SharedMemorySegmentUsb3::close()) or free private memory.
+void Rhd2000DecimationPyramidUsb3::close()
+{
+    sharedSegment.close();
+    privateStorage.clear();
+    privateStorage.shrink_to_fit();
+    header = nullptr;
+    storage = nullptr;
+    isProducer = false;
+}
+
+bool Rhd2000DecimationPyramidUsb3::isValid() const
+{
+    return header != nullptr;
+}
+
+// First entry of the history row holding entry number entry at the given level.
+Rhd2000DecimationEntry* Rhd2000DecimationPyramidUsb3::entryRow(int level, unsigned long long entry) const
+{
+    size_t row = (size_t) level * header->historyLength + (size_t) (entry % header->historyLength);
+    return (Rhd2000DecimationEntry*) (storage + PYRAMID_HEADER_BYTES) + row * header->numChannels;
+}
+
+// Fold one data block into the pyramid, publishing every entry it completes.  The block must hold
+// the number of data streams the pyramid was created with; any layout and sample format is accepted.
+bool Rhd2000DecimationPyramidUsb3::addBlock(const Rhd2000DataBlockUsb3 &dataBlock)
+{
+    if (!isProducer) {
+        cerr << "Error in Rhd2000DecimationPyramidUsb3::addBlock: pyramid was not created by this process." << endl;
+        return false;
+    }
+    if ((unsigned int) dataBlock.getNumDataStreams() != header->streamCount) {
+        cerr << "Error in Rhd2000DecimationPyramidUsb3::addBlock: data block has " << dataBlock.getNumDataStreams() <<
+                " streams; pyramid has " << header->streamCount << "." << endl;
+        return false;
+    }
+
+    int t = 0;
+    while (t < SAMPLES_PER_DATA_BLOCK) {
+        int numSamples = min((unsigned int) (SAMPLES_PER_DATA_BLOCK - t), header->levelFactor[0] - accCount[0]);
+        if (dataBlock.getSampleFormat() == Rhd2000DataBlockUsb3::UInt16Samples) {
+            accumulateSamples(dataBlock, dataBlock.amplifierData16.data(), t, numSamples);
+        } else {
+            accumulateSamples(dataBlock, (const int*) dataBlock.amplifierDataFast, t, numSamples);
+        }
+        accCount[0] += numSamples;
+        t += numSamples;
+
+        if (accCount[0] == header->levelFactor[0]) {
+            emitEntries(0);
+        }
+    }
+    return true;
+}
+
+// Fold raw samples t .. t + numSamples - 1 of every channel into the level 0 accumulators.  In
+// TimeMajor layout each sample time is one contiguous row of all channels in pyramid order, so
+// the update runs across channels; in ChannelMajor layout each channel's samples are contiguous.
+template <typename Sample>
+void Rhd2000DecimationPyramidUsb3::accumulateSamples(const Rhd2000DataBlockUsb3 &dataBlock, const Sample *amp,
+                                                     int t, int numSamples)
+{
+    const int numChannels = header->numChannels;
+    const int numDataStreams = header->streamCount;
+    uint16_t* minimum = accMin[0].data();
+    uint16_t* maximum = accMax[0].data();
+    uint32_t* sum = accSum[0].data();
+    int i, j, stream, channel;
+
+    if (dataBlock.getAmplifierLayout() == Rhd2000DataBlockUsb3::TimeMajor) {
+        if (accCount[0] == 0) {
+            fill(minimum, minimum + numChannels, (uint16_t) 0xffff);
+            fill(maximum, maximum + numChannels, (uint16_t) 0);
+            fill(sum, sum + numChannels, 0u);
+        }
+        for (j = 0; j < numSamples; ++j) {
+            Rhd2000DecoderUsb3::accumulateMinMaxSum(amp + (t + j) * numChannels, minimum, maximum, sum, numChannels);
+        }
+    } else {
+        for (channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
+            for (stream = 0; stream < numDataStreams; ++stream) {
+                const Sample* samples = amp + dataBlock.fastIndex(stream, channel, t);
+                i = channel * numDataStreams + stream;
+                if (accCount[0] == 0) {
+                    minimum[i] = 0xffff;
+                    maximum[i] = 0;
+                    sum[i] = 0;
+                }
+                Rhd2000DecoderUsb3::reduceMinMaxSum(samples, numSamples, minimum[i], maximum[i], sum[i]);
+            }
+        }
+    }
+}
+
+// Publish the completed accumulators of a level as its next entry, fold that entry into the level
+// above, and cascade if the level above is complete too.
+void Rhd2000DecimationPyramidUsb3::emitEntries(int level)
+{
+    const int numChannels = header->numChannels;
+    const uint32_t count = accCount[level];
+    const uint16_t* minimum = accMin[level].data();
+    const uint16_t* maximum = accMax[level].data();
+    const uint32_t* sum = accSum[level].data();
+    int i;
+
+    Rhd2000DecimationEntry* row = entryRow(level, numEntries[level]);
+    for (i = 0; i < numChannels; ++i) {
+        row[i].minimum = minimum[i];
+        row[i].maximum = maximum[i];
+        row[i].mean = (uint16_t) ((sum[i] + count / 2) / count);
+        row[i].reserved = 0;
+    }
+    ++numEntries[level];
+    header->levelCursor[level].store(numEntries[level], memory_order_release);
+    accCount[level] = 0;
+
+    int above = level + 1;
+    if (above >= (int) header->numLevels) {
+        return;
+    }
+    uint16_t* aboveMin = accMin[above].data();
+    uint16_t* aboveMax = accMax[above].data();
+    uint32_t* aboveSum = accSum[above].data();
+    if (accCount[above] == 0) {
+        for (i = 0; i < numChannels; ++i) {
+            aboveMin[i] = row[i].minimum;
+            aboveMax[i] = row[i].maximum;
+            aboveSum[i] = row[i].mean;
+        }
+    } else {
+        for (i = 0; i < numChannels; ++i) {
+            aboveMin[i] = min(aboveMin[i], row[i].minimum);
+            aboveMax[i] = max(aboveMax[i], row[i].maximum);
+            aboveSum[i] += row[i].mean;
+        }
+    }
+    if (++accCount[above] == header->levelFactor[above] / header->levelFactor[level]) {
+        emitEntries(above);
+    }
+}
+
+// Copy entries firstEntry .. firstEntry + numEntries - 1 of one channel at one level.  Returns false
+// if any of them is not yet published or has been overwritten (before or during the copy).
+bool Rhd2000DecimationPyramidUsb3::readEntries(int level, int channel, unsigned long long firstEntry,
+                                               unsigned int numEntries_, Rhd2000DecimationEntry *entries) const
+{
+    if (!header || level < 0 || level >= (int) header->numLevels || channel < 0 || channel >= (int) header->numChannels) {
+        return false;
+    }
+
+    unsigned long long cursor = header->levelCursor[level].load(memory_order_acquire);
+    if (firstEntry + numEntries_ > cursor || firstEntry + header->historyLength <= cursor) {
+        return false;
+    }
+    for (unsigned int j = 0; j < numEntries_; ++j) {
+        memcpy(&entries[j], entryRow(level, firstEntry + j) + channel, sizeof(Rhd2000DecimationEntry));
+    }
+
+    // The producer overwrites entry cursor - historyLength while writing entry cursor
+    atomic_thread_fence(memory_order_acquire);
+    cursor = header->levelCursor[level].load(memory_order_relaxed);
+    return firstEntry + header->historyLength > cursor;
+}
+
+int Rhd2000DecimationPyramidUsb3::getNumLevels() const
+{
+    return header ? header->numLevels : 0;
+}
+
+int Rhd2000DecimationPyramidUsb3::getNumChannels() const
+{
+    return header ? header->numChannels : 0;
+}
+
+// Raw samples summarized by each entry at the given level.
+unsigned int Rhd2000DecimationPyramidUsb3::getLevelFactor(int level) const
+{
+    return (header && level >= 0 && level < (int) header->numLevels) ? header->levelFactor[level] : 0;
+}
+
+// Number of entries published so far at the given level.
+unsigned long long Rhd2000DecimationPyramidUsb3::getNumEntries(int level) const
+{
+    if (!header || level < 0 || level >= (int) header->numLevels) {
+        return 0;
+    }
+    return header->levelCursor[level].load(memory_order_acquire);
+}
+
+const Rhd2000DecimationPyramidHeader* Rhd2000DecimationPyramidUsb3::getHeader() const
+{
+    return header;
+}
@@ -0,0 +1,117 @@
+//----------------------------------------------------------------------------------
+// rhd2000decimationpyramidusb3.h
+//
+// Rhd2000DecimationPyramidUsb3 Class Header File
+//
+// Streaming min/max/mean decimation pyramid of every amplifier channel, kept in a named
+// shared memory segment so visualizers can draw long stretches of history at a fixed cost
+// per pixel.  Each level summarizes a fixed number of raw samples per entry (by default
+// 16, 256, 4096 and 65536; full-rate 1x samples are in the IntanRHXData ring).  Level 0 is
+// accumulated directly from each data block and every higher level from entries of the
+// level below, so adding a block never rescans earlier samples.
+//
+// Segment layout (all integers in host byte order):
+//   Rhd2000DecimationPyramidHeader                          (PYRAMID_HEADER_BYTES bytes)
+//   numLevels x historyLength x numChannels x Rhd2000DecimationEntry
+//
+// Channels are numbered in the order of the amplifier words in a USB frame,
+// channel * streamCount + stream.  Entry k of a level (k = 0, 1, 2, ...) covers raw
+// samples [k * factor, (k + 1) * factor) and is stored in history row k % historyLength.
+// levelCursor[level] is the number of entries published at that level; entry k is
+// readable while k < levelCursor and k > levelCursor - historyLength.
+//----------------------------------------------------------------------------------
+
+#ifndef RHD2000DECIMATIONPYRAMIDUSB3_H
+#define RHD2000DECIMATIONPYRAMIDUSB3_H
+
+#define DECIMATION_PYRAMID_MAGIC 0x50544e49     // "INTP"
+#define DECIMATION_PYRAMID_VERSION 1
+#define DECIMATION_PYRAMID_MAX_LEVELS 8
+#define PYRAMID_HEADER_BYTES 256
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+#include "rhd2000datablockusb3.h"
+#include "rhd2000sharedmemorysegmentusb3.h"
+
+struct Rhd2000DecimationPyramidHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numChannels;
+    uint32_t streamCount;
+    uint32_t channelCount;              // channels per stream
+    uint32_t sampleRate;
+    uint32_t numLevels;
+    uint32_t historyLength;             // entries kept per channel at each level
+    double microvoltsPerBit;
+    int32_t sampleOffset;
+    uint32_t levelFactor[DECIMATION_PYRAMID_MAX_LEVELS];   // raw samples per entry
+    alignas(64) atomic<uint64_t> levelCursor[DECIMATION_PYRAMID_MAX_LEVELS];
+};
+
+struct Rhd2000DecimationEntry {
+    uint16_t minimum;
+    uint16_t maximum;
+    uint16_t mean;
+    uint16_t reserved;
+};
+
+static_assert(sizeof(Rhd2000DecimationPyramidHeader) <= PYRAMID_HEADER_BYTES, "pyramid header too large");
+
+class Rhd2000DecimationPyramidUsb3
+{
+public:
+    Rhd2000DecimationPyramidUsb3();
+    ~Rhd2000DecimationPyramidUsb3();
+
+    // Producer process.  An empty name keeps the pyramid in private memory.
+    bool create(const string &name, int numDataStreams, unsigned int sampleRate,
+                const vector<unsigned int> &levelFactors = defaultLevelFactors(), unsigned int historyLength = 1024,
+                double microvoltsPerBit = 0.195, int sampleOffset = 32768);
+    bool addBlock(const Rhd2000DataBlockUsb3 &dataBlock);
+
+    // Reader processes
+    bool openExisting(const string &name);
+    bool readEntries(int level, int channel, unsigned long long firstEntry, unsigned int numEntries,
+                     Rhd2000DecimationEntry *entries) const;
+
+    void close();
+    bool isValid() const;
+    int getNumLevels() const;
+    int getNumChannels() const;
+    unsigned int getLevelFactor(int level) const;
+    unsigned long long getNumEntries(int level) const;
+    const Rhd2000DecimationPyramidHeader* getHeader() const;
+
+    static vector<unsigned int> defaultLevelFactors();
+
+private:
+    Rhd2000DecimationPyramidUsb3(const Rhd2000DecimationPyramidUsb3 &);
+    Rhd2000DecimationPyramidUsb3& operator=(const Rhd2000DecimationPyramidUsb3 &);
+
+    template <typename Sample>
+    void accumulateSamples(const Rhd2000DataBlockUsb3 &dataBlock, const Sample *amp, int t, int numSamples);
+    void emitEntries(int level);
+    Rhd2000DecimationEntry* entryRow(int level, unsigned long long entry) const;
+
+    Rhd2000SharedMemorySegmentUsb3 sharedSegment;
+    vector<unsigned char> privateStorage;
+    Rhd2000DecimationPyramidHeader* header;
+    unsigned char* storage;
+    bool isProducer;
+
+    // Producer only: running minimum, maximum and sum of each channel at each level, and
+    // the number of samples (level 0) or lower-level entries folded in so far
+    vector<vector<uint16_t> > accMin;
+    vector<vector<uint16_t> > accMax;
+    vector<vector<uint32_t> > accSum;
+    vector<unsigned int> accCount;
+    vector<unsigned long long> numEntries;
+};
+
+#endif // RHD2000DECIMATIONPYRAMIDUSB3_H
@@ -0,0 +1,634 @@
+//----------------------------------------------------------------------------------
+// rhd2000decoderusb3.cpp
+//
+// Rhd2000DecoderUsb3 Class
+//
+// Run-time dispatched SIMD helpers for decoding Rhythm USB3 data blocks and reducing the
+// decoded samples.
+//----------------------------------------------------------------------------------
+
+#include <cstring>
+#include <atomic>
+
+#include "rhd2000decoderusb3.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define RHD2000_DECODER_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang need per-function target attributes to emit AVX2/SSE4.1 code without compiling the
+// whole file for that instruction set; MSVC accepts the intrinsics as is.
+#if defined(RHD2000_DECODER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define RHD2000_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define RHD2000_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RHD2000_TARGET_SSE41
+#define RHD2000_TARGET_AVX2
+#endif
+
+// Read on every decode call, possibly while setPath() runs on another thread; the path is a
+// standalone flag, so relaxed ordering is enough.
+static std::atomic<Rhd2000DecoderUsb3::DecodePath> currentPath(Rhd2000DecoderUsb3::detectBestPath());
+
+// RHD2000_HEADER_MAGIC_NUMBER in USB (little-endian) byte order
+static const unsigned char magicNumberBytes[8] = { 0x53, 0x2a, 0x13, 0x38, 0xaa, 0x2a, 0xa2, 0xd7 };
+
+// Return the widest decode path this CPU (and operating system) supports.
+Rhd2000DecoderUsb3::DecodePath Rhd2000DecoderUsb3::detectBestPath()
+{
+#if defined(RHD2000_DECODER_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return DecodeAvx2;
+    if (__builtin_cpu_supports("sse4.1")) return DecodeSse41;
+#elif defined(RHD2000_DECODER_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+    bool osAvx = ((info[2] & (1 << 27)) != 0) && ((info[2] & (1 << 28)) != 0) &&
+            ((_xgetbv(0) & 0x6) == 0x6);
+    __cpuidex(info, 7, 0);
+    bool avx2 = osAvx && ((info[1] & (1 << 5)) != 0);
+    if (avx2) return DecodeAvx2;
+    if (sse41) return DecodeSse41;
+#endif
+    return DecodeScalar;
+}
+
+Rhd2000DecoderUsb3::DecodePath Rhd2000DecoderUsb3::getPath()
+{
+    return currentPath.load(std::memory_order_relaxed);
+}
+
+// Force a particular decode path (e.g., for benchmarking).  Returns false and leaves the current
+// path unchanged if the CPU does not support the requested one.
+bool Rhd2000DecoderUsb3::setPath(DecodePath path)
+{
+    if (path > detectBestPath()) return false;
+    currentPath.store(path, std::memory_order_relaxed);
+    return true;
+}
+
+const char* Rhd2000DecoderUsb3::pathName(DecodePath path)
+{
+    switch (path) {
+    case DecodeAvx2:
+        return "AVX2";
+    case DecodeSse41:
+        return "SSE4.1";
+    default:
+        return "scalar";
+    }
+}
+
+void Rhd2000DecoderUsb3::widenWords(const unsigned char *src, int *dst, int numWords)
+{
+    switch (currentPath.load(std::memory_order_relaxed)) {
+    case DecodeAvx2:
+        widenWordsAvx2(src, dst, numWords);
+        break;
+    case DecodeSse41:
+        widenWordsSse41(src, dst, numWords);
+        break;
+    default:
+        widenWordsScalar(src, dst, numWords);
+        break;
+    }
+}
+
+void Rhd2000DecoderUsb3::decodeWords(const unsigned char *src, int *dst, int numWords)
+{
+    widenWords(src, dst, numWords);
+}
+
+void Rhd2000DecoderUsb3::decodeWords(const unsigned char *src, unsigned short *dst, int numWords)
+{
+#if defined(RHD2000_DECODER_X86)
+    // USB words are little-endian, as is the host, so they can be copied as they are.
+    memcpy(dst, src, 2 * numWords);
+#else
+    for (int i = 0; i < numWords; ++i) {
+        dst[i] = (unsigned short) ((src[2 * i + 1] << 8) | src[2 * i]);
+    }
+#endif
+}
+
+void Rhd2000DecoderUsb3::transposeWords8(const unsigned char *src, int srcStride, int numWords, int *dst,
+                                         const int *dstOffsets)
+{
+    if (currentPath.load(std::memory_order_relaxed) == DecodeScalar) {
+        transposeWords8Scalar(src, srcStride, numWords, dst, dstOffsets, 0);
+    } else {
+        transposeWords8Sse41(src, srcStride, numWords, dst, dstOffsets);
+    }
+}
+
+void Rhd2000DecoderUsb3::transposeWords8(const unsigned char *src, int srcStride, int numWords, unsigned short *dst,
+                                         const int *dstOffsets)
+{
+    if (currentPath.load(std::memory_order_relaxed) == DecodeScalar) {
+        transposeWords8Scalar(src, srcStride, numWords, dst, dstOffsets, 0);
+    } else {
+        transposeWords8Sse41(src, srcStride, numWords, dst, dstOffsets);
+    }
+}
+
+template <typename Sample>
+void Rhd2000DecoderUsb3::transposeWords8Scalar(const unsigned char *src, int srcStride, int numWords, Sample *dst,
+                                               const int *dstOffsets, int firstWord)
+{
+    for (int i = firstWord; i < numWords; ++i) {
+        Sample *row = dst + dstOffsets[i];
+        for (int f = 0; f < 8; ++f) {
+            const unsigned char *word = src + f * srcStride + 2 * i;
+            row[f] = (Sample) (((unsigned int) word[1] << 8) | (unsigned int) word[0]);
+        }
+    }
+}
+
+void Rhd2000DecoderUsb3::accumulateMinMaxSum(const unsigned short *src, unsigned short *minimum,
+                                             unsigned short *maximum, unsigned int *sum, int numWords)
+{
+    switch (currentPath.load(std::memory_order_relaxed)) {
+    case DecodeAvx2:
+        accumulateMinMaxSumAvx2(src, minimum, maximum, sum, numWords);
+        break;
+    case DecodeSse41:
+        accumulateMinMaxSumSse41(src, minimum, maximum, sum, numWords);
+        break;
+    default:
+        accumulateMinMaxSumScalar(src, minimum, maximum, sum, numWords, 0);
+        break;
+    }
+}
+
+void Rhd2000DecoderUsb3::accumulateMinMaxSum(const int *src, unsigned short *minimum,
+                                             unsigned short *maximum, unsigned int *sum, int numWords)
+{
+    switch (currentPath.load(std::memory_order_relaxed)) {
+    case DecodeAvx2:
+        accumulateMinMaxSumAvx2(src, minimum, maximum, sum, numWords);
+        break;
+    case DecodeSse41:
+        accumulateMinMaxSumSse41(src, minimum, maximum, sum, numWords);
+        break;
+    default:
+        accumulateMinMaxSumScalar(src, minimum, maximum, sum, numWords, 0);
+        break;
+    }
+}
+
+template <typename Sample>
+void Rhd2000DecoderUsb3::accumulateMinMaxSumScalar(const Sample *src, unsigned short *minimum,
+                                                   unsigned short *maximum, unsigned int *sum, int numWords,
+                                                   int firstWord)
+{
+    for (int i = firstWord; i < numWords; ++i) {
+        unsigned short value = (unsigned short) src[i];
+        if (value < minimum[i]) minimum[i] = value;
+        if (value > maximum[i]) maximum[i] = value;
+        sum[i] += value;
+    }
+}
+
+void Rhd2000DecoderUsb3::reduceMinMaxSum(const unsigned short *src, int numWords, unsigned short &minimum,
+                                         unsigned short &maximum, unsigned int &sum)
+{
+    if (currentPath.load(std::memory_order_relaxed) == DecodeScalar) {
+        reduceMinMaxSumScalar(src, numWords, minimum, maximum, sum, 0);
+    } else {
+        reduceMinMaxSumSse41(src, numWords, minimum, maximum, sum);
+    }
+}
+
+void Rhd2000DecoderUsb3::reduceMinMaxSum(const int *src, int numWords, unsigned short &minimum,
+                                         unsigned short &maximum, unsigned int &sum)
+{
+    if (currentPath.load(std::memory_order_relaxed) == DecodeScalar) {
+        reduceMinMaxSumScalar(src, numWords, minimum, maximum, sum, 0);
+    } else {
+        reduceMinMaxSumSse41(src, numWords, minimum, maximum, sum);
+    }
+}
+
+template <typename Sample>
+void Rhd2000DecoderUsb3::reduceMinMaxSumScalar(const Sample *src, int numWords, unsigned short &minimum,
+                                               unsigned short &maximum, unsigned int &sum, int firstWord)
+{
+    unsigned short low = minimum;
+    unsigned short high = maximum;
+    unsigned int total = sum;
+    for (int i = firstWord; i < numWords; ++i) {
+        unsigned short value = (unsigned short) src[i];
+        if (value < low) low = value;
+        if (value > high) high = value;
+        total += value;
+    }
+    minimum = low;
+    maximum = high;
+    sum = total;
+}
+
+bool Rhd2000DecoderUsb3::isMagicNumber(const unsigned char *src)
+{
+    return memcmp(src, magicNumberBytes, 8) == 0;
+}
+
+int Rhd2000DecoderUsb3::findMagicNumber(const unsigned char *src, int numBytes)
+{
+    switch (currentPath.load(std::memory_order_relaxed)) {
+    case DecodeAvx2:
+        return findMagicNumberAvx2(src, numBytes);
+    case DecodeSse41:
+        return findMagicNumberSse41(src, numBytes);
+    default:
+        return findMagicNumberScalar(src, numBytes, 0);
+    }
+}
+
+// Check each even offset from firstByte on.
+int Rhd2000DecoderUsb3::findMagicNumberScalar(const unsigned char *src, int numBytes, int firstByte)
+{
+    for (int i = firstByte; i + 8 <= numBytes; i += 2) {
+        if (memcmp(src + i, magicNumberBytes, 8) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void Rhd2000DecoderUsb3::widenWordsScalar(const unsigned char *src, int *dst, int numWords)
+{
+    for (int i = 0; i < numWords; ++i) {
+        dst[i] = (int) (((unsigned int) src[2 * i + 1] << 8) | (unsigned int) src[2 * i]);
+    }
+}
+
+#ifdef RHD2000_DECODER_X86
+
+RHD2000_TARGET_SSE41
+void Rhd2000DecoderUsb3::widenWordsSse41(const unsigned char *src, int *dst, int numWords)
+{
+    int i = 0;
+    for (; i + 8 <= numWords; i += 8) {
+        __m128i words = _mm_loadu_si128((const __m128i*) (src + 2 * i));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_cvtepu16_epi32(words));
+        _mm_storeu_si128((__m128i*) (dst + i + 4), _mm_cvtepu16_epi32(_mm_srli_si128(words, 8)));
+    }
+    widenWordsScalar(src + 2 * i, dst + i, numWords - i);
+}
+
+RHD2000_TARGET_AVX2
+void Rhd2000DecoderUsb3::widenWordsAvx2(const unsigned char *src, int *dst, int numWords)
+{
+    int i = 0;
+    for (; i + 16 <= numWords; i += 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i*) (src + 2 * i));
+        __m128i hi = _mm_loadu_si128((const __m128i*) (src + 2 * i + 16));
+        _mm256_storeu_si256((__m256i*) (dst + i), _mm256_cvtepu16_epi32(lo));
+        _mm256_storeu_si256((__m256i*) (dst + i + 8), _mm256_cvtepu16_epi32(hi));
+    }
+    widenWordsSse41(src + 2 * i, dst + i, numWords - i);
+}
+
+// 8x8 transpose of 16-bit words: a[f] holds eight words of frame f, c[k] receives word k of all
+// eight frames.  Three rounds of unpacks.
+RHD2000_TARGET_SSE41
+static inline void transpose8x8Words(const __m128i a[8], __m128i c[8])
+{
+    __m128i u[8];
+    __m128i t0 = _mm_unpacklo_epi16(a[0], a[1]);
+    __m128i t1 = _mm_unpackhi_epi16(a[0], a[1]);
+    __m128i t2 = _mm_unpacklo_epi16(a[2], a[3]);
+    __m128i t3 = _mm_unpackhi_epi16(a[2], a[3]);
+    __m128i t4 = _mm_unpacklo_epi16(a[4], a[5]);
+    __m128i t5 = _mm_unpackhi_epi16(a[4], a[5]);
+    __m128i t6 = _mm_unpacklo_epi16(a[6], a[7]);
+    __m128i t7 = _mm_unpackhi_epi16(a[6], a[7]);
+    u[0] = _mm_unpacklo_epi32(t0, t2);
+    u[1] = _mm_unpackhi_epi32(t0, t2);
+    u[2] = _mm_unpacklo_epi32(t1, t3);
+    u[3] = _mm_unpackhi_epi32(t1, t3);
+    u[4] = _mm_unpacklo_epi32(t4, t6);
+    u[5] = _mm_unpackhi_epi32(t4, t6);
+    u[6] = _mm_unpacklo_epi32(t5, t7);
+    u[7] = _mm_unpackhi_epi32(t5, t7);
+    for (int k = 0; k < 4; ++k) {
+        c[2 * k] = _mm_unpacklo_epi64(u[k], u[k + 4]);
+        c[2 * k + 1] = _mm_unpackhi_epi64(u[k], u[k + 4]);
+    }
+}
+
+// Transpose eight frames at a time, then widen each column to eight 32-bit ints.
+RHD2000_TARGET_SSE41
+void Rhd2000DecoderUsb3::transposeWords8Sse41(const unsigned char *src, int srcStride, int numWords, int *dst,
+                                              const int *dstOffsets)
+{
+    int i = 0;
+    for (; i + 8 <= numWords; i += 8) {
+        __m128i a[8], c[8];
+        for (int f = 0; f < 8; ++f) {
+            a[f] = _mm_loadu_si128((const __m128i*) (src + f * srcStride + 2 * i));
+        }
+        transpose8x8Words(a, c);
+        for (int k = 0; k < 8; ++k) {
+            int *row = dst + dstOffsets[i + k];
+            _mm_storeu_si128((__m128i*) row, _mm_cvtepu16_epi32(c[k]));
+            _mm_storeu_si128((__m128i*) (row + 4), _mm_cvtepu16_epi32(_mm_srli_si128(c[k], 8)));
+        }
+    }
+    transposeWords8Scalar(src, srcStride, numWords, dst, dstOffsets, i);
+}
+
+RHD2000_TARGET_SSE41
+void Rhd2000DecoderUsb3::transposeWords8Sse41(const unsigned char *src, int srcStride, int numWords, unsigned short *dst,
+                                              const int *dstOffsets)
+{
+    int i = 0;
+    for (; i + 8 <= numWords; i += 8) {
+        __m128i a[8], c[8];
+        for (int f = 0; f < 8; ++f) {
+            a[f] = _mm_loadu_si128((const __m128i*) (src + f * srcStride + 2 * i));
+        }
+        transpose8x8Words(a, c);
+        for (int k = 0; k < 8; ++k) {
+            _mm_storeu_si128((__m128i*) (dst + dstOffsets[i + k]), c[k]);
+        }
+    }
+    transposeWords8Scalar(src, srcStride, numWords, dst, dstOffsets, i);
+}
+
+// Index of the lowest set bit of a nonzero mask.
+static inline int lowestSetBit(unsigned int mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int) index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Compare the first two words of the magic number at all eight word offsets of a 16-byte load at
+// once, then confirm each candidate with a full 8-byte compare.
+RHD2000_TARGET_SSE41
+int Rhd2000DecoderUsb3::findMagicNumberSse41(const unsigned char *src, int numBytes)
+{
+    const __m128i word0 = _mm_set1_epi16(0x2a53);
+    const __m128i word1 = _mm_set1_epi16(0x3813);
+    int i = 0;
+    for (; i + 24 <= numBytes; i += 16) {
+        __m128i first = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*) (src + i)), word0);
+        __m128i second = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*) (src + i + 2)), word1);
+        unsigned int candidates = (unsigned int) _mm_movemask_epi8(_mm_and_si128(first, second)) & 0x5555u;
+        while (candidates != 0) {
+            int offset = i + lowestSetBit(candidates);
+            if (memcmp(src + offset, magicNumberBytes, 8) == 0) {
+                return offset;
+            }
+            candidates &= candidates - 1;
+        }
+    }
+    return findMagicNumberScalar(src, numBytes, i);
+}
+
+RHD2000_TARGET_AVX2
+int Rhd2000DecoderUsb3::findMagicNumberAvx2(const unsigned char *src, int numBytes)
+{
+    const __m256i word0 = _mm256_set1_epi16(0x2a53);
+    const __m256i word1 = _mm256_set1_epi16(0x3813);
+    int i = 0;
+    for (; i + 40 <= numBytes; i += 32) {
+        __m256i first = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*) (src + i)), word0);
+        __m256i second = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*) (src + i + 2)), word1);
+        unsigned int candidates = (unsigned int) _mm256_movemask_epi8(_mm256_and_si256(first, second)) & 0x55555555u;
+        while (candidates != 0) {
+            int offset = i + lowestSetBit(candidates);
+            if (memcmp(src + offset, magicNumberBytes, 8) == 0) {
+                return offset;
+            }
+            candidates &= candidates - 1;
+        }
+    }
+    int offset = findMagicNumberSse41(src + i, numBytes - i);
+    return (offset < 0) ? -1 : i + offset;
+}
+
+// Update eight running minima, maxima and sums at index i from eight 16-bit samples.
+RHD2000_TARGET_SSE41
+static inline void accumulate8Words(__m128i words, unsigned short *minimum, unsigned short *maximum,
+                                    unsigned int *sum, int i)
+{
+    __m128i low = _mm_loadu_si128((const __m128i*) (minimum + i));
+    __m128i high = _mm_loadu_si128((const __m128i*) (maximum + i));
+    _mm_storeu_si128((__m128i*) (minimum + i), _mm_min_epu16(low, words));
+    _mm_storeu_si128((__m128i*) (maximum + i), _mm_max_epu16(high, words));
+    __m128i sum0 = _mm_loadu_si128((const __m128i*) (sum + i));
+    __m128i sum1 = _mm_loadu_si128((const __m128i*) (sum + i + 4));
+    _mm_storeu_si128((__m128i*) (sum + i), _mm_add_epi32(sum0, _mm_cvtepu16_epi32(words)));
+    _mm_storeu_si128((__m128i*) (sum + i + 4), _mm_add_epi32(sum1, _mm_cvtepu16_epi32(_mm_srli_si128(words, 8))));
+}
+
+RHD2000_TARGET_SSE41
+void Rhd2000DecoderUsb3::accumulateMinMaxSumSse41(const unsigned short *src, unsigned short *minimum,
+                                                  unsigned short *maximum, unsigned int *sum, int numWords)
+{
+    int i = 0;
+    for (; i + 8 <= numWords; i += 8) {
+        accumulate8Words(_mm_loadu_si128((const __m128i*) (src + i)), minimum, maximum, sum, i);
+    }
+    accumulateMinMaxSumScalar(src, minimum, maximum, sum, numWords, i);
+}
+
+RHD2000_TARGET_SSE41
+void Rhd2000DecoderUsb3::accumulateMinMaxSumSse41(const int *src, unsigned short *minimum,
+                                                  unsigned short *maximum, unsigned int *sum, int numWords)
+{
+    int i = 0;
+    for (; i + 8 <= numWords; i += 8) {
+        __m128i lo = _mm_loadu_si128((const __m128i*) (src + i));
+        __m128i hi = _mm_loadu_si128((const __m128i*) (src + i + 4));
+        accumulate8Words(_mm_packus_epi32(lo, hi), minimum, maximum, sum, i);
+    }
+    accumulateMinMaxSumScalar(src, minimum, maximum, sum, numWords, i);
+}
+
+// Update sixteen running minima, maxima and sums at index i from sixteen 16-bit samples.
+RHD2000_TARGET_AVX2
+static inline void accumulate16Words(__m256i words, unsigned short *minimum, unsigned short *maximum,
+                                     unsigned int *sum, int i)
+{
+    __m256i low = _mm256_loadu_si256((const __m256i*) (minimum + i));
+    __m256i high = _mm256_loadu_si256((const __m256i*) (maximum + i));
+    _mm256_storeu_si256((__m256i*) (minimum + i), _mm256_min_epu16(low, words));
+    _mm256_storeu_si256((__m256i*) (maximum + i), _mm256_max_epu16(high, words));
+    __m256i sum0 = _mm256_loadu_si256((const __m256i*) (sum + i));
+    __m256i sum1 = _mm256_loadu_si256((const __m256i*) (sum + i + 8));
+    _mm256_storeu_si256((__m256i*) (sum + i),
+                        _mm256_add_epi32(sum0, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(words))));
+    _mm256_storeu_si256((__m256i*) (sum + i + 8),
+                        _mm256_add_epi32(sum1, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(words, 1))));
+}
+
+RHD2000_TARGET_AVX2
+void Rhd2000DecoderUsb3::accumulateMinMaxSumAvx2(const unsigned short *src, unsigned short *minimum,
+                                                 unsigned short *maximum, unsigned int *sum, int numWords)
+{
+    int i = 0;
+    for (; i + 16 <= numWords; i += 16) {
+        accumulate16Words(_mm256_loadu_si256((const __m256i*) (src + i)), minimum, maximum, sum, i);
+    }
+    accumulateMinMaxSumSse41(src + i, minimum + i, maximum + i, sum + i, numWords - i);
+}
+
+RHD2000_TARGET_AVX2
+void Rhd2000DecoderUsb3::accumulateMinMaxSumAvx2(const int *src, unsigned short *minimum,
+                                                 unsigned short *maximum, unsigned int *sum, int numWords)
+{
+    int i = 0;
+    for (; i + 16 <= numWords; i += 16) {
+        __m256i lo = _mm256_loadu_si256((const __m256i*) (src + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i*) (src + i + 8));
+        // packus works within 128-bit lanes; restore sample order across the lanes.
+        __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xd8);
+        accumulate16Words(words, minimum, maximum, sum, i);
+    }
+    accumulateMinMaxSumSse41(src + i, minimum + i, maximum + i, sum + i, numWords - i);
+}
+
+// Fold the eight lanes of the vector accumulators into the scalar running statistics.
+RHD2000_TARGET_SSE41
+static inline void reduce8Words(__m128i low, __m128i high, __m128i total, unsigned short &minimum,
+                                unsigned short &maximum, unsigned int &sum)
+{
+    // phminposuw finds the smallest word; the largest is the smallest of the complemented words.
+    unsigned short lowest = (unsigned short) _mm_cvtsi128_si32(_mm_minpos_epu16(low));
+    __m128i inverted = _mm_xor_si128(high, _mm_set1_epi32(-1));
+    unsigned short highest = (unsigned short) ~_mm_cvtsi128_si32(_mm_minpos_epu16(inverted));
+    total = _mm_add_epi32(total, _mm_srli_si128(total, 8));
+    total = _mm_add_epi32(total, _mm_srli_si128(total, 4));
+    if (lowest < minimum) minimum = lowest;
+    if (highest > maximum) maximum = highest;
+    sum += (unsigned int) _mm_cvtsi128_si32(total);
+}
+
+RHD2000_TARGET_SSE41
+void Rhd2000DecoderUsb3::reduceMinMaxSumSse41(const unsigned short *src, int numWords, unsigned short &minimum,
+                                              unsigned short &maximum, unsigned int &sum)
+{
+    int i = 0;
+    if (numWords >= 8) {
+        __m128i low = _mm_set1_epi16(-1);
+        __m128i high = _mm_setzero_si128();
+        __m128i total = _mm_setzero_si128();
+        for (; i + 8 <= numWords; i += 8) {
+            __m128i words = _mm_loadu_si128((const __m128i*) (src + i));
+            low = _mm_min_epu16(low, words);
+            high = _mm_max_epu16(high, words);
+            total = _mm_add_epi32(total, _mm_cvtepu16_epi32(words));
+            total = _mm_add_epi32(total, _mm_cvtepu16_epi32(_mm_srli_si128(words, 8)));
+        }
+        reduce8Words(low, high, total, minimum, maximum, sum);
+    }
+    reduceMinMaxSumScalar(src, numWords, minimum, maximum, sum, i);
+}
+
+RHD2000_TARGET_SSE41
+void Rhd2000DecoderUsb3::reduceMinMaxSumSse41(const int *src, int numWords, unsigned short &minimum,
+                                              unsigned short &maximum, unsigned int &sum)
+{
+    int i = 0;
+    if (numWords >= 8) {
+        __m128i low = _mm_set1_epi16(-1);
+        __m128i high = _mm_setzero_si128();
+        __m128i total = _mm_setzero_si128();
+        for (; i + 8 <= numWords; i += 8) {
+            __m128i lo = _mm_loadu_si128((const __m128i*) (src + i));
+            __m128i hi = _mm_loadu_si128((const __m128i*) (src + i + 4));
+            __m128i words = _mm_packus_epi32(lo, hi);
+            low = _mm_min_epu16(low, words);
+            high = _mm_max_epu16(high, words);
+            total = _mm_add_epi32(total, _mm_add_epi32(lo, hi));
+        }
+        reduce8Words(low, high, total, minimum, maximum, sum);
+    }
+    reduceMinMaxSumScalar(src, numWords, minimum, maximum, sum, i);
+}
+
+#else
+
+void Rhd2000DecoderUsb3::widenWordsSse41(const unsigned char *src, int *dst, int numWords)
+{
+    widenWordsScalar(src, dst, numWords);
+}
+
+void Rhd2000DecoderUsb3::widenWordsAvx2(const unsigned char *src, int *dst, int numWords)
+{
+    widenWordsScalar(src, dst, numWords);
+}
+
+void Rhd2000DecoderUsb3::transposeWords8Sse41(const unsigned char *src, int srcStride, int numWords, int *dst,
+                                              const int *dstOffsets)
+{
+    transposeWords8Scalar(src, srcStride, numWords, dst, dstOffsets, 0);
+}
+
+void Rhd2000DecoderUsb3::transposeWords8Sse41(const unsigned char *src, int srcStride, int numWords, unsigned short *dst,
+                                              const int *dstOffsets)
+{
+    transposeWords8Scalar(src, srcStride, numWords, dst, dstOffsets, 0);
+}
+
+
+void Rhd2000DecoderUsb3::accumulateMinMaxSumSse41(const unsigned short *src, unsigned short *minimum,
+                                                  unsigned short *maximum, unsigned int *sum, int numWords)
+{
+    accumulateMinMaxSumScalar(src, minimum, maximum, sum, numWords, 0);
+}
+
+void Rhd2000DecoderUsb3::accumulateMinMaxSumSse41(const int *src, unsigned short *minimum,
+                                                  unsigned short *maximum, unsigned int *sum, int numWords)
+{
+    accumulateMinMaxSumScalar(src, minimum, maximum, sum, numWords, 0);
+}
+
+void Rhd2000DecoderUsb3::accumulateMinMaxSumAvx2(const unsigned short *src, unsigned short *minimum,
+                                                 unsigned short *maximum, unsigned int *sum, int numWords)
+{
+    accumulateMinMaxSumScalar(src, minimum, maximum, sum, numWords, 0);
+}
+
+void Rhd2000DecoderUsb3::accumulateMinMaxSumAvx2(const int *src, unsigned short *minimum,
+                                                 unsigned short *maximum, unsigned int *sum, int numWords)
+{
+    accumulateMinMaxSumScalar(src, minimum, maximum, sum, numWords, 0);
+}
+
+
+void Rhd2000DecoderUsb3::reduceMinMaxSumSse41(const unsigned short *src, int numWords, unsigned short &minimum,
+                                              unsigned short &maximum, unsigned int &sum)
+{
+    reduceMinMaxSumScalar(src, numWords, minimum, maximum, sum, 0);
+}
+
+void Rhd2000DecoderUsb3::reduceMinMaxSumSse41(const int *src, int numWords, unsigned short &minimum,
+                                              unsigned short &maximum, unsigned int &sum)
+{
+    reduceMinMaxSumScalar(src, numWords, minimum, maximum, sum, 0);
+}
+
+int Rhd2000DecoderUsb3::findMagicNumberSse41(const unsigned char *src, int numBytes)
+{
+    return findMagicNumberScalar(src, numBytes, 0);
+}
+
+int Rhd2000DecoderUsb3::findMagicNumberAvx2(const unsigned char *src, int numBytes)
+{
+    return findMagicNumberScalar(src, numBytes, 0);
+}
+
+#endif
@@ -0,0 +1,102 @@
+//----------------------------------------------------------------------------------
+// rhd2000decoderusb3.h
+//
+// Rhd2000DecoderUsb3 Class Header File
+//
+// Vectorized helpers used by Rhd2000DataBlockUsb3::fillFromUsbBuffer, USB stream
+// resynchronization and the decimation pyramid.  The widest
+// instruction set supported by the CPU (AVX2, SSE4.1, or plain scalar code) is
+// selected at run time, so one binary runs on any x86-64 host.
+//----------------------------------------------------------------------------------
+
+#ifndef RHD2000DECODERUSB3_H
+#define RHD2000DECODERUSB3_H
+
+class Rhd2000DecoderUsb3
+{
+public:
+    enum DecodePath {
+        DecodeScalar,
+        DecodeSse41,
+        DecodeAvx2
+    };
+
+    static DecodePath detectBestPath();
+    static DecodePath getPath();
+    static bool setPath(DecodePath path);
+    static const char* pathName(DecodePath path);
+
+    // Zero-extend numWords little-endian 16-bit words at src into 32-bit ints at dst.
+    static void widenWords(const unsigned char *src, int *dst, int numWords);
+
+    // Store numWords little-endian 16-bit words at src into dst: widened for int, copied for
+    // unsigned short.
+    static void decodeWords(const unsigned char *src, int *dst, int numWords);
+    static void decodeWords(const unsigned char *src, unsigned short *dst, int numWords);
+
+    // Transpose the first numWords 16-bit words of 8 consecutive frames (srcStride bytes apart): word i
+    // of frame f is stored at dst[dstOffsets[i] + f].
+    static void transposeWords8(const unsigned char *src, int srcStride, int numWords, int *dst,
+                                const int *dstOffsets);
+    static void transposeWords8(const unsigned char *src, int srcStride, int numWords, unsigned short *dst,
+                                const int *dstOffsets);
+
+    // Fold one row of numWords samples into running per-word statistics: minimum[i] and maximum[i]
+    // track the extremes of src[i], and sum[i] accumulates it.  int samples must lie in 0 .. 65535.
+    static void accumulateMinMaxSum(const unsigned short *src, unsigned short *minimum, unsigned short *maximum,
+                                    unsigned int *sum, int numWords);
+    static void accumulateMinMaxSum(const int *src, unsigned short *minimum, unsigned short *maximum,
+                                    unsigned int *sum, int numWords);
+
+    // Fold numWords consecutive samples of one channel into a single running minimum, maximum and sum.
+    static void reduceMinMaxSum(const unsigned short *src, int numWords, unsigned short &minimum,
+                                unsigned short &maximum, unsigned int &sum);
+    static void reduceMinMaxSum(const int *src, int numWords, unsigned short &minimum,
+                                unsigned short &maximum, unsigned int &sum);
+
+    // True if the 8 bytes at src are a Rhythm USB frame header (RHD2000_HEADER_MAGIC_NUMBER).
+    static bool isMagicNumber(const unsigned char *src);
+
+    // Byte offset of the first Rhythm USB frame header (RHD2000_HEADER_MAGIC_NUMBER, little-endian)
+    // starting at an even offset within numBytes bytes at src, or -1 if there is none.
+    static int findMagicNumber(const unsigned char *src, int numBytes);
+
+private:
+    static void widenWordsScalar(const unsigned char *src, int *dst, int numWords);
+    static void widenWordsSse41(const unsigned char *src, int *dst, int numWords);
+    static void widenWordsAvx2(const unsigned char *src, int *dst, int numWords);
+
+    template <typename Sample>
+    static void transposeWords8Scalar(const unsigned char *src, int srcStride, int numWords, Sample *dst,
+                                      const int *dstOffsets, int firstWord);
+    static void transposeWords8Sse41(const unsigned char *src, int srcStride, int numWords, int *dst,
+                                     const int *dstOffsets);
+    static void transposeWords8Sse41(const unsigned char *src, int srcStride, int numWords, unsigned short *dst,
+                                     const int *dstOffsets);
+
+    template <typename Sample>
+    static void accumulateMinMaxSumScalar(const Sample *src, unsigned short *minimum, unsigned short *maximum,
+                                          unsigned int *sum, int numWords, int firstWord);
+    static void accumulateMinMaxSumSse41(const unsigned short *src, unsigned short *minimum, unsigned short *maximum,
+                                         unsigned int *sum, int numWords);
+    static void accumulateMinMaxSumSse41(const int *src, unsigned short *minimum, unsigned short *maximum,
+                                         unsigned int *sum, int numWords);
+    static void accumulateMinMaxSumAvx2(const unsigned short *src, unsigned short *minimum, unsigned short *maximum,
+                                        unsigned int *sum, int numWords);
+    static void accumulateMinMaxSumAvx2(const int *src, unsigned short *minimum, unsigned short *maximum,
+                                        unsigned int *sum, int numWords);
+
+    template <typename Sample>
+    static void reduceMinMaxSumScalar(const Sample *src, int numWords, unsigned short &minimum,
+                                      unsigned short &maximum, unsigned int &sum, int firstWord);
+    static void reduceMinMaxSumSse41(const unsigned short *src, int numWords, unsigned short &minimum,
+                                     unsigned short &maximum, unsigned int &sum);
+    static void reduceMinMaxSumSse41(const int *src, int numWords, unsigned short &minimum,
+                                     unsigned short &maximum, unsigned int &sum);
+
+    static int findMagicNumberScalar(const unsigned char *src, int numBytes, int firstByte);
+    static int findMagicNumberSse41(const unsigned char *src, int numBytes);
+    static int findMagicNumberAvx2(const unsigned char *src, int numBytes);
+};
+
+#endif // RHD2000DECODERUSB3_H
@@ -0,0 +1,479 @@
+//----------------------------------------------------------------------------------
+// rhd2000dspengineusb3.cpp
+//
+// Rhd2000DspEngineUsb3 Class
+//
+// Tiled, work-stealing host DSP over amplifier data blocks.
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <cmath>
+
+#include "rhd2000dspengineusb3.h"
+#include "rhd2000datablockusb3.h"
+
+using namespace std;
+
+static int greatestCommonDivisor(int a, int b)
+{
+    while (b != 0) {
+        int r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+// Constructor.  cutoffHz is the -3 dB frequency of the filter.
+Rhd2000DspHighPassStageUsb3::Rhd2000DspHighPassStageUsb3(double cutoffHz_) :
+    cutoffHz(cutoffHz_),
+    alpha(0.0f)
+{
+}
+
+bool Rhd2000DspHighPassStageUsb3::prepare(int numChannels, double sampleRate)
+{
+    if (cutoffHz <= 0.0 || cutoffHz >= sampleRate / 2.0) {
+        cerr << "Error in Rhd2000DspHighPassStageUsb3::prepare: cutoff " << cutoffHz << " Hz is outside (0, " <<
+                sampleRate / 2.0 << ") Hz." << endl;
+        return false;
+    }
+    alpha = (float) (1.0 - exp(-2.0 * 3.14159265358979323846 * cutoffHz / sampleRate));
+    baseline.assign(numChannels, 0.0f);
+    return true;
+}
+
+// y[n] = x[n] - b[n - 1], where b follows x through a one-pole low-pass filter.
+void Rhd2000DspHighPassStageUsb3::processTile(float *samples, int firstChannel, int numTileChannels)
+{
+    float *b = baseline.data() + firstChannel;
+    for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        float *x = samples + t * numTileChannels;
+        for (int i = 0; i < numTileChannels; ++i) {
+            float input = x[i];
+            x[i] = input - b[i];
+            b[i] += alpha * (input - b[i]);
+        }
+    }
+}
+
+Rhd2000DspEngineUsb3::Rhd2000DspEngineUsb3() :
+    numDataStreams(0),
+    numChannels(0),
+    running(false),
+    nextSubmitSequence(0),
+    nextTakeSequence(0),
+    maxBlocksInFlight(0),
+    numBlocksProcessed(0),
+    numBlocksRejected(0),
+    numQueuedTasks(0),
+    numIdleWorkers(0),
+    stopRequested(false)
+{
+}
+
+Rhd2000DspEngineUsb3::~Rhd2000DspEngineUsb3()
+{
+    stop();
+}
+
+// Append a stage to the chain run on every tile.  The engine does not take ownership.  Stages
+// can only be changed while the engine is stopped.
+void Rhd2000DspEngineUsb3::addStage(Rhd2000DspStageUsb3 *stage)
+{
+    if (running) {
+        cerr << "Error in Rhd2000DspEngineUsb3::addStage: engine is running." << endl;
+        return;
+    }
+    stages.push_back(stage);
+}
+
+void Rhd2000DspEngineUsb3::clearStages()
+{
+    if (running) {
+        cerr << "Error in Rhd2000DspEngineUsb3::clearStages: engine is running." << endl;
+        return;
+    }
+    stages.clear();
+}
+
+// Prepare every stage for numDataStreams streams at sampleRate and start numThreads workers
+// (0 for one per hardware thread).  Tiles hold tileChannels channels, rounded up to the
+// stages' channel granularity.  At most maxBlocksInFlight blocks may be submitted and not yet
+// taken back.  Returns false if a stage refuses the configuration.
+bool Rhd2000DspEngineUsb3::start(int numDataStreams_, double sampleRate, int numThreads, int tileChannels,
+                                 int maxBlocksInFlight_)
+{
+    if (running) {
+        cerr << "Error in Rhd2000DspEngineUsb3::start: engine is already running." << endl;
+        return false;
+    }
+    if (numDataStreams_ < 1 || maxBlocksInFlight_ < 1) {
+        cerr << "Error in Rhd2000DspEngineUsb3::start: need at least one data stream and one block in flight." << endl;
+        return false;
+    }
+    numDataStreams = numDataStreams_;
+    numChannels = numDataStreams * CHANNELS_PER_STREAM;
+
+    int granularity = 1;
+    for (unsigned int i = 0; i < stages.size(); ++i) {
+        int g = stages[i]->getChannelGranularity();
+        granularity = granularity / greatestCommonDivisor(granularity, g) * g;
+    }
+    if (numChannels % granularity != 0) {
+        cerr << "Error in Rhd2000DspEngineUsb3::start: stages need tiles of " << granularity << " channels, which " <<
+                numChannels << " channels cannot be split into." << endl;
+        return false;
+    }
+    for (unsigned int i = 0; i < stages.size(); ++i) {
+        if (!stages[i]->prepare(numChannels, sampleRate)) {
+            return false;
+        }
+    }
+
+    if (tileChannels < 1) {
+        tileChannels = 1;
+    }
+    tileChannels = ((tileChannels + granularity - 1) / granularity) * granularity;
+    tileFirstChannel.clear();
+    for (int channel = 0; channel < numChannels; channel += tileChannels) {
+        tileFirstChannel.push_back(channel);
+    }
+    tileFirstChannel.push_back(numChannels);
+
+    jobs.assign(maxBlocksInFlight_, Job());
+    tileNextSequence.assign(getNumTiles(), 0);
+    nextSubmitSequence = 0;
+    nextTakeSequence = 0;
+    numQueuedTasks = 0;
+    numIdleWorkers = 0;
+    stopRequested = false;
+
+    if (numThreads < 1) {
+        numThreads = (int) thread::hardware_concurrency();
+        if (numThreads < 1) {
+            numThreads = 1;
+        }
+    }
+    workers.clear();
+    for (int i = 0; i < numThreads; ++i) {
+        workers.push_back(unique_ptr<Worker>(new Worker()));
+        workers.back()->scratch.assign(SAMPLES_PER_DATA_BLOCK * tileChannels, 0.0f);
+    }
+    resetStats();
+    running = true;
+    for (int i = 0; i < numThreads; ++i) {
+        workers[i]->workerThread = thread(&Rhd2000DspEngineUsb3::workerLoop, this, i);
+    }
+    return true;
+}
+
+// Finish the blocks in flight and stop the workers.  Blocks not yet taken back are forgotten;
+// they remain the caller's.
+void Rhd2000DspEngineUsb3::stop()
+{
+    if (!running) {
+        return;
+    }
+    {
+        unique_lock<mutex> lock(scheduleMutex);
+        while (true) {
+            bool busy = false;
+            for (unsigned long long sequence = nextTakeSequence; sequence < nextSubmitSequence; ++sequence) {
+                busy = busy || jobs[sequence % jobs.size()].tilesRemaining > 0;
+            }
+            if (!busy) {
+                break;
+            }
+            blockDone.wait(lock);
+        }
+        nextTakeSequence = nextSubmitSequence;
+    }
+    {
+        lock_guard<mutex> lock(idleMutex);
+        stopRequested = true;
+    }
+    workAvailable.notify_all();
+    for (unsigned int i = 0; i < workers.size(); ++i) {
+        workers[i]->workerThread.join();
+    }
+    running = false;
+}
+
+bool Rhd2000DspEngineUsb3::isRunning() const
+{
+    return running;
+}
+
+int Rhd2000DspEngineUsb3::getNumThreads() const
+{
+    return (int) workers.size();
+}
+
+int Rhd2000DspEngineUsb3::getNumTiles() const
+{
+    return tileFirstChannel.empty() ? 0 : (int) tileFirstChannel.size() - 1;
+}
+
+// Queue a block for processing.  The block must hold the numDataStreams given to start() and
+// stay untouched until takeProcessedBlock() returns it.  Returns false without queueing it if
+// the engine is not running or maxBlocksInFlight blocks are already in flight.
+bool Rhd2000DspEngineUsb3::submitBlock(Rhd2000DataBlockUsb3 *dataBlock)
+{
+    if (!running) {
+        return false;
+    }
+    if (dataBlock->getNumDataStreams() != numDataStreams) {
+        cerr << "Error in Rhd2000DspEngineUsb3::submitBlock: block has " << dataBlock->getNumDataStreams() <<
+                " data streams; engine was started for " << numDataStreams << "." << endl;
+        return false;
+    }
+
+    lock_guard<mutex> lock(scheduleMutex);
+    if (nextSubmitSequence - nextTakeSequence >= jobs.size()) {
+        numBlocksRejected++;
+        return false;
+    }
+    unsigned long long sequence = nextSubmitSequence++;
+    Job &job = jobs[sequence % jobs.size()];
+    job.dataBlock = dataBlock;
+    job.tilesRemaining = getNumTiles();
+    unsigned int inFlight = (unsigned int) (nextSubmitSequence - nextTakeSequence);
+    if (inFlight > maxBlocksInFlight) {
+        maxBlocksInFlight = inFlight;
+    }
+
+    // Tiles still busy with an earlier block pick this one up when they finish (finishTask()).
+    // The rest start on the worker that owns their share of the channels.
+    const int numTiles = getNumTiles();
+    const int numWorkers = (int) workers.size();
+    for (int tile = 0; tile < numTiles; ++tile) {
+        if (tileNextSequence[tile] == sequence) {
+            Task task = { sequence, tile };
+            pushTask(tile * numWorkers / numTiles, task);
+        }
+    }
+    return true;
+}
+
+// Return the oldest submitted block once all of its tiles are done, or nullptr if it is not
+// done yet (wait false) or nothing is in flight.
+Rhd2000DataBlockUsb3* Rhd2000DspEngineUsb3::takeProcessedBlock(bool wait)
+{
+    unique_lock<mutex> lock(scheduleMutex);
+    while (nextTakeSequence < nextSubmitSequence) {
+        Job &job = jobs[nextTakeSequence % jobs.size()];
+        if (job.tilesRemaining == 0) {
+            nextTakeSequence++;
+            return job.dataBlock;
+        }
+        if (!wait) {
+            break;
+        }
+        blockDone.wait(lock);
+    }
+    return nullptr;
+}
+
+// Process one block and wait for it.  Only for use with no other blocks in flight.
+bool Rhd2000DspEngineUsb3::processBlock(Rhd2000DataBlockUsb3 &dataBlock)
+{
+    if (getNumBlocksInFlight() != 0) {
+        cerr << "Error in Rhd2000DspEngineUsb3::processBlock: other blocks are in flight." << endl;
+        return false;
+    }
+    if (!submitBlock(&dataBlock)) {
+        return false;
+    }
+    return takeProcessedBlock(true) == &dataBlock;
+}
+
+unsigned int Rhd2000DspEngineUsb3::getNumBlocksInFlight()
+{
+    lock_guard<mutex> lock(scheduleMutex);
+    return (unsigned int) (nextSubmitSequence - nextTakeSequence);
+}
+
+void Rhd2000DspEngineUsb3::getStats(DspStats &stats)
+{
+    stats.numThreads = getNumThreads();
+    stats.numTiles = getNumTiles();
+    stats.numTilesProcessed = 0;
+    stats.numTilesStolen = 0;
+    stats.busySeconds = 0.0;
+    for (unsigned int i = 0; i < workers.size(); ++i) {
+        stats.numTilesProcessed += workers[i]->numTilesProcessed;
+        stats.numTilesStolen += workers[i]->numTilesStolen;
+        stats.busySeconds += workers[i]->busyNanoseconds * 1.0e-9;
+    }
+    lock_guard<mutex> lock(scheduleMutex);
+    stats.numBlocksProcessed = numBlocksProcessed;
+    stats.numBlocksRejected = numBlocksRejected;
+    stats.maxBlocksInFlight = maxBlocksInFlight;
+}
+
+void Rhd2000DspEngineUsb3::resetStats()
+{
+    for (unsigned int i = 0; i < workers.size(); ++i) {
+        workers[i]->numTilesProcessed = 0;
+        workers[i]->numTilesStolen = 0;
+        workers[i]->busyNanoseconds = 0;
+    }
+    lock_guard<mutex> lock(scheduleMutex);
+    numBlocksProcessed = 0;
+    numBlocksRejected = 0;
+    maxBlocksInFlight = 0;
+}
+
+void Rhd2000DspEngineUsb3::workerLoop(int index)
+{
+    Worker &worker = *workers[index];
+    while (true) {
+        Task task;
+        if (popTask(index, task) || stealTask(index, task)) {
+            runTask(worker, task);
+            finishTask(index, task);
+            continue;
+        }
+
+        unique_lock<mutex> lock(idleMutex);
+        if (stopRequested) {
+            break;
+        }
+        if (numQueuedTasks > 0) {
+            continue;       // a task was pushed after this worker looked
+        }
+        numIdleWorkers++;
+        workAvailable.wait(lock, [this] { return stopRequested || numQueuedTasks > 0; });
+        numIdleWorkers--;
+    }
+}
+
+void Rhd2000DspEngineUsb3::pushTask(int worker, const Task &task)
+{
+    {
+        lock_guard<mutex> lock(workers[worker]->dequeMutex);
+        workers[worker]->tasks.push_back(task);
+    }
+    lock_guard<mutex> lock(idleMutex);
+    numQueuedTasks++;
+    if (numIdleWorkers > 0) {
+        workAvailable.notify_one();
+    }
+}
+
+// Newest task of a worker's own deque, whose tile was most likely just in its cache.
+bool Rhd2000DspEngineUsb3::popTask(int worker, Task &task)
+{
+    lock_guard<mutex> lock(workers[worker]->dequeMutex);
+    if (workers[worker]->tasks.empty()) {
+        return false;
+    }
+    task = workers[worker]->tasks.back();
+    workers[worker]->tasks.pop_back();
+    numQueuedTasks--;
+    return true;
+}
+
+// Oldest task of the next worker, after the thief, that has one.
+bool Rhd2000DspEngineUsb3::stealTask(int thief, Task &task)
+{
+    const int numWorkers = (int) workers.size();
+    for (int i = 1; i < numWorkers; ++i) {
+        Worker &victim = *workers[(thief + i) % numWorkers];
+        lock_guard<mutex> lock(victim.dequeMutex);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            numQueuedTasks--;
+            workers[thief]->numTilesStolen++;
+            return true;
+        }
+    }
+    return false;
+}
+
+// The job slot was filled before the task was queued and is not reused until the block has
+// been taken back, so it can be read here without scheduleMutex.
+void Rhd2000DspEngineUsb3::runTask(Worker &worker, const Task &task)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    Rhd2000DataBlockUsb3 &dataBlock = *jobs[task.sequence % jobs.size()].dataBlock;
+    const int firstChannel = tileFirstChannel[task.tile];
+    const int numTileChannels = tileFirstChannel[task.tile + 1] - firstChannel;
+    float *tile = worker.scratch.data();
+
+    if (dataBlock.getSampleFormat() == Rhd2000DataBlockUsb3::UInt16Samples) {
+        gatherTile(dataBlock, dataBlock.amplifierData16.data(), firstChannel, numTileChannels, tile);
+    } else {
+        gatherTile(dataBlock, dataBlock.amplifierDataFast, firstChannel, numTileChannels, tile);
+    }
+    for (unsigned int i = 0; i < stages.size(); ++i) {
+        stages[i]->processTile(tile, firstChannel, numTileChannels);
+    }
+    if (dataBlock.getSampleFormat() == Rhd2000DataBlockUsb3::UInt16Samples) {
+        scatterTile(dataBlock, dataBlock.amplifierData16.data(), firstChannel, numTileChannels, tile);
+    } else {
+        scatterTile(dataBlock, dataBlock.amplifierDataFast, firstChannel, numTileChannels, tile);
+    }
+
+    worker.numTilesProcessed++;
+    worker.busyNanoseconds += (unsigned long long)
+            chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+// Mark a tile of a block done and hand the tile's next block, if already submitted, to the
+// same worker.
+void Rhd2000DspEngineUsb3::finishTask(int worker, const Task &task)
+{
+    lock_guard<mutex> lock(scheduleMutex);
+    tileNextSequence[task.tile] = task.sequence + 1;
+    Job &job = jobs[task.sequence % jobs.size()];
+    if (--job.tilesRemaining == 0) {
+        numBlocksProcessed++;
+        blockDone.notify_all();
+    }
+    if (task.sequence + 1 < nextSubmitSequence) {
+        Task next = { task.sequence + 1, task.tile };
+        pushTask(worker, next);
+    }
+}
+
+template <typename Sample>
+void Rhd2000DspEngineUsb3::gatherTile(const Rhd2000DataBlockUsb3 &dataBlock, const Sample *amp, int firstChannel,
+                                      int numTileChannels, float *tile) const
+{
+    const int stride = dataBlock.amplifierSampleStride();
+    for (int i = 0; i < numTileChannels; ++i) {
+        const int channel = firstChannel + i;
+        const Sample *source = amp + dataBlock.fastIndex(channel / CHANNELS_PER_STREAM, channel % CHANNELS_PER_STREAM, 0);
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            tile[t * numTileChannels + i] = (float) ((int) source[t * stride] - 32768);
+        }
+    }
+}
+
+template <typename Sample>
+void Rhd2000DspEngineUsb3::scatterTile(Rhd2000DataBlockUsb3 &dataBlock, Sample *amp, int firstChannel,
+                                       int numTileChannels, const float *tile) const
+{
+    const int stride = dataBlock.amplifierSampleStride();
+    for (int i = 0; i < numTileChannels; ++i) {
+        const int channel = firstChannel + i;
+        Sample *destination = amp + dataBlock.fastIndex(channel / CHANNELS_PER_STREAM, channel % CHANNELS_PER_STREAM, 0);
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            float word = tile[t * numTileChannels + i] + 32768.5f;
+            word = (word < 0.0f) ? 0.0f : ((word > 65535.0f) ? 65535.0f : word);
+            destination[t * stride] = (Sample) (int) word;
+        }
+    }
+}
@@ -0,0 +1,173 @@
+//----------------------------------------------------------------------------------
+// rhd2000dspengineusb3.h
+//
+// Rhd2000DspEngineUsb3 Class Header File
+//
+// Runs host-side filtering of amplifier data on a pool of worker threads.  Each submitted
+// Rhd2000DataBlockUsb3 is split into tiles of adjacent channels, numbered
+// stream * CHANNELS_PER_STREAM + channel, and every tile is passed through the chain of
+// Rhd2000DspStageUsb3 stages in place.  Workers keep their own task deque and steal from the
+// others when it runs dry, so an uneven tile cost or a descheduled thread does not hold up
+// the block.
+//
+// A tile runs its blocks strictly in submission order, so stages may keep per-channel state
+// (filter memory) from one block to the next without locking: different tiles of a block
+// run concurrently, and several blocks may be in flight, but the same channels are never
+// processed by two threads at once.  takeProcessedBlock() returns blocks in the order they
+// were submitted, once every tile of the block is done.
+//
+// Stages see a tile as float samples in ADC steps about the 32768 midpoint; results are
+// rounded and clamped back to 16-bit ADC words in the block's own layout and sample format.
+//----------------------------------------------------------------------------------
+
+#ifndef RHD2000DSPENGINEUSB3_H
+#define RHD2000DSPENGINEUSB3_H
+
+// Default number of blocks that may be submitted but not yet taken back
+#define DSP_MAX_BLOCKS_IN_FLIGHT 8
+
+// Default channels per tile (one data stream)
+#define DSP_DEFAULT_TILE_CHANNELS 32
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <memory>
+
+using namespace std;
+
+#include "rhd2000datablockusb3.h"
+
+// One processing step of the engine.  prepare() is called by Rhd2000DspEngineUsb3::start()
+// and allocates the state of every channel; processTile() is then called from worker threads.
+class Rhd2000DspStageUsb3
+{
+public:
+    virtual ~Rhd2000DspStageUsb3() {}
+
+    virtual bool prepare(int numChannels, double sampleRate) = 0;
+
+    // Filter samples[t * numTileChannels + i], sample t of channel firstChannel + i, in place.
+    virtual void processTile(float *samples, int firstChannel, int numTileChannels) = 0;
+
+    // Tiles start and end on multiples of this many channels, e.g. so that a re-referencing
+    // group is never split.
+    virtual int getChannelGranularity() const { return 1; }
+};
+
+// First-order high-pass filter on every channel, like the RHD2000 DSP offset removal.
+class Rhd2000DspHighPassStageUsb3 : public Rhd2000DspStageUsb3
+{
+public:
+    explicit Rhd2000DspHighPassStageUsb3(double cutoffHz);
+
+    bool prepare(int numChannels, double sampleRate) override;
+    void processTile(float *samples, int firstChannel, int numTileChannels) override;
+
+private:
+    double cutoffHz;
+    float alpha;
+    vector<float> baseline;         // low-passed input of each channel
+};
+
+class Rhd2000DspEngineUsb3
+{
+public:
+    Rhd2000DspEngineUsb3();
+    ~Rhd2000DspEngineUsb3();
+
+    void addStage(Rhd2000DspStageUsb3 *stage);
+    void clearStages();
+
+    bool start(int numDataStreams, double sampleRate, int numThreads = 0,
+               int tileChannels = DSP_DEFAULT_TILE_CHANNELS, int maxBlocksInFlight = DSP_MAX_BLOCKS_IN_FLIGHT);
+    void stop();
+    bool isRunning() const;
+    int getNumThreads() const;
+    int getNumTiles() const;
+
+    bool submitBlock(Rhd2000DataBlockUsb3 *dataBlock);
+    Rhd2000DataBlockUsb3* takeProcessedBlock(bool wait);
+    bool processBlock(Rhd2000DataBlockUsb3 &dataBlock);
+    unsigned int getNumBlocksInFlight();
+
+    struct DspStats {
+        int numThreads;
+        int numTiles;
+        unsigned long long numBlocksProcessed;
+        unsigned long long numTilesProcessed;
+        unsigned long long numTilesStolen;      // tiles run by a worker other than the one they were queued on
+        unsigned long long numBlocksRejected;   // submitBlock() calls refused because the window was full
+        unsigned int maxBlocksInFlight;         // largest number of blocks in flight at once
+        double busySeconds;                     // summed over all workers
+    };
+    void getStats(DspStats &stats);
+    void resetStats();
+
+private:
+    Rhd2000DspEngineUsb3(const Rhd2000DspEngineUsb3 &);
+    Rhd2000DspEngineUsb3& operator=(const Rhd2000DspEngineUsb3 &);
+
+    struct Task {
+        unsigned long long sequence;            // block submission number
+        int tile;
+    };
+
+    struct Worker {
+        mutex dequeMutex;
+        deque<Task> tasks;                      // owner pops at the back, thieves take from the front
+        thread workerThread;
+        vector<float> scratch;                  // one tile, [t][channel]
+        atomic<unsigned long long> numTilesProcessed;
+        atomic<unsigned long long> numTilesStolen;
+        atomic<unsigned long long> busyNanoseconds;
+    };
+
+    struct Job {
+        Rhd2000DataBlockUsb3 *dataBlock;
+        int tilesRemaining;
+    };
+
+    vector<Rhd2000DspStageUsb3*> stages;
+    vector<unique_ptr<Worker> > workers;
+    int numDataStreams;
+    int numChannels;
+    vector<int> tileFirstChannel;               // numTiles + 1 entries
+    bool running;
+
+    // Block bookkeeping, guarded by scheduleMutex
+    mutex scheduleMutex;
+    condition_variable blockDone;
+    vector<Job> jobs;                           // in-flight blocks, indexed by sequence % jobs.size()
+    unsigned long long nextSubmitSequence;
+    unsigned long long nextTakeSequence;
+    vector<unsigned long long> tileNextSequence;    // next block each tile will process
+    unsigned int maxBlocksInFlight;
+    unsigned long long numBlocksProcessed;
+    unsigned long long numBlocksRejected;
+
+    // Idle workers sleep on workAvailable; numQueuedTasks is raised under idleMutex
+    mutex idleMutex;
+    condition_variable workAvailable;
+    atomic<int> numQueuedTasks;
+    int numIdleWorkers;
+    bool stopRequested;
+
+    void workerLoop(int index);
+    void pushTask(int worker, const Task &task);
+    bool popTask(int worker, Task &task);
+    bool stealTask(int thief, Task &task);
+    void runTask(Worker &worker, const Task &task);
+    void finishTask(int worker, const Task &task);
+    template <typename Sample>
+    void gatherTile(const Rhd2000DataBlockUsb3 &dataBlock, const Sample *amp, int firstChannel, int numTileChannels,
+                    float *tile) const;
+    template <typename Sample>
+    void scatterTile(Rhd2000DataBlockUsb3 &dataBlock, Sample *amp, int firstChannel, int numTileChannels,
+                     const float *tile) const;
+};
+
+#endif // RHD2000DSPENGINEUSB3_H
@@ -24,10 +24,20 @@
 #include <vector>
 #include <queue>
 #include <cmath>
+#include <algorithm>
+#include <utility>
 #include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 
 #include "rhd2000evalboardusb3.h"
 #include "rhd2000datablockusb3.h"
+#include "rhd2000datablockringusb3.h"
+#include "rhd2000datablockpoolusb3.h"
+#include "rhd2000datafilewriterusb3.h"
+#include "rhd2000decoderusb3.h"
 
 #include "okFrontPanelDLL.h"
 
@@ -41,9 +51,15 @@ using namespace std;
 Rhd2000EvalBoardUsb3::Rhd2000EvalBoardUsb3()
 {
     int i;
+    dev = nullptr;
     usbBufferSize = MAX_NUM_BLOCKS * 2 * Rhd2000DataBlockUsb3::calculateDataBlockSizeInWords(MAX_NUM_DATA_STREAMS);
     cout << "Rhd2000EvalBoardUsb3: Allocating " << usbBufferSize / 1.0e6 << " MBytes for USB buffer." << endl;
-    usbBuffer = new unsigned char [usbBufferSize];
+    // Extra room for bytes carried over from the previous transfer after a resync (less than one
+    // block plus one frame)
+    usbBuffer = new unsigned char [usbBufferSize + 4 * Rhd2000DataBlockUsb3::calculateDataBlockSizeInWords(MAX_NUM_DATA_STREAMS)];
+    usbResyncFrames.reserve(MAX_NUM_BLOCKS * SAMPLES_PER_DATA_BLOCK);
+    usbKeptRuns.reserve(MAX_NUM_BLOCKS * SAMPLES_PER_DATA_BLOCK);
+    resetUsbStream();
     sampleRate = SampleRate30000Hz; // Rhythm FPGA boots up with 30.0 kS/s/channel sampling rate
     numDataStreams = 0;
 
@@ -54,16 +70,47 @@ Rhd2000EvalBoardUsb3::Rhd2000EvalBoardUsb3()
     cableDelay.resize(MAX_NUM_SPI_PORTS, -1);
     lastNumWordsInFifo = 0;
     numWordsHasBeenUpdated = false;
+
+    readerThreadRunning = false;
+    readerThreadStop = false;
+    readerStallCount = 0;
+    dataBlockRing = nullptr;
+    queueFileWriter = nullptr;
+
+    maxBlocksPerRead = MAX_NUM_BLOCKS;
+    amplifierLayout = Rhd2000DataBlockUsb3::TimeMajor;
+    sampleFormat = Rhd2000DataBlockUsb3::Int32Samples;
+    resetUsbReadStats();
+
+    commandRamPipe = false;
+    resetCommandUploadStats();
+
+    wireInBatchDepth = 0;
+    wireInsPending = false;
+    resetWireInStats();
+
+    memset(&fpgaState, 0, sizeof(fpgaState));
+    fpgaStateFileChosen = false;
+    fpgaStateFileKnown = false;
+    fpgaReused = false;
 }
 
 Rhd2000EvalBoardUsb3::~Rhd2000EvalBoardUsb3()
 {
+    stopReaderThread();
+    if (dev) {
+        saveFpgaState();
+    }
+    delete dataBlockRing;
+    delete queueFileWriter;
     delete [] usbBuffer;
+    delete dev;     // closes the device; the FPGA keeps running its configuration
 }
 
-// Find an Opal Kelly XEM6310-LX45 board attached to a USB port and open it.
+// Find an Opal Kelly XEM6310-LX45 board attached to a USB port and open it: the first one found, or
+// the one with requestedSerialNumber (e.g., one of several boards on a rig).
 // Returns 1 if successful, -1 if FrontPanel cannot be loaded, and -2 if XEM6310 can't be found.
-int Rhd2000EvalBoardUsb3::open()
+int Rhd2000EvalBoardUsb3::open(string requestedSerialNumber)
 {
     lock_guard<mutex> lockOk(okMutex);
     char dll_date[32], dll_time[32];
@@ -92,16 +139,23 @@ int Rhd2000EvalBoardUsb3::open()
     }
     cout << endl;
 
-    // Find first device in list of type XEM6310LX45.
+    // Find first device in list of type XEM6310LX45 (with the requested serial number, if any).
     for (i = 0; i < nDevices; ++i) {
-        if (dev->GetDeviceListModel(i) == OK_PRODUCT_XEM6310LX45) {
+        if (dev->GetDeviceListModel(i) == OK_PRODUCT_XEM6310LX45 &&
+                (requestedSerialNumber == "" || dev->GetDeviceListSerial(i) == requestedSerialNumber)) {
             serialNumber = dev->GetDeviceListSerial(i);
             break;
         }
     }
 
     if (serialNumber == "") {
-        cerr << "No XEM6310-LX45 Opal Kelly board found." << endl;
+        if (requestedSerialNumber == "") {
+            cerr << "No XEM6310-LX45 Opal Kelly board found." << endl;
+        } else {
+            cerr << "No XEM6310-LX45 Opal Kelly board with serial number " << requestedSerialNumber << " found." << endl;
+        }
+        delete dev;
+        dev = nullptr;
         return -2;
     }
 
@@ -111,6 +165,7 @@ int Rhd2000EvalBoardUsb3::open()
     // Attempt to open device.
     if (result != okCFrontPanel::NoError) {
         delete dev;
+        dev = nullptr;
         cerr << "Device could not be opened.  Is one connected?" << endl;
         cerr << "Error = " << result << endl;
         return -2;
@@ -122,15 +177,99 @@ int Rhd2000EvalBoardUsb3::open()
     cout << "Opal Kelly device serial number: " << dev->GetSerialNumber().c_str() << endl;
     cout << "Opal Kelly device ID string: " << dev->GetDeviceID().c_str() << endl << endl;
 
+    boardSerialNumber = serialNumber;
     return 1;
 }
 
+// Serial number of the open board ("" before open()).
+string Rhd2000EvalBoardUsb3::getSerialNumber() const
+{
+    return boardSerialNumber;
+}
+
 // Uploads the configuration file (bitfile) to the FPGA.  Returns true if successful.
 bool Rhd2000EvalBoardUsb3::uploadFpgaBitfile(string filename)
 {
     lock_guard<mutex> lockOk(okMutex);
+    return configureFpga(filename);
+}
+
+// Bring the FPGA up with a bitfile, reusing the configuration it already has if that can be
+// trusted: the board must report the Rhythm board ID and the board version recorded in the state
+// file (see setFpgaStateFile()) when a bitfile with the same hash was last loaded.  The FPGA is
+// then not reconfigured, and the wire-in values recorded with it are taken as what it holds, so
+// that wire-in updates which would not change them (e.g. most of initialize()) are not sent.
+// Otherwise the bitfile is uploaded as by uploadFpgaBitfile().  Returns true if successful.
+//
+// Unless setFpgaStateFile() chose another, the state file is rhd2000usb3_<serial number>.state in the
+// working directory, and from this call on the board keeps it up to date.  Boards that never fast
+// start write no state file by default; a program that also starts boards with uploadFpgaBitfile()
+// should give them the same state file, so that a fast start cannot trust a stale record.
+//
+// A board reconfigured by another program with a different bitfile reporting the same board ID
+// and version is not detected; call uploadFpgaBitfile() if that may have happened.
+bool Rhd2000EvalBoardUsb3::fastStartFpga(string filename)
+{
+    lock_guard<mutex> lockOk(okMutex);
+    FpgaStateRecord record;
+    unsigned long long bitfileHash;
+
+    if (!fpgaStateFileChosen) {
+        fpgaStateFileName = "rhd2000usb3_" + boardSerialNumber + ".state";
+        fpgaStateFileChosen = true;
+    }
+
+    if (hashBitfile(filename, bitfileHash) && readFpgaState(record) && record.bitfileHash == bitfileHash &&
+            dev->IsFrontPanelEnabled()) {
+        dev->UpdateWireOuts();
+        unsigned int boardId = dev->GetWireOutValue(WireOutBoardId);
+        unsigned int boardVersion = dev->GetWireOutValue(WireOutBoardVersion);
+        if (boardId == RHYTHM_BOARD_ID && boardId == record.boardId && boardVersion == record.boardVersion) {
+            fpgaState = record;
+            for (int i = 0; i < NUM_WIRE_INS; ++i) {
+                dev->SetWireInValue(i, record.wireIns[i]);
+            }
+            writeFpgaState();
+            fpgaReused = true;
+            cout << "FPGA already configured with " << filename << " (board version " << boardVersion <<
+                    "); skipping upload." << endl << endl;
+            return true;
+        }
+    }
+    return configureFpga(filename);
+}
+
+// True if the last fastStartFpga() kept the FPGA configuration it found.
+bool Rhd2000EvalBoardUsb3::isFpgaConfigurationReused() const
+{
+    return fpgaReused;
+}
+
+// Keep the fast start record in filename, whether or not the board is started with fastStartFpga(),
+// instead of the default chosen by fastStartFpga(); an empty name turns recording off.  Call after
+// open().
+void Rhd2000EvalBoardUsb3::setFpgaStateFile(string filename)
+{
+    lock_guard<mutex> lockOk(okMutex);
+    if (fpgaStateFile.is_open()) {
+        fpgaStateFile.close();
+    }
+    fpgaStateFileName = filename;
+    fpgaStateFileChosen = true;
+}
+
+bool Rhd2000EvalBoardUsb3::configureFpga(string filename)
+{
+    // Until configuration succeeds, neither the bitfile nor the wire-ins are known.
+    memset(&fpgaState, 0, sizeof(fpgaState));
+    writeFpgaState();
+    fpgaReused = false;
+
     okCFrontPanel::ErrorCode errorCode = dev->ConfigureFPGA(filename);
 
+    // Configuration clears the command RAM (and a failed one leaves it unknown)
+    clearCommandRamCache();
+
     switch (errorCode) {
         case okCFrontPanel::NoError:
             break;
@@ -164,6 +303,7 @@ bool Rhd2000EvalBoardUsb3::uploadFpgaBitfile(string filename)
     if (dev->IsFrontPanelEnabled() == false) {
         cerr << "Opal Kelly FrontPanel support is not enabled in this FPGA configuration." << endl;
         delete dev;
+        dev = nullptr;
         return(false);
     }
 
@@ -179,12 +319,146 @@ bool Rhd2000EvalBoardUsb3::uploadFpgaBitfile(string filename)
         cout << "Rhythm USB3 configuration file successfully loaded." << endl << endl;
     }
 
+    // A freshly configured FPGA has every wire-in at zero.
+    if (hashBitfile(filename, fpgaState.bitfileHash)) {
+        fpgaState.boardId = boardId;
+        fpgaState.boardVersion = boardVersion;
+        fpgaState.wireInsKnown = 1;
+        writeFpgaState();
+    }
     return(true);
 }
 
+// 64-bit FNV-1a hash of a bitfile's contents.  Returns false if the file cannot be read.
+bool Rhd2000EvalBoardUsb3::hashBitfile(const string &filename, unsigned long long &hash)
+{
+    ifstream bitfile(filename.c_str(), ios::binary);
+    if (!bitfile.good()) {
+        return false;
+    }
+
+    vector<char> buffer(65536);
+    hash = 0xcbf29ce484222325ULL;
+    while (bitfile) {
+        bitfile.read(buffer.data(), buffer.size());
+        streamsize numBytes = bitfile.gcount();
+        for (streamsize i = 0; i < numBytes; ++i) {
+            hash = (hash ^ (unsigned char) buffer[i]) * 0x100000001b3ULL;
+        }
+    }
+    return true;
+}
+
+bool Rhd2000EvalBoardUsb3::readFpgaState(FpgaStateRecord &record)
+{
+    if (fpgaStateFileName.empty()) {
+        return false;
+    }
+    ifstream stateFile(fpgaStateFileName.c_str(), ios::binary);
+    stateFile.read((char*) &record, sizeof(record));
+    return stateFile.gcount() == (streamsize) sizeof(record) && record.magic == FPGA_STATE_MAGIC &&
+            record.recordVersion == FPGA_STATE_VERSION && record.bitfileHash != 0;
+}
+
+// Rewrite the state file from fpgaState, with the wire-ins marked unknown unless wireInsKnown.  The
+// file is kept open, and only flushed to the operating system, so the record survives the program
+// crashing.  (Private method; okMutex must be held.)
+void Rhd2000EvalBoardUsb3::writeFpgaState(bool wireInsKnown)
+{
+    if (fpgaStateFileName.empty()) {
+        return;
+    }
+    if (!fpgaStateFile.is_open()) {
+        fpgaStateFile.open(fpgaStateFileName.c_str(), ios::in | ios::out | ios::binary | ios::trunc);
+    }
+
+    fpgaState.magic = FPGA_STATE_MAGIC;
+    fpgaState.recordVersion = FPGA_STATE_VERSION;
+    FpgaStateRecord record = fpgaState;
+    record.wireInsKnown = (fpgaState.wireInsKnown && wireInsKnown) ? 1 : 0;
+    fpgaStateFileKnown = (record.wireInsKnown != 0);
+    fpgaStateFile.seekp(0);
+    fpgaStateFile.write((const char*) &record, sizeof(record));
+    fpgaStateFile.flush();
+    if (!fpgaStateFile.good()) {
+        cerr << "Error in Rhd2000EvalBoardUsb3::writeFpgaState: cannot write " << fpgaStateFileName <<
+                "; fast start records turned off." << endl;
+        fpgaStateFile.close();
+        fpgaStateFileName.clear();
+    }
+}
+
+// Record the wire-in values the FPGA holds, if the state file does not already.  (Private method;
+// okMutex must be held.)
+void Rhd2000EvalBoardUsb3::saveFpgaState()
+{
+    if (fpgaState.wireInsKnown && !fpgaStateFileKnown) {
+        writeFpgaState();
+    }
+}
+
+// Send the wire-in values set so far to the FPGA, or, inside a wire-in batch, leave them for the
+// end of the batch.  (Private method; okMutex must be held.)
+void Rhd2000EvalBoardUsb3::updateWireIns()
+{
+    wireInStats.numUpdatesRequested++;
+    if (wireInBatchDepth > 0) {
+        wireInStats.numUpdatesDeferred++;
+        wireInsPending = true;
+        return;
+    }
+    sendWireIns();
+}
+
+// Send the wire-in values now, even inside a batch, for values that must reach the FPGA before the
+// next change to the same wire (pulses) or before wire-outs are read.  (Private method; okMutex
+// must be held.)
+void Rhd2000EvalBoardUsb3::updateWireInsNow()
+{
+    wireInStats.numUpdatesRequested++;
+    sendWireIns();
+}
+
+// Fire a trigger-in, first sending any wire-in values a batch is holding back, since triggers act
+// on them.  (Private method; okMutex must be held.)
+void Rhd2000EvalBoardUsb3::activateTriggerIn(int endPoint, int bit)
+{
+    if (wireInsPending) {
+        sendWireIns();
+    }
+    dev->ActivateTriggerIn(endPoint, bit);
+}
+
+// Send the wire-in values to the FPGA, unless it is known to hold them already (an update always
+// sends all of them).  The first update after the state file was saved marks the values unknown
+// there, so a crash before the next save cannot leave a stale record; later updates touch only
+// memory.  (Private method; okMutex must be held.)
+void Rhd2000EvalBoardUsb3::sendWireIns()
+{
+    wireInsPending = false;
+    unsigned int wireIns[NUM_WIRE_INS];
+    for (int i = 0; i < NUM_WIRE_INS; ++i) {
+        dev->GetWireInValue(i, &wireIns[i]);
+    }
+    if (fpgaState.wireInsKnown) {
+        if (memcmp(wireIns, fpgaState.wireIns, sizeof(wireIns)) == 0) {
+            return;
+        }
+    }
+    if (fpgaStateFileKnown) {
+        writeFpgaState(false);
+    }
+
+    dev->UpdateWireIns();
+    wireInStats.numUpdatesSent++;
+    memcpy(fpgaState.wireIns, wireIns, sizeof(wireIns));
+    fpgaState.wireInsKnown = 1;
+}
+
 // Initialize Rhythm FPGA to default starting values.
 void Rhd2000EvalBoardUsb3::initialize()
 {
+    WireInBatch batch(*this);
     int i;
 
     resetBoard();
@@ -233,7 +507,11 @@ void Rhd2000EvalBoardUsb3::initialize()
 
     // Must first force all data streams off
     dev->SetWireInValue(WireInDataStreamEn, 0x00000000);
-    dev->UpdateWireIns();
+    updateWireIns();
+    for (i = 0; i < MAX_NUM_DATA_STREAMS; i++) {
+        dataStreamEnabled[i] = 0;
+    }
+    numDataStreams = 0;
 
     enableDataStream(0, true);        // start with only one data stream enabled
     for (i = 1; i < MAX_NUM_DATA_STREAMS; i++) {
@@ -446,8 +724,8 @@ bool Rhd2000EvalBoardUsb3::setSampleRate(AmplifierSampleRate newSampleRate)
 
     // Reprogram clock synthesizer
     dev->SetWireInValue(WireInDataFreqPll, (256 * M + D));
-    dev->UpdateWireIns();
-    dev->ActivateTriggerIn(TrigInConfig, 0);
+    updateWireIns();
+    activateTriggerIn(TrigInConfig, 0);
 
     // Wait for DataClkLocked = 1 before allowing data acquisition to continue
     while (isDataClockLocked() == false) {}
@@ -558,6 +836,12 @@ void Rhd2000EvalBoardUsb3::printCommandList(const vector<int> &commandList) cons
 
 // Upload an auxiliary command list to a particular command slot (AuxCmd1, AuxCmd2, or AuxCmd3) and RAM bank (0-15)
 // on the FPGA.
+//
+// Only commands that differ from what the bank is known to hold are sent, so uploading a list the
+// bank already holds costs no USB traffic, and a list that differs in a few commands (e.g. the
+// channel selected for an impedance check) costs only those.  Each command sent takes two USB
+// round trips through the wire-ins, or all of them go in one pipe transfer if setCommandRamPipe()
+// is on.
 void Rhd2000EvalBoardUsb3::uploadCommandList(const vector<int> &commandList, AuxCmdSlot auxCommandSlot, int bank)
 {
     lock_guard<mutex> lockOk(okMutex);
@@ -573,25 +857,178 @@ void Rhd2000EvalBoardUsb3::uploadCommandList(const vector<int> &commandList, Aux
         return;
     }
 
+    if (commandList.size() > COMMAND_RAM_WORDS) {
+        cerr << "Error in Rhd2000EvalBoardUsb3::uploadCommandList: command list longer than " << COMMAND_RAM_WORDS <<
+                " commands." << endl;
+        return;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    const int slot = (auxCommandSlot == AuxCmd1) ? 1 : ((auxCommandSlot == AuxCmd2) ? 2 : 3);
+    vector<int> &cached = commandRamCache[slot - 1][bank];
+
+    vector<int> addresses;
     for (i = 0; i < commandList.size(); ++i) {
-        dev->SetWireInValue(WireInCmdRamData, commandList[i]);
-        dev->SetWireInValue(WireInCmdRamAddr, i);
+        if (i >= cached.size() || cached[i] != commandList[i]) {
+            addresses.push_back(i);
+        }
+    }
+
+    if (!addresses.empty() && !(commandRamPipe && writeCommandRamPipe(commandList, addresses, slot, bank))) {
         dev->SetWireInValue(WireInCmdRamBank, bank);
-        dev->UpdateWireIns();
-        switch (auxCommandSlot) {
-            case AuxCmd1:
-                dev->ActivateTriggerIn(TrigInConfig, 1);
-                break;
-            case AuxCmd2:
-                dev->ActivateTriggerIn(TrigInConfig, 2);
-                break;
-            case AuxCmd3:
-                dev->ActivateTriggerIn(TrigInConfig, 3);
-                break;
+        for (i = 0; i < addresses.size(); ++i) {
+            dev->SetWireInValue(WireInCmdRamData, commandList[addresses[i]]);
+            dev->SetWireInValue(WireInCmdRamAddr, addresses[i]);
+            updateWireIns();
+            activateTriggerIn(TrigInConfig, slot);
+        }
+        commandUploadStats.numTransactions += 2 * addresses.size();
+    }
+
+    if (cached.size() < commandList.size()) {
+        cached.resize(commandList.size());
+    }
+    copy(commandList.begin(), commandList.end(), cached.begin());
+
+    double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    commandUploadStats.numUploads++;
+    if (addresses.empty()) {
+        commandUploadStats.numUploadsSkipped++;
+    }
+    commandUploadStats.numWordsWritten += addresses.size();
+    commandUploadStats.numWordsSkipped += commandList.size() - addresses.size();
+    commandUploadStats.totalMs += elapsedMs;
+    commandUploadStats.bankMs[slot - 1][bank] = elapsedMs;
+}
+
+// Write the commands at addresses in commandList to the command RAM in a single pipe transfer.
+// Returns false if the FPGA configuration has no command RAM pipe, after which uploads go through
+// the wire-ins.
+bool Rhd2000EvalBoardUsb3::writeCommandRamPipe(const vector<int> &commandList, const vector<int> &addresses,
+                                               int slot, int bank)
+{
+    // One 32-bit word per command: slot, bank, address and command.  Zero words (slot 0) pad the
+    // transfer to whole USB blocks and are ignored by the FPGA.
+    unsigned int numBytes = 4 * (unsigned int) addresses.size();
+    numBytes = ((numBytes + USB3_BLOCK_SIZE - 1) / USB3_BLOCK_SIZE) * USB3_BLOCK_SIZE;
+    commandRamPipeBuffer.assign(numBytes, 0);
+    for (unsigned int i = 0; i < addresses.size(); ++i) {
+        unsigned int word = ((unsigned int) slot << 30) | ((unsigned int) bank << 26) |
+                ((unsigned int) addresses[i] << 16) | (commandList[addresses[i]] & 0xffff);
+        commandRamPipeBuffer[4 * i] = word & 0xff;
+        commandRamPipeBuffer[4 * i + 1] = (word >> 8) & 0xff;
+        commandRamPipeBuffer[4 * i + 2] = (word >> 16) & 0xff;
+        commandRamPipeBuffer[4 * i + 3] = (word >> 24) & 0xff;
+    }
+
+    long result = dev->WriteToBlockPipeIn(PipeInCmdRam, USB3_BLOCK_SIZE, numBytes, commandRamPipeBuffer.data());
+    commandUploadStats.numTransactions++;
+    if (result != (long) numBytes) {
+        cerr << "Error in Rhd2000EvalBoardUsb3::uploadCommandList: command RAM pipe write failed (" << result <<
+                "); using wire-ins from now on." << endl;
+        commandRamPipe = false;
+        return false;
+    }
+    return true;
+}
+
+// Upload command lists in bulk through pipe-in PipeInCmdRam.  This needs an FPGA configuration
+// with a command RAM pipe; if the first write fails, uploads fall back to the wire-ins.
+void Rhd2000EvalBoardUsb3::setCommandRamPipe(bool enabled)
+{
+    lock_guard<mutex> lockOk(okMutex);
+    commandRamPipe = enabled;
+}
+
+// Forget what the command RAM is known to hold, so that the next upload to each bank writes every
+// command.  Call if anything other than this object may have written to the command RAM.
+void Rhd2000EvalBoardUsb3::invalidateCommandRamCache()
+{
+    lock_guard<mutex> lockOk(okMutex);
+    clearCommandRamCache();
+}
+
+void Rhd2000EvalBoardUsb3::clearCommandRamCache()
+{
+    for (int slot = 0; slot < NUM_AUX_CMD_SLOTS; ++slot) {
+        for (int bank = 0; bank < NUM_COMMAND_BANKS; ++bank) {
+            commandRamCache[slot][bank].clear();
+        }
+    }
+}
+
+// Return command RAM upload counters accumulated since the last call to resetCommandUploadStats().
+void Rhd2000EvalBoardUsb3::getCommandUploadStats(CommandUploadStats &stats)
+{
+    lock_guard<mutex> lockOk(okMutex);
+    stats = commandUploadStats;
+}
+
+void Rhd2000EvalBoardUsb3::resetCommandUploadStats()
+{
+    lock_guard<mutex> lockOk(okMutex);
+    memset(&commandUploadStats, 0, sizeof(commandUploadStats));
+}
+
+// Start a wire-in batch.  Batches nest; wire-in values are held back until the outermost one ends.
+// Anything that acts on the wire-ins (triggers, including run()) sends them first, so a batch
+// changes how many transfers are made, not what the FPGA sees at each step.
+void Rhd2000EvalBoardUsb3::beginWireInBatch()
+{
+    lock_guard<mutex> lockOk(okMutex);
+    wireInBatchDepth++;
+}
+
+// End a wire-in batch, sending the held-back values if this was the outermost one.
+void Rhd2000EvalBoardUsb3::endWireInBatch()
+{
+    lock_guard<mutex> lockOk(okMutex);
+    if (wireInBatchDepth == 0) {
+        cerr << "Error in Rhd2000EvalBoardUsb3::endWireInBatch: no wire-in batch to end." << endl;
+        return;
+    }
+    if (--wireInBatchDepth == 0) {
+        if (wireInsPending) {
+            sendWireIns();
         }
+        saveFpgaState();
+    }
+}
+
+// Send any held-back wire-in values now, e.g. before reading data inside a batch.  The batch stays open.
+void Rhd2000EvalBoardUsb3::commitWireIns()
+{
+    lock_guard<mutex> lockOk(okMutex);
+    if (wireInsPending) {
+        sendWireIns();
     }
 }
 
+Rhd2000EvalBoardUsb3::WireInBatch::WireInBatch(Rhd2000EvalBoardUsb3 &board_) :
+    board(board_)
+{
+    board.beginWireInBatch();
+}
+
+Rhd2000EvalBoardUsb3::WireInBatch::~WireInBatch()
+{
+    board.endWireInBatch();
+}
+
+// Return wire-in update counters accumulated since the last call to resetWireInStats().
+void Rhd2000EvalBoardUsb3::getWireInStats(WireInStats &stats)
+{
+    lock_guard<mutex> lockOk(okMutex);
+    stats = wireInStats;
+    stats.numTransfersSaved = wireInStats.numUpdatesRequested - wireInStats.numUpdatesSent;
+}
+
+void Rhd2000EvalBoardUsb3::resetWireInStats()
+{
+    lock_guard<mutex> lockOk(okMutex);
+    memset(&wireInStats, 0, sizeof(wireInStats));
+}
+
 // Select an auxiliary command slot (AuxCmd1, AuxCmd2, or AuxCmd3) and bank (0-15) for a particular SPI port
 // (PortA - PortH) on the FPGA.
 void Rhd2000EvalBoardUsb3::selectAuxCommandBank(BoardPort port, AuxCmdSlot auxCommandSlot, int bank)
@@ -646,7 +1083,7 @@ void Rhd2000EvalBoardUsb3::selectAuxCommandBank(BoardPort port, AuxCmdSlot auxCo
         dev->SetWireInValue(WireInAuxCmdBank3, bank << bitShift, 0x0000000f << bitShift);
         break;
     }
-    dev->UpdateWireIns();
+    updateWireIns();
 }
 
 // Specify a command sequence length (endIndex = 0-1023) and command loop index (0-1023) for a particular
@@ -683,7 +1120,7 @@ void Rhd2000EvalBoardUsb3::selectAuxCommandLength(AuxCmdSlot auxCommandSlot, int
         dev->SetWireInValue(WireInAuxCmdLength, endIndex << 20, 0x000003ff << 20);
         break;
     }
-    dev->UpdateWireIns();
+    updateWireIns();
 }
 
 // Reset FPGA.  This clears all auxiliary command RAM banks, clears the USB FIFO, and resets the
@@ -693,17 +1130,18 @@ void Rhd2000EvalBoardUsb3::resetBoard()
     lock_guard<mutex> lockOk(okMutex);
 
     dev->SetWireInValue(WireInResetRun, 0x01, 0x01);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInResetRun, 0x00, 0x01);
-    dev->UpdateWireIns();
+    updateWireInsNow();
+    clearCommandRamCache();
 
     // Set up USB3 block transfer parameters.
     dev->SetWireInValue(WireInMultiUse, USB3_BLOCK_SIZE / 4);  // Divide by 4 to convert from bytes to 32-bit words (used in FPGA FIFO)
-    dev->UpdateWireIns();
-    dev->ActivateTriggerIn(TrigInConfig, 9);
+    updateWireIns();
+    activateTriggerIn(TrigInConfig, 9);
     dev->SetWireInValue(WireInMultiUse, RAM_BURST_SIZE);
-    dev->UpdateWireIns();
-    dev->ActivateTriggerIn(TrigInConfig, 10);
+    updateWireIns();
+    activateTriggerIn(TrigInConfig, 10);
 }
 
 // Low-level FPGA reset.  Call when closing application to make sure everything has stopped.
@@ -712,6 +1150,8 @@ void Rhd2000EvalBoardUsb3::resetFpga()
     lock_guard<mutex> lockOk(okMutex);
 
     dev->ResetFPGA();
+    fpgaState.wireInsKnown = 0;
+    writeFpgaState();
 }
 
 // Set the FPGA to run continuously once started (if continuousMode == true) or to run until
@@ -725,7 +1165,7 @@ void Rhd2000EvalBoardUsb3::setContinuousRunMode(bool continuousMode)
     } else {
         dev->SetWireInValue(WireInResetRun, 0x00, 0x02);
     }
-    dev->UpdateWireIns();
+    updateWireIns();
 }
 
 // Set maxTimeStep for cases where continuousMode == false.
@@ -734,7 +1174,7 @@ void Rhd2000EvalBoardUsb3::setMaxTimeStep(unsigned int maxTimeStep)
     lock_guard<mutex> lockOk(okMutex);
 
     dev->SetWireInValue(WireInMaxTimeStep, maxTimeStep);
-    dev->UpdateWireIns();
+    updateWireIns();
 }
 
 // Initiate SPI data acquisition.
@@ -742,7 +1182,14 @@ void Rhd2000EvalBoardUsb3::run()
 {
     lock_guard<mutex> lockOk(okMutex);
 
-    dev->ActivateTriggerIn(TrigInSpiStart, 0);
+    // Wire-ins set during acquisition are saved by flush(); until then the state file must not vouch
+    // for them, and marking them unknown now keeps file I/O out of acquisition.
+    if (fpgaStateFileKnown) {
+        writeFpgaState(false);
+    }
+
+    timeStampMonitor.restart();
+    activateTriggerIn(TrigInSpiStart, 0);
 }
 
 // Is the FPGA currently running?
@@ -769,6 +1216,7 @@ unsigned int Rhd2000EvalBoardUsb3::numWordsInFifo()
     dev->UpdateWireOuts();
     lastNumWordsInFifo = dev->GetWireOutValue(WireOutNumWords);
     numWordsHasBeenUpdated = true;
+    usbReadStats.numFifoQueries++;
     return lastNumWordsInFifo;
 }
 
@@ -864,7 +1312,7 @@ void Rhd2000EvalBoardUsb3::setCableDelay(BoardPort port, int delay)
     }
 
     dev->SetWireInValue(WireInMisoDelay, delay << bitShift, 0x0000000f << bitShift);
-    dev->UpdateWireIns();
+    updateWireIns();
 }
 
 // Set the delay for sampling the MISO line on a particular SPI port (PortA - PortH) based on the length
@@ -934,7 +1382,7 @@ void Rhd2000EvalBoardUsb3::setDspSettle(bool enabled)
     lock_guard<mutex> lockOk(okMutex);
 
     dev->SetWireInValue(WireInResetRun, (enabled ? 0x04 : 0x00), 0x04);
-    dev->UpdateWireIns();
+    updateWireIns();
 }
 
 // Enable or disable one of the 32 available USB data streams (0-31).
@@ -950,16 +1398,18 @@ void Rhd2000EvalBoardUsb3::enableDataStream(int stream, bool enabled)
     if (enabled) {
         if (dataStreamEnabled[stream] == 0) {
             dev->SetWireInValue(WireInDataStreamEn, 0x00000001 << stream, 0x00000001 << stream);
-            dev->UpdateWireIns();
+            updateWireIns();
             dataStreamEnabled[stream] = 1;
             numDataStreams++;
+            resetUsbStream();
         }
     } else {
         if (dataStreamEnabled[stream] == 1) {
             dev->SetWireInValue(WireInDataStreamEn, 0x00000000 << stream, 0x00000001 << stream);
-            dev->UpdateWireIns();
+            updateWireIns();
             dataStreamEnabled[stream] = 0;
             numDataStreams--;
+            resetUsbStream();
         }
     }
 }
@@ -970,13 +1420,26 @@ int Rhd2000EvalBoardUsb3::getNumEnabledDataStreams() const
     return numDataStreams;
 }
 
+// Returns a mask with bit n set if data stream n is enabled.  Enabled streams appear in data blocks
+// in ascending order of n.
+unsigned int Rhd2000EvalBoardUsb3::getEnabledDataStreamMask() const
+{
+    unsigned int mask = 0;
+    for (int stream = 0; stream < MAX_NUM_DATA_STREAMS; ++stream) {
+        if (dataStreamEnabled[stream]) {
+            mask |= 1u << stream;
+        }
+    }
+    return mask;
+}
+
 // Set all 16 bits of the digital TTL output lines on the FPGA to zero.
 void Rhd2000EvalBoardUsb3::clearTtlOut()
 {
     lock_guard<mutex> lockOk(okMutex);
 
     dev->SetWireInValue(WireInTtlOut, 0x0000);
-    dev->UpdateWireIns();
+    updateWireIns();
 }
 
 // Set the 16 bits of the digital TTL output lines on the FPGA high or low according to integer array.
@@ -991,7 +1454,7 @@ void Rhd2000EvalBoardUsb3::setTtlOut(int ttlOutArray[])
             ttlOut += 1 << i;
     }
     dev->SetWireInValue(WireInTtlOut, ttlOut);
-    dev->UpdateWireIns();
+    updateWireIns();
 }
 
 // Read the 16 bits of the digital TTL input lines on the FPGA into an integer array.
@@ -1020,7 +1483,7 @@ void Rhd2000EvalBoardUsb3::setDacManual(int value)
     }
 
     dev->SetWireInValue(WireInDacManual, value);
-    dev->UpdateWireIns();
+    updateWireIns();
 }
 
 // Set the eight red LEDs on the Opal Kelly XEM6310 board according to integer array.
@@ -1035,7 +1498,7 @@ void Rhd2000EvalBoardUsb3::setLedDisplay(int ledArray[])
             ledOut += 1 << i;
     }
     dev->SetWireInValue(WireInLedDisplay, ledOut);
-    dev->UpdateWireIns();
+    updateWireIns();
 }
 
 // Set the eight red LEDs on the front panel SPI ports according to integer array.
@@ -1050,8 +1513,8 @@ void Rhd2000EvalBoardUsb3::setSpiLedDisplay(int ledArray[])
             ledOut += 1 << i;
     }
     dev->SetWireInValue(WireInMultiUse, ledOut);
-    dev->UpdateWireIns();
-    dev->ActivateTriggerIn(TrigInConfig, 8);
+    updateWireIns();
+    activateTriggerIn(TrigInConfig, 8);
 }
 
 // Enable or disable DAC channel (0-7)
@@ -1089,7 +1552,7 @@ void Rhd2000EvalBoardUsb3::enableDac(int dacChannel, bool enabled)
         dev->SetWireInValue(WireInDacSource8, (enabled ? 0x0800 : 0x0000), 0x0800);
         break;
     }
-    dev->UpdateWireIns();
+    updateWireIns();
 }
 
 // Set the gain level of all eight DAC channels to 2^gain (gain = 0-7).
@@ -1102,7 +1565,7 @@ void Rhd2000EvalBoardUsb3::setDacGain(int gain)
     }
 
     dev->SetWireInValue(WireInResetRun, gain << 13, 0xe000);
-    dev->UpdateWireIns();
+    updateWireIns();
 }
 
 // Suppress the noise on DAC channels 0 and 1 (the audio channels) between
@@ -1117,7 +1580,7 @@ void Rhd2000EvalBoardUsb3::setAudioNoiseSuppress(int noiseSuppress)
     }
 
     dev->SetWireInValue(WireInResetRun, noiseSuppress << 6, 0x1fc0);
-    dev->UpdateWireIns();
+    updateWireIns();
 }
 
 // Assign a particular data stream (0-31) to a DAC channel (0-7).  Setting stream
@@ -1162,7 +1625,7 @@ void Rhd2000EvalBoardUsb3::selectDacDataStream(int dacChannel, int stream)
         dev->SetWireInValue(WireInDacSource8, stream << 5, 0x07e0);
         break;
     }
-    dev->UpdateWireIns();
+    updateWireIns();
 }
 
 // Assign a particular amplifier channel (0-31) to a DAC channel (0-7).
@@ -1206,7 +1669,7 @@ void Rhd2000EvalBoardUsb3::selectDacDataChannel(int dacChannel, int dataChannel)
         dev->SetWireInValue(WireInDacSource8, dataChannel << 0, 0x001f);
         break;
     }
-    dev->UpdateWireIns();
+    updateWireIns();
 }
 
 // Enable external triggering of amplifier hardware 'fast settle' function (blanking).
@@ -1217,8 +1680,8 @@ void Rhd2000EvalBoardUsb3::enableExternalFastSettle(bool enable)
     lock_guard<mutex> lockOk(okMutex);
 
     dev->SetWireInValue(WireInMultiUse, enable ? 1 : 0);
-    dev->UpdateWireIns();
-    dev->ActivateTriggerIn(TrigInConfig, 6);
+    updateWireIns();
+    activateTriggerIn(TrigInConfig, 6);
 }
 
 // Select which of the TTL inputs 0-15 is used to perform a hardware 'fast settle' (blanking)
@@ -1233,8 +1696,8 @@ void Rhd2000EvalBoardUsb3::setExternalFastSettleChannel(int channel)
     }
 
     dev->SetWireInValue(WireInMultiUse, channel);
-    dev->UpdateWireIns();
-    dev->ActivateTriggerIn(TrigInConfig, 7);
+    updateWireIns();
+    activateTriggerIn(TrigInConfig, 7);
 }
 
 // Enable external control of RHD2000 auxiliary digital output pin (auxout).
@@ -1245,32 +1708,32 @@ void Rhd2000EvalBoardUsb3::enableExternalDigOut(BoardPort port, bool enable)
     lock_guard<mutex> lockOk(okMutex);
 
     dev->SetWireInValue(WireInMultiUse, enable ? 1 : 0);
-    dev->UpdateWireIns();
+    updateWireIns();
 
     switch (port) {
     case PortA:
-        dev->ActivateTriggerIn(TrigInDacConfig, 16);
+        activateTriggerIn(TrigInDacConfig, 16);
         break;
     case PortB:
-        dev->ActivateTriggerIn(TrigInDacConfig, 17);
+        activateTriggerIn(TrigInDacConfig, 17);
         break;
     case PortC:
-        dev->ActivateTriggerIn(TrigInDacConfig, 18);
+        activateTriggerIn(TrigInDacConfig, 18);
         break;
     case PortD:
-        dev->ActivateTriggerIn(TrigInDacConfig, 19);
+        activateTriggerIn(TrigInDacConfig, 19);
         break;
     case PortE:
-        dev->ActivateTriggerIn(TrigInDacConfig, 20);
+        activateTriggerIn(TrigInDacConfig, 20);
         break;
     case PortF:
-        dev->ActivateTriggerIn(TrigInDacConfig, 21);
+        activateTriggerIn(TrigInDacConfig, 21);
         break;
     case PortG:
-        dev->ActivateTriggerIn(TrigInDacConfig, 22);
+        activateTriggerIn(TrigInDacConfig, 22);
         break;
     case PortH:
-        dev->ActivateTriggerIn(TrigInDacConfig, 23);
+        activateTriggerIn(TrigInDacConfig, 23);
         break;
     default:
         cerr << "Error in Rhd2000EvalBoardUsb3::enableExternalDigOut: port out of range." << endl;
@@ -1289,32 +1752,32 @@ void Rhd2000EvalBoardUsb3::setExternalDigOutChannel(BoardPort port, int channel)
     }
 
     dev->SetWireInValue(WireInMultiUse, channel);
-    dev->UpdateWireIns();
+    updateWireIns();
 
     switch (port) {
     case PortA:
-        dev->ActivateTriggerIn(TrigInDacConfig, 24);
+        activateTriggerIn(TrigInDacConfig, 24);
         break;
     case PortB:
-        dev->ActivateTriggerIn(TrigInDacConfig, 25);
+        activateTriggerIn(TrigInDacConfig, 25);
         break;
     case PortC:
-        dev->ActivateTriggerIn(TrigInDacConfig, 26);
+        activateTriggerIn(TrigInDacConfig, 26);
         break;
     case PortD:
-        dev->ActivateTriggerIn(TrigInDacConfig, 27);
+        activateTriggerIn(TrigInDacConfig, 27);
         break;
     case PortE:
-        dev->ActivateTriggerIn(TrigInDacConfig, 28);
+        activateTriggerIn(TrigInDacConfig, 28);
         break;
     case PortF:
-        dev->ActivateTriggerIn(TrigInDacConfig, 29);
+        activateTriggerIn(TrigInDacConfig, 29);
         break;
     case PortG:
-        dev->ActivateTriggerIn(TrigInDacConfig, 30);
+        activateTriggerIn(TrigInDacConfig, 30);
         break;
     case PortH:
-        dev->ActivateTriggerIn(TrigInDacConfig, 31);
+        activateTriggerIn(TrigInDacConfig, 31);
         break;
     default:
         cerr << "Error in Rhd2000EvalBoardUsb3::setExternalDigOutChannel: port out of range." << endl;
@@ -1331,8 +1794,8 @@ void Rhd2000EvalBoardUsb3::enableDacHighpassFilter(bool enable)
     lock_guard<mutex> lockOk(okMutex);
 
     dev->SetWireInValue(WireInMultiUse, enable ? 1 : 0);
-    dev->UpdateWireIns();
-    dev->ActivateTriggerIn(TrigInConfig, 4);
+    updateWireIns();
+    activateTriggerIn(TrigInConfig, 4);
 }
 
 // Set cutoff frequency (in Hz) for optional FPGA-implemented digital high-pass filters
@@ -1362,8 +1825,8 @@ void Rhd2000EvalBoardUsb3::setDacHighpassFilter(double cutoff)
     }
 
     dev->SetWireInValue(WireInMultiUse, filterCoefficient);
-    dev->UpdateWireIns();
-    dev->ActivateTriggerIn(TrigInConfig, 5);
+    updateWireIns();
+    activateTriggerIn(TrigInConfig, 5);
 }
 
 // Set thresholds for DAC channels; threshold output signals appear on TTL outputs 0-7.
@@ -1387,13 +1850,13 @@ void Rhd2000EvalBoardUsb3::setDacThreshold(int dacChannel, int threshold, bool t
 
     // Set threshold level.
     dev->SetWireInValue(WireInMultiUse, threshold);
-    dev->UpdateWireIns();
-    dev->ActivateTriggerIn(TrigInDacConfig, dacChannel);
+    updateWireIns();
+    activateTriggerIn(TrigInDacConfig, dacChannel);
 
     // Set threshold polarity.
     dev->SetWireInValue(WireInMultiUse, (trigPolarity ? 1 : 0));
-    dev->UpdateWireIns();
-    dev->ActivateTriggerIn(TrigInDacConfig, dacChannel + 8);
+    updateWireIns();
+    activateTriggerIn(TrigInDacConfig, dacChannel + 8);
 }
 
 // Set the TTL output mode of the board.
@@ -1410,7 +1873,7 @@ void Rhd2000EvalBoardUsb3::setTtlMode(int mode)
     }
 
     dev->SetWireInValue(WireInResetRun, mode << 3, 0x0008);
-    dev->UpdateWireIns();
+    updateWireIns();
 }
 
 // Is variable-frequency clock DCM programming done?
@@ -1442,7 +1905,7 @@ void Rhd2000EvalBoardUsb3::flush()
     lock_guard<mutex> lockOk(okMutex);
 
     dev->SetWireInValue(WireInResetRun, 1 << 16, 1 << 16); // override pipeout block throttle
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     while (numWordsInFifo() >= usbBufferSize / 2) {
         dev->ReadFromBlockPipeOut(PipeOutData, USB3_BLOCK_SIZE, usbBufferSize, usbBuffer);
@@ -1450,9 +1913,13 @@ void Rhd2000EvalBoardUsb3::flush()
     while (numWordsInFifo() > 0) {
         dev->ReadFromBlockPipeOut(PipeOutData, USB3_BLOCK_SIZE, USB3_BLOCK_SIZE * max(2 * numWordsInFifo() / USB3_BLOCK_SIZE, (unsigned int)1), usbBuffer);
     }
+    resetUsbStream();
 
     dev->SetWireInValue(WireInResetRun, 0 << 16, 1 << 16);
-    dev->UpdateWireIns();
+    updateWireIns();
+    if (wireInBatchDepth == 0) {
+        saveFpgaState();
+    }
 }
 
 // Read data block from the USB interface, if one is available.  Returns true if data block
@@ -1461,26 +1928,11 @@ bool Rhd2000EvalBoardUsb3::readDataBlock(Rhd2000DataBlockUsb3 *dataBlock)
 {
     lock_guard<mutex> lockOk(okMutex);
 
-    unsigned int numBytesToRead;
-    long result;
-
-    numBytesToRead = 2 * dataBlock->calculateDataBlockSizeInWords(numDataStreams);
-
-    if (numBytesToRead > usbBufferSize) {
-        cerr << "Error in Rhd2000EvalBoardUsb3::readDataBlock: USB buffer size exceeded.  " <<
-                "Increase value of MAX_NUM_BLOCKS." << endl;
+    // A transfer that had to be realigned may not leave a whole block.
+    if (transferUsbBlocks(1) == 0)
         return false;
-    }
-
-    result = dev->ReadFromBlockPipeOut(PipeOutData, USB3_BLOCK_SIZE, USB3_BLOCK_SIZE * max(numBytesToRead / USB3_BLOCK_SIZE, (unsigned int)1), usbBuffer);
-
-    if (result == ok_Failed) {
-        cerr << "CRITICAL (readDataBlock): Failure on pipe read.  Check block and buffer sizes." << endl;
-    } else if (result == ok_Timeout) {
-        cerr << "CRITICAL (readDataBlock): Timeout on pipe read.  Check block and buffer sizes." << endl;
-    }
 
-    dataBlock->fillFromUsbBuffer(usbBuffer, 0, numDataStreams);
+    decodeUsbBlock(*dataBlock, 0);
 
     return true;
 }
@@ -1507,31 +1959,59 @@ long Rhd2000EvalBoardUsb3::readDataBlocksRaw(int numBlocks, unsigned char* buffe
     return result;
 }
 
-// Reads a certain number of USB data blocks, if the specified number is available, and appends them
-// to queue.  Returns true if data blocks were available.
-bool Rhd2000EvalBoardUsb3::readDataBlocks(int numBlocks, queue<Rhd2000DataBlockUsb3> &dataQueue)
+// Reads a certain number of USB data blocks into usbBuffer, if the specified number is available.
+// Returns the number of whole blocks ready to decode (see transferUsbBlocks()), or 0 if the data
+// blocks were not available.  (Private method; okMutex must be held.)
+int Rhd2000EvalBoardUsb3::readUsbBlocks(int numBlocks)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    if (numWordsInFifo() < numBlocks * Rhd2000DataBlockUsb3::calculateDataBlockSizeInWords(numDataStreams))
+        return 0;
 
-    unsigned int numWordsToRead, numBytesToRead;
-    int j;
-    Rhd2000DataBlockUsb3 *dataBlock;
-    long result;
+    return transferUsbBlocks(numBlocks);
+}
 
-    numWordsToRead = numBlocks * dataBlock->calculateDataBlockSizeInWords(numDataStreams);
+// Queries the FIFO level once and returns the number of whole data blocks to read in a single
+// transaction: everything waiting, up to maxBlocks and the capacity of usbBuffer.  Returns 0 if
+// less than one block is available.  (Private method; okMutex must be held.)
+int Rhd2000EvalBoardUsb3::numUsbBlocksToRead(int maxBlocks)
+{
+    unsigned int blockSizeInWords = Rhd2000DataBlockUsb3::calculateDataBlockSizeInWords(numDataStreams);
+    int numBlocks = numWordsInFifo() / blockSizeInWords;
+    int bufferBlocks = usbBufferSize / (2 * blockSizeInWords);
 
-    if (numWordsInFifo() < numWordsToRead)
-        return false;
+    if (numBlocks > maxBlocks) numBlocks = maxBlocks;
+    if (numBlocks > bufferBlocks) numBlocks = bufferBlocks;
+    if (numBlocks > MAX_NUM_BLOCKS) numBlocks = MAX_NUM_BLOCKS;
+    return numBlocks;
+}
 
-    numBytesToRead = 2 * numWordsToRead;
+// Reads numBlocks data blocks into usbBuffer in one pipe transaction without checking the FIFO
+// level first.  Returns the number of whole blocks now at the start of usbBuffer, which is
+// numBlocks unless the stream had to be realigned (see realignUsbBuffer()).  (Private method;
+// okMutex must be held.)
+int Rhd2000EvalBoardUsb3::transferUsbBlocks(int numBlocks)
+{
+    unsigned int numBytesToRead, blockSizeInBytes;
+    long result;
+
+    blockSizeInBytes = 2 * Rhd2000DataBlockUsb3::calculateDataBlockSizeInWords(numDataStreams);
+    numBytesToRead = numBlocks * blockSizeInBytes;
 
     if (numBytesToRead > usbBufferSize) {
         cerr << "Error in Rhd2000EvalBoardUsb3::readDataBlocks: USB buffer size exceeded.  " <<
                 "Increase value of MAX_NUM_BLOCKS." << endl;
-        return false;
+        return 0;
+    }
+
+    // Bytes left over from a realigned transfer come first.
+    if (usbCarryBytes > 0 && usbCarryOffset > 0) {
+        memmove(usbBuffer, usbBuffer + usbCarryOffset, usbCarryBytes);
     }
+    unsigned int numCarryBytes = usbCarryBytes;
+    usbCarryOffset = 0;
+    usbCarryBytes = 0;
 
-    result = dev->ReadFromBlockPipeOut(PipeOutData, USB3_BLOCK_SIZE, numBytesToRead, usbBuffer);
+    result = dev->ReadFromBlockPipeOut(PipeOutData, USB3_BLOCK_SIZE, numBytesToRead, usbBuffer + numCarryBytes);
 
     if (result == ok_Failed) {
         cerr << "CRITICAL (readDataBlocks): Failure on pipe read.  Check block and buffer sizes." << endl;
@@ -1539,32 +2019,474 @@ bool Rhd2000EvalBoardUsb3::readDataBlocks(int numBlocks, queue<Rhd2000DataBlockU
         cerr << "CRITICAL (readDataBlocks): Timeout on pipe read.  Check block and buffer sizes." << endl;
     }
 
-    dataBlock = new Rhd2000DataBlockUsb3(numDataStreams);
+    usbReadStats.numTransactions++;
+    usbReadStats.numBlocks += numBlocks;
+    usbReadStats.numBytes += numBytesToRead;
+    if (numBlocks > usbReadStats.maxBlocksPerTransaction) {
+        usbReadStats.maxBlocksPerTransaction = numBlocks;
+    }
+
+    // Normally every frame starts where it should and the blocks are decoded in place.
+    usbResyncFrames.clear();
+    if (numCarryBytes == 0) {
+        unsigned int frameSizeInBytes = blockSizeInBytes / SAMPLES_PER_DATA_BLOCK;
+        bool aligned = true;
+        for (unsigned int offset = 0; offset < numBytesToRead && aligned; offset += frameSizeInBytes) {
+            aligned = Rhd2000DecoderUsb3::isMagicNumber(usbBuffer + offset);
+        }
+        if (aligned) {
+            return numBlocks;
+        }
+    }
+    return realignUsbBuffer(numCarryBytes + numBytesToRead);
+}
+
+// Realign the first numBytes of usbBuffer after bytes were lost on the USB link.  Wherever a frame
+// does not start with the magic number, the bytes up to the next frame header (found with a
+// vectorized search) are skipped and the frames that follow are moved down to close the gap.
+// Whole blocks are left at the start of usbBuffer; the remaining frames and any partial frame are
+// carried into the next transfer.  Returns the number of whole blocks.  (Private method; okMutex
+// must be held.)
+//
+// The whole transfer is scanned before anything is moved, so every search runs over the bytes as
+// read, however many glitches the transfer holds: in is the scan (source) offset, out the number
+// of bytes kept so far, and usbKeptRuns the source runs to move down to offset 0 afterwards.
+int Rhd2000EvalBoardUsb3::realignUsbBuffer(unsigned int numBytes)
+{
+    const unsigned int blockSizeInBytes = 2 * Rhd2000DataBlockUsb3::calculateDataBlockSizeInWords(numDataStreams);
+    const unsigned int frameSizeInBytes = blockSizeInBytes / SAMPLES_PER_DATA_BLOCK;
+    unsigned int in = 0, out = 0;
+
+    usbKeptRuns.clear();
+    while (in + frameSizeInBytes <= numBytes) {
+        if (Rhd2000DecoderUsb3::isMagicNumber(usbBuffer + in)) {
+            if (!usbKeptRuns.empty() && usbKeptRuns.back().first + usbKeptRuns.back().second == in) {
+                usbKeptRuns.back().second += frameSizeInBytes;
+            } else {
+                usbKeptRuns.push_back(make_pair(in, frameSizeInBytes));
+            }
+            in += frameSizeInBytes;
+            out += frameSizeInBytes;
+            continue;
+        }
+
+        // The bytes were lost somewhere in the frame before this one, which kept its header but may
+        // have lost its time stamp, so drop it too.  Frames are word-aligned, so search even offsets
+        // from there on.  If no header turns up, keep the last few bytes, which may be the start of
+        // one split across transfers.
+        if (!usbKeptRuns.empty() && usbKeptRuns.back().first + usbKeptRuns.back().second == in) {
+            usbKeptRuns.back().second -= frameSizeInBytes;
+            if (usbKeptRuns.back().second == 0) {
+                usbKeptRuns.pop_back();
+            }
+            out -= frameSizeInBytes;
+            in -= frameSizeInBytes;
+        }
+        int found = Rhd2000DecoderUsb3::findMagicNumber(usbBuffer + in + 2, numBytes - in - 2);
+        unsigned int skipped = (found >= 0) ? found + 2 : numBytes - in - min(numBytes - in, 6u);
+        usbReadStats.numBytesSkipped += skipped;
+        in += skipped;
+        if (found < 0) {
+            break;
+        }
+        usbReadStats.numResyncs++;
+        usbResyncFrames.push_back(out / frameSizeInBytes);
+    }
+
+    // Each run moves down (or stays), below the source of every later run.
+    unsigned int kept = 0;
+    for (size_t i = 0; i < usbKeptRuns.size(); ++i) {
+        if (usbKeptRuns[i].first != kept) {
+            memmove(usbBuffer + kept, usbBuffer + usbKeptRuns[i].first, usbKeptRuns[i].second);
+        }
+        kept += usbKeptRuns[i].second;
+    }
+
+    unsigned int numPartialBytes = numBytes - in;
+    if (numPartialBytes > 0 && out != in) {
+        memmove(usbBuffer + out, usbBuffer + in, numPartialBytes);
+    }
+
+    int numWholeBlocks = out / blockSizeInBytes;
+    usbCarryOffset = numWholeBlocks * blockSizeInBytes;
+    usbCarryBytes = out + numPartialBytes - usbCarryOffset;
+    return numWholeBlocks;
+}
+
+// Decode block blockIndex of usbBuffer into dataBlock and record what went wrong with it, if
+// anything: damaged frames, a resync, or time stamps that do not follow on from the previous
+// block.  (Private method; okMutex must be held.)
+void Rhd2000EvalBoardUsb3::decodeUsbBlock(Rhd2000DataBlockUsb3 &dataBlock, int blockIndex)
+{
+    dataBlock.fillFromUsbBuffer(usbBuffer, blockIndex, numDataStreams);
+    unsigned int flags = dataBlock.getSyncFlags();
+
+    for (size_t i = 0; i < usbResyncFrames.size(); ++i) {
+        if (usbResyncFrames[i] / SAMPLES_PER_DATA_BLOCK == blockIndex) {
+            flags |= Rhd2000DataBlockUsb3::SyncResynchronized;
+        }
+    }
+
+    dataBlock.setSyncFlags(flags);
+
+    if (timeStampMonitor.checkBlock(dataBlock) != 0) {
+        usbReadStats.numFramesLost += dataBlock.getNumSamplesDropped();
+        usbReadStats.numTimeStampGaps++;
+    }
+    if (dataBlock.getSyncFlags() != 0) {
+        usbReadStats.numBlocksFlagged++;
+    }
+}
+
+// Forget carried-over bytes and the expected time stamp, e.g. after a flush or a change in the
+// enabled data streams.  (Private method; okMutex must be held.)
+void Rhd2000EvalBoardUsb3::resetUsbStream()
+{
+    usbCarryOffset = 0;
+    usbCarryBytes = 0;
+    usbResyncFrames.clear();
+    timeStampMonitor.restart();
+}
+
+// Reads a certain number of USB data blocks, if the specified number is available, and appends them
+// to queue.  Returns true if data blocks were available.
+bool Rhd2000EvalBoardUsb3::readDataBlocks(int numBlocks, queue<Rhd2000DataBlockUsb3> &dataQueue)
+{
+    lock_guard<mutex> lockOk(okMutex);
+
+    int j;
+
+    if (readerThreadRunning) {
+        cerr << "Error in Rhd2000EvalBoardUsb3::readDataBlocks: reader thread is running; " <<
+                "consume blocks from getDataBlockRing() instead." << endl;
+        return false;
+    }
+
+    // After a resync fewer than numBlocks may be ready; the rest arrive with the next read.
+    numBlocks = readUsbBlocks(numBlocks);
+    if (numBlocks == 0)
+        return false;
 
+    // Construct each block in place rather than filling a temporary and copying it in.
     for (j = 0; j < numBlocks; ++j) {
-        dataBlock->fillFromUsbBuffer(usbBuffer, j, numDataStreams);
-        dataQueue.push(*dataBlock);
+        dataQueue.emplace(numDataStreams, amplifierLayout, sampleFormat);
+        decodeUsbBlock(dataQueue.back(), j);
     }
-    delete dataBlock;
 
     return true;
 }
 
+// Reads a certain number of USB data blocks, if the specified number is available, into blocks taken
+// from pool and appends their handles to dataBlocks.  Nothing is read if the pool cannot supply
+// numBlocks blocks.  Returns true if data blocks were read; if another thread empties the pool
+// meanwhile, only the blocks decoded before then are appended.  Once dataBlocks has reached its
+// working capacity, this performs no heap allocation.
+bool Rhd2000EvalBoardUsb3::readDataBlocks(int numBlocks, Rhd2000DataBlockPoolUsb3 &pool,
+                                          vector<Rhd2000DataBlockHandleUsb3> &dataBlocks)
+{
+    lock_guard<mutex> lockOk(okMutex);
+
+    if (!checkDataBlockPool(pool, numBlocks, "readDataBlocks"))
+        return false;
+
+    numBlocks = readUsbBlocks(numBlocks);
+    if (numBlocks == 0)
+        return false;
+
+    return fillPooledDataBlocks(numBlocks, pool, dataBlocks) > 0;
+}
+
+// Pooled version of readAvailableDataBlocks(): reads every whole data block waiting in the FIFO, up to
+// the number of free blocks in pool, in a single USB transaction.  Returns the number of blocks
+// appended to dataBlocks.
+int Rhd2000EvalBoardUsb3::readAvailableDataBlocks(Rhd2000DataBlockPoolUsb3 &pool,
+                                                  vector<Rhd2000DataBlockHandleUsb3> &dataBlocks)
+{
+    lock_guard<mutex> lockOk(okMutex);
+
+    if (!checkDataBlockPool(pool, 1, "readAvailableDataBlocks"))
+        return 0;
+
+    int numBlocks = numUsbBlocksToRead(min((int) pool.getNumAvailable(), (int) maxBlocksPerRead));
+    if (numBlocks > 0)
+        numBlocks = transferUsbBlocks(numBlocks);
+    if (numBlocks == 0)
+        return 0;
+
+    return fillPooledDataBlocks(numBlocks, pool, dataBlocks);
+}
+
+// Returns true if pool matches the enabled data streams and has at least numBlocks free blocks.
+// (Private method; okMutex must be held.)
+bool Rhd2000EvalBoardUsb3::checkDataBlockPool(Rhd2000DataBlockPoolUsb3 &pool, int numBlocks, const char *caller)
+{
+    if (readerThreadRunning) {
+        cerr << "Error in Rhd2000EvalBoardUsb3::" << caller << ": reader thread is running; " <<
+                "consume blocks from getDataBlockRing() instead." << endl;
+        return false;
+    }
+    if (pool.getNumDataStreams() != numDataStreams) {
+        cerr << "Error in Rhd2000EvalBoardUsb3::" << caller << ": pool holds blocks for " <<
+                pool.getNumDataStreams() << " data streams; " << numDataStreams << " are enabled." << endl;
+        return false;
+    }
+    return pool.getNumAvailable() >= (unsigned int) numBlocks;
+}
+
+// Decodes the first numBlocks data blocks in usbBuffer into blocks taken from pool.  Returns the
+// number of blocks decoded, which is less than numBlocks if the pool runs out (another thread may
+// take blocks after checkDataBlockPool()); the rest of the data read is lost.
+// (Private method; okMutex must be held.)
+int Rhd2000EvalBoardUsb3::fillPooledDataBlocks(int numBlocks, Rhd2000DataBlockPoolUsb3 &pool,
+                                               vector<Rhd2000DataBlockHandleUsb3> &dataBlocks)
+{
+    for (int j = 0; j < numBlocks; ++j) {
+        Rhd2000DataBlockHandleUsb3 dataBlock = pool.acquire();
+        if (!dataBlock) {
+            cerr << "Error in Rhd2000EvalBoardUsb3::fillPooledDataBlocks: pool ran out of blocks; " <<
+                    numBlocks - j << " data blocks dropped." << endl;
+            return j;
+        }
+        decodeUsbBlock(*dataBlock, j);
+        dataBlocks.push_back(std::move(dataBlock));
+    }
+    return numBlocks;
+}
+
+// Reads every whole data block waiting in the FIFO (up to the limit set by setMaxBlocksPerRead())
+// in a single USB transaction and appends them to queue.  The batch grows with the FIFO backlog and
+// falls back to single blocks when the host is keeping up.  Returns the number of blocks read.
+int Rhd2000EvalBoardUsb3::readAvailableDataBlocks(queue<Rhd2000DataBlockUsb3> &dataQueue)
+{
+    lock_guard<mutex> lockOk(okMutex);
+
+    int j, numBlocks;
+
+    if (readerThreadRunning) {
+        cerr << "Error in Rhd2000EvalBoardUsb3::readAvailableDataBlocks: reader thread is running; " <<
+                "consume blocks from getDataBlockRing() instead." << endl;
+        return 0;
+    }
+
+    numBlocks = numUsbBlocksToRead(maxBlocksPerRead);
+    if (numBlocks > 0)
+        numBlocks = transferUsbBlocks(numBlocks);
+    if (numBlocks == 0)
+        return 0;
+
+    for (j = 0; j < numBlocks; ++j) {
+        dataQueue.emplace(numDataStreams, amplifierLayout, sampleFormat);
+        decodeUsbBlock(dataQueue.back(), j);
+    }
+
+    return numBlocks;
+}
+
+// Set the largest number of data blocks read per USB transaction by readAvailableDataBlocks() and
+// the reader thread (1-MAX_NUM_BLOCKS).  Use small values when end-to-end latency matters more than
+// USB efficiency.
+void Rhd2000EvalBoardUsb3::setMaxBlocksPerRead(int maxBlocks)
+{
+    if (maxBlocks < 1 || maxBlocks > MAX_NUM_BLOCKS) {
+        cerr << "Error in Rhd2000EvalBoardUsb3::setMaxBlocksPerRead: maxBlocks out of range." << endl;
+        return;
+    }
+    maxBlocksPerRead = maxBlocks;
+}
+
+int Rhd2000EvalBoardUsb3::getMaxBlocksPerRead() const
+{
+    return maxBlocksPerRead;
+}
+
+// Select the amplifierDataFast layout of data blocks created by readDataBlocks(),
+// readAvailableDataBlocks() and startReaderThread().  ChannelMajor stores each channel's samples
+// contiguously, which suits per-channel filtering and display.  Blocks from a Rhd2000DataBlockPoolUsb3
+// keep the layout the pool was created with.
+void Rhd2000EvalBoardUsb3::setAmplifierLayout(Rhd2000DataBlockUsb3::AmplifierLayout layout)
+{
+    amplifierLayout = layout;
+}
+
+Rhd2000DataBlockUsb3::AmplifierLayout Rhd2000EvalBoardUsb3::getAmplifierLayout() const
+{
+    return amplifierLayout;
+}
+
+// Select the sample format of data blocks created by readDataBlocks(), readAvailableDataBlocks() and
+// startReaderThread().  UInt16Samples keeps every word at its native 16 bits, halving the memory
+// traffic of decoding, copying, saving and forwarding blocks.
+void Rhd2000EvalBoardUsb3::setSampleFormat(Rhd2000DataBlockUsb3::SampleFormat format)
+{
+    sampleFormat = format;
+}
+
+Rhd2000DataBlockUsb3::SampleFormat Rhd2000EvalBoardUsb3::getSampleFormat() const
+{
+    return sampleFormat;
+}
+
+// Return USB data pipe counters accumulated since the last call to resetUsbReadStats().
+void Rhd2000EvalBoardUsb3::getUsbReadStats(UsbReadStats &stats)
+{
+    lock_guard<mutex> lockOk(okMutex);
+    stats = usbReadStats;
+    stats.elapsedSeconds = chrono::duration<double>(chrono::steady_clock::now() - usbReadStatsStart).count();
+}
+
+void Rhd2000EvalBoardUsb3::resetUsbReadStats()
+{
+    lock_guard<mutex> lockOk(okMutex);
+    usbReadStats.numFifoQueries = 0;
+    usbReadStats.numTransactions = 0;
+    usbReadStats.numBlocks = 0;
+    usbReadStats.numBytes = 0;
+    usbReadStats.maxBlocksPerTransaction = 0;
+    usbReadStats.elapsedSeconds = 0.0;
+    usbReadStats.numResyncs = 0;
+    usbReadStats.numBytesSkipped = 0;
+    usbReadStats.numFramesLost = 0;
+    usbReadStats.numTimeStampGaps = 0;
+    usbReadStats.numBlocksFlagged = 0;
+    usbReadStatsStart = chrono::steady_clock::now();
+}
+
+double Rhd2000EvalBoardUsb3::UsbReadStats::megabytesPerSecond() const
+{
+    return (elapsedSeconds > 0.0) ? numBytes / elapsedSeconds / 1.0e6 : 0.0;
+}
+
+double Rhd2000EvalBoardUsb3::UsbReadStats::transactionsPerSecond() const
+{
+    return (elapsedSeconds > 0.0) ? numTransactions / elapsedSeconds : 0.0;
+}
+
+double Rhd2000EvalBoardUsb3::UsbReadStats::blocksPerTransaction() const
+{
+    return (numTransactions > 0) ? (double) numBlocks / numTransactions : 0.0;
+}
+
 // Writes the contents of a data block queue (dataQueue) to a binary output stream (saveOut).
-// Returns the number of data blocks written.
+// Returns the number of data blocks written.  Blocks are serialized into one buffer and passed to
+// saveOut in large chunks (see Rhd2000DataFileWriterUsb3); the buffer is kept for the next call.
 int Rhd2000EvalBoardUsb3::queueToFile(queue<Rhd2000DataBlockUsb3> &dataQueue, ofstream &saveOut)
 {
     int count = 0;
+    if (!queueFileWriter) {
+        queueFileWriter = new Rhd2000DataFileWriterUsb3(saveOut);
+    } else {
+        queueFileWriter->setOutputStream(saveOut);
+    }
 
     while (!dataQueue.empty()) {
-        dataQueue.front().write(saveOut, getNumEnabledDataStreams());
+        queueFileWriter->writeBlock(dataQueue.front(), getNumEnabledDataStreams());
         dataQueue.pop();
         ++count;
     }
+    queueFileWriter->flush();
 
     return count;
 }
 
+// Start a thread that continuously drains the USB FIFO into a ring of ringCapacity preallocated
+// data blocks (see getDataBlockRing()).  The set of enabled data streams must not change while
+// the thread is running.  Returns false if the thread is already running.
+bool Rhd2000EvalBoardUsb3::startReaderThread(unsigned int ringCapacity)
+{
+    if (readerThreadRunning) {
+        cerr << "Error in Rhd2000EvalBoardUsb3::startReaderThread: reader thread already running." << endl;
+        return false;
+    }
+
+    delete dataBlockRing;
+    dataBlockRing = new Rhd2000DataBlockRingUsb3(ringCapacity, numDataStreams, amplifierLayout, sampleFormat);
+    readerStallCount = 0;
+    readerThreadStop = false;
+    readerThreadRunning = true;
+    readerThread = thread(&Rhd2000EvalBoardUsb3::readerThreadLoop, this);
+
+    return true;
+}
+
+// Stop the reader thread.  Blocks already in the ring remain available to the consumer.
+void Rhd2000EvalBoardUsb3::stopReaderThread()
+{
+    if (!readerThreadRunning) return;
+
+    readerThreadStop = true;
+    if (readerThread.joinable()) {
+        readerThread.join();
+    }
+    readerThreadRunning = false;
+}
+
+bool Rhd2000EvalBoardUsb3::isReaderThreadRunning() const
+{
+    return readerThreadRunning;
+}
+
+// Returns the ring filled by the reader thread.  Consumers drain it with front() and pop() from a
+// single thread; neither call touches okMutex.
+Rhd2000DataBlockRingUsb3* Rhd2000EvalBoardUsb3::getDataBlockRing() const
+{
+    return dataBlockRing;
+}
+
+// Returns the monitor that checks the time stamps of every block this board decodes.  Its totals
+// cover the life of the board object; getStats() may be called from any thread.
+Rhd2000TimeStampMonitorUsb3& Rhd2000EvalBoardUsb3::getTimeStampMonitor()
+{
+    return timeStampMonitor;
+}
+
+// Returns the number of times the reader thread found the ring full and had to leave data waiting
+// in the FPGA FIFO.
+unsigned long long Rhd2000EvalBoardUsb3::getReaderStallCount() const
+{
+    return readerStallCount;
+}
+
+// Reader thread body.  okMutex is held only for the duration of each USB transfer, so other
+// board methods may still be called while acquisition is running.
+void Rhd2000EvalBoardUsb3::readerThreadLoop()
+{
+    // Poll the FIFO about four times per data block period when it runs dry.
+    const chrono::microseconds idleWait((long long) (0.25e6 * SAMPLES_PER_DATA_BLOCK / getSampleRate()));
+    bool stalled = false;
+
+    while (!readerThreadStop) {
+        int freeSlots = dataBlockRing->getFreeSlots();
+        if (freeSlots == 0) {
+            if (!stalled) {
+                readerStallCount++;
+                stalled = true;
+            }
+            this_thread::sleep_for(idleWait);
+            continue;
+        }
+        stalled = false;
+
+        // Pull everything waiting in the FIFO that fits in the ring in one transaction.
+        int numBlocks;
+        {
+            lock_guard<mutex> lockOk(okMutex);
+            numBlocks = numUsbBlocksToRead(min(freeSlots, (int) maxBlocksPerRead));
+            if (numBlocks > 0) {
+                numBlocks = transferUsbBlocks(numBlocks);
+            }
+            for (int j = 0; j < numBlocks; ++j) {
+                decodeUsbBlock(*dataBlockRing->beginWrite(j), j);
+            }
+        }
+
+        if (numBlocks > 0) {
+            dataBlockRing->commitWrite(numBlocks);
+        } else {
+            this_thread::sleep_for(idleWait);
+        }
+    }
+}
+
 // Return name of Opal Kelly board based on model code.
 string Rhd2000EvalBoardUsb3::opalKellyModelName(int model) const
 {
@@ -1702,129 +2624,129 @@ int Rhd2000EvalBoardUsb3::readDigitalInManual(bool& expanderBoardDetected)
     expanderBoardIdNumber = ((dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x08) ? 1 : 0);
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 2);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);  // Load digital in shift registers on falling edge of serial_LOAD
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     spiPortPresent[7] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x01;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     spiPortPresent[6] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x01;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     spiPortPresent[5] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x01;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     spiPortPresent[4] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x01;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     spiPortPresent[3] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x01;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     spiPortPresent[2] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x01;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     spiPortPresent[1] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x01;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     spiPortPresent[0] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x01;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     digOutVoltageLevel = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x01;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     userId[2] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x01;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     userId[1] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x01;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     userId[0] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x01;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     serialId[3] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x01;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     serialId[2] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x01;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     serialId[1] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x01;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     serialId[0] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x01;
@@ -1852,129 +2774,129 @@ void Rhd2000EvalBoardUsb3::readDigitalInExpManual()
     int ttlIn[16];
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 2);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);  // Load digital in shift registers on falling edge of serial_LOAD
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     ttlIn[15] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x02;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     ttlIn[14] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x02;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     ttlIn[13] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x02;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     ttlIn[12] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x02;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     ttlIn[11] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x02;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     ttlIn[10] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x02;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     ttlIn[9] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x02;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     ttlIn[8] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x02;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     ttlIn[7] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x02;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     ttlIn[6] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x02;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     ttlIn[5] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x02;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     ttlIn[4] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x02;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     ttlIn[3] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x02;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     ttlIn[2] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x02;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     ttlIn[1] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x02;
 
     dev->SetWireInValue(WireInSerialDigitalInCntl, 1);
-    dev->UpdateWireIns();
+    updateWireInsNow();
     dev->SetWireInValue(WireInSerialDigitalInCntl, 0);
-    dev->UpdateWireIns();
+    updateWireInsNow();
 
     dev->UpdateWireOuts();
     ttlIn[0] = dev->GetWireOutValue(WireOutSerialDigitalIn) & 0x02;
@@ -2000,7 +2922,7 @@ void Rhd2000EvalBoardUsb3::setDacRerefSource(int stream, int channel)
     }
 
     dev->SetWireInValue(WireInDacReref, (stream << 5) + channel, 0x0000003ff);
-    dev->UpdateWireIns();
+    updateWireIns();
 }
 
 // Enables DAC rereferencing, where a selected amplifier channel is subtracted from all DACs in real time.
@@ -2009,5 +2931,5 @@ void Rhd2000EvalBoardUsb3::enableDacReref(bool enabled)
     lock_guard<mutex> lockOk(okMutex);
 
     dev->SetWireInValue(WireInDacReref, (enabled ? 0x00000400 : 0x00000000), 0x00000400);
-    dev->UpdateWireIns();
+    updateWireIns();
 }
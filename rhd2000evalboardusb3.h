@@ -36,13 +36,36 @@
 #define USB3_BLOCK_SIZE	1024
 #define RAM_BURST_SIZE 32
 
+// Auxiliary command RAM: 16 banks of 1024 commands for each of AuxCmd1-AuxCmd3
+#define NUM_AUX_CMD_SLOTS 3
+#define NUM_COMMAND_BANKS 16
+#define COMMAND_RAM_WORDS 1024
+
+// Opal Kelly wire-in endpoints 0x00-0x1f, all sent by every wire-in update
+#define NUM_WIRE_INS 32
+
+// Fast start state file record (see Rhd2000EvalBoardUsb3::fastStartFpga())
+#define FPGA_STATE_MAGIC 0x53444852         // "RHDS"
+#define FPGA_STATE_VERSION 1
+
+#include <vector>
+#include <fstream>
 #include <queue>
 #include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
 
 using namespace std;
 
+#include "rhd2000datablockusb3.h"
+#include "rhd2000timestampmonitorusb3.h"
+
 class okCFrontPanel;
-class Rhd2000DataBlockUsb3;
+class Rhd2000DataBlockRingUsb3;
+class Rhd2000DataBlockPoolUsb3;
+class Rhd2000DataBlockHandleUsb3;
+class Rhd2000DataFileWriterUsb3;
 
 class Rhd2000EvalBoardUsb3
 {
@@ -51,8 +74,12 @@ public:
     Rhd2000EvalBoardUsb3();
     ~Rhd2000EvalBoardUsb3();
 
-    int open();
+    int open(string requestedSerialNumber = "");
+    string getSerialNumber() const;
     bool uploadFpgaBitfile(string filename);
+    bool fastStartFpga(string filename);
+    bool isFpgaConfigurationReused() const;
+    void setFpgaStateFile(string filename);
     void initialize();
 
     enum AmplifierSampleRate {
@@ -97,6 +124,8 @@ public:
     };
 
     void uploadCommandList(const vector<int> &commandList, AuxCmdSlot auxCommandSlot, int bank);
+    void setCommandRamPipe(bool enabled);
+    void invalidateCommandRamCache();
     void printCommandList(const vector<int> &commandList) const;
     void selectAuxCommandBank(BoardPort port, AuxCmdSlot auxCommandSlot, int bank);
     void selectAuxCommandLength(AuxCmdSlot auxCommandSlot, int loopIndex, int endIndex);
@@ -123,6 +152,7 @@ public:
 
     void enableDataStream(int stream, bool enabled);
     int getNumEnabledDataStreams() const;
+    unsigned int getEnabledDataStreamMask() const;
 
     void clearTtlOut();
     void setTtlOut(int ttlOutArray[]);
@@ -151,7 +181,87 @@ public:
     bool readDataBlock(Rhd2000DataBlockUsb3 *dataBlock);
     long readDataBlocksRaw(int numBlocks, unsigned char* buffer);
     bool readDataBlocks(int numBlocks, queue<Rhd2000DataBlockUsb3> &dataQueue);
+    int readAvailableDataBlocks(queue<Rhd2000DataBlockUsb3> &dataQueue);
+    bool readDataBlocks(int numBlocks, Rhd2000DataBlockPoolUsb3 &pool, vector<Rhd2000DataBlockHandleUsb3> &dataBlocks);
+    int readAvailableDataBlocks(Rhd2000DataBlockPoolUsb3 &pool, vector<Rhd2000DataBlockHandleUsb3> &dataBlocks);
+    void setMaxBlocksPerRead(int maxBlocks);
+    void setAmplifierLayout(Rhd2000DataBlockUsb3::AmplifierLayout layout);
+    Rhd2000DataBlockUsb3::AmplifierLayout getAmplifierLayout() const;
+    void setSampleFormat(Rhd2000DataBlockUsb3::SampleFormat format);
+    Rhd2000DataBlockUsb3::SampleFormat getSampleFormat() const;
+    int getMaxBlocksPerRead() const;
     int queueToFile(queue<Rhd2000DataBlockUsb3> &dataQueue, std::ofstream &saveOut);
+
+    bool startReaderThread(unsigned int ringCapacity = 512);
+    void stopReaderThread();
+    bool isReaderThreadRunning() const;
+    Rhd2000DataBlockRingUsb3* getDataBlockRing() const;
+    Rhd2000TimeStampMonitorUsb3& getTimeStampMonitor();
+    unsigned long long getReaderStallCount() const;
+
+    // Counters for USB data pipe traffic, used to tune the multi-block read batch size.
+    struct UsbReadStats {
+        unsigned long long numFifoQueries;      // UpdateWireOuts round trips to read the FIFO level
+        unsigned long long numTransactions;     // ReadFromBlockPipeOut calls
+        unsigned long long numBlocks;           // data blocks transferred
+        unsigned long long numBytes;            // bytes transferred
+        int maxBlocksPerTransaction;
+        double elapsedSeconds;                  // time since resetUsbReadStats()
+
+        // Stream integrity (see transferUsbBlocks())
+        unsigned long long numResyncs;          // times the stream was realigned to the next frame header
+        unsigned long long numBytesSkipped;     // bytes discarded while searching for a frame header
+        unsigned long long numFramesLost;       // frames missing according to the time stamps
+        unsigned long long numTimeStampGaps;    // blocks whose time stamps do not follow on (see getTimeStampMonitor())
+        unsigned long long numBlocksFlagged;    // blocks with any Rhd2000DataBlockUsb3::SyncFlag set
+
+        double megabytesPerSecond() const;
+        double transactionsPerSecond() const;
+        double blocksPerTransaction() const;
+    };
+    void getUsbReadStats(UsbReadStats &stats);
+    void resetUsbReadStats();
+
+    // Counters for auxiliary command RAM uploads (see uploadCommandList()).
+    struct CommandUploadStats {
+        unsigned long long numUploads;          // uploadCommandList() calls
+        unsigned long long numUploadsSkipped;   // lists the bank already held
+        unsigned long long numWordsWritten;
+        unsigned long long numWordsSkipped;     // already held at their address
+        unsigned long long numTransactions;     // USB round trips: wire-in updates, trigger-ins and pipe writes
+        double totalMs;
+        double bankMs[NUM_AUX_CMD_SLOTS][NUM_COMMAND_BANKS];   // last upload to each bank of AuxCmd1-AuxCmd3
+    };
+    void getCommandUploadStats(CommandUploadStats &stats);
+    void resetCommandUploadStats();
+
+    // Wire-in batches: between beginWireInBatch() and the matching endWireInBatch(), setters change
+    // only the host copy of the wire-ins, and the FPGA is sent them once, when the outermost batch
+    // ends or earlier if a trigger needs them.  WireInBatch does the same for a scope.
+    void beginWireInBatch();
+    void endWireInBatch();
+    void commitWireIns();
+
+    class WireInBatch {
+    public:
+        explicit WireInBatch(Rhd2000EvalBoardUsb3 &board);
+        ~WireInBatch();
+    private:
+        Rhd2000EvalBoardUsb3 &board;
+        WireInBatch(const WireInBatch&) = delete;
+        WireInBatch& operator=(const WireInBatch&) = delete;
+    };
+
+    // Counters for wire-in updates, i.e. UpdateWireIns control transfers.
+    struct WireInStats {
+        unsigned long long numUpdatesRequested;     // setter updates (each was one transfer before)
+        unsigned long long numUpdatesDeferred;      // requested inside a batch
+        unsigned long long numUpdatesSent;          // transfers actually made
+        unsigned long long numTransfersSaved;       // numUpdatesRequested - numUpdatesSent
+    };
+    void getWireInStats(WireInStats &stats);
+    void resetWireInStats();
+
     int getBoardMode();
     int getCableDelay(BoardPort port) const;
     void getCableDelay(vector<int> &delays) const;
@@ -176,6 +286,62 @@ private:
     // Buffer for reading bytes from USB interface
     unsigned char* usbBuffer;
 
+    // After bytes are lost on the USB link, frames no longer line up with pipe transfers.  The
+    // frames (and partial frame) left over after the last whole block are carried into the next
+    // transfer: usbCarryBytes bytes at usbBuffer + usbCarryOffset.
+    unsigned int usbCarryOffset;
+    unsigned int usbCarryBytes;
+    vector<int> usbResyncFrames;        // frames of the current transfer that follow skipped bytes
+    vector<pair<unsigned int, unsigned int> > usbKeptRuns;  // (offset, bytes) of runs of good frames
+
+    // Checks the time stamps of every block decoded
+    Rhd2000TimeStampMonitorUsb3 timeStampMonitor;
+
+    // Fast start (see fastStartFpga()).  The state file records, for this board's serial number, the
+    // bitfile last loaded and the wire-in values the FPGA holds.  It is saved at the end of each
+    // wire-in batch, by flush() and on destruction, and marks the wire-ins unknown in between
+    // (see sendWireIns()), so wire-in updates during acquisition do no file I/O.
+    struct FpgaStateRecord {
+        unsigned int magic;
+        unsigned int recordVersion;
+        unsigned long long bitfileHash;
+        unsigned int boardId;
+        unsigned int boardVersion;
+        unsigned int wireInsKnown;
+        unsigned int wireIns[NUM_WIRE_INS];
+    };
+    string boardSerialNumber;
+    string fpgaStateFileName;           // empty: no state file is kept
+    bool fpgaStateFileChosen;           // by setFpgaStateFile() or the first fastStartFpga()
+    fstream fpgaStateFile;
+    FpgaStateRecord fpgaState;
+    bool fpgaStateFileKnown;            // the state file records fpgaState's wire-ins as known
+    bool fpgaReused;
+
+    bool configureFpga(string filename);
+    static bool hashBitfile(const string &filename, unsigned long long &hash);
+    bool readFpgaState(FpgaStateRecord &record);
+    void writeFpgaState(bool wireInsKnown = true);
+    void saveFpgaState();
+
+    // Wire-in updates (see beginWireInBatch()); guarded by okMutex
+    int wireInBatchDepth;
+    bool wireInsPending;
+    WireInStats wireInStats;
+    void updateWireIns();
+    void updateWireInsNow();
+    void sendWireIns();
+    void activateTriggerIn(int endPoint, int bit);
+
+    // Host copy of the auxiliary command RAM: the words each bank is known to hold, from address 0
+    // (none until the bank is first uploaded, or after the FPGA is configured)
+    vector<int> commandRamCache[NUM_AUX_CMD_SLOTS][NUM_COMMAND_BANKS];
+    bool commandRamPipe;
+    vector<unsigned char> commandRamPipeBuffer;
+    CommandUploadStats commandUploadStats;
+    bool writeCommandRamPipe(const vector<int> &commandList, const vector<int> &addresses, int slot, int bank);
+    void clearCommandRamCache();
+
     // Opal Kelly module USB interface endpoint addresses
     enum OkEndPoint {
         WireInResetRun = 0x00,
@@ -221,6 +387,8 @@ private:
         WireOutBoardId = 0x3e,
         WireOutBoardVersion = 0x3f,
 
+        PipeInCmdRam = 0x80,
+
         PipeOutData = 0xa0
     };
 
@@ -232,6 +400,36 @@ private:
     unsigned int lastNumWordsInFifo;
     bool numWordsHasBeenUpdated;
     unsigned int numWordsInFifo();
+
+    int readUsbBlocks(int numBlocks);
+    int numUsbBlocksToRead(int maxBlocks);
+    int transferUsbBlocks(int numBlocks);
+    int realignUsbBuffer(unsigned int numBytes);
+    void decodeUsbBlock(Rhd2000DataBlockUsb3 &dataBlock, int blockIndex);
+    void resetUsbStream();
+    bool checkDataBlockPool(Rhd2000DataBlockPoolUsb3 &pool, int numBlocks, const char *caller);
+    int fillPooledDataBlocks(int numBlocks, Rhd2000DataBlockPoolUsb3 &pool, vector<Rhd2000DataBlockHandleUsb3> &dataBlocks);
+
+    // Upper bound on blocks pulled per USB transaction by the adaptive read path; lower values
+    // trade USB efficiency for latency.
+    atomic<int> maxBlocksPerRead;
+
+    // Layout and sample format of data blocks created by readDataBlocks() and the reader thread's ring
+    Rhd2000DataBlockUsb3::AmplifierLayout amplifierLayout;
+    Rhd2000DataBlockUsb3::SampleFormat sampleFormat;
+    UsbReadStats usbReadStats;
+    chrono::steady_clock::time_point usbReadStatsStart;
+
+    // Reader thread draining the USB FIFO into dataBlockRing
+    thread readerThread;
+    atomic<bool> readerThreadRunning;
+    atomic<bool> readerThreadStop;
+    atomic<unsigned long long> readerStallCount;
+    Rhd2000DataBlockRingUsb3* dataBlockRing;
+    void readerThreadLoop();
+
+    // Writer reused by every queueToFile() call, so that its buffer is allocated once
+    Rhd2000DataFileWriterUsb3* queueFileWriter;
 };
 
 #endif // RHD2000EVALBOARDUSB3_H
@@ -0,0 +1,411 @@
+//----------------------------------------------------------------------------------
+// rhd2000fpgasinkusb3.cpp
+//
+// Rhd2000FpgaSinkUsb3 Class
+//
+// Pipelined pipe-in/pipe-out forwarding to a downstream Opal Kelly FPGA.
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+
+#include "rhd2000fpgasinkusb3.h"
+
+#include "okFrontPanelDLL.h"
+
+using namespace std;
+
+// Constructor.  Allocates numBuffers (at least pipelineDepth + 1) transfer buffers of transferBytes
+// each, rounded up to a multiple of 16 bytes.
+Rhd2000FpgaSinkUsb3::Rhd2000FpgaSinkUsb3(unsigned int transferBytes_, unsigned int numBuffers,
+                                         unsigned int pipelineDepth_) :
+    dev(nullptr),
+    deviceIsOpen(false),
+    fillBuffer(nullptr),
+    numCarryBytes(0),
+    stopRequested(false),
+    maxInFlight(0),
+    numBytesSubmitted(0),
+    numBytesDropped(0),
+    numTransfers(0),
+    numBytesWritten(0),
+    numBytesRead(0),
+    numErrors(0),
+    numBytesLost(0),
+    numLatencies(0),
+    latencyHistoryNext(0),
+    latencyMaxMs(0.0)
+{
+    if (transferBytes_ < FPGA_SINK_TRANSFER_ALIGNMENT) {
+        transferBytes_ = FPGA_SINK_TRANSFER_ALIGNMENT;
+    }
+    transferBytes = ((transferBytes_ + FPGA_SINK_TRANSFER_ALIGNMENT - 1) / FPGA_SINK_TRANSFER_ALIGNMENT) *
+            FPGA_SINK_TRANSFER_ALIGNMENT;
+    pipelineDepth = (pipelineDepth_ < 1) ? 1 : pipelineDepth_;
+    if (numBuffers < pipelineDepth + 1) {
+        numBuffers = pipelineDepth + 1;
+    }
+
+    buffers.resize(numBuffers);
+    for (unsigned int i = 0; i < numBuffers; ++i) {
+        buffers[i].data.resize(transferBytes);
+        buffers[i].numBytes = 0;
+        buffers[i].numPaddingBytes = 0;
+        buffers[i].writeFailed = false;
+    }
+    readBuffer.resize(transferBytes);
+    latencyHistory.resize(FPGA_SINK_LATENCY_HISTORY);
+}
+
+// Destructor.  Forwards any buffered data and closes the device.
+Rhd2000FpgaSinkUsb3::~Rhd2000FpgaSinkUsb3()
+{
+    close();
+}
+
+// Set the function the sink thread calls with the bytes read back from pipe-out 0xA0 after each
+// transfer.  Must be called before open().
+void Rhd2000FpgaSinkUsb3::setReturnCallback(ReturnCallback callback)
+{
+    if (deviceIsOpen) {
+        cerr << "Error in Rhd2000FpgaSinkUsb3::setReturnCallback: sink is already open." << endl;
+        return;
+    }
+    returnCallback = callback;
+}
+
+// Set the function the sink thread calls with the submitted bytes of each failed transfer.  Must be
+// called before open().
+void Rhd2000FpgaSinkUsb3::setLossCallback(LossCallback callback)
+{
+    if (deviceIsOpen) {
+        cerr << "Error in Rhd2000FpgaSinkUsb3::setLossCallback: sink is already open." << endl;
+        return;
+    }
+    lossCallback = callback;
+}
+
+// Open the Opal Kelly board with the given serial number, configure its FPGA with bitfileName
+// (skipped if bitfileName is empty), reset the FPGA's FIFO and start the sink thread.  Returns
+// false if the board cannot be opened or configured.
+bool Rhd2000FpgaSinkUsb3::open(const string &serialNumber, const string &bitfileName)
+{
+    if (deviceIsOpen) {
+        cerr << "Error in Rhd2000FpgaSinkUsb3::open: a device is already open." << endl;
+        return false;
+    }
+    if (okFrontPanelDLL_LoadLib(NULL) == false) {
+        cerr << "Error in Rhd2000FpgaSinkUsb3::open: FrontPanel DLL could not be loaded." << endl;
+        return false;
+    }
+
+    dev = new okCFrontPanel;
+    okCFrontPanel::ErrorCode result = dev->OpenBySerial(serialNumber);
+    if (result != okCFrontPanel::NoError) {
+        cerr << "Error in Rhd2000FpgaSinkUsb3::open: cannot open device " << serialNumber <<
+                " (error " << result << ")." << endl;
+        delete dev;
+        dev = nullptr;
+        return false;
+    }
+    if (!bitfileName.empty()) {
+        result = dev->ConfigureFPGA(bitfileName);
+        if (result != okCFrontPanel::NoError) {
+            cerr << "Error in Rhd2000FpgaSinkUsb3::open: FPGA configuration from " << bitfileName <<
+                    " failed (error " << result << ")." << endl;
+            delete dev;
+            dev = nullptr;
+            return false;
+        }
+    }
+
+    // Pulse the reset bit to empty the FPGA's FIFO.
+    dev->SetWireInValue(FPGA_SINK_WIRE_IN_RESET, 0x01, 0x01);
+    dev->UpdateWireIns();
+    dev->SetWireInValue(FPGA_SINK_WIRE_IN_RESET, 0x00, 0x01);
+    dev->UpdateWireIns();
+
+    freeBuffers.clear();
+    fullBuffers.clear();
+    inFlight.clear();
+    for (unsigned int i = 0; i < buffers.size(); ++i) {
+        buffers[i].numBytes = 0;
+        freeBuffers.push_back(&buffers[i]);
+    }
+    fillBuffer = nullptr;
+    numCarryBytes = 0;
+    stopRequested = false;
+
+    maxInFlight = 0;
+    numBytesSubmitted = 0;
+    numBytesDropped = 0;
+    numTransfers = 0;
+    numBytesWritten = 0;
+    numBytesRead = 0;
+    numErrors = 0;
+    numBytesLost = 0;
+    numLatencies = 0;
+    latencyHistoryNext = 0;
+    latencyMaxMs = 0.0;
+
+    deviceIsOpen = true;
+    sinkThread = thread(&Rhd2000FpgaSinkUsb3::sinkThreadLoop, this);
+    return true;
+}
+
+bool Rhd2000FpgaSinkUsb3::isOpen() const
+{
+    return deviceIsOpen;
+}
+
+// Take a free buffer to collect submitted bytes, starting it with any carried-over bytes.
+// Returns false if every buffer is in use.  Called with bufferMutex held.
+bool Rhd2000FpgaSinkUsb3::startFillBuffer()
+{
+    if (freeBuffers.empty()) {
+        return false;
+    }
+    fillBuffer = freeBuffers.front();
+    freeBuffers.pop_front();
+    memcpy(fillBuffer->data.data(), carry, numCarryBytes);
+    fillBuffer->numBytes = numCarryBytes;
+    fillBuffer->numPaddingBytes = 0;
+    fillBuffer->writeFailed = false;
+    numCarryBytes = 0;
+    return true;
+}
+
+// Queue numBytes for the downstream FPGA.  Never blocks on USB: returns false, and counts the bytes
+// as dropped, if there is not enough free buffer space for all of them.  Must be called from one
+// thread only.
+bool Rhd2000FpgaSinkUsb3::submit(const unsigned char *data, unsigned int numBytes)
+{
+    if (!deviceIsOpen) {
+        cerr << "Error in Rhd2000FpgaSinkUsb3::submit: no device is open." << endl;
+        return false;
+    }
+
+    {
+        lock_guard<mutex> lockBuffers(bufferMutex);
+
+        // Carried-over bytes start the next fill buffer, so they take up room in it.
+        unsigned long long room = freeBuffers.size() * (unsigned long long) transferBytes;
+        if (fillBuffer) {
+            room += transferBytes - fillBuffer->numBytes;
+        } else if (room > 0) {
+            room -= numCarryBytes;
+        }
+        if (numBytes > room) {
+            numBytesDropped += numBytes;
+            return false;
+        }
+
+        unsigned int remaining = numBytes;
+        while (remaining > 0) {
+            if (!fillBuffer) {
+                startFillBuffer();
+            }
+            unsigned int chunk = min(remaining, transferBytes - fillBuffer->numBytes);
+            memcpy(fillBuffer->data.data() + fillBuffer->numBytes, data, chunk);
+            fillBuffer->numBytes += chunk;
+            data += chunk;
+            remaining -= chunk;
+            if (fillBuffer->numBytes == transferBytes) {
+                fullBuffers.push_back(fillBuffer);
+                fillBuffer = nullptr;
+            }
+        }
+        numBytesSubmitted += numBytes;
+    }
+    bufferReady.notify_one();
+    return true;
+}
+
+// Next buffer to write to the FPGA, or nullptr if fewer than 16 bytes are waiting.  A partly
+// filled buffer is sent as soon as the sink thread is free, so transfers grow with the backlog
+// instead of waiting for a full buffer; bytes past the last 16-byte boundary are carried over.
+// Called with bufferMutex held.
+Rhd2000FpgaSinkUsb3::TransferBuffer* Rhd2000FpgaSinkUsb3::takeWriteBuffer()
+{
+    TransferBuffer* buffer = nullptr;
+
+    if (!fullBuffers.empty()) {
+        buffer = fullBuffers.front();
+        fullBuffers.pop_front();
+    } else if (fillBuffer && fillBuffer->numBytes >= FPGA_SINK_TRANSFER_ALIGNMENT) {
+        buffer = fillBuffer;
+        fillBuffer = nullptr;
+        numCarryBytes = buffer->numBytes % FPGA_SINK_TRANSFER_ALIGNMENT;
+        buffer->numBytes -= numCarryBytes;
+        memcpy(carry, buffer->data.data() + buffer->numBytes, numCarryBytes);
+    }
+    return buffer;
+}
+
+// Send all submitted bytes, zero-padding the last transfer to a multiple of 16 bytes, and wait
+// until every transfer has been read back.
+void Rhd2000FpgaSinkUsb3::flush()
+{
+    if (!deviceIsOpen) {
+        return;
+    }
+
+    unique_lock<mutex> lockBuffers(bufferMutex);
+    if (!fillBuffer && numCarryBytes > 0) {
+        bufferFree.wait(lockBuffers, [this] { return !freeBuffers.empty(); });
+        startFillBuffer();
+    }
+    if (fillBuffer) {
+        unsigned int padding = (FPGA_SINK_TRANSFER_ALIGNMENT - fillBuffer->numBytes % FPGA_SINK_TRANSFER_ALIGNMENT) %
+                FPGA_SINK_TRANSFER_ALIGNMENT;
+        memset(fillBuffer->data.data() + fillBuffer->numBytes, 0, padding);
+        fillBuffer->numBytes += padding;
+        fillBuffer->numPaddingBytes = padding;
+        if (fillBuffer->numBytes > 0) {
+            fullBuffers.push_back(fillBuffer);
+        } else {
+            freeBuffers.push_back(fillBuffer);
+        }
+        fillBuffer = nullptr;
+    }
+    bufferReady.notify_one();
+    bufferFree.wait(lockBuffers, [this] { return fullBuffers.empty() && inFlight.empty(); });
+}
+
+// Forward all buffered data, stop the sink thread and close the device.
+void Rhd2000FpgaSinkUsb3::close()
+{
+    if (!deviceIsOpen) {
+        return;
+    }
+
+    flush();
+    {
+        lock_guard<mutex> lockBuffers(bufferMutex);
+        stopRequested = true;
+    }
+    bufferReady.notify_one();
+    sinkThread.join();
+
+    delete dev;
+    dev = nullptr;
+    deviceIsOpen = false;
+}
+
+// Sink thread: keep up to pipelineDepth transfers in flight, writing whenever data is waiting and
+// the pipeline has room, and otherwise reading back the oldest transfer.  A transfer stays in
+// inFlight from the start of its write until its read-back completes, or, if the write failed,
+// until it is the oldest and its loss has been reported.
+void Rhd2000FpgaSinkUsb3::sinkThreadLoop()
+{
+    while (true) {
+        TransferBuffer* writeBuffer = nullptr;
+        TransferBuffer* readBackBuffer = nullptr;
+        {
+            unique_lock<mutex> lockBuffers(bufferMutex);
+            bufferReady.wait(lockBuffers, [this] {
+                return stopRequested || !inFlight.empty() || !fullBuffers.empty() ||
+                        (fillBuffer && fillBuffer->numBytes >= FPGA_SINK_TRANSFER_ALIGNMENT);
+            });
+            if (inFlight.size() < pipelineDepth) {
+                writeBuffer = takeWriteBuffer();
+            }
+            if (writeBuffer) {
+                writeBuffer->writeStart = chrono::steady_clock::now();
+                inFlight.push_back(writeBuffer);
+                maxInFlight = max(maxInFlight, (unsigned int) inFlight.size());
+            } else if (!inFlight.empty()) {
+                readBackBuffer = inFlight.front();
+            } else {
+                break;
+            }
+        }
+
+        if (writeBuffer) {
+            long result = dev->WriteToPipeIn(FPGA_SINK_PIPE_IN, writeBuffer->numBytes, writeBuffer->data.data());
+            lock_guard<mutex> lockBuffers(bufferMutex);
+            if (result == (long) writeBuffer->numBytes) {
+                numTransfers++;
+                numBytesWritten += writeBuffer->numBytes;
+            } else {
+                // Nothing reached the FPGA, so there is nothing to read back.
+                numErrors++;
+                writeBuffer->writeFailed = true;
+            }
+            continue;
+        }
+
+        bool ok = false;
+        if (!readBackBuffer->writeFailed) {
+            long result = dev->ReadFromPipeOut(FPGA_SINK_PIPE_OUT, readBackBuffer->numBytes, readBuffer.data());
+            ok = (result == (long) readBackBuffer->numBytes);
+        }
+        double latencyMs = chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                                            readBackBuffer->writeStart).count();
+        unsigned int numDataBytes = readBackBuffer->numBytes - readBackBuffer->numPaddingBytes;
+        if (ok && returnCallback) {
+            returnCallback(readBuffer.data(), readBackBuffer->numBytes, readBackBuffer->numPaddingBytes);
+        } else if (!ok && lossCallback) {
+            lossCallback(numDataBytes);
+        }
+
+        {
+            lock_guard<mutex> lockBuffers(bufferMutex);
+            inFlight.pop_front();
+            if (ok) {
+                numBytesRead += readBackBuffer->numBytes;
+                numLatencies++;
+                latencyHistory[latencyHistoryNext] = latencyMs;
+                latencyHistoryNext = (latencyHistoryNext + 1) % FPGA_SINK_LATENCY_HISTORY;
+                latencyMaxMs = max(latencyMaxMs, latencyMs);
+            } else {
+                if (!readBackBuffer->writeFailed) {
+                    numErrors++;
+                }
+                numBytesLost += numDataBytes;
+            }
+            readBackBuffer->numBytes = 0;
+            freeBuffers.push_back(readBackBuffer);
+        }
+        bufferFree.notify_all();
+    }
+}
+
+// Snapshot of the sink's throughput, drop and latency counters.  May be called from any thread.
+void Rhd2000FpgaSinkUsb3::getStats(SinkStats &stats)
+{
+    vector<double> latencies;
+    {
+        lock_guard<mutex> lockBuffers(bufferMutex);
+        stats.numBuffers = (unsigned int) buffers.size();
+        stats.pipelineDepth = pipelineDepth;
+        stats.maxInFlight = maxInFlight;
+        stats.numBytesSubmitted = numBytesSubmitted;
+        stats.numBytesDropped = numBytesDropped;
+        stats.numTransfers = numTransfers;
+        stats.numBytesWritten = numBytesWritten;
+        stats.numBytesRead = numBytesRead;
+        stats.numErrors = numErrors;
+        stats.numBytesLost = numBytesLost;
+        stats.latencyMaxMs = latencyMaxMs;
+        latencies.assign(latencyHistory.begin(),
+                         latencyHistory.begin() + min<unsigned long long>(numLatencies, FPGA_SINK_LATENCY_HISTORY));
+    }
+
+    stats.meanTransferBytes = (stats.numTransfers > 0) ? (double) stats.numBytesWritten / stats.numTransfers : 0.0;
+    stats.latencyMedianMs = 0.0;
+    stats.latency99Ms = 0.0;
+    if (!latencies.empty()) {
+        sort(latencies.begin(), latencies.end());
+        stats.latencyMedianMs = latencies[latencies.size() / 2];
+        stats.latency99Ms = latencies[(latencies.size() * 99) / 100];
+    }
+}
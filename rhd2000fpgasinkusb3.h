@@ -0,0 +1,147 @@
+//----------------------------------------------------------------------------------
+// rhd2000fpgasinkusb3.h
+//
+// Rhd2000FpgaSinkUsb3 Class Header File
+//
+// Forwards acquired data to a second Opal Kelly board running a downstream processing
+// FPGA design, and reads back what it returns.  Bytes handed to submit() are gathered by
+// a dedicated sink thread into transfers that are a multiple of 16 bytes (as USB 3.0
+// pipes require), written to pipe-in 0x80, and read back from pipe-out 0xA0.  Up to
+// pipelineDepth transfers are in flight at once, so the next write goes out while the
+// FPGA is still working on the previous one.  submit() never waits on USB: if every
+// buffer is in use the bytes are dropped and counted.
+//----------------------------------------------------------------------------------
+
+#ifndef RHD2000FPGASINKUSB3_H
+#define RHD2000FPGASINKUSB3_H
+
+// Downstream FPGA endpoint addresses
+#define FPGA_SINK_PIPE_IN 0x80
+#define FPGA_SINK_PIPE_OUT 0xa0
+#define FPGA_SINK_WIRE_IN_RESET 0x10
+
+// USB 3.0 pipe transfers must be a multiple of this many bytes
+#define FPGA_SINK_TRANSFER_ALIGNMENT 16
+
+// Default upper bound on bytes per pipe transfer; smaller batches go out as soon as the
+// sink thread is free
+#define FPGA_SINK_TRANSFER_BYTES 65536
+
+// Default number of transfer buffers, and of transfers written but not yet read back
+#define FPGA_SINK_NUM_BUFFERS 8
+#define FPGA_SINK_PIPELINE_DEPTH 2
+
+// Number of most recent transfer latencies kept for the percentile statistics
+#define FPGA_SINK_LATENCY_HISTORY 1024
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <functional>
+
+using namespace std;
+
+class okCFrontPanel;
+
+class Rhd2000FpgaSinkUsb3
+{
+public:
+    Rhd2000FpgaSinkUsb3(unsigned int transferBytes = FPGA_SINK_TRANSFER_BYTES,
+                        unsigned int numBuffers = FPGA_SINK_NUM_BUFFERS,
+                        unsigned int pipelineDepth = FPGA_SINK_PIPELINE_DEPTH);
+    ~Rhd2000FpgaSinkUsb3();
+
+    // Called on the sink thread with the bytes read back for each transfer.  The last
+    // numPaddingBytes of them answer the zero padding flush() added, not submitted data.
+    typedef function<void(const unsigned char *data, unsigned int numBytes, unsigned int numPaddingBytes)> ReturnCallback;
+    void setReturnCallback(ReturnCallback callback);
+
+    // Called on the sink thread, in turn with the return callback, with the number of submitted
+    // bytes a failed transfer carried, which will never be read back.  (Bytes submit() drops are
+    // never accepted; its return value reports them.)
+    typedef function<void(unsigned int numBytes)> LossCallback;
+    void setLossCallback(LossCallback callback);
+
+    bool open(const string &serialNumber, const string &bitfileName);
+    bool isOpen() const;
+    bool submit(const unsigned char *data, unsigned int numBytes);
+    void flush();
+    void close();
+
+    struct SinkStats {
+        unsigned int numBuffers;
+        unsigned int pipelineDepth;
+        unsigned int maxInFlight;               // most transfers written but not yet read back
+        unsigned long long numBytesSubmitted;   // bytes accepted by submit()
+        unsigned long long numBytesDropped;     // bytes rejected because no buffer was free
+        unsigned long long numTransfers;        // pipe-in writes completed
+        unsigned long long numBytesWritten;
+        unsigned long long numBytesRead;
+        unsigned long long numErrors;           // failed pipe transfers
+        unsigned long long numBytesLost;        // submitted bytes of failed transfers
+        double meanTransferBytes;
+        double latencyMedianMs;                 // write start to read-back end, over the last
+        double latency99Ms;                     // FPGA_SINK_LATENCY_HISTORY transfers
+        double latencyMaxMs;                    // since open()
+    };
+    void getStats(SinkStats &stats);
+
+private:
+    Rhd2000FpgaSinkUsb3(const Rhd2000FpgaSinkUsb3 &);
+    Rhd2000FpgaSinkUsb3& operator=(const Rhd2000FpgaSinkUsb3 &);
+
+    struct TransferBuffer {
+        vector<unsigned char> data;
+        unsigned int numBytes;
+        unsigned int numPaddingBytes;   // zero bytes flush() added at the end of data
+        bool writeFailed;               // left in inFlight so that its loss is reported in order
+        chrono::steady_clock::time_point writeStart;
+    };
+
+    unsigned int transferBytes;
+    unsigned int pipelineDepth;
+    vector<TransferBuffer> buffers;
+    vector<unsigned char> readBuffer;
+    okCFrontPanel *dev;
+    bool deviceIsOpen;
+    ReturnCallback returnCallback;
+    LossCallback lossCallback;
+
+    // Buffers shared with the sink thread, guarded by bufferMutex.  fillBuffer collects submitted
+    // bytes until the sink thread takes its whole 16-byte units; the remainder waits in carry.
+    mutex bufferMutex;
+    condition_variable bufferReady;     // signalled when data is submitted or stop is requested
+    condition_variable bufferFree;      // signalled when the sink thread returns a buffer
+    TransferBuffer* fillBuffer;
+    unsigned char carry[FPGA_SINK_TRANSFER_ALIGNMENT];
+    unsigned int numCarryBytes;
+    deque<TransferBuffer*> freeBuffers;
+    deque<TransferBuffer*> fullBuffers;     // waiting to be written
+    deque<TransferBuffer*> inFlight;        // written, waiting to be read back
+    bool stopRequested;
+
+    thread sinkThread;
+    void sinkThreadLoop();
+    TransferBuffer* takeWriteBuffer();
+    bool startFillBuffer();
+
+    // Statistics, guarded by bufferMutex
+    unsigned int maxInFlight;
+    unsigned long long numBytesSubmitted;
+    unsigned long long numBytesDropped;
+    unsigned long long numTransfers;
+    unsigned long long numBytesWritten;
+    unsigned long long numBytesRead;
+    unsigned long long numErrors;
+    unsigned long long numBytesLost;
+    unsigned long long numLatencies;    // successful read-backs
+    vector<double> latencyHistory;
+    unsigned int latencyHistoryNext;
+    double latencyMaxMs;
+};
+
+#endif // RHD2000FPGASINKUSB3_H
@@ -0,0 +1,251 @@
+//----------------------------------------------------------------------------------
+// rhd2000frameencoderusb3.cpp
+//
+// Rhd2000FrameEncoderUsb3 Class
+//
+// Framed binary protocol for forwarding amplifier data downstream.
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#include "rhd2000frameencoderusb3.h"
+#include "rhd2000datablockusb3.h"
+
+using namespace std;
+
+// Sum of the 32-bit words of a header, including headerChecksum.
+static uint32_t sumHeaderWords(const Rhd2000FrameHeader &header)
+{
+    uint32_t words[FRAME_HEADER_BYTES / 4];
+    memcpy(words, &header, FRAME_HEADER_BYTES);
+    uint32_t sum = 0;
+    for (int i = 0; i < FRAME_HEADER_BYTES / 4; ++i) {
+        sum += words[i];
+    }
+    return sum;
+}
+
+static int countBits(unsigned int mask)
+{
+    int count = 0;
+    for (; mask != 0; mask &= mask - 1) {
+        count++;
+    }
+    return count;
+}
+
+// Constructor.  Selects nothing; call selectAllChannels() or selectChannels() before encode().
+Rhd2000FrameEncoderUsb3::Rhd2000FrameEncoderUsb3() :
+    streamMask(0),
+    numChannels(0),
+    payloadLayout(PayloadTimeMajor),
+    sequence(0),
+    sourceStride(0),
+    sourceNumStreams(-1),
+    sourceLayout(Rhd2000DataBlockUsb3::TimeMajor),
+    fullSelection(false)
+{
+    memset(channelMasks, 0, sizeof(channelMasks));
+    updateFrameSize();
+}
+
+// Select every channel of the data streams in streamMask (e.g., the board's
+// getEnabledDataStreamMask()).
+void Rhd2000FrameEncoderUsb3::selectAllChannels(unsigned int streamMask_)
+{
+    unsigned int allChannels[MAX_NUM_DATA_STREAMS];
+    for (int stream = 0; stream < MAX_NUM_DATA_STREAMS; ++stream) {
+        allChannels[stream] = (streamMask_ & (1u << stream)) ? 0xffffffffu : 0;
+    }
+    selectChannels(streamMask_, allChannels);
+}
+
+// Select the channels to forward.  streamMask has bit n set if hardware data stream n is enabled,
+// i.e. it describes which streams the blocks passed to encode() contain; bit c of channelMasks[n]
+// selects channel c of stream n.  Returns false, leaving the selection unchanged, if a channel of
+// a stream that is not enabled is selected.
+bool Rhd2000FrameEncoderUsb3::selectChannels(unsigned int streamMask_,
+                                             const unsigned int channelMasks_[MAX_NUM_DATA_STREAMS])
+{
+    int count = 0;
+    for (int stream = 0; stream < MAX_NUM_DATA_STREAMS; ++stream) {
+        if (channelMasks_[stream] != 0 && !(streamMask_ & (1u << stream))) {
+            cerr << "Error in Rhd2000FrameEncoderUsb3::selectChannels: channels selected on disabled stream " <<
+                    stream << "." << endl;
+            return false;
+        }
+        count += countBits(channelMasks_[stream]);
+    }
+
+    streamMask = streamMask_;
+    memcpy(channelMasks, channelMasks_, sizeof(channelMasks));
+    numChannels = count;
+    sourceNumStreams = -1;
+    updateFrameSize();
+    return true;
+}
+
+void Rhd2000FrameEncoderUsb3::setPayloadLayout(PayloadLayout layout)
+{
+    payloadLayout = layout;
+}
+
+// Restart sequence numbers from zero, e.g. at the start of a new acquisition.
+void Rhd2000FrameEncoderUsb3::resetSequence()
+{
+    sequence = 0;
+}
+
+void Rhd2000FrameEncoderUsb3::updateFrameSize()
+{
+    unsigned int payloadBytes = numChannels * SAMPLES_PER_DATA_BLOCK * sizeof(unsigned short);
+    unsigned int frameBytes = FRAME_HEADER_BYTES + payloadBytes;
+    frameBytes = ((frameBytes + FRAME_ALIGNMENT - 1) / FRAME_ALIGNMENT) * FRAME_ALIGNMENT;
+    frame.assign(frameBytes, 0);
+}
+
+// Work out where each selected channel lives in blocks shaped like block.  Returns false if the
+// block does not hold the streams in streamMask.
+bool Rhd2000FrameEncoderUsb3::updateSourceOffsets(const Rhd2000DataBlockUsb3 &block)
+{
+    if (block.getNumDataStreams() == sourceNumStreams && block.getAmplifierLayout() == sourceLayout) {
+        return true;
+    }
+    if (block.getNumDataStreams() != countBits(streamMask)) {
+        cerr << "Error in Rhd2000FrameEncoderUsb3::encode: block has " << block.getNumDataStreams() <<
+                " data streams but " << countBits(streamMask) << " are enabled in the stream mask." << endl;
+        return false;
+    }
+
+    // Block stream index of each hardware stream: enabled streams are stored in ascending order.
+    int blockStream[MAX_NUM_DATA_STREAMS];
+    int numStreams = 0;
+    for (int stream = 0; stream < MAX_NUM_DATA_STREAMS; ++stream) {
+        blockStream[stream] = (streamMask & (1u << stream)) ? numStreams++ : -1;
+    }
+
+    sourceOffsets.clear();
+    for (int channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
+        for (int stream = 0; stream < MAX_NUM_DATA_STREAMS; ++stream) {
+            if (channelMasks[stream] & (1u << channel)) {
+                sourceOffsets.push_back(block.fastIndex(blockStream[stream], channel, 0));
+            }
+        }
+    }
+    sourceStride = block.amplifierSampleStride();
+    sourceNumStreams = block.getNumDataStreams();
+    sourceLayout = block.getAmplifierLayout();
+    fullSelection = (numChannels == (unsigned int) (numStreams * CHANNELS_PER_STREAM));
+    return true;
+}
+
+// Copy the selected channels of one block into the payload in the order set by payloadLayout.
+template <typename Sample>
+void Rhd2000FrameEncoderUsb3::gatherSamples(const Sample *source, unsigned short *payload) const
+{
+    const int n = (int) sourceOffsets.size();
+    const int *offsets = sourceOffsets.data();
+
+    if (payloadLayout == PayloadChannelMajor) {
+        for (int i = 0; i < n; ++i) {
+            const Sample *channel = source + offsets[i];
+            for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+                payload[t] = (unsigned short) channel[t * sourceStride];
+            }
+            payload += SAMPLES_PER_DATA_BLOCK;
+        }
+    } else {
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            const Sample *frameStart = source + t * sourceStride;
+            for (int i = 0; i < n; ++i) {
+                payload[i] = (unsigned short) frameStart[offsets[i]];
+            }
+            payload += n;
+        }
+    }
+}
+
+// Encode one block as a frame, available from getFrame() until the next call.  Returns the frame
+// length in bytes, or 0 if the block does not match the stream mask.  Every call, successful or
+// not, uses up a sequence number, so a consumer sees a gap wherever a block was not forwarded.
+unsigned int Rhd2000FrameEncoderUsb3::encode(const Rhd2000DataBlockUsb3 &block)
+{
+    unsigned long long frameSequence = sequence++;
+    if (!updateSourceOffsets(block)) {
+        return 0;
+    }
+
+    const unsigned int payloadBytes = numChannels * SAMPLES_PER_DATA_BLOCK * sizeof(unsigned short);
+    Rhd2000FrameHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = FRAME_MAGIC;
+    header.version = FRAME_VERSION;
+    header.headerBytes = FRAME_HEADER_BYTES;
+    header.frameBytes = (uint32_t) frame.size();
+    header.payloadBytes = payloadBytes;
+    header.sequence = frameSequence;
+    header.firstTimestamp = block.timeStamp[0];
+    header.numSamples = SAMPLES_PER_DATA_BLOCK;
+    header.numChannels = (uint16_t) numChannels;
+    header.streamMask = streamMask;
+    header.payloadLayout = (uint16_t) payloadLayout;
+    header.sampleBits = 16;
+    memcpy(header.channelMasks, channelMasks, sizeof(channelMasks));
+    header.headerChecksum = 0u - sumHeaderWords(header);
+    memcpy(frame.data(), &header, FRAME_HEADER_BYTES);
+
+    // The channel order matches a TimeMajor block, so a full selection of one is a single copy.
+    unsigned short *payload = (unsigned short*) (frame.data() + FRAME_HEADER_BYTES);
+    if (block.getSampleFormat() == Rhd2000DataBlockUsb3::UInt16Samples) {
+        if (fullSelection && payloadLayout == PayloadTimeMajor && sourceLayout == Rhd2000DataBlockUsb3::TimeMajor) {
+            memcpy(payload, block.amplifierData16.data(), payloadBytes);
+        } else {
+            gatherSamples(block.amplifierData16.data(), payload);
+        }
+    } else {
+        gatherSamples(block.amplifierDataFast, payload);
+    }
+    return (unsigned int) frame.size();
+}
+
+const unsigned char* Rhd2000FrameEncoderUsb3::getFrame() const
+{
+    return frame.data();
+}
+
+unsigned int Rhd2000FrameEncoderUsb3::getNumChannels() const
+{
+    return numChannels;
+}
+
+// Length of every frame with the current selection, header and padding included.
+unsigned int Rhd2000FrameEncoderUsb3::getFrameBytes() const
+{
+    return (unsigned int) frame.size();
+}
+
+// Sequence number the next frame will carry.
+unsigned long long Rhd2000FrameEncoderUsb3::getSequence() const
+{
+    return sequence;
+}
+
+// Copy out and validate the header at the start of data.  Returns false if numBytes is too short
+// or the bytes are not a frame header this version understands.
+bool Rhd2000FrameEncoderUsb3::parseHeader(const unsigned char *data, unsigned int numBytes,
+                                          Rhd2000FrameHeader &header)
+{
+    if (numBytes < FRAME_HEADER_BYTES) {
+        return false;
+    }
+    memcpy(&header, data, FRAME_HEADER_BYTES);
+    if (header.magic != FRAME_MAGIC || header.version != FRAME_VERSION || header.headerBytes != FRAME_HEADER_BYTES ||
+            sumHeaderWords(header) != 0) {
+        return false;
+    }
+    return header.payloadBytes == header.numChannels * header.numSamples * (header.sampleBits / 8) &&
+            header.frameBytes >= FRAME_HEADER_BYTES + header.payloadBytes && header.frameBytes % FRAME_ALIGNMENT == 0;
+}
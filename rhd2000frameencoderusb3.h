@@ -0,0 +1,109 @@
+//----------------------------------------------------------------------------------
+// rhd2000frameencoderusb3.h
+//
+// Rhd2000FrameEncoderUsb3 Class Header File
+//
+// Packs the amplifier data of one data block into a self-describing frame for the
+// downstream FPGA (or any other byte-stream consumer).  Each frame is a fixed-size
+// Rhd2000FrameHeader followed by the payload, padded with zeros to a multiple of
+// FRAME_ALIGNMENT bytes so that frames always start on a USB 3.0 pipe boundary.
+//
+// The payload carries a selectable subset of amplifier channels as 16-bit words, exactly
+// as delivered by the FPGA.  Channels are always in the same defined order: ascending
+// channel number, and for each channel ascending hardware data stream -- the order of
+// the USB frames, so a full selection is a straight copy of a TimeMajor block.  With
+// PayloadTimeMajor the words are ordered [t][selected channel]; with PayloadChannelMajor
+// they are ordered [selected channel][t].
+//
+// Consecutive frames have consecutive sequence numbers and their first timestamps differ
+// by numSamples, so a consumer can detect dropped frames and gaps in acquisition.  All
+// integers are little-endian.
+//----------------------------------------------------------------------------------
+
+#ifndef RHD2000FRAMEENCODERUSB3_H
+#define RHD2000FRAMEENCODERUSB3_H
+
+#define FRAME_MAGIC 0x46444852      // "RHDF"
+#define FRAME_VERSION 1
+
+#define FRAME_HEADER_BYTES 176
+
+// Frames are padded to a multiple of this many bytes
+#define FRAME_ALIGNMENT 16
+
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+#include "rhd2000datablockusb3.h"
+#include "rhd2000evalboardusb3.h"
+
+struct Rhd2000FrameHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerBytes;               // FRAME_HEADER_BYTES
+    uint32_t frameBytes;                // header, payload and padding
+    uint32_t payloadBytes;
+    uint64_t sequence;                  // frames encoded since resetSequence()
+    uint32_t firstTimestamp;            // timestamp of the first sample in the frame
+    uint16_t numSamples;                // samples per channel
+    uint16_t numChannels;               // selected channels
+    uint32_t streamMask;                // bit n set if hardware data stream n was enabled
+    uint16_t payloadLayout;             // Rhd2000FrameEncoderUsb3::PayloadLayout
+    uint16_t sampleBits;                // 16: unsigned amplifier words, 0x8000 = 0 microvolts
+    uint32_t reserved;
+    uint32_t channelMasks[MAX_NUM_DATA_STREAMS];    // bit c of word n: channel c of stream n selected
+    uint32_t headerChecksum;            // chosen so that the header's 32-bit words sum to zero
+};
+
+static_assert(sizeof(Rhd2000FrameHeader) == FRAME_HEADER_BYTES, "frame header size mismatch");
+static_assert(FRAME_HEADER_BYTES % FRAME_ALIGNMENT == 0, "frame header must keep the payload aligned");
+
+class Rhd2000FrameEncoderUsb3
+{
+public:
+    Rhd2000FrameEncoderUsb3();
+
+    enum PayloadLayout {
+        PayloadTimeMajor = 0,           // [t][selected channel]
+        PayloadChannelMajor = 1         // [selected channel][t]
+    };
+
+    void selectAllChannels(unsigned int streamMask);
+    bool selectChannels(unsigned int streamMask, const unsigned int channelMasks[MAX_NUM_DATA_STREAMS]);
+    void setPayloadLayout(PayloadLayout layout);
+    void resetSequence();
+
+    unsigned int encode(const Rhd2000DataBlockUsb3 &block);
+    const unsigned char* getFrame() const;
+    unsigned int getNumChannels() const;
+    unsigned int getFrameBytes() const;
+    unsigned long long getSequence() const;
+
+    static bool parseHeader(const unsigned char *data, unsigned int numBytes, Rhd2000FrameHeader &header);
+
+private:
+    unsigned int streamMask;
+    unsigned int channelMasks[MAX_NUM_DATA_STREAMS];
+    unsigned int numChannels;
+    PayloadLayout payloadLayout;
+    unsigned long long sequence;
+    vector<unsigned char> frame;
+
+    // Position of each selected channel's first sample in the source block, and the distance
+    // between its successive samples; rebuilt when the block shape changes
+    vector<int> sourceOffsets;
+    int sourceStride;
+    int sourceNumStreams;
+    Rhd2000DataBlockUsb3::AmplifierLayout sourceLayout;
+    bool fullSelection;
+
+    void updateFrameSize();
+    bool updateSourceOffsets(const Rhd2000DataBlockUsb3 &block);
+
+    template <typename Sample>
+    void gatherSamples(const Sample *source, unsigned short *payload) const;
+};
+
+#endif // RHD2000FRAMEENCODERUSB3_H
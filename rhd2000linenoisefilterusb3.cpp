@@ -0,0 +1,195 @@
+//----------------------------------------------------------------------------------
+// rhd2000linenoisefilterusb3.cpp
+//
+// Rhd2000LineNoiseFilterUsb3 Class
+//
+// Adaptive mains canceller with per-stream line frequency tracking.
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <cmath>
+
+#include "rhd2000linenoisefilterusb3.h"
+#include "rhd2000datablockusb3.h"
+
+using namespace std;
+
+// Fraction of the measured frequency error corrected per block
+#define LINE_TRACKING_GAIN 0.05
+
+// Fits with an RMS amplitude below this many ADC steps per channel are too weak to track
+#define LINE_TRACKING_MIN_AMPLITUDE 1.0
+
+static const double twoPi = 2.0 * 3.14159265358979323846;
+
+// Constructor.  lineFrequencyHz is the nominal mains frequency, 50 or 60 Hz; harmonics
+// 1 to numHarmonics are removed, each by a notch bandwidthHz wide (-3 dB).  Tracking is on.
+Rhd2000LineNoiseFilterUsb3::Rhd2000LineNoiseFilterUsb3(double lineFrequencyHz, int numHarmonics_, double bandwidthHz_) :
+    nominalHz(lineFrequencyHz),
+    numHarmonics(numHarmonics_),
+    bandwidthHz(bandwidthHz_),
+    tracking(true),
+    maxDeviationHz(0.5),
+    sampleRate(0.0),
+    stepSize(0.0f)
+{
+}
+
+// Follow drifts of the line frequency of up to maxDeviationHz from nominal, or hold it at nominal.
+// Takes effect at the next prepare().
+void Rhd2000LineNoiseFilterUsb3::setTracking(bool enabled, double maxDeviationHz_)
+{
+    tracking = enabled;
+    maxDeviationHz = maxDeviationHz_;
+}
+
+bool Rhd2000LineNoiseFilterUsb3::prepare(int numChannels, double sampleRate_)
+{
+    if (numHarmonics < 1 || nominalHz <= 0.0 || (numHarmonics * (nominalHz + maxDeviationHz)) >= sampleRate_ / 2.0) {
+        cerr << "Error in Rhd2000LineNoiseFilterUsb3::prepare: " << numHarmonics << " harmonics of " << nominalHz <<
+                " Hz do not fit below " << sampleRate_ / 2.0 << " Hz." << endl;
+        return false;
+    }
+    if (bandwidthHz <= 0.0 || bandwidthHz >= nominalHz / 2.0) {
+        cerr << "Error in Rhd2000LineNoiseFilterUsb3::prepare: notch bandwidth " << bandwidthHz <<
+                " Hz must lie in (0, " << nominalHz / 2.0 << ") Hz." << endl;
+        return false;
+    }
+    sampleRate = sampleRate_;
+
+    // An LMS canceller updated as w += mu e r, with unit-amplitude references, notches each
+    // harmonic with a -3 dB width of mu radians per sample.
+    stepSize = (float) (twoPi * bandwidthHz / sampleRate);
+
+    int numStreams = numChannels / CHANNELS_PER_STREAM;
+    weights.assign(numStreams * numHarmonics * 2 * CHANNELS_PER_STREAM, 0.0f);
+    streams.resize(numStreams);
+    reportedFrequency.reset(new atomic<double>[numStreams]);
+    for (int i = 0; i < numStreams; ++i) {
+        streams[i].phase = 0.0;
+        streams[i].frequency = nominalHz;
+        streams[i].reference.assign(SAMPLES_PER_DATA_BLOCK * numHarmonics * 2, 0.0f);
+        streams[i].previousFit.assign(2 * CHANNELS_PER_STREAM, 0.0f);
+        reportedFrequency[i] = nominalHz;
+    }
+    return true;
+}
+
+// Oscillators and fits are per stream.
+int Rhd2000LineNoiseFilterUsb3::getChannelGranularity() const
+{
+    return CHANNELS_PER_STREAM;
+}
+
+// Line frequency currently tracked on a stream, in Hz.  May be called while the engine runs.
+double Rhd2000LineNoiseFilterUsb3::getLineFrequency(int stream) const
+{
+    if (stream < 0 || stream >= (int) streams.size()) {
+        return nominalHz;
+    }
+    return reportedFrequency[stream];
+}
+
+void Rhd2000LineNoiseFilterUsb3::processTile(float *samples, int firstChannel, int numTileChannels)
+{
+    for (int offset = 0; offset < numTileChannels; offset += CHANNELS_PER_STREAM) {
+        int streamIndex = (firstChannel + offset) / CHANNELS_PER_STREAM;
+        StreamState &stream = streams[streamIndex];
+        float *weightBlock = weights.data() + streamIndex * numHarmonics * 2 * CHANNELS_PER_STREAM;
+        makeReference(stream);
+        cancel(stream, weightBlock, samples + offset, numTileChannels);
+        if (tracking) {
+            track(stream, weightBlock, streamIndex);
+        }
+    }
+}
+
+// Cosine and sine of every harmonic for the block's samples.  The fundamental phasor is rotated
+// sample by sample in double precision from an exact start, and harmonics follow by angle addition.
+void Rhd2000LineNoiseFilterUsb3::makeReference(StreamState &stream)
+{
+    const double step = twoPi * stream.frequency / sampleRate;
+    const double stepCos = cos(step), stepSin = sin(step);
+    double c1 = cos(stream.phase), s1 = sin(stream.phase);
+    float *reference = stream.reference.data();
+    for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        double c = c1, s = s1;
+        for (int k = 0; k < numHarmonics; ++k) {
+            *reference++ = (float) c;
+            *reference++ = (float) s;
+            double next = c * c1 - s * s1;
+            s = s * c1 + c * s1;
+            c = next;
+        }
+        double next = c1 * stepCos - s1 * stepSin;
+        s1 = s1 * stepCos + c1 * stepSin;
+        c1 = next;
+    }
+    stream.phase = fmod(stream.phase + SAMPLES_PER_DATA_BLOCK * step, twoPi);
+}
+
+// Subtract each channel's fit from its samples and adapt the fit to the residual.  The 32
+// channels of the stream are adjacent in every row, so each inner loop is one SIMD sweep.
+void Rhd2000LineNoiseFilterUsb3::cancel(const StreamState &stream, float *weightBlock, float *samples, int rowLength)
+{
+    const float *reference = stream.reference.data();
+    for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        float *x = samples + t * rowLength;
+        float estimate[CHANNELS_PER_STREAM] = {};
+        for (int k = 0; k < numHarmonics; ++k) {
+            const float c = reference[2 * k], s = reference[2 * k + 1];
+            const float *wc = weightBlock + (2 * k) * CHANNELS_PER_STREAM;
+            const float *ws = wc + CHANNELS_PER_STREAM;
+            for (int i = 0; i < CHANNELS_PER_STREAM; ++i) {
+                estimate[i] += wc[i] * c + ws[i] * s;
+            }
+        }
+        float error[CHANNELS_PER_STREAM];
+        for (int i = 0; i < CHANNELS_PER_STREAM; ++i) {
+            error[i] = x[i] - estimate[i];
+            x[i] = error[i];
+        }
+        for (int k = 0; k < numHarmonics; ++k) {
+            const float c = stepSize * reference[2 * k], s = stepSize * reference[2 * k + 1];
+            float *wc = weightBlock + (2 * k) * CHANNELS_PER_STREAM;
+            float *ws = wc + CHANNELS_PER_STREAM;
+            for (int i = 0; i < CHANNELS_PER_STREAM; ++i) {
+                wc[i] += c * error[i];
+                ws[i] += s * error[i];
+            }
+        }
+        reference += 2 * numHarmonics;
+    }
+}
+
+// A channel's fundamental fit, as the phasor wc - j ws, turns at the oscillator's frequency error.
+// Sum fit(now) * conj(fit(one block ago)) over the stream's channels, so strongly interfered
+// channels dominate, and correct a fraction of the error its angle gives.
+void Rhd2000LineNoiseFilterUsb3::track(StreamState &stream, const float *weightBlock, int streamIndex)
+{
+    const float *wc = weightBlock;
+    const float *ws = weightBlock + CHANNELS_PER_STREAM;
+    float *previousWc = stream.previousFit.data();
+    float *previousWs = previousWc + CHANNELS_PER_STREAM;
+    double re = 0.0, im = 0.0;
+    for (int i = 0; i < CHANNELS_PER_STREAM; ++i) {
+        re += (double) wc[i] * previousWc[i] + (double) ws[i] * previousWs[i];
+        im += (double) wc[i] * previousWs[i] - (double) ws[i] * previousWc[i];
+        previousWc[i] = wc[i];
+        previousWs[i] = ws[i];
+    }
+
+    const double minimumPower = CHANNELS_PER_STREAM * LINE_TRACKING_MIN_AMPLITUDE * LINE_TRACKING_MIN_AMPLITUDE;
+    if (sqrt(re * re + im * im) < minimumPower) {
+        return;
+    }
+    double error = atan2(im, re) * sampleRate / (twoPi * SAMPLES_PER_DATA_BLOCK);
+    double frequency = stream.frequency + LINE_TRACKING_GAIN * error;
+    if (frequency > nominalHz + maxDeviationHz) frequency = nominalHz + maxDeviationHz;
+    if (frequency < nominalHz - maxDeviationHz) frequency = nominalHz - maxDeviationHz;
+    stream.frequency = frequency;
+    reportedFrequency[streamIndex] = frequency;
+}
@@ -0,0 +1,69 @@
+//----------------------------------------------------------------------------------
+// rhd2000linenoisefilterusb3.h
+//
+// Rhd2000LineNoiseFilterUsb3 Class Header File
+//
+// Removes mains interference (50 or 60 Hz and its harmonics) from every amplifier channel,
+// as a Rhd2000DspEngineUsb3 stage.  Each data stream runs one oscillator at the tracked line
+// frequency; each channel fits the cosine and sine of every harmonic of that oscillator to
+// its own signal by LMS and subtracts the fit (an adaptive line canceller).  This acts as a
+// notch bandwidthHz wide at every harmonic and costs a fixed amount per sample, whatever the
+// sample rate or notch width.
+//
+// The line frequency is tracked per stream: if the oscillator is off by df, the fitted
+// fundamentals of all channels rotate at df, so once per block the stage measures that
+// rotation, summed over the stream's channels, and steers the oscillator onto the mains.
+// Tracking is limited to maxDeviationHz of the nominal frequency.  Streams are tracked
+// independently, so results do not depend on how the engine tiles or schedules channels.
+//----------------------------------------------------------------------------------
+
+#ifndef RHD2000LINENOISEFILTERUSB3_H
+#define RHD2000LINENOISEFILTERUSB3_H
+
+#include <vector>
+#include <atomic>
+#include <memory>
+
+using namespace std;
+
+#include "rhd2000dspengineusb3.h"
+
+class Rhd2000LineNoiseFilterUsb3 : public Rhd2000DspStageUsb3
+{
+public:
+    Rhd2000LineNoiseFilterUsb3(double lineFrequencyHz = 60.0, int numHarmonics = 3, double bandwidthHz = 1.0);
+
+    void setTracking(bool enabled, double maxDeviationHz = 0.5);
+
+    bool prepare(int numChannels, double sampleRate) override;
+    void processTile(float *samples, int firstChannel, int numTileChannels) override;
+    int getChannelGranularity() const override;
+
+    double getLineFrequency(int stream) const;
+
+private:
+    struct StreamState {
+        double phase;                   // oscillator phase at the next sample, radians
+        double frequency;               // oscillator frequency, Hz
+        vector<float> reference;        // [t][harmonic][cos, sin] for the current block
+        vector<float> previousFit;      // fundamental [cos, sin][channel] weights one block ago
+    };
+
+    double nominalHz;
+    int numHarmonics;
+    double bandwidthHz;
+    bool tracking;
+    double maxDeviationHz;
+
+    double sampleRate;
+    float stepSize;                     // LMS step size, giving notches bandwidthHz wide
+    vector<float> weights;              // [stream][harmonic][cos, sin][channel]
+    vector<StreamState> streams;
+    unique_ptr<atomic<double>[]> reportedFrequency;
+
+    void makeReference(StreamState &stream);
+    void cancel(const StreamState &stream, float *weightBlock, float *samples, int rowLength);
+    void track(StreamState &stream, const float *weightBlock, int streamIndex);
+};
+
+#endif // RHD2000LINENOISEFILTERUSB3_H
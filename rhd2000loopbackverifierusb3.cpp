@@ -0,0 +1,257 @@
+//----------------------------------------------------------------------------------
+// rhd2000loopbackverifierusb3.cpp
+//
+// Rhd2000LoopbackVerifierUsb3 Class
+//
+// Block-by-block verification of a downstream FPGA's output against a reference model.
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+
+#include "rhd2000loopbackverifierusb3.h"
+#include "rhd2000fpgasinkusb3.h"
+
+using namespace std;
+
+// Reference model of a loopback design: the output equals the input.
+void Rhd2000LoopbackVerifierUsb3::identityModel(const unsigned char *input, unsigned int numBytes,
+                                                unsigned char *expected)
+{
+    memcpy(expected, input, numBytes);
+}
+
+// Constructor.  queueBytes bounds the expected output held for blocks still in flight.
+Rhd2000LoopbackVerifierUsb3::Rhd2000LoopbackVerifierUsb3(ReferenceModel model_, unsigned int queueBytes) :
+    model(model_)
+{
+    expectedBytes.resize(queueBytes > 0 ? queueBytes : 1);
+    latencyHistory.resize(LOOPBACK_VERIFIER_LATENCY_HISTORY);
+    reset();
+}
+
+// Forget all pending blocks and clear the statistics.  Call only while no data is in flight.
+void Rhd2000LoopbackVerifierUsb3::reset()
+{
+    lock_guard<mutex> lockVerifier(verifierMutex);
+    expectedHead = 0;
+    expectedTail = 0;
+    pendingBlocks.clear();
+
+    numBlocksSent = 0;
+    numBlocksVerified = 0;
+    numBlocksMismatched = 0;
+    numBlocksLost = 0;
+    numBlocksNotQueued = 0;
+    numBytesVerified = 0;
+    numBytesLost = 0;
+    numWordsMismatched = 0;
+    numExtraBytes = 0;
+    firstMismatchedBlock = -1;
+    latencyHistoryNext = 0;
+    latencyMaxMs = 0.0;
+}
+
+// Route the data bytes sink reads back into checkReturned(), leaving out flush padding, and the
+// bytes of its failed transfers into skipLost().  Must be called before the sink is opened.
+void Rhd2000LoopbackVerifierUsb3::attach(Rhd2000FpgaSinkUsb3 &sink)
+{
+    sink.setReturnCallback([this](const unsigned char *data, unsigned int numBytes, unsigned int numPaddingBytes) {
+        checkReturned(data, numBytes - numPaddingBytes);
+    });
+    sink.setLossCallback([this](unsigned int numBytes) {
+        skipLost(numBytes);
+    });
+}
+
+// Queue the reference model's output for one block, then hand the block to sink.  Returns false,
+// leaving nothing queued, if the expected-byte queue is full or the sink drops the block.  Must be
+// called from one thread only (the one feeding the sink).
+bool Rhd2000LoopbackVerifierUsb3::submit(Rhd2000FpgaSinkUsb3 &sink, const unsigned char *data, unsigned int numBytes)
+{
+    const unsigned long long capacity = expectedBytes.size();
+    if (numBytes > capacity) {
+        cerr << "Error in Rhd2000LoopbackVerifierUsb3::submit: block is larger than the expected-byte queue." << endl;
+        return false;
+    }
+
+    if (modelOutput.size() < numBytes) {
+        modelOutput.resize(numBytes);
+    }
+    model(data, numBytes, modelOutput.data());
+
+    {
+        lock_guard<mutex> lockVerifier(verifierMutex);
+        if (expectedHead - expectedTail + numBytes > capacity) {
+            numBlocksNotQueued++;
+            return false;
+        }
+        unsigned int offset = (unsigned int) (expectedHead % capacity);
+        unsigned int firstPart = (unsigned int) min<unsigned long long>(numBytes, capacity - offset);
+        memcpy(expectedBytes.data() + offset, modelOutput.data(), firstPart);
+        memcpy(expectedBytes.data(), modelOutput.data() + firstPart, numBytes - firstPart);
+        expectedHead += numBytes;
+
+        PendingBlock block;
+        block.sequence = numBlocksSent++;
+        block.numBytes = numBytes;
+        block.numBytesChecked = 0;
+        block.lastMismatchedWord = -1;
+        block.mismatched = false;
+        block.lost = false;
+        block.sendTime = chrono::steady_clock::now();
+        if (block.sequence == 0) {
+            firstSendTime = block.sendTime;
+        }
+        pendingBlocks.push_back(block);
+    }
+
+    // The block must be queued before the sink can possibly return it.
+    if (!sink.submit(data, numBytes)) {
+        lock_guard<mutex> lockVerifier(verifierMutex);
+        pendingBlocks.pop_back();
+        expectedHead -= numBytes;
+        numBlocksSent--;
+        return false;
+    }
+    return true;
+}
+
+// Count the 16-bit words of block that differ between returned and expected; blockOffset is the
+// position of the first byte within the block.
+void Rhd2000LoopbackVerifierUsb3::countMismatches(const unsigned char *returned, const unsigned char *expected,
+                                                  unsigned int numBytes, unsigned int blockOffset, PendingBlock &block)
+{
+    if (memcmp(returned, expected, numBytes) == 0) {
+        return;
+    }
+    block.mismatched = true;
+    for (unsigned int i = 0; i < numBytes; ++i) {
+        long long word = (blockOffset + i) / 2;
+        if (returned[i] != expected[i] && word != block.lastMismatchedWord) {
+            numWordsMismatched++;
+            block.lastMismatchedWord = word;
+        }
+    }
+}
+
+// Match bytes read back from the downstream FPGA against the expected output of the oldest
+// pending blocks.  Called by the sink thread (see attach()).
+void Rhd2000LoopbackVerifierUsb3::checkReturned(const unsigned char *data, unsigned int numBytes)
+{
+    const unsigned long long capacity = expectedBytes.size();
+    lock_guard<mutex> lockVerifier(verifierMutex);
+
+    while (numBytes > 0) {
+        if (pendingBlocks.empty()) {
+            numExtraBytes += numBytes;
+            break;
+        }
+        PendingBlock &block = pendingBlocks.front();
+        unsigned int chunk = min(numBytes, block.numBytes - block.numBytesChecked);
+
+        unsigned int offset = (unsigned int) (expectedTail % capacity);
+        unsigned int firstPart = (unsigned int) min<unsigned long long>(chunk, capacity - offset);
+        countMismatches(data, expectedBytes.data() + offset, firstPart, block.numBytesChecked, block);
+        countMismatches(data + firstPart, expectedBytes.data(), chunk - firstPart, block.numBytesChecked + firstPart,
+                        block);
+
+        block.numBytesChecked += chunk;
+        expectedTail += chunk;
+        numBytesVerified += chunk;
+        data += chunk;
+        numBytes -= chunk;
+
+        if (block.numBytesChecked == block.numBytes) {
+            retireFrontBlock();
+        }
+    }
+}
+
+// Retire the next numBytes expected bytes unchecked: the sink reported that a transfer carrying
+// them failed, so they will never be read back.  Every block they touch is counted as lost rather
+// than verified.  Called by the sink thread (see attach()).
+void Rhd2000LoopbackVerifierUsb3::skipLost(unsigned int numBytes)
+{
+    lock_guard<mutex> lockVerifier(verifierMutex);
+
+    while (numBytes > 0 && !pendingBlocks.empty()) {
+        PendingBlock &block = pendingBlocks.front();
+        unsigned int chunk = min(numBytes, block.numBytes - block.numBytesChecked);
+
+        block.lost = true;
+        block.numBytesChecked += chunk;
+        expectedTail += chunk;
+        numBytesLost += chunk;
+        numBytes -= chunk;
+
+        if (block.numBytesChecked == block.numBytes) {
+            retireFrontBlock();
+        }
+    }
+}
+
+// Count the oldest pending block, all of whose bytes have been checked or skipped, and drop it.
+// verifierMutex must be held.
+void Rhd2000LoopbackVerifierUsb3::retireFrontBlock()
+{
+    const PendingBlock &block = pendingBlocks.front();
+    if (block.lost) {
+        numBlocksLost++;
+    } else {
+        double latencyMs = chrono::duration<double, milli>(chrono::steady_clock::now() - block.sendTime).count();
+        latencyHistory[latencyHistoryNext] = latencyMs;
+        latencyHistoryNext = (latencyHistoryNext + 1) % LOOPBACK_VERIFIER_LATENCY_HISTORY;
+        latencyMaxMs = max(latencyMaxMs, latencyMs);
+        numBlocksVerified++;
+        if (block.mismatched) {
+            numBlocksMismatched++;
+            if (firstMismatchedBlock < 0) {
+                firstMismatchedBlock = (long long) block.sequence;
+            }
+        }
+    }
+    pendingBlocks.pop_front();
+}
+
+// Snapshot of the verification counters.  May be called from any thread.
+void Rhd2000LoopbackVerifierUsb3::getStats(VerifierStats &stats)
+{
+    vector<double> latencies;
+    {
+        lock_guard<mutex> lockVerifier(verifierMutex);
+        stats.numBlocksSent = numBlocksSent;
+        stats.numBlocksVerified = numBlocksVerified;
+        stats.numBlocksMismatched = numBlocksMismatched;
+        stats.numBlocksLost = numBlocksLost;
+        stats.numBlocksPending = pendingBlocks.size();
+        stats.numBlocksNotQueued = numBlocksNotQueued;
+        stats.numBytesVerified = numBytesVerified;
+        stats.numBytesLost = numBytesLost;
+        stats.numWordsMismatched = numWordsMismatched;
+        stats.numExtraBytes = numExtraBytes;
+        stats.firstMismatchedBlock = firstMismatchedBlock;
+        stats.latencyMaxMs = latencyMaxMs;
+        stats.megabytesPerSecond = 0.0;
+        if (numBlocksSent > 0) {
+            double elapsed = chrono::duration<double>(chrono::steady_clock::now() - firstSendTime).count();
+            stats.megabytesPerSecond = (elapsed > 0.0) ? numBytesVerified / elapsed / 1.0e6 : 0.0;
+        }
+        latencies.assign(latencyHistory.begin(),
+                         latencyHistory.begin() + min<unsigned long long>(numBlocksVerified,
+                                                                          LOOPBACK_VERIFIER_LATENCY_HISTORY));
+    }
+
+    stats.latencyMedianMs = 0.0;
+    stats.latency99Ms = 0.0;
+    if (!latencies.empty()) {
+        sort(latencies.begin(), latencies.end());
+        stats.latencyMedianMs = latencies[latencies.size() / 2];
+        stats.latency99Ms = latencies[(latencies.size() * 99) / 100];
+    }
+}
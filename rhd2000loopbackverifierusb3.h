@@ -0,0 +1,111 @@
+//----------------------------------------------------------------------------------
+// rhd2000loopbackverifierusb3.h
+//
+// Rhd2000LoopbackVerifierUsb3 Class Header File
+//
+// Checks what a downstream FPGA returns against what was sent to it.  Each block passed
+// to submit() is run through a reference model (identity by default, i.e. a loopback
+// design) and the expected result is queued; the bytes the sink thread reads back are
+// matched against that queue in order, one block at a time; the bytes of failed
+// transfers are retired from it unchecked.  Results are kept as counters -- mismatched
+// and lost blocks, mismatched 16-bit words, per-block round-trip latency and verified
+// throughput -- rather than printed.
+//----------------------------------------------------------------------------------
+
+#ifndef RHD2000LOOPBACKVERIFIERUSB3_H
+#define RHD2000LOOPBACKVERIFIERUSB3_H
+
+// Default capacity of the queue of expected bytes (blocks sent but not yet read back)
+#define LOOPBACK_VERIFIER_QUEUE_BYTES 16777216
+
+// Number of most recent block latencies kept for the percentile statistics
+#define LOOPBACK_VERIFIER_LATENCY_HISTORY 1024
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <functional>
+
+using namespace std;
+
+class Rhd2000FpgaSinkUsb3;
+
+class Rhd2000LoopbackVerifierUsb3
+{
+public:
+    // Fill expected with the numBytes the downstream design should return for input
+    typedef function<void(const unsigned char *input, unsigned int numBytes, unsigned char *expected)> ReferenceModel;
+    static void identityModel(const unsigned char *input, unsigned int numBytes, unsigned char *expected);
+
+    Rhd2000LoopbackVerifierUsb3(ReferenceModel model = identityModel,
+                                unsigned int queueBytes = LOOPBACK_VERIFIER_QUEUE_BYTES);
+
+    void attach(Rhd2000FpgaSinkUsb3 &sink);
+    bool submit(Rhd2000FpgaSinkUsb3 &sink, const unsigned char *data, unsigned int numBytes);
+    void checkReturned(const unsigned char *data, unsigned int numBytes);
+    void skipLost(unsigned int numBytes);
+    void reset();
+
+    struct VerifierStats {
+        unsigned long long numBlocksSent;       // blocks accepted by the sink
+        unsigned long long numBlocksVerified;   // blocks whose every byte has been read back
+        unsigned long long numBlocksMismatched;
+        unsigned long long numBlocksLost;       // blocks with bytes in a failed transfer
+        unsigned long long numBlocksPending;
+        unsigned long long numBlocksNotQueued;  // rejected because the expected-byte queue was full
+        unsigned long long numBytesVerified;
+        unsigned long long numBytesLost;        // expected bytes retired unchecked by skipLost()
+        unsigned long long numWordsMismatched;  // 16-bit words differing from the reference model
+        unsigned long long numExtraBytes;       // data read back with no block outstanding
+        long long firstMismatchedBlock;         // sequence number, or -1
+        double megabytesPerSecond;              // verified bytes since the first block was sent
+        double latencyMedianMs;                 // submit() to last byte checked, over the last
+        double latency99Ms;                     // LOOPBACK_VERIFIER_LATENCY_HISTORY blocks
+        double latencyMaxMs;
+    };
+    void getStats(VerifierStats &stats);
+
+private:
+    struct PendingBlock {
+        unsigned long long sequence;
+        unsigned int numBytes;
+        unsigned int numBytesChecked;       // including bytes retired by skipLost()
+        long long lastMismatchedWord;
+        bool mismatched;
+        bool lost;
+        chrono::steady_clock::time_point sendTime;
+    };
+
+    ReferenceModel model;
+    vector<unsigned char> modelOutput;
+
+    // Expected bytes of pending blocks, in a ring of queueBytes, guarded by verifierMutex
+    mutex verifierMutex;
+    vector<unsigned char> expectedBytes;
+    unsigned long long expectedHead;        // total bytes ever queued
+    unsigned long long expectedTail;        // total bytes ever checked
+    deque<PendingBlock> pendingBlocks;
+
+    void countMismatches(const unsigned char *returned, const unsigned char *expected, unsigned int numBytes,
+                         unsigned int blockOffset, PendingBlock &block);
+    void retireFrontBlock();
+
+    // Statistics, guarded by verifierMutex
+    unsigned long long numBlocksSent;
+    unsigned long long numBlocksVerified;
+    unsigned long long numBlocksMismatched;
+    unsigned long long numBlocksLost;
+    unsigned long long numBlocksNotQueued;
+    unsigned long long numBytesVerified;
+    unsigned long long numBytesLost;
+    unsigned long long numWordsMismatched;
+    unsigned long long numExtraBytes;
+    long long firstMismatchedBlock;
+    chrono::steady_clock::time_point firstSendTime;
+    vector<double> latencyHistory;
+    unsigned int latencyHistoryNext;
+    double latencyMaxMs;
+};
+
+#endif // RHD2000LOOPBACKVERIFIERUSB3_H
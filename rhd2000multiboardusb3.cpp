@@ -0,0 +1,494 @@
+//----------------------------------------------------------------------------------
+// rhd2000multiboardusb3.cpp
+//
+// Rhd2000MultiBoardUsb3 Class
+//
+// Several Rhythm USB3 boards read in parallel and merged into one time-aligned block stream.
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+
+#include "rhd2000multiboardusb3.h"
+#include "rhd2000evalboardusb3.h"
+#include "rhd2000datablockringusb3.h"
+
+using namespace std;
+
+// Copy numSamples samples of every amplifier channel of one board's block into a merged block,
+// where the board's streams start at streamOffset.
+template <typename Sample>
+static void copyAmplifierSamples(const Rhd2000DataBlockUsb3 &source, const Sample *sourceAmp, int sourceT,
+                                 const Rhd2000DataBlockUsb3 &merged, Sample *mergedAmp, int mergedT, int numSamples,
+                                 int numStreams, int streamOffset)
+{
+    if (merged.getAmplifierLayout() == Rhd2000DataBlockUsb3::ChannelMajor) {
+        for (int stream = 0; stream < numStreams; ++stream) {
+            for (int channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
+                memcpy(mergedAmp + merged.fastIndex(streamOffset + stream, channel, mergedT),
+                       sourceAmp + source.fastIndex(stream, channel, sourceT), numSamples * sizeof(Sample));
+            }
+        }
+    } else {
+        // TimeMajor: the board's streams of one channel are adjacent in both blocks.
+        for (int t = 0; t < numSamples; ++t) {
+            for (int channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
+                memcpy(mergedAmp + merged.fastIndex(streamOffset, channel, mergedT + t),
+                       sourceAmp + source.fastIndex(0, channel, sourceT + t), numStreams * sizeof(Sample));
+            }
+        }
+    }
+}
+
+Rhd2000MultiBoardUsb3::Rhd2000MultiBoardUsb3() :
+    numDataStreams(0),
+    syncTtlBit(-1),
+    syncInterval(1.0),
+    sampleRate(30000.0),
+    amplifierLayout(Rhd2000DataBlockUsb3::TimeMajor),
+    sampleFormat(Rhd2000DataBlockUsb3::Int32Samples),
+    running(false),
+    synchronized(false),
+    baseTimeStamp(0),
+    numMergedBlocks(0),
+    numSyncs(0)
+{
+}
+
+Rhd2000MultiBoardUsb3::~Rhd2000MultiBoardUsb3()
+{
+    close();
+}
+
+// Open one board per serial number, in that order.  Returns 1 if successful; otherwise the error
+// code of the first board that could not be opened (see Rhd2000EvalBoardUsb3::open()), with no
+// boards left open.  Configure each board through getBoard() before start().
+int Rhd2000MultiBoardUsb3::open(const vector<string> &serialNumbers)
+{
+    close();
+    for (unsigned int i = 0; i < serialNumbers.size(); ++i) {
+        if (find(serialNumbers.begin(), serialNumbers.begin() + i, serialNumbers[i]) != serialNumbers.begin() + i) {
+            cerr << "Error in Rhd2000MultiBoardUsb3::open: serial number " << serialNumbers[i] <<
+                    " given twice." << endl;
+            close();
+            return -2;
+        }
+
+        BoardState state;
+        memset(&state, 0, sizeof(state));
+        state.board = new Rhd2000EvalBoardUsb3;
+        boards.push_back(state);
+        int result = state.board->open(serialNumbers[i]);
+        if (result != 1) {
+            close();
+            return result;
+        }
+    }
+    return 1;
+}
+
+// Stop acquisition and close every board.
+void Rhd2000MultiBoardUsb3::close()
+{
+    stop();
+    for (unsigned int i = 0; i < boards.size(); ++i) {
+        delete boards[i].board;
+    }
+    boards.clear();
+    numDataStreams = 0;
+}
+
+int Rhd2000MultiBoardUsb3::getNumBoards() const
+{
+    return (int) boards.size();
+}
+
+// The board opened with the given serial number (index into the list given to open()), for
+// uploading the bitfile, initialize(), enabling data streams and other settings.  Do not call its
+// acquisition methods (run(), readDataBlock(), the reader thread) between start() and stop().
+Rhd2000EvalBoardUsb3* Rhd2000MultiBoardUsb3::getBoard(int board) const
+{
+    if (board < 0 || board >= (int) boards.size()) {
+        cerr << "Error in Rhd2000MultiBoardUsb3::getBoard: board out of range." << endl;
+        return nullptr;
+    }
+    return boards[board].board;
+}
+
+// Align the boards on rising edges of TTL input ttlBit (0-15), which must carry the same pulse on
+// every board, no more often than once every minPulseIntervalSeconds.  With no sync input (ttlBit
+// -1, the default) the boards are aligned on their first samples, which is only right if they were
+// started by a common hardware trigger.  Call before start().
+void Rhd2000MultiBoardUsb3::setSyncInput(int ttlBit, double minPulseIntervalSeconds)
+{
+    if (ttlBit < -1 || ttlBit > 15) {
+        cerr << "Error in Rhd2000MultiBoardUsb3::setSyncInput: ttlBit out of range." << endl;
+        return;
+    }
+    if (minPulseIntervalSeconds <= 0.0) {
+        cerr << "Error in Rhd2000MultiBoardUsb3::setSyncInput: minPulseIntervalSeconds must be positive." << endl;
+        return;
+    }
+    syncTtlBit = ttlBit;
+    syncInterval = minPulseIntervalSeconds;
+}
+
+// Start every board's reader thread, then start the boards one after another.  All boards must have
+// the same sampling rate, amplifier layout and sample format.  Returns false if they do not, or
+// if no board is open or acquisition is already running.
+bool Rhd2000MultiBoardUsb3::start(unsigned int ringCapacity)
+{
+    if (boards.empty()) {
+        cerr << "Error in Rhd2000MultiBoardUsb3::start: no boards open." << endl;
+        return false;
+    }
+    if (running) {
+        cerr << "Error in Rhd2000MultiBoardUsb3::start: already running." << endl;
+        return false;
+    }
+
+    Rhd2000EvalBoardUsb3 *firstBoard = boards[0].board;
+    sampleRate = firstBoard->getSampleRate();
+    amplifierLayout = firstBoard->getAmplifierLayout();
+    sampleFormat = firstBoard->getSampleFormat();
+    numDataStreams = 0;
+    for (unsigned int i = 0; i < boards.size(); ++i) {
+        BoardState &state = boards[i];
+        if (state.board->getSampleRate() != sampleRate || state.board->getAmplifierLayout() != amplifierLayout ||
+                state.board->getSampleFormat() != sampleFormat) {
+            cerr << "Error in Rhd2000MultiBoardUsb3::start: board " << state.board->getSerialNumber() <<
+                    " has a different sampling rate, amplifier layout or sample format from board " <<
+                    firstBoard->getSerialNumber() << "." << endl;
+            return false;
+        }
+        state.numDataStreams = state.board->getNumEnabledDataStreams();
+        state.streamOffset = numDataStreams;
+        numDataStreams += state.numDataStreams;
+
+        state.cursor = 0;
+        state.timeStampKnown = false;
+        state.blockChecked = false;
+        state.nextTimeStamp = 0;
+        state.lastSyncLevel = -1;
+        state.edgeFound = false;
+        state.syncTimeStamp = -1;
+        state.numBlocksMerged = 0;
+        state.numBlocksDiscarded = 0;
+        state.numTimeStampGaps = 0;
+    }
+
+    for (unsigned int i = 0; i < boards.size(); ++i) {
+        BoardState &state = boards[i];
+        state.board->setContinuousRunMode(true);
+        state.board->resetUsbReadStats();
+        state.board->startReaderThread(ringCapacity);
+        state.ring = state.board->getDataBlockRing();
+    }
+
+    // Back to back, so the boards start within a few control transfers of one another.
+    chrono::steady_clock::time_point firstRun = chrono::steady_clock::now();
+    for (unsigned int i = 0; i < boards.size(); ++i) {
+        boards[i].runSeconds = chrono::duration<double>(chrono::steady_clock::now() - firstRun).count();
+        boards[i].board->run();
+    }
+
+    running = true;
+    synchronized = false;
+    baseTimeStamp = 0;
+    numMergedBlocks = 0;
+    numSyncs = 0;
+    return true;
+}
+
+// Stop the boards and their reader threads, and empty their FIFOs.
+void Rhd2000MultiBoardUsb3::stop()
+{
+    if (!running) return;
+
+    for (unsigned int i = 0; i < boards.size(); ++i) {
+        BoardState &state = boards[i];
+        state.board->stopReaderThread();
+        state.board->setContinuousRunMode(false);
+        state.board->setMaxTimeStep(0);
+        state.board->flush();
+        state.ring = nullptr;
+    }
+    running = false;
+    synchronized = false;
+}
+
+bool Rhd2000MultiBoardUsb3::isRunning() const
+{
+    return running;
+}
+
+// True once every board has seen the same sync edge, until alignment is lost to a time stamp gap.
+bool Rhd2000MultiBoardUsb3::isSynchronized() const
+{
+    return synchronized;
+}
+
+// Data streams in a merged block: the enabled streams of all boards, as of start().
+int Rhd2000MultiBoardUsb3::getNumDataStreams() const
+{
+    return numDataStreams;
+}
+
+// First stream of the given board in a merged block.
+int Rhd2000MultiBoardUsb3::getStreamOffset(int board) const
+{
+    if (board < 0 || board >= (int) boards.size()) {
+        cerr << "Error in Rhd2000MultiBoardUsb3::getStreamOffset: board out of range." << endl;
+        return -1;
+    }
+    return boards[board].streamOffset;
+}
+
+// Check that a board's block follows on from the samples before it, the first time the block is
+// reached.  Returns false, and starts expecting the block's own time stamps, if it does not.
+bool Rhd2000MultiBoardUsb3::checkTimeStamp(BoardState &state, const Rhd2000DataBlockUsb3 &block)
+{
+    if (state.blockChecked) return true;
+    state.blockChecked = true;
+
+    unsigned int first = block.timeStamp[0];
+    bool follows = (!state.timeStampKnown || first == state.nextTimeStamp) &&
+            block.timeStamp[SAMPLES_PER_DATA_BLOCK - 1] == first + SAMPLES_PER_DATA_BLOCK - 1;
+    if (!follows && state.timeStampKnown) {
+        state.numTimeStampGaps++;
+    }
+    state.timeStampKnown = true;
+    state.nextTimeStamp = first;
+    return follows;
+}
+
+void Rhd2000MultiBoardUsb3::popBlock(BoardState &state)
+{
+    state.nextTimeStamp = state.ring->front()->timeStamp[SAMPLES_PER_DATA_BLOCK - 1] + 1;
+    state.ring->pop();
+    state.cursor = 0;
+    state.blockChecked = false;
+}
+
+// Read one board's samples up to the next rising edge of the sync input, leaving the cursor on it.
+// Samples before it are discarded.  Returns false if the board's ring runs out first.
+bool Rhd2000MultiBoardUsb3::findNextEdge(BoardState &state)
+{
+    while (state.ring->size() > 0) {
+        const Rhd2000DataBlockUsb3 &block = *state.ring->front();
+        if (state.cursor == 0 && !checkTimeStamp(state, block)) {
+            state.lastSyncLevel = -1;
+        }
+
+        for (int t = state.cursor; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            int level = (syncTtlBit < 0) ? 1 : (block.ttlInSample(t) >> syncTtlBit) & 1;
+            if (level == 1 && (state.lastSyncLevel == 0 || syncTtlBit < 0)) {
+                state.cursor = t;
+                state.nextTimeStamp = block.timeStamp[t];
+                state.lastSyncLevel = 1;
+                state.edgeFound = true;
+                state.syncTimeStamp = block.timeStamp[t];
+                return true;
+            }
+            state.lastSyncLevel = level;
+        }
+        state.numBlocksDiscarded++;
+        popBlock(state);
+    }
+    return false;
+}
+
+// Bring every board to the same sync edge.  The first edge each board sees may be an earlier pulse
+// than another board's first edge if that board started later; edges are matched by when they came,
+// from the boards' time stamps and when each was started.  Returns false if more data is needed.
+bool Rhd2000MultiBoardUsb3::findCommonEdge()
+{
+    while (true) {
+        for (unsigned int i = 0; i < boards.size(); ++i) {
+            if (!boards[i].edgeFound && !findNextEdge(boards[i])) {
+                return false;
+            }
+        }
+
+        double latest = 0.0;
+        for (unsigned int i = 0; i < boards.size(); ++i) {
+            latest = max(latest, boards[i].runSeconds + boards[i].syncTimeStamp / sampleRate);
+        }
+        bool matched = true;
+        for (unsigned int i = 0; i < boards.size(); ++i) {
+            BoardState &state = boards[i];
+            if (syncTtlBit >= 0 && state.runSeconds + state.syncTimeStamp / sampleRate < latest - 0.5 * syncInterval) {
+                // An earlier pulse: move past it.
+                state.edgeFound = false;
+                state.cursor++;
+                state.nextTimeStamp++;
+                if (state.cursor == SAMPLES_PER_DATA_BLOCK) {
+                    state.numBlocksDiscarded++;
+                    popBlock(state);
+                }
+                matched = false;
+            }
+        }
+        if (matched) break;
+    }
+
+    for (unsigned int i = 0; i < boards.size(); ++i) {
+        boards[i].edgeFound = false;
+    }
+    if (numSyncs == 0) {
+        baseTimeStamp = boards[0].syncTimeStamp;
+    }
+    numSyncs++;
+    synchronized = true;
+    return true;
+}
+
+// A board's samples no longer follow on; look for a new common sync edge.
+void Rhd2000MultiBoardUsb3::loseSync()
+{
+    synchronized = false;
+    for (unsigned int i = 0; i < boards.size(); ++i) {
+        boards[i].edgeFound = false;
+        boards[i].lastSyncLevel = -1;
+    }
+}
+
+// Copy numSamples samples of one board's block, from sourceT on, into a merged block from mergedT on.
+void Rhd2000MultiBoardUsb3::copySamples(const Rhd2000DataBlockUsb3 &source, int sourceT, Rhd2000DataBlockUsb3 &merged,
+                                        int mergedT, int numSamples, const BoardState &state, bool firstBoard) const
+{
+    const int n = state.numDataStreams;
+    const int offset = state.streamOffset;
+    int stream, i;
+
+    if (sampleFormat == Rhd2000DataBlockUsb3::UInt16Samples) {
+        copyAmplifierSamples(source, source.amplifierData16.data(), sourceT, merged, merged.amplifierData16.data(),
+                             mergedT, numSamples, n, offset);
+        for (stream = 0; stream < n; ++stream) {
+            for (i = 0; i < 3; ++i) {
+                memcpy(&merged.auxiliaryData16[((offset + stream) * 3 + i) * SAMPLES_PER_DATA_BLOCK + mergedT],
+                       &source.auxiliaryData16[(stream * 3 + i) * SAMPLES_PER_DATA_BLOCK + sourceT],
+                       numSamples * sizeof(unsigned short));
+            }
+        }
+        if (firstBoard) {
+            for (i = 0; i < 8; ++i) {
+                memcpy(&merged.boardAdcData16[i * SAMPLES_PER_DATA_BLOCK + mergedT],
+                       &source.boardAdcData16[i * SAMPLES_PER_DATA_BLOCK + sourceT], numSamples * sizeof(unsigned short));
+            }
+            memcpy(&merged.ttlIn16[mergedT], &source.ttlIn16[sourceT], numSamples * sizeof(unsigned short));
+            memcpy(&merged.ttlOut16[mergedT], &source.ttlOut16[sourceT], numSamples * sizeof(unsigned short));
+        }
+    } else {
+        copyAmplifierSamples(source, (const int*) source.amplifierDataFast, sourceT, merged, merged.amplifierDataFast,
+                             mergedT, numSamples, n, offset);
+        for (stream = 0; stream < n; ++stream) {
+            for (i = 0; i < 3; ++i) {
+                memcpy(&merged.auxiliaryData[offset + stream][i][mergedT], &source.auxiliaryData[stream][i][sourceT],
+                       numSamples * sizeof(int));
+            }
+        }
+        if (firstBoard) {
+            for (i = 0; i < 8; ++i) {
+                memcpy(&merged.boardAdcData[i][mergedT], &source.boardAdcData[i][sourceT], numSamples * sizeof(int));
+            }
+            memcpy(&merged.ttlIn[mergedT], &source.ttlIn[sourceT], numSamples * sizeof(int));
+            memcpy(&merged.ttlOut[mergedT], &source.ttlOut[sourceT], numSamples * sizeof(int));
+        }
+    }
+}
+
+// Fill dataBlock with the next SAMPLES_PER_DATA_BLOCK aligned samples of all boards.  dataBlock must
+// have getNumDataStreams() streams and the boards' amplifier layout and sample format.  Returns
+// false, leaving dataBlock undefined, until every board has that many samples past the common sync
+// edge.  Time stamps count from the first common edge, in the first board's time base, so they
+// jump where alignment was lost and found again.  Call from one thread only.
+bool Rhd2000MultiBoardUsb3::readMergedBlock(Rhd2000DataBlockUsb3 *dataBlock)
+{
+    if (!running) return false;
+    if (dataBlock->getNumDataStreams() != numDataStreams || dataBlock->getAmplifierLayout() != amplifierLayout ||
+            dataBlock->getSampleFormat() != sampleFormat) {
+        cerr << "Error in Rhd2000MultiBoardUsb3::readMergedBlock: dataBlock does not match the merged " <<
+                "stream count, amplifier layout or sample format." << endl;
+        return false;
+    }
+    if (!synchronized && !findCommonEdge()) {
+        return false;
+    }
+
+    // Every board must hold a whole block's worth of samples from its cursor on.
+    for (unsigned int i = 0; i < boards.size(); ++i) {
+        if (boards[i].ring->size() < ((boards[i].cursor == 0) ? 1u : 2u)) {
+            return false;
+        }
+    }
+
+    unsigned int syncFlags = 0;
+    for (unsigned int i = 0; i < boards.size(); ++i) {
+        BoardState &state = boards[i];
+        int t = 0;
+        while (t < SAMPLES_PER_DATA_BLOCK) {
+            const Rhd2000DataBlockUsb3 &block = *state.ring->front();
+            if (state.cursor == 0 && !checkTimeStamp(state, block)) {
+                loseSync();
+                return false;
+            }
+
+            int numSamples = min(SAMPLES_PER_DATA_BLOCK - state.cursor, SAMPLES_PER_DATA_BLOCK - t);
+            copySamples(block, state.cursor, *dataBlock, t, numSamples, state, i == 0);
+            if (i == 0) {
+                for (int j = 0; j < numSamples; ++j) {
+                    dataBlock->timeStamp[t + j] = block.timeStamp[state.cursor + j] - (unsigned int) baseTimeStamp;
+                }
+            }
+            syncFlags |= block.getSyncFlags();
+
+            t += numSamples;
+            state.cursor += numSamples;
+            state.nextTimeStamp += numSamples;
+            if (state.cursor == SAMPLES_PER_DATA_BLOCK) {
+                state.numBlocksMerged++;
+                popBlock(state);
+            }
+        }
+    }
+    dataBlock->setSyncFlags(syncFlags);
+    dataBlock->setNumSamplesDropped(0);
+    numMergedBlocks++;
+    return true;
+}
+
+// Counters for one board.  Call from the thread that calls readMergedBlock().
+void Rhd2000MultiBoardUsb3::getBoardStats(int board, BoardStats &stats)
+{
+    if (board < 0 || board >= (int) boards.size()) {
+        cerr << "Error in Rhd2000MultiBoardUsb3::getBoardStats: board out of range." << endl;
+        return;
+    }
+    const BoardState &state = boards[board];
+    stats.serialNumber = state.board->getSerialNumber();
+    stats.numDataStreams = state.numDataStreams;
+    stats.streamOffset = state.streamOffset;
+    stats.syncTimeStamp = synchronized ? state.syncTimeStamp : -1;
+    stats.numBlocksMerged = state.numBlocksMerged;
+    stats.numBlocksDiscarded = state.numBlocksDiscarded;
+    stats.numTimeStampGaps = state.numTimeStampGaps;
+    stats.ringOccupancy = state.ring ? state.ring->size() : 0;
+    stats.ringMaxOccupancy = state.ring ? state.ring->getMaxOccupancy() : 0;
+    stats.numReaderStalls = state.board->getReaderStallCount();
+
+    Rhd2000EvalBoardUsb3::UsbReadStats usbStats;
+    state.board->getUsbReadStats(usbStats);
+    stats.megabytesPerSecond = usbStats.megabytesPerSecond();
+}
+
+void Rhd2000MultiBoardUsb3::getMergeStats(MergeStats &stats) const
+{
+    stats.numMergedBlocks = numMergedBlocks;
+    stats.numSyncs = numSyncs;
+    stats.synchronized = synchronized;
+}
@@ -0,0 +1,124 @@
+//----------------------------------------------------------------------------------
+// rhd2000multiboardusb3.h
+//
+// Rhd2000MultiBoardUsb3 Class Header File
+//
+// Runs several Rhythm USB3 boards (XEM6310 controllers) as one acquisition system, for
+// rigs that need more than the 32 data streams one board provides.  Each board is opened
+// by serial number and drained by its own reader thread (see
+// Rhd2000EvalBoardUsb3::startReaderThread()).
+//
+// The boards are started one after another, so their time stamps count from slightly
+// different moments.  A sync pulse wired to the same TTL input of every board marks
+// common instants: once every board has seen the same rising edge, readMergedBlock()
+// returns blocks holding the data streams of all boards, aligned sample by sample.
+// Merged sample 0 is that edge, and merged time stamps then follow the first board's.
+// Pulses must be at least minPulseIntervalSeconds apart (see setSyncInput()), and the
+// boards must be started within half that of one another, which start() does.
+//
+// Streams appear board by board, in the order the serial numbers were given to open().
+// The board ADC and TTL words of a merged block are those of the first board.
+//----------------------------------------------------------------------------------
+
+#ifndef RHD2000MULTIBOARDUSB3_H
+#define RHD2000MULTIBOARDUSB3_H
+
+#include <vector>
+#include <string>
+
+using namespace std;
+
+#include "rhd2000datablockusb3.h"
+
+class Rhd2000EvalBoardUsb3;
+class Rhd2000DataBlockRingUsb3;
+
+class Rhd2000MultiBoardUsb3
+{
+public:
+    Rhd2000MultiBoardUsb3();
+    ~Rhd2000MultiBoardUsb3();
+
+    int open(const vector<string> &serialNumbers);
+    void close();
+    int getNumBoards() const;
+    Rhd2000EvalBoardUsb3* getBoard(int board) const;
+
+    void setSyncInput(int ttlBit, double minPulseIntervalSeconds);
+    bool start(unsigned int ringCapacity = 512);
+    void stop();
+    bool isRunning() const;
+    bool isSynchronized() const;
+
+    int getNumDataStreams() const;
+    int getStreamOffset(int board) const;
+    bool readMergedBlock(Rhd2000DataBlockUsb3 *dataBlock);
+
+    // Per-board counters since start().
+    struct BoardStats {
+        string serialNumber;
+        int numDataStreams;
+        int streamOffset;                       // first stream of this board in merged blocks
+        long long syncTimeStamp;                // board time stamp of the current sync edge, or -1
+        unsigned long long numBlocksMerged;     // blocks whose samples went into merged blocks
+        unsigned long long numBlocksDiscarded;  // read while looking for a sync edge
+        unsigned long long numTimeStampGaps;    // discontinuities that forced a new sync
+        unsigned int ringOccupancy;             // blocks waiting in the reader thread's ring
+        unsigned int ringMaxOccupancy;
+        unsigned long long numReaderStalls;     // times the reader thread found the ring full
+        double megabytesPerSecond;              // USB data pipe throughput
+    };
+    void getBoardStats(int board, BoardStats &stats);
+
+    struct MergeStats {
+        unsigned long long numMergedBlocks;
+        unsigned long long numSyncs;            // common sync edges found (1 unless alignment was lost)
+        bool synchronized;
+    };
+    void getMergeStats(MergeStats &stats) const;
+
+private:
+    Rhd2000MultiBoardUsb3(const Rhd2000MultiBoardUsb3 &);
+    Rhd2000MultiBoardUsb3& operator=(const Rhd2000MultiBoardUsb3 &);
+
+    struct BoardState {
+        Rhd2000EvalBoardUsb3 *board;
+        Rhd2000DataBlockRingUsb3 *ring;
+        int numDataStreams;
+        int streamOffset;
+        double runSeconds;                      // when run() was called, from the first board's run()
+        int cursor;                             // next sample of the ring's front block
+        bool blockChecked;                      // checkTimeStamp() has seen the front block
+        bool timeStampKnown;
+        unsigned int nextTimeStamp;             // time stamp expected at the cursor
+        int lastSyncLevel;                      // sync input at the previous sample, or -1 if unknown
+        bool edgeFound;                         // cursor is at a rising edge of the sync input
+        long long syncTimeStamp;
+        unsigned long long numBlocksMerged;
+        unsigned long long numBlocksDiscarded;
+        unsigned long long numTimeStampGaps;
+    };
+
+    vector<BoardState> boards;
+    int numDataStreams;
+    int syncTtlBit;
+    double syncInterval;
+    double sampleRate;
+    Rhd2000DataBlockUsb3::AmplifierLayout amplifierLayout;
+    Rhd2000DataBlockUsb3::SampleFormat sampleFormat;
+    bool running;
+    bool synchronized;
+    unsigned long long baseTimeStamp;           // first board's time stamp of merged sample 0
+    unsigned long long numMergedBlocks;
+    unsigned long long numSyncs;
+
+    bool checkTimeStamp(BoardState &state, const Rhd2000DataBlockUsb3 &block);
+    void popBlock(BoardState &state);
+    bool findNextEdge(BoardState &state);
+    bool findCommonEdge();
+    void loseSync();
+    void copySamples(const Rhd2000DataBlockUsb3 &source, int sourceT, Rhd2000DataBlockUsb3 &merged, int mergedT,
+                     int numSamples, const BoardState &state, bool firstBoard) const;
+};
+
+#endif // RHD2000MULTIBOARDUSB3_H
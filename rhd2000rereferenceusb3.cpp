@@ -0,0 +1,377 @@
+//----------------------------------------------------------------------------------
+// rhd2000rereferenceusb3.cpp
+//
+// Rhd2000ReReferenceUsb3 Class
+//
+// In-place common average and common median referencing over channel groups.
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include "rhd2000rereferenceusb3.h"
+#include "rhd2000datablockusb3.h"
+#include "rhd2000decoderusb3.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define RHD2000_REREFERENCE_X86
+#include <immintrin.h>
+#endif
+
+// GCC and Clang need per-function target attributes to emit AVX2/SSE4.1 code without compiling the
+// whole file for that instruction set; MSVC accepts the intrinsics as is.
+#if defined(RHD2000_REREFERENCE_X86) && (defined(__GNUC__) || defined(__clang__))
+#define RHD2000_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define RHD2000_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RHD2000_TARGET_SSE41
+#define RHD2000_TARGET_AVX2
+#endif
+
+using namespace std;
+
+Rhd2000ReReferenceUsb3::Rhd2000ReReferenceUsb3() :
+    numDataStreams(0),
+    mode(CommonAverage),
+    path(Rhd2000DecoderUsb3::detectBestPath())
+{
+    reference.assign(SAMPLES_PER_DATA_BLOCK, 0);
+}
+
+// Set up for blocks of numDataStreams streams, with one group per stream and no bad channels.
+bool Rhd2000ReReferenceUsb3::configure(int numDataStreams_, ReferenceMode mode_)
+{
+    if (numDataStreams_ < 1) {
+        cerr << "Error in Rhd2000ReReferenceUsb3::configure: need at least one data stream." << endl;
+        return false;
+    }
+    numDataStreams = numDataStreams_;
+    mode = mode_;
+    badChannel.assign(numDataStreams * CHANNELS_PER_STREAM, false);
+    groupByStream();
+    return true;
+}
+
+void Rhd2000ReReferenceUsb3::setMode(ReferenceMode mode_)
+{
+    mode = mode_;
+}
+
+Rhd2000ReReferenceUsb3::ReferenceMode Rhd2000ReReferenceUsb3::getMode() const
+{
+    return mode;
+}
+
+// One group per data stream (headstage).
+void Rhd2000ReReferenceUsb3::groupByStream()
+{
+    groupByShank(CHANNELS_PER_STREAM);
+}
+
+// Groups of channelsPerShank consecutive channels of each stream, e.g. 16 for a two-shank probe on
+// a 32-channel headstage.  channelsPerShank must divide CHANNELS_PER_STREAM.
+bool Rhd2000ReReferenceUsb3::groupByShank(int channelsPerShank)
+{
+    if (channelsPerShank < 1 || CHANNELS_PER_STREAM % channelsPerShank != 0) {
+        cerr << "Error in Rhd2000ReReferenceUsb3::groupByShank: " << channelsPerShank << " channels per shank do not " <<
+                "divide the " << CHANNELS_PER_STREAM << " channels of a stream." << endl;
+        return false;
+    }
+    vector<vector<int> > shanks;
+    for (int first = 0; first < numDataStreams * CHANNELS_PER_STREAM; first += channelsPerShank) {
+        shanks.push_back(vector<int>());
+        for (int channel = first; channel < first + channelsPerShank; ++channel) {
+            shanks.back().push_back(channel);
+        }
+    }
+    return setGroups(shanks);
+}
+
+// Arbitrary groups of channels.  A channel may belong to one group at most.  Returns false, leaving
+// the groups unchanged, if a channel is out of range or listed twice.
+bool Rhd2000ReReferenceUsb3::setGroups(const vector<vector<int> > &newGroups)
+{
+    const int numChannels = numDataStreams * CHANNELS_PER_STREAM;
+    vector<bool> used(numChannels, false);
+    for (unsigned int g = 0; g < newGroups.size(); ++g) {
+        for (unsigned int i = 0; i < newGroups[g].size(); ++i) {
+            int channel = newGroups[g][i];
+            if (channel < 0 || channel >= numChannels || used[channel]) {
+                cerr << "Error in Rhd2000ReReferenceUsb3::setGroups: channel " << channel << " is out of range or in " <<
+                        "more than one group." << endl;
+                return false;
+            }
+            used[channel] = true;
+        }
+    }
+
+    groups.clear();
+    for (unsigned int g = 0; g < newGroups.size(); ++g) {
+        if (newGroups[g].empty()) continue;
+        groups.push_back(Group());
+        groups.back().channels = newGroups[g];
+    }
+    updateReferenceChannels();
+    return true;
+}
+
+// Leave these channels out of every reference (and no others).
+bool Rhd2000ReReferenceUsb3::setBadChannels(const vector<int> &channels)
+{
+    const int numChannels = numDataStreams * CHANNELS_PER_STREAM;
+    for (unsigned int i = 0; i < channels.size(); ++i) {
+        if (channels[i] < 0 || channels[i] >= numChannels) {
+            cerr << "Error in Rhd2000ReReferenceUsb3::setBadChannels: channel " << channels[i] << " is out of range." <<
+                    endl;
+            return false;
+        }
+    }
+    badChannel.assign(numChannels, false);
+    for (unsigned int i = 0; i < channels.size(); ++i) {
+        badChannel[channels[i]] = true;
+    }
+    updateReferenceChannels();
+    return true;
+}
+
+int Rhd2000ReReferenceUsb3::getNumGroups() const
+{
+    return (int) groups.size();
+}
+
+void Rhd2000ReReferenceUsb3::updateReferenceChannels()
+{
+    unsigned int maxInputs = 0;
+    for (unsigned int g = 0; g < groups.size(); ++g) {
+        Group &group = groups[g];
+        group.referenceChannels.clear();
+        for (unsigned int i = 0; i < group.channels.size(); ++i) {
+            if (!badChannel[group.channels[i]]) {
+                group.referenceChannels.push_back(group.channels[i]);
+            }
+        }
+        medianNetwork((int) group.referenceChannels.size(), group.network);
+        maxInputs = max(maxInputs, (unsigned int) group.referenceChannels.size());
+    }
+    scratch.assign(maxInputs * SAMPLES_PER_DATA_BLOCK, 0);
+}
+
+Rhd2000DecoderUsb3::DecodePath Rhd2000ReReferenceUsb3::getPath() const
+{
+    return path;
+}
+
+// Force a particular SIMD path for the median network (e.g., for benchmarking).  Returns false and
+// leaves the current path unchanged if the CPU does not support the requested one.
+bool Rhd2000ReReferenceUsb3::setPath(Rhd2000DecoderUsb3::DecodePath path_)
+{
+    if (path_ > Rhd2000DecoderUsb3::detectBestPath()) return false;
+    path = path_;
+    return true;
+}
+
+// Batcher's odd-even merge sort over the next power of two, less the comparators that touch the
+// missing inputs (which would hold +infinity and never move), then less every comparator that
+// cannot reach wire (numInputs - 1) / 2 or numInputs / 2.
+void Rhd2000ReReferenceUsb3::medianNetwork(int numInputs, vector<pair<int, int> > &comparators)
+{
+    comparators.clear();
+    int size = 1;
+    while (size < numInputs) size <<= 1;
+
+    vector<pair<int, int> > sortingNetwork;
+    for (int p = 1; p < size; p <<= 1) {
+        for (int k = p; k >= 1; k >>= 1) {
+            for (int j = k % p; j + k < size; j += 2 * k) {
+                for (int i = 0; i < min(k, size - j - k); ++i) {
+                    int a = i + j, b = i + j + k;
+                    if (a / (2 * p) == b / (2 * p) && b < numInputs) {
+                        sortingNetwork.push_back(make_pair(a, b));
+                    }
+                }
+            }
+        }
+    }
+
+    vector<bool> needed(max(numInputs, 1), false);
+    if (numInputs > 0) {
+        needed[(numInputs - 1) / 2] = true;
+        needed[numInputs / 2] = true;
+    }
+    for (int c = (int) sortingNetwork.size() - 1; c >= 0; --c) {
+        const pair<int, int> &comparator = sortingNetwork[c];
+        if (needed[comparator.first] || needed[comparator.second]) {
+            needed[comparator.first] = true;
+            needed[comparator.second] = true;
+            comparators.push_back(comparator);
+        }
+    }
+    reverse(comparators.begin(), comparators.end());
+}
+
+// Re-reference every group of the block in place.  Returns false if the block does not hold the
+// configured number of data streams.
+bool Rhd2000ReReferenceUsb3::apply(Rhd2000DataBlockUsb3 &dataBlock)
+{
+    if (dataBlock.getNumDataStreams() != numDataStreams) {
+        cerr << "Error in Rhd2000ReReferenceUsb3::apply: block has " << dataBlock.getNumDataStreams() <<
+                " data streams; configured for " << numDataStreams << "." << endl;
+        return false;
+    }
+    const bool compact = (dataBlock.getSampleFormat() == Rhd2000DataBlockUsb3::UInt16Samples);
+    for (unsigned int g = 0; g < groups.size(); ++g) {
+        const Group &group = groups[g];
+        const int numInputs = (int) group.referenceChannels.size();
+        if (numInputs == 0) continue;
+
+        if (compact) {
+            gatherGroup(dataBlock, dataBlock.amplifierData16.data(), group);
+        } else {
+            gatherGroup(dataBlock, dataBlock.amplifierDataFast, group);
+        }
+        if (mode == CommonMedian) {
+            medianReference(group);
+        } else {
+            averageReference(numInputs);
+        }
+        if (compact) {
+            subtractReference(dataBlock, dataBlock.amplifierData16.data(), group);
+        } else {
+            subtractReference(dataBlock, dataBlock.amplifierDataFast, group);
+        }
+    }
+    return true;
+}
+
+// Copy the group's reference channels into scratch, one row of SAMPLES_PER_DATA_BLOCK per channel.
+template <typename Sample>
+void Rhd2000ReReferenceUsb3::gatherGroup(const Rhd2000DataBlockUsb3 &dataBlock, const Sample *amp, const Group &group)
+{
+    const int stride = dataBlock.amplifierSampleStride();
+    for (unsigned int j = 0; j < group.referenceChannels.size(); ++j) {
+        const int channel = group.referenceChannels[j];
+        const Sample *source = amp + dataBlock.fastIndex(channel / CHANNELS_PER_STREAM, channel % CHANNELS_PER_STREAM, 0);
+        int *row = scratch.data() + j * SAMPLES_PER_DATA_BLOCK;
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            row[t] = (int) source[t * stride];
+        }
+    }
+}
+
+// x - reference + 32768, clamped to a 16-bit word, for every channel of the group.
+template <typename Sample>
+void Rhd2000ReReferenceUsb3::subtractReference(const Rhd2000DataBlockUsb3 &dataBlock, Sample *amp,
+                                               const Group &group) const
+{
+    const int stride = dataBlock.amplifierSampleStride();
+    for (unsigned int i = 0; i < group.channels.size(); ++i) {
+        const int channel = group.channels[i];
+        Sample *destination = amp + dataBlock.fastIndex(channel / CHANNELS_PER_STREAM, channel % CHANNELS_PER_STREAM, 0);
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            int word = (int) destination[t * stride] - reference[t] + 32768;
+            word = (word < 0) ? 0 : ((word > 65535) ? 65535 : word);
+            destination[t * stride] = (Sample) word;
+        }
+    }
+}
+
+// Rounded mean of the scratch rows at every time step.
+void Rhd2000ReReferenceUsb3::averageReference(int numInputs)
+{
+    for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        reference[t] = 0;
+    }
+    for (int j = 0; j < numInputs; ++j) {
+        const int *row = scratch.data() + j * SAMPLES_PER_DATA_BLOCK;
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            reference[t] += row[t];
+        }
+    }
+    for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        reference[t] = (reference[t] + numInputs / 2) / numInputs;
+    }
+}
+
+// Median at every time step: the middle row after the network, or the rounded mean of the two
+// middle rows for an even number of inputs.
+void Rhd2000ReReferenceUsb3::medianReference(const Group &group)
+{
+    switch (path) {
+    case Rhd2000DecoderUsb3::DecodeAvx2:
+        runNetworkAvx2(group.network);
+        break;
+    case Rhd2000DecoderUsb3::DecodeSse41:
+        runNetworkSse41(group.network);
+        break;
+    default:
+        runNetworkScalar(group.network);
+        break;
+    }
+    const int numInputs = (int) group.referenceChannels.size();
+    const int *low = scratch.data() + ((numInputs - 1) / 2) * SAMPLES_PER_DATA_BLOCK;
+    const int *high = scratch.data() + (numInputs / 2) * SAMPLES_PER_DATA_BLOCK;
+    for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        reference[t] = (low[t] + high[t] + 1) >> 1;
+    }
+}
+
+void Rhd2000ReReferenceUsb3::runNetworkScalar(const vector<pair<int, int> > &network)
+{
+    for (unsigned int c = 0; c < network.size(); ++c) {
+        int *a = scratch.data() + network[c].first * SAMPLES_PER_DATA_BLOCK;
+        int *b = scratch.data() + network[c].second * SAMPLES_PER_DATA_BLOCK;
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            int low = min(a[t], b[t]);
+            int high = max(a[t], b[t]);
+            a[t] = low;
+            b[t] = high;
+        }
+    }
+}
+
+#if defined(RHD2000_REREFERENCE_X86)
+
+RHD2000_TARGET_SSE41
+void Rhd2000ReReferenceUsb3::runNetworkSse41(const vector<pair<int, int> > &network)
+{
+    for (unsigned int c = 0; c < network.size(); ++c) {
+        int *a = scratch.data() + network[c].first * SAMPLES_PER_DATA_BLOCK;
+        int *b = scratch.data() + network[c].second * SAMPLES_PER_DATA_BLOCK;
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; t += 4) {
+            __m128i va = _mm_loadu_si128((const __m128i*) (a + t));
+            __m128i vb = _mm_loadu_si128((const __m128i*) (b + t));
+            _mm_storeu_si128((__m128i*) (a + t), _mm_min_epi32(va, vb));
+            _mm_storeu_si128((__m128i*) (b + t), _mm_max_epi32(va, vb));
+        }
+    }
+}
+
+RHD2000_TARGET_AVX2
+void Rhd2000ReReferenceUsb3::runNetworkAvx2(const vector<pair<int, int> > &network)
+{
+    for (unsigned int c = 0; c < network.size(); ++c) {
+        int *a = scratch.data() + network[c].first * SAMPLES_PER_DATA_BLOCK;
+        int *b = scratch.data() + network[c].second * SAMPLES_PER_DATA_BLOCK;
+        for (int t = 0; t < SAMPLES_PER_DATA_BLOCK; t += 8) {
+            __m256i va = _mm256_loadu_si256((const __m256i*) (a + t));
+            __m256i vb = _mm256_loadu_si256((const __m256i*) (b + t));
+            _mm256_storeu_si256((__m256i*) (a + t), _mm256_min_epi32(va, vb));
+            _mm256_storeu_si256((__m256i*) (b + t), _mm256_max_epi32(va, vb));
+        }
+    }
+}
+
+#else
+
+void Rhd2000ReReferenceUsb3::runNetworkSse41(const vector<pair<int, int> > &network)
+{
+    runNetworkScalar(network);
+}
+
+void Rhd2000ReReferenceUsb3::runNetworkAvx2(const vector<pair<int, int> > &network)
+{
+    runNetworkScalar(network);
+}
+
+#endif
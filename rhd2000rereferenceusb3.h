@@ -0,0 +1,87 @@
+//----------------------------------------------------------------------------------
+// rhd2000rereferenceusb3.h
+//
+// Rhd2000ReReferenceUsb3 Class Header File
+//
+// Host-side common average or common median referencing of amplifier data, in place on a
+// Rhd2000DataBlockUsb3 (amplifierDataFast, or amplifierData16 for UInt16Samples blocks).  Channels,
+// numbered stream * CHANNELS_PER_STREAM + channel, are split into groups -- by default one per
+// data stream, or e.g. one per probe shank -- and at every time step each channel of a group
+// has the group's mean or median subtracted.  Bad channels are left out of the reference but
+// are still re-referenced; channels in no group are left untouched.  Results stay 16-bit ADC
+// words about the 32768 midpoint.
+//
+// The median is taken with a sorting network (Batcher's odd-even merge sort) pruned to the
+// comparators that reach the middle element(s).  Its compare-exchange steps run on SIMD lanes
+// holding consecutive time steps, 8 at a time with AVX2 and 4 with SSE4.1, with the path chosen
+// at run time as for Rhd2000DecoderUsb3.
+//----------------------------------------------------------------------------------
+
+#ifndef RHD2000REREFERENCEUSB3_H
+#define RHD2000REREFERENCEUSB3_H
+
+#include <vector>
+
+using namespace std;
+
+#include "rhd2000datablockusb3.h"
+#include "rhd2000decoderusb3.h"
+
+class Rhd2000ReReferenceUsb3
+{
+public:
+    enum ReferenceMode {
+        CommonAverage,
+        CommonMedian
+    };
+
+    Rhd2000ReReferenceUsb3();
+
+    bool configure(int numDataStreams, ReferenceMode mode = CommonAverage);
+    void setMode(ReferenceMode mode);
+    ReferenceMode getMode() const;
+
+    void groupByStream();
+    bool groupByShank(int channelsPerShank);
+    bool setGroups(const vector<vector<int> > &groups);
+    bool setBadChannels(const vector<int> &channels);
+    int getNumGroups() const;
+
+    bool apply(Rhd2000DataBlockUsb3 &dataBlock);
+
+    Rhd2000DecoderUsb3::DecodePath getPath() const;
+    bool setPath(Rhd2000DecoderUsb3::DecodePath path);
+
+    // Comparators (pairs of wires, lower wire gets the minimum) of a network that puts the
+    // middle element(s) of numInputs values in place, as used for CommonMedian.
+    static void medianNetwork(int numInputs, vector<pair<int, int> > &comparators);
+
+private:
+    struct Group {
+        vector<int> channels;           // every channel re-referenced by this group
+        vector<int> referenceChannels;  // the good ones, which make up the reference
+        vector<pair<int, int> > network;
+    };
+
+    int numDataStreams;
+    ReferenceMode mode;
+    Rhd2000DecoderUsb3::DecodePath path;
+    vector<Group> groups;
+    vector<bool> badChannel;
+
+    vector<int> scratch;                // [reference channel][t]
+    vector<int> reference;              // [t]
+
+    void updateReferenceChannels();
+    template <typename Sample>
+    void gatherGroup(const Rhd2000DataBlockUsb3 &dataBlock, const Sample *amp, const Group &group);
+    template <typename Sample>
+    void subtractReference(const Rhd2000DataBlockUsb3 &dataBlock, Sample *amp, const Group &group) const;
+    void averageReference(int numInputs);
+    void medianReference(const Group &group);
+    void runNetworkScalar(const vector<pair<int, int> > &network);
+    void runNetworkSse41(const vector<pair<int, int> > &network);
+    void runNetworkAvx2(const vector<pair<int, int> > &network);
+};
+
+#endif // RHD2000REREFERENCEUSB3_H
@@ -0,0 +1,230 @@
+//----------------------------------------------------------------------------------
+// rhd2000sharedmemoryringusb3.cpp
+//
+// Rhd2000SharedMemoryRingUsb3 Class
+//
+// Seqlock-protected multi-slot ring in named shared memory.
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include "rhd2000sharedmemoryringusb3.h"
+#include "rhd2000sharedmemorysegmentusb3.h"
+
+using namespace std;
+
+Rhd2000SharedMemoryRingUsb3::Rhd2000SharedMemoryRingUsb3() :
+    header(nullptr),
+    segment(nullptr),
+    isProducer(false),
+    nextCursor(0)
+{
+}
+
+Rhd2000SharedMemoryRingUsb3::~Rhd2000SharedMemoryRingUsb3()
+{
+    close();
+}
+
+// Create (or replace) the named segment with numSlots slots of up to slotBytes payload bytes each.
+// streamCount, channelCount, sampleRate and the payload description are published in the ring
+// header for readers.
+bool Rhd2000SharedMemoryRingUsb3::create(const string &name, unsigned int numSlots, unsigned int slotBytes,
+                                         unsigned int streamCount, unsigned int channelCount, unsigned int sampleRate,
+                                         PayloadFormat payloadFormat, unsigned int samplesPerSlot,
+                                         double microvoltsPerBit, int sampleOffset)
+{
+    close();
+    if (numSlots < 2) {
+        cerr << "Error in Rhd2000SharedMemoryRingUsb3::create: at least two slots are required." << endl;
+        return false;
+    }
+
+    // Keep every slot header on its own cache line
+    unsigned int slotStride = ((SLOT_HEADER_BYTES + slotBytes + 63) / 64) * 64;
+    if (!sharedSegment.create(name, RING_HEADER_BYTES + (size_t) numSlots * slotStride)) {
+        return false;
+    }
+    segment = sharedSegment.getData();
+    isProducer = true;
+    nextCursor = 0;
+
+    header = new (segment) Rhd2000SharedMemoryRingHeader;
+    header->magic = 0;
+    header->version = SHARED_MEMORY_RING_VERSION;
+    header->numSlots = numSlots;
+    header->slotStride = slotStride;
+    header->slotBytes = slotBytes;
+    header->streamCount = streamCount;
+    header->channelCount = channelCount;
+    header->sampleRate = sampleRate;
+    header->payloadFormat = payloadFormat;
+    header->samplesPerSlot = samplesPerSlot;
+    header->microvoltsPerBit = microvoltsPerBit;
+    header->sampleOffset = sampleOffset;
+    header->writeCursor.store(0, memory_order_relaxed);
+    for (unsigned int i = 0; i < numSlots; ++i) {
+        Rhd2000SharedMemorySlotHeader* slot =
+                new (segment + RING_HEADER_BYTES + (size_t) i * slotStride) Rhd2000SharedMemorySlotHeader;
+        slot->sequence.store(0, memory_order_relaxed);
+        slot->timestamp.store(0, memory_order_relaxed);
+        slot->payloadBytes.store(0, memory_order_relaxed);
+    }
+
+    // Readers check the magic number last, so they never see a partly initialized header
+    atomic_thread_fence(memory_order_release);
+    header->magic = SHARED_MEMORY_RING_MAGIC;
+    return true;
+}
+
+// Attach to a segment created by another process.  Returns false if it does not exist or is not
+// a ring of this version.
+bool Rhd2000SharedMemoryRingUsb3::openExisting(const string &name)
+{
+    close();
+    if (!sharedSegment.open(name, RING_HEADER_BYTES)) {
+        return false;
+    }
+    segment = sharedSegment.getData();
+    header = reinterpret_cast<Rhd2000SharedMemoryRingHeader*>(segment);
+    if (header->magic != SHARED_MEMORY_RING_MAGIC || header->version != SHARED_MEMORY_RING_VERSION) {
+        cerr << "Error in Rhd2000SharedMemoryRingUsb3::openExisting: " << name <<
+                " is not a version " << SHARED_MEMORY_RING_VERSION << " data ring." << endl;
+        close();
+        return false;
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    // Remap with the full size now that the geometry is known
+    size_t size = RING_HEADER_BYTES + (size_t) header->numSlots * header->slotStride;
+    close();
+    if (!sharedSegment.open(name, size)) {
+        return false;
+    }
+    segment = sharedSegment.getData();
+    header = reinterpret_cast<Rhd2000SharedMemoryRingHeader*>(segment);
+    isProducer = false;
+    return true;
+}
+
+Rhd2000SharedMemorySlotHeader* Rhd2000SharedMemoryRingUsb3::slotHeader(unsigned long long cursor) const
+{
+    return reinterpret_cast<Rhd2000SharedMemorySlotHeader*>(
+                segment + RING_HEADER_BYTES + (size_t) (cursor % header->numSlots) * header->slotStride);
+}
+
+// Start writing the next slot and return its payload area (slotBytes bytes).  Readers that try to
+// read the slot's previous contents from now until commitWrite() see ReadOverwritten.
+unsigned char* Rhd2000SharedMemoryRingUsb3::beginWrite()
+{
+    if (!isProducer) {
+        cerr << "Error in Rhd2000SharedMemoryRingUsb3::beginWrite: ring was not created by this process." << endl;
+        return nullptr;
+    }
+    Rhd2000SharedMemorySlotHeader* slot = slotHeader(nextCursor);
+    slot->sequence.store(2 * nextCursor + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    return reinterpret_cast<unsigned char*>(slot) + SLOT_HEADER_BYTES;
+}
+
+// Publish the slot started by beginWrite().
+void Rhd2000SharedMemoryRingUsb3::commitWrite(unsigned int payloadBytes, unsigned long long timestamp)
+{
+    Rhd2000SharedMemorySlotHeader* slot = slotHeader(nextCursor);
+    slot->payloadBytes.store(payloadBytes < header->slotBytes ? payloadBytes : header->slotBytes, memory_order_relaxed);
+    slot->timestamp.store(timestamp, memory_order_relaxed);
+    slot->sequence.store(2 * nextCursor + 2, memory_order_release);
+
+    ++nextCursor;
+    header->writeCursor.store(nextCursor, memory_order_release);
+}
+
+// Copy payloadBytes bytes into the next slot and publish it.
+bool Rhd2000SharedMemoryRingUsb3::write(const void* payload, unsigned int payloadBytes, unsigned long long timestamp)
+{
+    if (payloadBytes > getSlotBytes()) {
+        cerr << "Error in Rhd2000SharedMemoryRingUsb3::write: payload larger than slot." << endl;
+        return false;
+    }
+    unsigned char* dest = beginWrite();
+    if (!dest) {
+        return false;
+    }
+    memcpy(dest, payload, payloadBytes);
+    commitWrite(payloadBytes, timestamp);
+    return true;
+}
+
+// Copy slot number cursor (0 <= cursor < getWriteCursor()) into payload, which holds maxBytes bytes.
+// Returns ReadOverwritten if the producer reused the slot before or while it was copied; the
+// copy must then be discarded.  Readers that fall behind can skip ahead to
+// getWriteCursor() - getNumSlots().
+Rhd2000SharedMemoryRingUsb3::ReadResult Rhd2000SharedMemoryRingUsb3::read(unsigned long long cursor, void* payload,
+                                                                          unsigned int maxBytes, unsigned int &payloadBytes,
+                                                                          unsigned long long &timestamp) const
+{
+    unsigned long long writeCursor = header->writeCursor.load(memory_order_acquire);
+    if (cursor >= writeCursor) {
+        return ReadNotYetWritten;
+    }
+    if (writeCursor - cursor > header->numSlots) {
+        return ReadOverwritten;
+    }
+
+    const Rhd2000SharedMemorySlotHeader* slot = slotHeader(cursor);
+    const unsigned long long published = 2 * cursor + 2;
+    if (slot->sequence.load(memory_order_acquire) != published) {
+        return ReadOverwritten;
+    }
+
+    payloadBytes = slot->payloadBytes.load(memory_order_relaxed);
+    timestamp = slot->timestamp.load(memory_order_relaxed);
+    memcpy(payload, reinterpret_cast<const unsigned char*>(slot) + SLOT_HEADER_BYTES,
+           payloadBytes < maxBytes ? payloadBytes : maxBytes);
+
+    atomic_thread_fence(memory_order_acquire);
+    if (slot->sequence.load(memory_order_relaxed) != published) {
+        return ReadOverwritten;
+    }
+    return ReadOk;
+}
+
+bool Rhd2000SharedMemoryRingUsb3::isValid() const
+{
+    return header != nullptr;
+}
+
+// Number of slots published so far; the newest slot is getWriteCursor() - 1.
+unsigned long long Rhd2000SharedMemoryRingUsb3::getWriteCursor() const
+{
+    return header ? header->writeCursor.load(memory_order_acquire) : 0;
+}
+
+unsigned int Rhd2000SharedMemoryRingUsb3::getNumSlots() const
+{
+    return header ? header->numSlots : 0;
+}
+
+unsigned int Rhd2000SharedMemoryRingUsb3::getSlotBytes() const
+{
+    return header ? header->slotBytes : 0;
+}
+
+const Rhd2000SharedMemoryRingHeader* Rhd2000SharedMemoryRingUsb3::getHeader() const
+{
+    return header;
+}
+
+// Unmap the segment (see Rhd2000SharedMemorySegmentUsb3::close()).
+void Rhd2000SharedMemoryRingUsb3::close()
+{
+    sharedSegment.close();
+    segment = nullptr;
+    header = nullptr;
+    isProducer = false;
+}
@@ -0,0 +1,128 @@
+//----------------------------------------------------------------------------------
+// rhd2000sharedmemoryringusb3.h
+//
+// Rhd2000SharedMemoryRingUsb3 Class Header File
+//
+// Multi-slot ring in a named shared memory segment, written by one producer process and
+// read by any number of reader processes without locks.  Each slot is guarded by a
+// sequence number (a seqlock): readers copy a slot and then confirm its sequence number
+// did not change, so they never see a torn slot and never block the producer.
+//
+// Segment layout (all integers in host byte order):
+//   Rhd2000SharedMemoryRingHeader                       (RING_HEADER_BYTES bytes)
+//   numSlots x { Rhd2000SharedMemorySlotHeader,         (SLOT_HEADER_BYTES bytes)
+//                payload of up to slotBytes bytes }     (slotStride bytes per slot in total)
+//
+// Slot k (k = 0, 1, 2, ...) is stored at index k % numSlots.  Its sequence number is
+// 2k + 1 while the producer is writing it and 2k + 2 once it is published, after which
+// writeCursor is advanced to k + 1.
+//
+// The ring header also describes the payload.  With PayloadAmplifierWords each slot holds
+// samplesPerSlot frames of streamCount x channelCount 16-bit amplifier words, ordered
+// [t][channel][stream] as delivered by the FPGA; readers convert a word to microvolts as
+// (word - sampleOffset) * microvoltsPerBit (see sampleToMicrovolts()).
+//----------------------------------------------------------------------------------
+
+#ifndef RHD2000SHAREDMEMORYRINGUSB3_H
+#define RHD2000SHAREDMEMORYRINGUSB3_H
+
+#define SHARED_MEMORY_RING_MAGIC 0x52544e49     // "INTR"
+#define SHARED_MEMORY_RING_VERSION 2
+
+#define RING_HEADER_BYTES 128
+#define SLOT_HEADER_BYTES 64
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+#include "rhd2000sharedmemorysegmentusb3.h"
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared memory ring requires address-free 64-bit atomics");
+
+struct Rhd2000SharedMemoryRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numSlots;
+    uint32_t slotStride;                // bytes from one slot header to the next
+    uint32_t slotBytes;                 // payload capacity of each slot
+    uint32_t streamCount;
+    uint32_t channelCount;
+    uint32_t sampleRate;
+    uint32_t payloadFormat;             // Rhd2000SharedMemoryRingUsb3::PayloadFormat
+    uint32_t samplesPerSlot;            // frames per slot (PayloadAmplifierWords)
+    double microvoltsPerBit;            // amplifier word scale
+    int32_t sampleOffset;               // amplifier word value of 0 microvolts
+    alignas(64) atomic<uint64_t> writeCursor;   // number of slots published
+};
+
+struct Rhd2000SharedMemorySlotHeader {
+    atomic<uint64_t> sequence;          // 2k + 1 while slot k is written, 2k + 2 once published
+    atomic<uint64_t> timestamp;         // producer-defined, e.g. index of the first sample in the slot
+    atomic<uint32_t> payloadBytes;
+};
+
+static_assert(sizeof(Rhd2000SharedMemoryRingHeader) <= RING_HEADER_BYTES, "ring header too large");
+static_assert(sizeof(Rhd2000SharedMemorySlotHeader) <= SLOT_HEADER_BYTES, "slot header too large");
+
+class Rhd2000SharedMemoryRingUsb3
+{
+public:
+    Rhd2000SharedMemoryRingUsb3();
+    ~Rhd2000SharedMemoryRingUsb3();
+
+    enum PayloadFormat {
+        PayloadOpaque = 0,              // producer-defined bytes
+        PayloadAmplifierWords = 1       // 16-bit amplifier words, [t][channel][stream]
+    };
+
+    enum ReadResult {
+        ReadOk,
+        ReadNotYetWritten,      // the slot has not been published yet
+        ReadOverwritten         // the producer has reused the slot; the reader fell too far behind
+    };
+
+    // Producer process
+    bool create(const string &name, unsigned int numSlots, unsigned int slotBytes,
+                unsigned int streamCount, unsigned int channelCount, unsigned int sampleRate,
+                PayloadFormat payloadFormat = PayloadOpaque, unsigned int samplesPerSlot = 0,
+                double microvoltsPerBit = 0.0, int sampleOffset = 0);
+    unsigned char* beginWrite();
+    void commitWrite(unsigned int payloadBytes, unsigned long long timestamp);
+    bool write(const void* payload, unsigned int payloadBytes, unsigned long long timestamp);
+
+    // Reader processes
+    bool openExisting(const string &name);
+    ReadResult read(unsigned long long cursor, void* payload, unsigned int maxBytes,
+                    unsigned int &payloadBytes, unsigned long long &timestamp) const;
+
+    void close();
+    bool isValid() const;
+    unsigned long long getWriteCursor() const;
+    unsigned int getNumSlots() const;
+    unsigned int getSlotBytes() const;
+    const Rhd2000SharedMemoryRingHeader* getHeader() const;
+    inline float sampleToMicrovolts(unsigned short word) const;
+
+private:
+    Rhd2000SharedMemoryRingUsb3(const Rhd2000SharedMemoryRingUsb3 &);
+    Rhd2000SharedMemoryRingUsb3& operator=(const Rhd2000SharedMemoryRingUsb3 &);
+
+    Rhd2000SharedMemorySlotHeader* slotHeader(unsigned long long cursor) const;
+
+    Rhd2000SharedMemorySegmentUsb3 sharedSegment;
+    Rhd2000SharedMemoryRingHeader* header;
+    unsigned char* segment;
+    bool isProducer;
+    unsigned long long nextCursor;      // producer only: slot being (or next to be) written
+};
+
+// Convert a PayloadAmplifierWords sample to microvolts using the scale and offset in the ring header.
+inline float Rhd2000SharedMemoryRingUsb3::sampleToMicrovolts(unsigned short word) const
+{
+    return (float) (((int) word - header->sampleOffset) * header->microvoltsPerBit);
+}
+
+#endif // RHD2000SHAREDMEMORYRINGUSB3_H
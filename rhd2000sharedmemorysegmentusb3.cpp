@@ -0,0 +1,166 @@
+//----------------------------------------------------------------------------------
+// rhd2000sharedmemorysegmentusb3.cpp
+//
+// Rhd2000SharedMemorySegmentUsb3 Class
+//
+// Named shared memory segment.
+//----------------------------------------------------------------------------------
+
+#include <iostream>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "rhd2000sharedmemorysegmentusb3.h"
+
+using namespace std;
+
+Rhd2000SharedMemorySegmentUsb3::Rhd2000SharedMemorySegmentUsb3() :
+    data(nullptr),
+    size(0),
+    isCreator(false)
+{
+#ifdef _WIN32
+    mapHandle = nullptr;
+#endif
+}
+
+Rhd2000SharedMemorySegmentUsb3::~Rhd2000SharedMemorySegmentUsb3()
+{
+    close();
+}
+
+// Create (or replace) a zero-filled, read/write segment of size bytes.
+bool Rhd2000SharedMemorySegmentUsb3::create(const string &name, size_t size_)
+{
+    close();
+    return map(name, size_, true);
+}
+
+// Map the first size bytes of an existing segment read-only.
+bool Rhd2000SharedMemorySegmentUsb3::open(const string &name, size_t size_)
+{
+    close();
+    return map(name, size_, false);
+}
+
+bool Rhd2000SharedMemorySegmentUsb3::isValid() const
+{
+    return data != nullptr;
+}
+
+unsigned char* Rhd2000SharedMemorySegmentUsb3::getData() const
+{
+    return data;
+}
+
+size_t Rhd2000SharedMemorySegmentUsb3::getSize() const
+{
+    return size;
+}
+
+#ifdef _WIN32
+
+bool Rhd2000SharedMemorySegmentUsb3::map(const string &name, size_t size_, bool create_)
+{
+    if (create_) {
+        mapHandle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                       (DWORD) ((unsigned long long) size_ >> 32), (DWORD) (size_ & 0xffffffff), name.c_str());
+    } else {
+        mapHandle = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+    }
+    if (!mapHandle) {
+        cerr << "Error in Rhd2000SharedMemorySegmentUsb3: cannot " << (create_ ? "create" : "open") <<
+                " shared memory " << name << " (error " << GetLastError() << ")" << endl;
+        return false;
+    }
+
+    data = (unsigned char*) MapViewOfFile((HANDLE) mapHandle, create_ ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, size_);
+    if (!data) {
+        cerr << "Error in Rhd2000SharedMemorySegmentUsb3: cannot map shared memory " << name <<
+                " (error " << GetLastError() << ")" << endl;
+        CloseHandle((HANDLE) mapHandle);
+        mapHandle = nullptr;
+        return false;
+    }
+    size = size_;
+    isCreator = create_;
+    segmentName = name;
+    return true;
+}
+
+// Unmap the segment.  Windows removes it once every process has closed it.
+void Rhd2000SharedMemorySegmentUsb3::close()
+{
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    if (mapHandle) {
+        CloseHandle((HANDLE) mapHandle);
+    }
+    mapHandle = nullptr;
+    data = nullptr;
+    size = 0;
+    isCreator = false;
+}
+
+#else
+
+bool Rhd2000SharedMemorySegmentUsb3::map(const string &name, size_t size_, bool create_)
+{
+    // POSIX shared memory object names start with a single slash
+    string posixName = (name.empty() || name[0] != '/') ? "/" + name : name;
+
+    int fd;
+    if (create_) {
+        shm_unlink(posixName.c_str());
+        fd = shm_open(posixName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd >= 0 && ftruncate(fd, (off_t) size_) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    } else {
+        fd = shm_open(posixName.c_str(), O_RDONLY, 0);
+    }
+    if (fd < 0) {
+        cerr << "Error in Rhd2000SharedMemorySegmentUsb3: cannot " << (create_ ? "create" : "open") <<
+                " shared memory " << posixName << endl;
+        return false;
+    }
+
+    void* address = mmap(nullptr, size_, create_ ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED) {
+        cerr << "Error in Rhd2000SharedMemorySegmentUsb3: cannot map shared memory " << posixName << endl;
+        return false;
+    }
+    data = (unsigned char*) address;
+    size = size_;
+    isCreator = create_;
+    segmentName = posixName;
+    return true;
+}
+
+// Unmap the segment.  The creator also removes the name, so no new readers can attach;
+// readers already attached keep their mapping until they close it.
+void Rhd2000SharedMemorySegmentUsb3::close()
+{
+    if (data) {
+        munmap(data, size);
+        if (isCreator) {
+            shm_unlink(segmentName.c_str());
+        }
+    }
+    data = nullptr;
+    size = 0;
+    isCreator = false;
+}
+
+#endif
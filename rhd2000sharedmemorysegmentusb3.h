@@ -0,0 +1,48 @@
+//----------------------------------------------------------------------------------
+// rhd2000sharedmemorysegmentusb3.h
+//
+// Rhd2000SharedMemorySegmentUsb3 Class Header File
+//
+// Named shared memory segment, created read/write by one producer process and mapped
+// read-only by reader processes.  Uses CreateFileMapping on Windows and shm_open/mmap
+// elsewhere.
+//----------------------------------------------------------------------------------
+
+#ifndef RHD2000SHAREDMEMORYSEGMENTUSB3_H
+#define RHD2000SHAREDMEMORYSEGMENTUSB3_H
+
+#include <string>
+#include <cstddef>
+
+using namespace std;
+
+class Rhd2000SharedMemorySegmentUsb3
+{
+public:
+    Rhd2000SharedMemorySegmentUsb3();
+    ~Rhd2000SharedMemorySegmentUsb3();
+
+    bool create(const string &name, size_t size);
+    bool open(const string &name, size_t size);
+    void close();
+
+    bool isValid() const;
+    unsigned char* getData() const;
+    size_t getSize() const;
+
+private:
+    Rhd2000SharedMemorySegmentUsb3(const Rhd2000SharedMemorySegmentUsb3 &);
+    Rhd2000SharedMemorySegmentUsb3& operator=(const Rhd2000SharedMemorySegmentUsb3 &);
+
+    bool map(const string &name, size_t size, bool create);
+
+    unsigned char* data;
+    size_t size;
+    bool isCreator;
+    string segmentName;
+#ifdef _WIN32
+    void* mapHandle;
+#endif
+};
+
+#endif // RHD2000SHAREDMEMORYSEGMENTUSB3_H
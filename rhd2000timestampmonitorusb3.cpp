@@ -0,0 +1,111 @@
+//----------------------------------------------------------------------------------
+// rhd2000timestampmonitorusb3.cpp
+//
+// Rhd2000TimeStampMonitorUsb3 Class
+//
+// Continuity check of sample time stamps and dropped-sample accounting.
+//----------------------------------------------------------------------------------
+
+#include <vector>
+#include <mutex>
+#include <cstring>
+
+#include "rhd2000timestampmonitorusb3.h"
+#include "rhd2000datablockusb3.h"
+
+using namespace std;
+
+// Constructor.  The first block checked sets the expected time stamp.
+Rhd2000TimeStampMonitorUsb3::Rhd2000TimeStampMonitorUsb3()
+{
+    reset();
+}
+
+// Forget the expected time stamp, e.g. when the board is started again and its time stamps start
+// over.  The totals are kept.
+void Rhd2000TimeStampMonitorUsb3::restart()
+{
+    lock_guard<mutex> lockMonitor(monitorMutex);
+    if (expecting) {
+        totals.numRestarts++;
+    }
+    expecting = false;
+}
+
+// Forget the expected time stamp and clear the totals.
+void Rhd2000TimeStampMonitorUsb3::reset()
+{
+    lock_guard<mutex> lockMonitor(monitorMutex);
+    expecting = false;
+    nextTimeStamp = 0;
+    memset(&totals, 0, sizeof(totals));
+}
+
+// Check that dataBlock's time stamps follow on from the previous block's, count the samples missing
+// or repeated, and annotate the block: SyncTimeStampGap and SyncTimeStampRepeat are OR'ed into its
+// sync flags and getNumSamplesDropped() is set.  Returns the time stamp flags found.
+unsigned int Rhd2000TimeStampMonitorUsb3::checkBlock(Rhd2000DataBlockUsb3 &dataBlock)
+{
+    lock_guard<mutex> lockMonitor(monitorMutex);
+    const vector<unsigned int> &timeStamp = dataBlock.timeStamp;
+    const unsigned int lastTimeStamp = timeStamp[SAMPLES_PER_DATA_BLOCK - 1];
+    unsigned int flags = 0, numDropped = 0;
+
+    if (expecting && dataBlock.timeStampsFollow(nextTimeStamp)) {
+        // The usual case; the counter wrapped if it ended up below the previous block's last sample.
+        if (lastTimeStamp < nextTimeStamp - 1) {
+            totals.numWraps++;
+        }
+    } else {
+        checkSamples(dataBlock, flags, numDropped);
+    }
+
+    totals.numBlocks++;
+    totals.numSamples += SAMPLES_PER_DATA_BLOCK;
+    totals.lastSampleIndex = (totals.numWraps << 32) | lastTimeStamp;
+    nextTimeStamp = lastTimeStamp + 1;
+    expecting = true;
+
+    dataBlock.setSyncFlags(dataBlock.getSyncFlags() | flags);
+    dataBlock.setNumSamplesDropped(numDropped);
+    return flags;
+}
+
+// Classify every step between successive time stamps.  (Private method; monitorMutex must be held.)
+void Rhd2000TimeStampMonitorUsb3::checkSamples(Rhd2000DataBlockUsb3 &dataBlock, unsigned int &flags,
+                                               unsigned int &numDropped)
+{
+    const vector<unsigned int> &timeStamp = dataBlock.timeStamp;
+    // The first block after restart() sets the expected time stamp with its first sample.
+    unsigned int previous = expecting ? nextTimeStamp - 1 : timeStamp[0];
+
+    for (int t = expecting ? 0 : 1; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        unsigned int step = timeStamp[t] - previous;
+        if ((int) step > 0) {
+            if (timeStamp[t] < previous) {
+                totals.numWraps++;
+            }
+            if (step > 1) {
+                flags |= Rhd2000DataBlockUsb3::SyncTimeStampGap;
+                numDropped += step - 1;
+                totals.numGaps++;
+                totals.numSamplesDropped += step - 1;
+                if (step - 1 > totals.maxGapSamples) {
+                    totals.maxGapSamples = step - 1;
+                }
+            }
+        } else {
+            flags |= Rhd2000DataBlockUsb3::SyncTimeStampRepeat;
+            totals.numRepeats++;
+            totals.numSamplesRepeated += 1 - (int) step;
+        }
+        previous = timeStamp[t];
+    }
+}
+
+// Snapshot of the totals.  May be called from any thread.
+void Rhd2000TimeStampMonitorUsb3::getStats(MonitorStats &stats)
+{
+    lock_guard<mutex> lockMonitor(monitorMutex);
+    stats = totals;
+}
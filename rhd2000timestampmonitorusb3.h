@@ -0,0 +1,55 @@
+//----------------------------------------------------------------------------------
+// rhd2000timestampmonitorusb3.h
+//
+// Rhd2000TimeStampMonitorUsb3 Class Header File
+//
+// Checks that the 32-bit sample time stamps of successive data blocks from one board
+// increase by exactly one, wrapping around after 0xffffffff (about 39.8 hours at 30 kS/s).
+// Each block is annotated with SyncTimeStampGap / SyncTimeStampRepeat and the number of
+// samples missing before it; cumulative totals are kept for the life of the monitor.  A
+// block that follows on costs one vectorizable pass over its 128 time stamps.
+//----------------------------------------------------------------------------------
+
+#ifndef RHD2000TIMESTAMPMONITORUSB3_H
+#define RHD2000TIMESTAMPMONITORUSB3_H
+
+#include <mutex>
+
+using namespace std;
+
+class Rhd2000DataBlockUsb3;
+
+class Rhd2000TimeStampMonitorUsb3
+{
+public:
+    Rhd2000TimeStampMonitorUsb3();
+
+    unsigned int checkBlock(Rhd2000DataBlockUsb3 &dataBlock);
+    void restart();
+    void reset();
+
+    struct MonitorStats {
+        unsigned long long numBlocks;           // blocks checked
+        unsigned long long numSamples;          // samples checked
+        unsigned long long numGaps;             // forward jumps in the time stamps
+        unsigned long long numSamplesDropped;   // samples missing at those jumps
+        unsigned long long maxGapSamples;       // longest single jump
+        unsigned long long numRepeats;          // time stamps equal to or behind the one before
+        unsigned long long numSamplesRepeated;  // samples delivered again at those steps
+        unsigned long long numWraps;            // times the 32-bit counter wrapped past 0xffffffff
+        unsigned long long numRestarts;         // calls to restart() after the first block
+        unsigned long long lastSampleIndex;     // last time stamp seen, extended to 64 bits with numWraps
+    };
+    void getStats(MonitorStats &stats);
+
+private:
+    void checkSamples(Rhd2000DataBlockUsb3 &dataBlock, unsigned int &flags, unsigned int &numDropped);
+
+    // Guards everything below; checkBlock() takes it once per block
+    mutex monitorMutex;
+    bool expecting;                 // false until the first block after restart()
+    unsigned int nextTimeStamp;
+    MonitorStats totals;
+};
+
+#endif // RHD2000TIMESTAMPMONITORUSB3_H